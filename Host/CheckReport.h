@@ -0,0 +1,79 @@
+// ---------------------------------------------------------------------------
+// Check Report Library - v0.0.1 - 07/12/2020
+//
+// AUTHOR/LICENSE:
+// Created by Imran Peerbhai -- ipeerbhai@aol.com
+// Copyright 2020 License:
+// Forks and derivitive works are NOT permitted without
+// permission. Permission is only granted to use as-is for private and
+// non-commercial use by natural persons or non-profit entities.
+// For-profit entities require a license.
+//
+// CONTRIBUTIONS:
+// If you wish to contribute, make changes, or enhancements,
+// please create a pull request.
+//
+// DISCLAIMER:
+// This software is furnished "as is", without technical support, and with no
+// warranty, express or implied, as to its usefulness for any purpose.
+// ---------------------------------------------------------------------------
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+// Theory of Operation:
+
+//  The host checks (ConfigCheck, VelocityCheck, WaveformCheck) each build to
+//  one program, so they share this header rather than a library.  Every check
+//  prints one line, "ok" or "FAIL" and what it checked:
+//    ok    a sealed image is valid
+//    FAIL  channel 2: steps are Interval apart
+//  and main ends with CheckSummary, which prints the same last line for all of
+//  them and returns the exit status -- 0 only if every check passed:
+//    PASS 24 checks
+//    FAIL 1 of 24 checks
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdarg.h>
+
+#ifndef CHECK_REPORT_ONCE
+#define CHECK_REPORT_ONCE
+
+static int s_checkCount = 0;
+static int s_checkFailures = 0;
+
+//-----------------------------------------------------------------------------------------
+// Procedure:
+//  CheckReport records one check.  what is a printf format for what was checked.
+static void CheckReport(bool passed, const char *what, ...)
+{
+    va_list args;
+    va_start(args, what);
+    printf("%s  ", passed ? "ok  " : "FAIL");
+    vprintf(what, args);
+    printf("\n");
+    va_end(args);
+    s_checkCount++;
+    if (!passed)
+    {
+        s_checkFailures++;
+    }
+}
+
+//-----------------------------------------------------------------------------------------
+// Function:
+//  CheckSummary prints the last line and returns the exit status.
+static int CheckSummary()
+{
+    if (s_checkFailures == 0)
+    {
+        printf("PASS %d checks\n", s_checkCount);
+        return (0);
+    }
+    printf("FAIL %d of %d checks\n", s_checkFailures, s_checkCount);
+    return (1);
+}
+
+#endif
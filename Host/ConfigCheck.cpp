@@ -0,0 +1,232 @@
+// ---------------------------------------------------------------------------
+// TeensyBot Config Check - v0.0.1 - 07/12/2020
+//
+// AUTHOR/LICENSE:
+// Created by Imran Peerbhai -- ipeerbhai@aol.com
+// Copyright 2020 License:
+// Forks and derivitive works are NOT permitted without
+// permission. Permission is only granted to use as-is for private and
+// non-commercial use by natural persons or non-profit entities.
+// For-profit entities require a license.
+//
+// CONTRIBUTIONS:
+// If you wish to contribute, make changes, or enhancements,
+// please create a pull request.
+//
+// DISCLAIMER:
+// This software is furnished "as is", without technical support, and with no
+// warranty, express or implied, as to its usefulness for any purpose.
+// ---------------------------------------------------------------------------
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+// Theory of Operation:
+
+//  Runs the firmware's ConfigManager (PlatformIO/src/ConfigSystem.h) on this
+//  machine, over a RamConfigStorage, with the real motor, sensor and safety
+//  subsystems behind it on the Teensy shim (TeensyShim/Arduino.h).  A robot is
+//  configured with a "K" description, which saves it, and a second robot boots
+//  from the same storage.  It checks:
+
+//    Seal makes an image IsValid accepts;
+//    the saved image is valid, and a second Save of the same image doesn't write;
+//    LoadAndApply configures the second robot identically (same hash, counts);
+//    the image is rejected, and the robot left unconfigured, if any one byte of
+//    it is flipped, if Version or Size is wrong (checksum fixed up, so only that
+//    field is wrong), or if a count is past capacity;
+//    a "K" description, or a "c" ... "C" staged image, that claims a pin twice
+//    is rejected and the running configuration stays -- except a single pin
+//    sensor's echo and trigger;
+//    storage one byte too small is neither written nor read.
+
+//  Exit status is 0 if every check passed.
+
+//  Build:
+//    g++ -std=gnu++17 -O2 -ITeensyShim -I../PlatformIO/src -o ConfigCheck ConfigCheck.cpp TeensyShim/TeensyShim.cpp ../PlatformIO/src/{ConfigSystem,MotorControl,SensorSystem,SafetySystem,OutputQueue,Transport,ClockSystem,TraceSystem,ReflexSystem,WaveSystem,WaveformGenerator,EasyString}.cpp
+//  Run:
+//    ./ConfigCheck
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "ConfigSystem.h"
+#include "CheckReport.h"
+#include "WaveSystem.h"
+#include "Transport.h"
+
+#define CHECK_STORAGE_LENGTH 1024
+#define CHECK_DESCRIPTION "2,1;01,02,03,500,250;-1,-1,04,20000,1500;05,05,700000,500"
+
+// The subsystems a ConfigManager touches, wired the way main.cpp wires them.
+struct Robot
+{
+    volatile uint32_t TickCounter;
+    uint32_t PrevTickCounter;
+    UsbTransport Link;
+    OutputQueue Output;
+    ClockManager Clock;
+    TraceRecorder Trace;
+    MotorControl Motors;
+    SafetyManager Safety;
+    SensorManager Sensors;
+    ReflexManager Reflexes;
+    WaveformManager Waveforms;
+    ConfigManager Config;
+
+    void Init(ConfigStorage *storage)
+    {
+        TickCounter = 0;
+        PrevTickCounter = 0;
+        Clock.Init(&TickCounter);
+        Trace.Init(&TickCounter, &Output, &Clock);
+        Output.Init(&Link, &Trace);
+        Safety.Init(&TickCounter, &Output, &Clock, &Trace, &Motors);
+        Motors.Init(0, &TickCounter, &PrevTickCounter, &Safety, &Output, &Trace, &Clock, &Waveforms);
+        Waveforms.Init(&Motors, &Safety, &Output);
+        Reflexes.Init(&Motors, &Safety);
+        Sensors.Init(0, &TickCounter, &Safety, &Output, &Clock, &Reflexes);
+        Config.Init(storage, &Motors, &Sensors, &Safety, &Output);
+    }
+};
+
+//-----------------------------------------------------------------------------------------
+// Function:
+//  Crc32 is the standard CRC-32, written out again here so the check doesn't trust the
+//  firmware's to fix up the images it tampers with.
+static uint32_t Crc32(const uint8_t *data, uint32_t length)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    for (uint32_t i = 0; i < length; i++)
+    {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 1) ? ((crc >> 1) ^ 0xEDB88320) : (crc >> 1);
+        }
+    }
+    return (~crc);
+}
+
+static void Reseal(RobotConfig *image)
+{
+    image->Checksum = Crc32((const uint8_t *)image, offsetof(RobotConfig, Checksum));
+}
+
+//-----------------------------------------------------------------------------------------
+// Function:
+//  Boots a fresh robot from storage holding image.  true if it came up configured.
+static bool BootFrom(const RobotConfig &image)
+{
+    static uint8_t bytes[CHECK_STORAGE_LENGTH];
+    memset(bytes, 0xFF, sizeof(bytes));
+    memcpy(&bytes[CONFIG_ADDRESS], &image, sizeof(image));
+    RamConfigStorage storage(bytes, sizeof(bytes));
+    Robot *robot = new Robot();
+    robot->Init(&storage);
+    bool loaded = robot->Config.LoadAndApply();
+    bool configured = robot->Safety.IsConfigured() || (robot->Motors.GetMotorCount() != 0) || (robot->Sensors.GetUltrasonicCount() != 0);
+    delete robot;
+    return (loaded || configured);
+}
+
+int main(int argc, char **argv)
+{
+    // Seal and IsValid on their own.
+    RobotConfig blank;
+    memset(&blank, 0, sizeof(blank));
+    CheckReport(!ConfigManager::IsValid(&blank), "an unsealed image is not valid");
+    ConfigManager::Seal(&blank);
+    CheckReport(ConfigManager::IsValid(&blank), "a sealed image is valid");
+    CheckReport(blank.Checksum == Crc32((const uint8_t *)&blank, offsetof(RobotConfig, Checksum)), "the checksum is the standard CRC-32");
+
+    // configure one robot, which saves it.
+    static uint8_t bytes[CHECK_STORAGE_LENGTH];
+    memset(bytes, 0xFF, sizeof(bytes));
+    RamConfigStorage storage(bytes, sizeof(bytes));
+    Robot *first = new Robot();
+    first->Init(&storage);
+    const char *error = first->Config.ApplyDescription(CHECK_DESCRIPTION);
+    CheckReport(error == NULL, "the description applies");
+    CheckReport(storage.GetWriteCount() == 1, "applying it saves it once");
+    RobotConfig saved;
+    memcpy(&saved, &bytes[CONFIG_ADDRESS], sizeof(saved));
+    CheckReport(ConfigManager::IsValid(&saved), "the saved image is valid");
+    CheckReport(saved.Checksum == first->Config.GetHash(), "the saved checksum is the configuration hash");
+    CheckReport(!first->Config.Save() && (storage.GetWriteCount() == 1), "saving it again doesn't write");
+
+    // boot a second robot from it.
+    Robot *second = new Robot();
+    second->Init(&storage);
+    CheckReport(second->Config.LoadAndApply(), "the second robot loads it");
+    CheckReport(second->Config.GetHash() == first->Config.GetHash(), "the second robot has the same hash");
+    CheckReport((second->Motors.GetMotorCount() == 2) && (second->Sensors.GetUltrasonicCount() == 1), "the second robot has the same motors and sensors");
+    CheckReport(second->Safety.IsConfigured(), "the second robot is configured");
+    CheckReport(storage.GetWriteCount() == 1, "loading doesn't write");
+    delete second;
+    CheckReport(BootFrom(saved), "an untouched copy boots");
+
+    // every single flipped byte, checksum included, is caught.
+    int flipsLoaded = 0;
+    for (size_t i = 0; i < sizeof(saved); i++)
+    {
+        RobotConfig flipped = saved;
+        ((uint8_t *)&flipped)[i] ^= 0x01;
+        flipsLoaded += BootFrom(flipped) ? 1 : 0;
+    }
+    printf("      %d of %d flipped images loaded\n", flipsLoaded, (int)sizeof(saved));
+    CheckReport(flipsLoaded == 0, "a flipped byte is rejected");
+
+    // each header field wrong on its own, with a good checksum.
+    RobotConfig bumped = saved;
+    bumped.Version++;
+    Reseal(&bumped);
+    CheckReport(!BootFrom(bumped), "a bumped Version is rejected");
+    RobotConfig resized = saved;
+    resized.Size -= 4;
+    Reseal(&resized);
+    CheckReport(!BootFrom(resized), "a wrong Size is rejected");
+    RobotConfig magic = saved;
+    magic.Magic ^= 0x80000000;
+    Reseal(&magic);
+    CheckReport(!BootFrom(magic), "a wrong Magic is rejected");
+    RobotConfig crowded = saved;
+    crowded.MotorCount = MOTOR_CAPACITY + 1;
+    Reseal(&crowded);
+    CheckReport(!BootFrom(crowded), "a motor count past capacity is rejected");
+    RobotConfig reseal = saved;
+    Reseal(&reseal);
+    CheckReport(BootFrom(reseal), "resealing an untouched copy still boots");
+
+    // a pin claimed twice is refused, whichever way the configuration arrives.
+    uint32_t hash = first->Config.GetHash();
+    uint32_t writes = storage.GetWriteCount();
+    CheckReport(first->Config.ApplyDescription("2,1;01,02,03,500,250;01,02,03,500,250;03,03,700000,500") != NULL, "two motors on the same pins are rejected");
+    CheckReport(first->Config.ApplyDescription("1,1;01,02,03,500,250;04,03,700000,500") != NULL, "a sensor on a motor's pin is rejected");
+    first->Config.StageCounts(1, 1);
+    first->Config.StageMotor(0, 1, 2, 3, 500, 250);
+    first->Config.StageUltrasonic(0, 3, 3, 700000, 500);
+    CheckReport(first->Config.Commit() != NULL, "a staged image claiming a pin twice is rejected");
+    CheckReport((first->Config.GetHash() == hash) && (storage.GetWriteCount() == writes), "the rejected configurations left the running one alone");
+    first->Config.StageUltrasonic(0, 4, 4, 700000, 500);
+    CheckReport(first->Config.Commit() == NULL, "a single pin sensor's echo may be its trigger");
+
+    // storage one byte too small for the image, and just big enough.
+    RamConfigStorage tooSmall(bytes, CONFIG_ADDRESS + sizeof(RobotConfig) - 1);
+    first->Config.Init(&tooSmall, &first->Motors, &first->Sensors, &first->Safety, &first->Output);
+    first->Config.ApplyDescription(CHECK_DESCRIPTION);
+    CheckReport(tooSmall.GetWriteCount() == 0, "a too small storage is not written");
+    Robot *third = new Robot();
+    third->Init(&tooSmall);
+    CheckReport(!third->Config.LoadAndApply(), "a too small storage is not loaded, even holding a good image");
+    RamConfigStorage exact(bytes, CONFIG_ADDRESS + sizeof(RobotConfig));
+    third->Init(&exact);
+    CheckReport(third->Config.LoadAndApply(), "storage exactly the image's size loads");
+    delete third;
+    delete first;
+
+    return (CheckSummary());
+}
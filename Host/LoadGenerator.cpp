@@ -0,0 +1,220 @@
+// ---------------------------------------------------------------------------
+// TeensyBot Load Generator - v0.0.1 - 07/12/2020
+//
+// AUTHOR/LICENSE:
+// Created by Imran Peerbhai -- ipeerbhai@aol.com
+// Copyright 2020 License:
+// Forks and derivitive works are NOT permitted without
+// permission. Permission is only granted to use as-is for private and
+// non-commercial use by natural persons or non-profit entities.
+// For-profit entities require a license.
+//
+// CONTRIBUTIONS:
+// If you wish to contribute, make changes, or enhancements,
+// please create a pull request.
+//
+// DISCLAIMER:
+// This software is furnished "as is", without technical support, and with no
+// warranty, express or implied, as to its usefulness for any purpose.
+// ---------------------------------------------------------------------------
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+// Theory of Operation:
+
+//  Sends one command over and over at a target rate through TeensyBotClient,
+//  keeping up to a window of them in flight, then reports what came back:
+//  throughput, p50/p99/max round trip, and how many were dropped (no Done
+//  within the timeout).  If the window is full the send waits, so the achieved
+//  rate falls below the target -- that's the protocol's capacity.
+
+//  The robot needs to be configured first, or the safety system will ignore
+//  most commands.  "w" (watchdog) and "u" (output statistics) work either way.
+//  -k sends a bulk "K" description (see ConfigSystem.h) before the run.
+
+//  With no robot at hand, TeensyBotSim runs the firmware itself on this machine
+//  behind a pty; give LoadGenerator the pty it prints.
+
+//  With -d generic or -d auto, the motor ISR's dispatch path is forced (or left
+//  to pick a matching compile-time profile, see RobotProfile.h) and its cycle
+//  counts cleared before the run, and read back with "B" after it.  Run once each
+//  way under the same load to see what the profile saves per tick.
+
+//  Build:
+//    g++ -std=c++11 -O2 -pthread -o LoadGenerator LoadGenerator.cpp TeensyBotClient.cpp
+//  Run:
+//    ./LoadGenerator /dev/ttyACM0 -r 2000 -t 10 -w 32 -c w
+//    ./LoadGenerator /dev/ttyACM0 -r 2000 -t 10 -c m+00500,+00500 -d auto
+//    ./LoadGenerator /dev/pts/3 -k "2,0;01,02,03,500,250;04,05,06,500,250" -r 2000 -t 10 -c w
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include "TeensyBotClient.h"
+
+struct LoadResults
+{
+    std::mutex Lock;
+    std::vector<double> LatenciesUS;
+    uint64_t Completed = 0;
+    uint64_t Dropped = 0;
+};
+
+//-----------------------------------------------------------------------------------------
+// Function:
+//  Percentile of an already sorted list.
+static double Percentile(const std::vector<double> &sorted, double fraction)
+{
+    if (sorted.empty())
+    {
+        return (0.0);
+    }
+    size_t index = (size_t)(fraction * (sorted.size() - 1) + 0.5);
+    return (sorted[index]);
+}
+
+static void Usage()
+{
+    fprintf(stderr, "usage: LoadGenerator <device> [-b baud] [-r commands/s] [-t seconds] [-w window] [-T timeoutMS] [-c command] [-d generic|auto] [-k description]\n");
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        Usage();
+        return (1);
+    }
+    std::string device = argv[1];
+    uint32_t baud = 115200;
+    double rate = 1000.0;
+    double seconds = 10.0;
+    uint32_t window = CLIENT_DEFAULT_WINDOW;
+    uint32_t timeoutMS = CLIENT_DEFAULT_TIMEOUT_MS;
+    std::string command = CommandEncoder::Watchdog();
+    std::string dispatch;
+    std::string description;
+    for (int i = 2; i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], "-b") == 0) baud = strtoul(argv[i + 1], NULL, 10);
+        else if (strcmp(argv[i], "-r") == 0) rate = atof(argv[i + 1]);
+        else if (strcmp(argv[i], "-t") == 0) seconds = atof(argv[i + 1]);
+        else if (strcmp(argv[i], "-w") == 0) window = strtoul(argv[i + 1], NULL, 10);
+        else if (strcmp(argv[i], "-T") == 0) timeoutMS = strtoul(argv[i + 1], NULL, 10);
+        else if (strcmp(argv[i], "-c") == 0) command = argv[i + 1];
+        else if (strcmp(argv[i], "-d") == 0) dispatch = argv[i + 1];
+        else if (strcmp(argv[i], "-k") == 0) description = argv[i + 1];
+        else
+        {
+            Usage();
+            return (1);
+        }
+    }
+    if ((rate <= 0.0) || (!dispatch.empty() && (dispatch != "generic") && (dispatch != "auto")))
+    {
+        Usage();
+        return (1);
+    }
+
+    TeensyBotClient client;
+    if (!client.Open(device, baud))
+    {
+        return (1);
+    }
+    client.SetWindow(window);
+    client.SetTimeout(timeoutMS);
+    if (!description.empty())
+    {
+        Reply configured = client.Call(CommandEncoder::BulkConfiguration(description));
+        for (size_t i = 0; i < configured.Lines.size(); i++)
+        {
+            if (configured.Lines[i].find("Error") != std::string::npos)
+            {
+                fprintf(stderr, "configuration refused: %s\n", configured.Lines[i].c_str());
+                return (1);
+            }
+        }
+        if (configured.TimedOut)
+        {
+            fprintf(stderr, "no reply to the configuration\n");
+            return (1);
+        }
+    }
+    if (!dispatch.empty())
+    {
+        client.Call(CommandEncoder::ForceGenericDispatch(dispatch == "generic"));
+        client.Call(CommandEncoder::ClearDispatchCycles());
+    }
+
+    LoadResults results;
+    Completion record = [&results](const Reply &reply) {
+        std::lock_guard<std::mutex> guard(results.Lock);
+        if (reply.TimedOut)
+        {
+            results.Dropped++;
+        }
+        else
+        {
+            results.Completed++;
+            results.LatenciesUS.push_back(reply.LatencyUS());
+        }
+    };
+
+    // pace sends off an absolute schedule so a slow send doesn't lower the target.
+    std::chrono::duration<double> period(1.0 / rate);
+    ClientClock::time_point start = ClientClock::now();
+    ClientClock::time_point end = start + std::chrono::duration_cast<ClientClock::duration>(std::chrono::duration<double>(seconds));
+    ClientClock::time_point next = start;
+    uint64_t sent = 0;
+    while (ClientClock::now() < end)
+    {
+        std::this_thread::sleep_until(next);
+        client.Send(command, record);
+        sent++;
+        next += std::chrono::duration_cast<ClientClock::duration>(period);
+    }
+    double sendSeconds = std::chrono::duration<double>(ClientClock::now() - start).count();
+
+    // give the stragglers a chance to finish or time out.
+    ClientClock::time_point drainUntil = ClientClock::now() + std::chrono::milliseconds(timeoutMS * 2);
+    while ((client.InFlight() > 0) && (ClientClock::now() < drainUntil))
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    double totalSeconds = std::chrono::duration<double>(ClientClock::now() - start).count();
+    Reply cycles;
+    cycles.TimedOut = true;
+    if (!dispatch.empty())
+    {
+        cycles = client.Call(CommandEncoder::DispatchCycles());
+    }
+    client.Close();
+
+    std::lock_guard<std::mutex> guard(results.Lock);
+    std::sort(results.LatenciesUS.begin(), results.LatenciesUS.end());
+    printf("command        '%s'\n", command.c_str());
+    printf("target rate    %.1f/s, window %u\n", rate, window);
+    printf("sent           %llu in %.2fs (%.1f/s)\n", (unsigned long long)sent, sendSeconds, sent / sendSeconds);
+    printf("completed      %llu (%.1f/s)\n", (unsigned long long)results.Completed, results.Completed / totalSeconds);
+    printf("dropped        %llu (%.2f%%)\n", (unsigned long long)results.Dropped, sent ? (100.0 * results.Dropped / sent) : 0.0);
+    printf("latency p50    %.0fus\n", Percentile(results.LatenciesUS, 0.50));
+    printf("latency p99    %.0fus\n", Percentile(results.LatenciesUS, 0.99));
+    printf("latency max    %.0fus\n", results.LatenciesUS.empty() ? 0.0 : results.LatenciesUS.back());
+    if (!dispatch.empty())
+    {
+        printf("dispatch       %s\n", dispatch.c_str());
+        for (size_t i = 0; i < cycles.Lines.size(); i++)
+        {
+            printf("               %s\n", cycles.Lines[i].c_str());
+        }
+        if (cycles.TimedOut)
+        {
+            printf("               no reply to '%s'\n", CommandEncoder::DispatchCycles().c_str());
+        }
+    }
+    return (0);
+}
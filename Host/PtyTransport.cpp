@@ -0,0 +1,152 @@
+#include "PtyTransport.h"
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+//-----------------------------------------------------------------------------------------
+// Constructor:
+//  Nothing is open until Begin.
+PtyTransport::PtyTransport()
+{
+    m_master = -1;
+    m_slave = -1;
+    m_deviceName[0] = '\0';
+    m_running = false;
+    m_rxHead = 0;
+    m_rxTail = 0;
+    m_lastReadAgeUS = 0;
+}
+
+PtyTransport::~PtyTransport()
+{
+    m_running = false;
+    if (m_receiver.joinable())
+    {
+        m_receiver.join();
+    }
+    if (m_slave >= 0)
+    {
+        close(m_slave);
+    }
+    if (m_master >= 0)
+    {
+        close(m_master);
+    }
+}
+
+//-----------------------------------------------------------------------------------------
+// Begin opens the pty, makes the slave raw, prints its name and starts the receive thread.
+void PtyTransport::Begin()
+{
+    if (m_master >= 0)
+    {
+        return;
+    }
+    m_master = posix_openpt(O_RDWR | O_NOCTTY);
+    if ((m_master < 0) || (grantpt(m_master) != 0) || (unlockpt(m_master) != 0) ||
+        (ptsname_r(m_master, m_deviceName, sizeof(m_deviceName)) != 0))
+    {
+        fprintf(stderr, "can't open a pty: %s\n", strerror(errno));
+        exit(1);
+    }
+    m_slave = open(m_deviceName, O_RDWR | O_NOCTTY);
+    struct termios settings;
+    if ((m_slave >= 0) && (tcgetattr(m_slave, &settings) == 0))
+    {
+        cfmakeraw(&settings);
+        tcsetattr(m_slave, TCSANOW, &settings);
+    }
+    fcntl(m_master, F_SETFL, fcntl(m_master, F_GETFL) | O_NONBLOCK);
+    fprintf(stderr, "pty: %s\n", m_deviceName);
+
+    m_running = true;
+    m_receiver = std::thread(&PtyTransport::ReceiveLoop, this);
+}
+
+//-----------------------------------------------------------------------------------------
+// ReceiveLoop moves bytes from the master into the ring as they arrive.  A full ring stops
+// reading, so the pty holds the rest and the client blocks, like a UART with flow control.
+void PtyTransport::ReceiveLoop()
+{
+    while (m_running)
+    {
+        struct pollfd waiting = {m_master, POLLIN, 0};
+        if (poll(&waiting, 1, 10) <= 0)
+        {
+            continue;
+        }
+        uint32_t head = m_rxHead.load(std::memory_order_relaxed);
+        uint32_t tail = m_rxTail.load(std::memory_order_acquire);
+        uint32_t room = (PTY_RX_SIZE - 1) - ((head + PTY_RX_SIZE - tail) % PTY_RX_SIZE);
+        if (room == 0)
+        {
+            usleep(100);
+            continue;
+        }
+        uint8_t chunk[256];
+        ssize_t count = read(m_master, chunk, (room < sizeof(chunk)) ? room : sizeof(chunk));
+        if (count <= 0)
+        {
+            continue;
+        }
+        uint32_t now = micros();
+        for (ssize_t i = 0; i < count; i++)
+        {
+            m_rxBuffer[head] = chunk[i];
+            m_rxStamps[head] = now;
+            head = (head + 1) % PTY_RX_SIZE;
+        }
+        m_rxHead.store(head, std::memory_order_release);
+    }
+}
+
+int PtyTransport::Available()
+{
+    uint32_t head = m_rxHead.load(std::memory_order_acquire);
+    return ((head + PTY_RX_SIZE - m_rxTail.load(std::memory_order_relaxed)) % PTY_RX_SIZE);
+}
+
+int PtyTransport::Read()
+{
+    if (Available() == 0)
+    {
+        return (-1);
+    }
+    uint32_t tail = m_rxTail.load(std::memory_order_relaxed);
+    int incoming = m_rxBuffer[tail];
+    m_lastReadAgeUS = micros() - m_rxStamps[tail];
+    m_rxTail.store((tail + 1) % PTY_RX_SIZE, std::memory_order_release);
+    return (incoming);
+}
+
+//-----------------------------------------------------------------------------------------
+// ReadAgeUS is how long the byte Read last returned sat in the ring.
+uint32_t PtyTransport::ReadAgeUS()
+{
+    return (m_lastReadAgeUS);
+}
+
+int PtyTransport::AvailableForWrite()
+{
+    return ((m_master >= 0) ? PTY_TX_SIZE : 0);
+}
+
+//-----------------------------------------------------------------------------------------
+// Write hands the pty what it will take right now.
+size_t PtyTransport::Write(const uint8_t *buffer, size_t length)
+{
+    if ((m_master < 0) || (length == 0))
+    {
+        return (0);
+    }
+    ssize_t written = write(m_master, buffer, length);
+    return ((written > 0) ? (size_t)written : 0);
+}
+
+const char *PtyTransport::GetDeviceName()
+{
+    return (m_deviceName);
+}
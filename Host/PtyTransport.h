@@ -0,0 +1,84 @@
+// ---------------------------------------------------------------------------
+// Pty Transport Library - v0.0.1 - 07/12/2020
+//
+// AUTHOR/LICENSE:
+// Created by Imran Peerbhai -- ipeerbhai@aol.com
+// Copyright 2020 License:
+// Forks and derivitive works are NOT permitted without
+// permission. Permission is only granted to use as-is for private and
+// non-commercial use by natural persons or non-profit entities.
+// For-profit entities require a license.
+//
+// CONTRIBUTIONS:
+// If you wish to contribute, make changes, or enhancements,
+// please create a pull request.
+//
+// DISCLAIMER:
+// This software is furnished "as is", without technical support, and with no
+// warranty, express or implied, as to its usefulness for any purpose.
+// ---------------------------------------------------------------------------
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+// Theory of Operation:
+
+//  A Transport (PlatformIO/src/Transport.h) on a POSIX pseudo-terminal, for the
+//  host build of the firmware (TeensyBotSim.cpp).  Begin opens the master side
+//  with posix_openpt and prints the slave's name; a host client opens that like
+//  the robot's serial device.  We hold the slave open too, set raw, so the line
+//  discipline never echoes or cooks a frame, and the master never reads EIO
+//  while the client is away.
+
+//  A receive thread plays the part of the UART's receive DMA: it blocks in poll()
+//  on the master and copies bytes into a ring as soon as they arrive, stamping
+//  each with micros().  Available and Read only look at the ring, so ReadAgeUS is
+//  how long the byte just read really sat there -- the same thing the latency
+//  system gets from UartDmaTransport, measured instead of estimated.
+
+//  Writes go straight to the master, non-blocking.  The pty takes what it has
+//  room for and Write returns that, so the output queue keeps the rest.
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+
+#include <Arduino.h>
+#include <stdint.h>
+#include <atomic>
+#include <thread>
+#include "Transport.h"
+
+#ifndef PTY_TRANSPORT_ONCE
+#define PTY_TRANSPORT_ONCE
+
+#define PTY_RX_SIZE 4096   // bytes the receive thread can get ahead of us.
+#define PTY_TX_SIZE 4096   // what AvailableForWrite offers; the pty may take less.
+
+class PtyTransport : public Transport
+{
+public:
+    PtyTransport();
+    ~PtyTransport();
+    void Begin();
+    int Available();
+    int Read();
+    int AvailableForWrite();
+    size_t Write(const uint8_t *buffer, size_t length);
+    uint32_t ReadAgeUS();
+    const char *GetDeviceName(); // the slave a client opens.  Empty until Begin.
+
+private:
+    void ReceiveLoop();
+
+    int m_master;
+    int m_slave;
+    char m_deviceName[64];
+    std::thread m_receiver;
+    std::atomic<bool> m_running;
+    std::atomic<uint32_t> m_rxHead;    // next slot the receive thread fills.
+    std::atomic<uint32_t> m_rxTail;    // next byte we haven't read yet.
+    uint32_t m_lastReadAgeUS;
+    uint8_t m_rxBuffer[PTY_RX_SIZE];
+    uint32_t m_rxStamps[PTY_RX_SIZE];  // micros() each byte arrived at.
+};
+
+#endif
@@ -0,0 +1,474 @@
+#include "TeensyBotClient.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+//-----------------------------------------------------------------------------------------
+// Reply::LatencyUS is how long from handing the frame to the OS until the Done arrived.
+double Reply::LatencyUS() const
+{
+    return (std::chrono::duration<double, std::micro>(Completed - Sent).count());
+}
+
+//-----------------------------------------------------------------------------------------
+// CommandEncoder -- one function per command letter.
+static std::string Format(const char *format, ...) __attribute__((format(printf, 1, 2)));
+static std::string Format(const char *format, ...)
+{
+    char text[128];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    return (std::string(text));
+}
+
+std::string CommandEncoder::Memory() { return ("a"); }
+std::string CommandEncoder::ClearMemory() { return ("a0"); }
+std::string CommandEncoder::Battery() { return ("b"); }
+std::string CommandEncoder::Counts(int motors, int sensors) { return (Format("c%d,%d", motors, sensors)); }
+std::string CommandEncoder::Disable(int motor) { return (Format("d%d", motor)); }
+std::string CommandEncoder::Enable(int motor) { return (Format("e%d", motor)); }
+std::string CommandEncoder::StepFrequency(int motor, double hertz) { return (Format("f%d,%+011.3f", motor, hertz)); }
+std::string CommandEncoder::ProgramState() { return ("g"); }
+std::string CommandEncoder::ProgramStep(int slot, const std::string &step) { return (Format("gA%d,", slot) + step); }
+std::string CommandEncoder::RunProgram(int slot) { return (Format("gR%d", slot)); }
+std::string CommandEncoder::StopProgram() { return ("gS"); }
+std::string CommandEncoder::ClearProgram(int slot) { return (Format("gX%d", slot)); }
+std::string CommandEncoder::ListProgram(int slot) { return (Format("gL%d", slot)); }
+std::string CommandEncoder::Hash() { return ("h"); }
+std::string CommandEncoder::Latency() { return ("l"); }
+std::string CommandEncoder::ClearLatency() { return ("l0"); }
+std::string CommandEncoder::MotorIntervals(int32_t left, int32_t right) { return (Format("m%+06d,%+06d", (int)left, (int)right)); }
+std::string CommandEncoder::Override() { return ("o"); }
+std::string CommandEncoder::Pose() { return ("p"); }
+std::string CommandEncoder::EncoderState() { return ("q"); }
+std::string CommandEncoder::ConfigureEncoder(int encoder, int pinA, int pinB) { return (Format("qE%d,%02d,%02d", encoder, pinA, pinB)); }
+std::string CommandEncoder::CloseLoop(int loop, int motor, bool dutyOutput) { return (Format("qL%d,%d,%c", loop, motor, dutyOutput ? 'D' : 'F')); }
+std::string CommandEncoder::Setpoint(int loop, double countsPerSecond) { return (Format("qS%d,%+.1f", loop, countsPerSecond)); }
+std::string CommandEncoder::Gain(int loop, char term, double gain) { return (Format("q%c%d,%.3f", term, loop, gain)); }
+std::string CommandEncoder::LoopRate(int hertz) { return (Format("qR%d", hertz)); }
+std::string CommandEncoder::OpenLoop(int loop) { return (Format("qX%d", loop)); }
+std::string CommandEncoder::Reflexes() { return ("R"); }
+std::string CommandEncoder::ClearReflexes() { return ("RX"); }
+std::string CommandEncoder::ReflexRule(int rule, uint16_t sensorMask, uint32_t nearMM, uint32_t farMM, uint16_t motorMask, int percent)
+{
+    return (Format("R%d,%u,%u,%u,%u,%d", rule, sensorMask, nearMM, farMM, motorMask, percent));
+}
+std::string CommandEncoder::ResetSafety() { return ("r"); }
+std::string CommandEncoder::Ultrasonic() { return ("s"); }
+std::string CommandEncoder::Sync(int64_t hostSendUS, int64_t lastReplyUS) { return (Format("t%lld,%lld", (long long)hostSendUS, (long long)lastReplyUS)); }
+std::string CommandEncoder::Trace() { return ("T"); }
+std::string CommandEncoder::ClearTrace() { return ("T0"); }
+std::string CommandEncoder::TraceSteps(uint32_t everyN) { return (Format("TS%04u", everyN)); }
+std::string CommandEncoder::OutputStatistics() { return ("u"); }
+std::string CommandEncoder::Servo(int motor, int dutyIntervalUS) { return (Format("v%d,%d", motor, dutyIntervalUS)); }
+std::string CommandEncoder::MoveServo(int motor, int targetDutyUS, int ratePerSecond, int accelPerSecond)
+{
+    return (Format("vS%d,%d,%d,%d", motor, targetDutyUS, ratePerSecond, accelPerSecond));
+}
+std::string CommandEncoder::Watchdog() { return ("w"); }
+std::string CommandEncoder::WatchdogStatistics() { return ("wS"); }
+std::string CommandEncoder::PowerStatistics() { return ("z"); }
+std::string CommandEncoder::AllowIdle(bool isAllowed) { return (isAllowed ? "z1" : "z0"); }
+std::string CommandEncoder::DispatchCycles() { return ("B"); }
+std::string CommandEncoder::ClearDispatchCycles() { return ("B0"); }
+std::string CommandEncoder::ForceGenericDispatch(bool isForced) { return (isForced ? "BG" : "BA"); }
+std::string CommandEncoder::WaveformStatistics() { return ("W"); }
+std::string CommandEncoder::Waveform(bool isOn) { return (isOn ? "W1" : "W0"); }
+std::string CommandEncoder::Batch(const std::vector<std::string>& items)
+{
+    std::string frame = "X";
+    for (size_t i = 0; i < items.size(); i++)
+    {
+        frame += (i > 0) ? ";" : "";
+        frame += items[i];
+    }
+    return (frame);
+}
+std::string CommandEncoder::ConfigurationComplete() { return ("C"); }
+
+std::string CommandEncoder::ConfigureMotor(int motor, int enablePin, int dirPin, int pulsePin, int interval, int dutyInterval)
+{
+    return (Format("M%d,%02d,%02d,%02d,%05d,%d", motor, enablePin, dirPin, pulsePin, interval, dutyInterval));
+}
+
+std::string CommandEncoder::ConfigureUltrasonic(int sensor, int triggerPin, int echoPin, uint32_t maxUS, uint32_t minUS)
+{
+    return (Format("S%d,%02d,%02d,%06u,%u", sensor, triggerPin, echoPin, maxUS, minUS));
+}
+
+std::string CommandEncoder::ConfigureOdometry(int left, int right, uint32_t wheelRadiusUM, uint32_t trackWidthUM, uint32_t stepsPerRev)
+{
+    return (Format("O%d,%d,%06u,%06u,%u", left, right, wheelRadiusUM, trackWidthUM, stepsPerRev));
+}
+
+std::string CommandEncoder::StreamPose(uint32_t intervalMS) { return (Format("P%u", intervalMS)); }
+std::string CommandEncoder::BulkConfiguration(const std::string &description) { return ("K" + description); }
+
+//-----------------------------------------------------------------------------------------
+// Constructor:
+//  Nothing is open until Open.
+TeensyBotClient::TeensyBotClient()
+{
+    m_fd = -1;
+    m_running = false;
+    m_nextSequence = 1;
+    m_inReply = false;
+    m_skipEcho = false;
+    m_replySequence = 0;
+    m_window = CLIENT_DEFAULT_WINDOW;
+    m_timeoutMS = CLIENT_DEFAULT_TIMEOUT_MS;
+}
+
+TeensyBotClient::~TeensyBotClient()
+{
+    Close();
+}
+
+//-----------------------------------------------------------------------------------------
+// Function:
+//  BaudConstant turns a number into the termios constant.  USB CDC ignores it anyway.
+static speed_t BaudConstant(uint32_t baud)
+{
+    switch (baud)
+    {
+    case 9600: return (B9600);
+    case 19200: return (B19200);
+    case 38400: return (B38400);
+    case 57600: return (B57600);
+    case 230400: return (B230400);
+#ifdef B460800
+    case 460800: return (B460800);
+#endif
+#ifdef B921600
+    case 921600: return (B921600);
+#endif
+#ifdef B2000000
+    case 2000000: return (B2000000);
+#endif
+    default: return (B115200);
+    }
+}
+
+//-----------------------------------------------------------------------------------------
+// Function:
+//  Open the device raw and start the reader thread.
+bool TeensyBotClient::Open(const std::string &device, uint32_t baud)
+{
+    Close();
+    m_fd = open(device.c_str(), O_RDWR | O_NOCTTY);
+    if (m_fd < 0)
+    {
+        fprintf(stderr, "can't open %s: %s\n", device.c_str(), strerror(errno));
+        return (false);
+    }
+    struct termios settings;
+    if (tcgetattr(m_fd, &settings) == 0)
+    {
+        cfmakeraw(&settings);
+        cfsetispeed(&settings, BaudConstant(baud));
+        cfsetospeed(&settings, BaudConstant(baud));
+        settings.c_cc[VMIN] = 0;
+        settings.c_cc[VTIME] = 0;
+        tcsetattr(m_fd, TCSANOW, &settings);
+    }
+    m_lineBuffer.clear();
+    m_inReply = false;
+    m_running = true;
+    m_reader = std::thread(&TeensyBotClient::ReaderLoop, this);
+    return (true);
+}
+
+//-----------------------------------------------------------------------------------------
+// Procedure:
+//  Stop the reader and time out anything still waiting.
+void TeensyBotClient::Close()
+{
+    m_running = false;
+    if (m_reader.joinable())
+    {
+        m_reader.join();
+    }
+    if (m_fd >= 0)
+    {
+        close(m_fd);
+        m_fd = -1;
+    }
+
+    std::vector<Pending> abandoned;
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        for (auto &entry : m_pending)
+        {
+            abandoned.push_back(entry.second);
+        }
+        m_pending.clear();
+        m_inReply = false;
+    }
+    m_room.notify_all();
+    for (auto &pending : abandoned)
+    {
+        Finish(pending, true);
+    }
+}
+
+bool TeensyBotClient::IsOpen()
+{
+    return (m_fd >= 0);
+}
+
+//-----------------------------------------------------------------------------------------
+// Function:
+//  Send tags the command, writes the frame and returns without waiting for the reply.
+uint32_t TeensyBotClient::Send(const std::string &command, Completion completion)
+{
+    uint32_t sequence;
+    {
+        std::unique_lock<std::mutex> guard(m_lock);
+        m_room.wait(guard, [this] { return ((m_pending.size() < m_window) || !m_running); });
+        sequence = m_nextSequence++;
+        Pending &pending = m_pending[sequence];
+        pending.Result.Sequence = sequence;
+        pending.Result.Command = command;
+        pending.Result.TimedOut = false;
+        pending.Result.Sent = ClientClock::now();
+        pending.Done = completion;
+    }
+
+    std::string frame = "@" + std::to_string(sequence) + ":" + command + "~";
+    std::lock_guard<std::mutex> guard(m_writeLock);
+    size_t written = 0;
+    while ((m_fd >= 0) && (written < frame.size()))
+    {
+        ssize_t count = write(m_fd, frame.data() + written, frame.size() - written);
+        if (count < 0)
+        {
+            if ((errno == EAGAIN) || (errno == EINTR))
+            {
+                continue;
+            }
+            break; // it'll time out.
+        }
+        written += count;
+    }
+    return (sequence);
+}
+
+std::future<Reply> TeensyBotClient::Send(const std::string &command)
+{
+    std::shared_ptr<std::promise<Reply>> promise = std::make_shared<std::promise<Reply>>();
+    Send(command, [promise](const Reply &reply) { promise->set_value(reply); });
+    return (promise->get_future());
+}
+
+Reply TeensyBotClient::Call(const std::string &command)
+{
+    return (Send(command).get());
+}
+
+//-----------------------------------------------------------------------------------------
+// Function:
+//  HostMicros is the clock the firmware syncs to.  Monotonic, so it never jumps.
+int64_t TeensyBotClient::HostMicros()
+{
+    return (std::chrono::duration_cast<std::chrono::microseconds>(ClientClock::now().time_since_epoch()).count());
+}
+
+//-----------------------------------------------------------------------------------------
+// Function:
+//  SyncClock sends rounds+1 pings.  Each one carries when the previous reply arrived, which
+//  is what lets the firmware finish the previous exchange.  True once the firmware says synced.
+bool TeensyBotClient::SyncClock(int rounds)
+{
+    int64_t lastReply = 0;
+    bool isSynced = false;
+    for (int round = 0; round <= rounds; round++)
+    {
+        Reply reply = Call(CommandEncoder::Sync(HostMicros(), lastReply));
+        if (reply.TimedOut)
+        {
+            lastReply = 0; // the firmware can't use an exchange we didn't finish.
+            continue;
+        }
+        lastReply = std::chrono::duration_cast<std::chrono::microseconds>(reply.Completed.time_since_epoch()).count();
+        for (const std::string &line : reply.Lines)
+        {
+            isSynced = isSynced || (line.find("'Synced':1") != std::string::npos);
+        }
+    }
+    return (isSynced);
+}
+
+void TeensyBotClient::SetEventHandler(EventHandler handler)
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_eventHandler = handler;
+}
+
+void TeensyBotClient::SetWindow(uint32_t window)
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_window = (window == 0) ? 1 : window;
+    m_room.notify_all();
+}
+
+void TeensyBotClient::SetTimeout(uint32_t timeoutMS)
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_timeoutMS = timeoutMS;
+}
+
+uint32_t TeensyBotClient::InFlight()
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    return (m_pending.size());
+}
+
+//-----------------------------------------------------------------------------------------
+// Procedure:
+//  ReaderLoop splits what arrives into lines and checks for timeouts between reads.
+void TeensyBotClient::ReaderLoop()
+{
+    char incoming[4096];
+    while (m_running)
+    {
+        struct pollfd waitFor;
+        waitFor.fd = m_fd;
+        waitFor.events = POLLIN;
+        waitFor.revents = 0;
+        if (poll(&waitFor, 1, 10) > 0)
+        {
+            ssize_t count = read(m_fd, incoming, sizeof(incoming));
+            for (ssize_t i = 0; i < count; i++)
+            {
+                if (incoming[i] == '\n')
+                {
+                    HandleLine(m_lineBuffer);
+                    m_lineBuffer.clear();
+                }
+                else if (incoming[i] != '\r')
+                {
+                    m_lineBuffer += incoming[i];
+                }
+            }
+        }
+        ExpireTimeouts();
+    }
+}
+
+//-----------------------------------------------------------------------------------------
+// Procedure:
+//  HandleLine sorts a line into the reply it belongs to, or hands it to the event handler.
+void TeensyBotClient::HandleLine(const std::string &line)
+{
+    static const std::string ackTag = "ACK>@";
+    static const std::string doneTag = "{'Done' : ";
+    std::vector<Pending> finished;
+    EventHandler handler;
+    bool isEvent = false;
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        if (line.compare(0, ackTag.size(), ackTag) == 0)
+        {
+            m_inReply = true;
+            m_skipEcho = true; // the firmware echoes the command right after the ACK.
+            m_replySequence = strtoul(line.c_str() + ackTag.size(), NULL, 10);
+        }
+        else if (m_inReply && (line.compare(0, doneTag.size(), doneTag) == 0))
+        {
+            uint32_t sequence = strtoul(line.c_str() + doneTag.size(), NULL, 10);
+            auto found = m_pending.find(sequence);
+            if (found != m_pending.end())
+            {
+                finished.push_back(found->second);
+                m_pending.erase(found);
+            }
+            m_inReply = false;
+        }
+        else if (m_inReply)
+        {
+            if (m_skipEcho)
+            {
+                m_skipEcho = false;
+            }
+            else
+            {
+                auto found = m_pending.find(m_replySequence);
+                if (found != m_pending.end())
+                {
+                    found->second.Result.Lines.push_back(line);
+                }
+            }
+        }
+        else if (line != "ACK>")
+        {
+            isEvent = true;
+            handler = m_eventHandler;
+        }
+    }
+    if (!finished.empty())
+    {
+        m_room.notify_all();
+    }
+    for (auto &pending : finished)
+    {
+        Finish(pending, false);
+    }
+    if (isEvent && handler)
+    {
+        handler(line);
+    }
+}
+
+//-----------------------------------------------------------------------------------------
+// Procedure:
+//  ExpireTimeouts completes anything that's waited too long as dropped.
+void TeensyBotClient::ExpireTimeouts()
+{
+    std::vector<Pending> expired;
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        ClientClock::time_point cutoff = ClientClock::now() - std::chrono::milliseconds(m_timeoutMS);
+        for (auto entry = m_pending.begin(); entry != m_pending.end();)
+        {
+            if (entry->second.Result.Sent < cutoff)
+            {
+                if (m_inReply && (m_replySequence == entry->first))
+                {
+                    m_inReply = false;
+                }
+                expired.push_back(entry->second);
+                entry = m_pending.erase(entry);
+            }
+            else
+            {
+                ++entry;
+            }
+        }
+    }
+    if (!expired.empty())
+    {
+        m_room.notify_all();
+    }
+    for (auto &pending : expired)
+    {
+        Finish(pending, true);
+    }
+}
+
+void TeensyBotClient::Finish(Pending &pending, bool timedOut)
+{
+    pending.Result.TimedOut = timedOut;
+    pending.Result.Completed = ClientClock::now();
+    if (pending.Done)
+    {
+        pending.Done(pending.Result);
+    }
+}
@@ -0,0 +1,195 @@
+// ---------------------------------------------------------------------------
+// TeensyBot Host Client Library - v0.0.1 - 07/12/2020
+//
+// AUTHOR/LICENSE:
+// Created by Imran Peerbhai -- ipeerbhai@aol.com
+// Copyright 2020 License:
+// Forks and derivitive works are NOT permitted without
+// permission. Permission is only granted to use as-is for private and
+// non-commercial use by natural persons or non-profit entities.
+// For-profit entities require a license.
+//
+// CONTRIBUTIONS:
+// If you wish to contribute, make changes, or enhancements,
+// please create a pull request.
+//
+// DISCLAIMER:
+// This software is furnished "as is", without technical support, and with no
+// warranty, express or implied, as to its usefulness for any purpose.
+// ---------------------------------------------------------------------------
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+// Theory of Operation:
+
+//  This runs on the main computer, not the Teensy.  It's plain C++11 and POSIX,
+//  and opens the robot's serial device (or any tty or pty that speaks the same
+//  protocol).
+
+//  CommandEncoder knows the exact fixed-width format of every command that
+//  CommandManager::ProcessCommandBuffer understands, so callers never build
+//  command strings by hand.
+
+//  TeensyBotClient tags each command with a sequence number, "@42:w~", and
+//  doesn't wait for the reply before sending the next one.  A reader thread
+//  collects every line between "ACK>@42" and "{'Done' : 42}" and hands them to
+//  the completion for 42.  Lines outside any reply, like a streamed pose, go to
+//  the event handler.  A command that gets no Done within the timeout completes
+//  with TimedOut set -- the firmware dropped it or the reply.
+
+//  SyncClock runs the firmware's NTP-style clock sync (see ClockSystem.h), so
+//  telemetry timestamps come back as 'HostUS' on our HostMicros clock.
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <future>
+#include <chrono>
+#include <functional>
+#include <condition_variable>
+
+#ifndef TEENSYBOT_CLIENT_ONCE
+#define TEENSYBOT_CLIENT_ONCE
+
+#define CLIENT_DEFAULT_TIMEOUT_MS 1000 // a command with no Done by then is counted as dropped.
+#define CLIENT_DEFAULT_WINDOW 16       // commands in flight before Send waits.
+
+typedef std::chrono::steady_clock ClientClock;
+
+struct Reply
+{
+    uint32_t Sequence;
+    std::string Command;             // what we sent, without the tag or the ~.
+    std::vector<std::string> Lines;  // everything between the ACK and the Done.
+    bool TimedOut;
+    ClientClock::time_point Sent;
+    ClientClock::time_point Completed;
+
+    double LatencyUS() const;        // sent to Done, in microseconds.
+};
+
+typedef std::function<void(const Reply &)> Completion;
+typedef std::function<void(const std::string &)> EventHandler;
+
+// Builds the command strings, without the ~.  Formats match ProcessCommandBuffer exactly.
+class CommandEncoder
+{
+public:
+    static std::string Memory();                                   // "a" -- stack, static RAM and heap, see MemorySystem.h.
+    static std::string ClearMemory();                              // "a0"
+    static std::string Battery();                                  // "b"
+    static std::string Counts(int motors, int sensors);            // "c2,1"
+    static std::string Disable(int motor);                         // "d0"
+    static std::string Enable(int motor);                          // "e0"
+    static std::string StepFrequency(int motor, double hertz);     // "f0,+001234.567"
+    static std::string ProgramState();                             // "g" -- see ProgramSystem.h.
+    static std::string ProgramStep(int slot, const std::string &step); // "gA0,D,250"
+    static std::string RunProgram(int slot);                       // "gR0"
+    static std::string StopProgram();                              // "gS"
+    static std::string ClearProgram(int slot);                     // "gX0"
+    static std::string ListProgram(int slot);                      // "gL0"
+    static std::string Hash();                                     // "h"
+    static std::string Latency();                                  // "l" -- per-stage histograms, see LatencySystem.h.
+    static std::string ClearLatency();                             // "l0"
+    static std::string MotorIntervals(int32_t left, int32_t right); // "m+00500,-00500", sign is direction.
+    static std::string Override();                                 // "o"
+    static std::string Pose();                                     // "p"
+    static std::string EncoderState();                             // "q"
+    static std::string ConfigureEncoder(int encoder, int pinA, int pinB); // "qE0,02,03"
+    static std::string CloseLoop(int loop, int motor, bool dutyOutput);   // "qL0,1,F"
+    static std::string Setpoint(int loop, double countsPerSecond);        // "qS0,+1500.0"
+    static std::string Gain(int loop, char term, double gain);            // "qP0,1.500"
+    static std::string LoopRate(int hertz);                               // "qR1000"
+    static std::string OpenLoop(int loop);                                // "qX0"
+    static std::string Reflexes();                                 // "R" -- rules and caps in force, see ReflexSystem.h.
+    static std::string ClearReflexes();                            // "RX"
+    static std::string ReflexRule(int rule, uint16_t sensorMask, uint32_t nearMM, uint32_t farMM, uint16_t motorMask, int percent); // "R0,3,0,300,3,0"
+    static std::string ResetSafety();                              // "r"
+    static std::string Ultrasonic();                               // "s"
+    static std::string Sync(int64_t hostSendUS, int64_t lastReplyUS); // "t<T1>,<T4>" -- see ClockSystem.h.
+    static std::string Trace();                                    // "T" -- dump the event trace, see TraceDecode.
+    static std::string ClearTrace();                               // "T0"
+    static std::string TraceSteps(uint32_t everyN);                // "TS0010", 0 stops.
+    static std::string OutputStatistics();                         // "u"
+    static std::string Servo(int motor, int dutyIntervalUS);       // "v0,1500"
+    static std::string MoveServo(int motor, int targetDutyUS, int ratePerSecond, int accelPerSecond); // "vS0,1500,200,50", 0 accel for no ramp.
+    static std::string Watchdog();                                 // "w"
+    static std::string WatchdogStatistics();                       // "wS" -- trips and stop latency, see SafetySystem.h.
+    static std::string PowerStatistics();                          // "z" -- see PowerSystem.h.
+    static std::string AllowIdle(bool isAllowed);                  // "z1", "z0" keeps the tick at full rate.
+    static std::string DispatchCycles();                           // "B" -- see RobotProfile.h.
+    static std::string ClearDispatchCycles();                      // "B0"
+    static std::string ForceGenericDispatch(bool isForced);        // "BG", "BA" lets a matching profile run.
+    static std::string WaveformStatistics();                       // "W" -- DMA refills and misses, see WaveSystem.h.
+    static std::string Waveform(bool isOn);                        // "W1" hands the steppers to the DMA, "W0" gives them back.
+    static std::string Batch(const std::vector<std::string>& items); // "X" -- items like "I,0,+500" applied on one tick, see BatchSystem.h.
+    static std::string ConfigurationComplete();                    // "C"
+    static std::string ConfigureMotor(int motor, int enablePin, int dirPin, int pulsePin, int interval, int dutyInterval); // "M0,01,02,03,00500,250"
+    static std::string ConfigureUltrasonic(int sensor, int triggerPin, int echoPin, uint32_t maxUS, uint32_t minUS);       // "S0,05,06,700000,500"
+    static std::string ConfigureOdometry(int left, int right, uint32_t wheelRadiusUM, uint32_t trackWidthUM, uint32_t stepsPerRev); // "O0,1,032500,150000,3200"
+    static std::string StreamPose(uint32_t intervalMS);            // "P100", 0 stops.
+    static std::string BulkConfiguration(const std::string &description); // "K..." -- see ConfigSystem.h.
+};
+
+class TeensyBotClient
+{
+public:
+    TeensyBotClient();
+    ~TeensyBotClient();
+    bool Open(const std::string &device, uint32_t baud); // opens a tty at baud, or a pty as-is.
+    void Close();
+    bool IsOpen();
+
+    // Send queues a command and returns at once with its sequence number.  If the window is
+    // full it waits for room first.  The completion runs on the reader thread.
+    uint32_t Send(const std::string &command, Completion completion);
+    std::future<Reply> Send(const std::string &command);
+    Reply Call(const std::string &command); // send and wait, for simple scripts.
+
+    // SyncClock pings "t" a few times so the firmware can learn our clock.  Telemetry then
+    // carries 'HostUS' on the HostMicros timebase.  Repeat every few seconds to track drift.
+    bool SyncClock(int rounds);
+    static int64_t HostMicros();
+
+    void SetEventHandler(EventHandler handler);
+    void SetWindow(uint32_t window);
+    void SetTimeout(uint32_t timeoutMS);
+    uint32_t InFlight();
+
+private:
+    struct Pending
+    {
+        Reply Result;
+        Completion Done;
+    };
+
+    void ReaderLoop();
+    void HandleLine(const std::string &line);
+    void ExpireTimeouts();
+    void Finish(Pending &pending, bool timedOut);
+
+    int m_fd;
+    std::thread m_reader;
+    std::atomic<bool> m_running;
+    std::mutex m_lock;                       // guards everything below.
+    std::mutex m_writeLock;                  // one frame on the wire at a time.
+    std::condition_variable m_room;
+    std::map<uint32_t, Pending> m_pending;   // by sequence number.
+    uint32_t m_nextSequence;
+    bool m_inReply;                          // between an ACK and its Done.
+    bool m_skipEcho;                         // next line is the firmware echoing the command.
+    uint32_t m_replySequence;
+    EventHandler m_eventHandler;
+    uint32_t m_window;
+    uint32_t m_timeoutMS;
+    std::string m_lineBuffer;
+};
+
+#endif
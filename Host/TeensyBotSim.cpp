@@ -0,0 +1,66 @@
+// ---------------------------------------------------------------------------
+// TeensyBot Simulator - v0.0.1 - 07/12/2020
+//
+// AUTHOR/LICENSE:
+// Created by Imran Peerbhai -- ipeerbhai@aol.com
+// Copyright 2020 License:
+// Forks and derivitive works are NOT permitted without
+// permission. Permission is only granted to use as-is for private and
+// non-commercial use by natural persons or non-profit entities.
+// For-profit entities require a license.
+//
+// CONTRIBUTIONS:
+// If you wish to contribute, make changes, or enhancements,
+// please create a pull request.
+//
+// DISCLAIMER:
+// This software is furnished "as is", without technical support, and with no
+// warranty, express or implied, as to its usefulness for any purpose.
+// ---------------------------------------------------------------------------
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+// Theory of Operation:
+
+//  The firmware, built for this machine: main.cpp's setup() and loop() and every
+//  subsystem behind them, on the Teensy shim (TeensyShim/Arduino.h), with the
+//  command link on a pty (PtyTransport.h).  It prints the pty's name; point
+//  TeensyBotClient or LoadGenerator at it, as at /dev/ttyACM0, and they talk to
+//  the real framing, parser, output queue and latency system.
+
+//  There are no interrupts here.  Between passes of loop(), TeensyShimRunTimers
+//  runs the tick ISR (and the safety and encoder timers) once for every period
+//  that has gone by on micros(), so the tick counter keeps real time and motors
+//  step on it as they would on the Teensy -- only late by however long a loop()
+//  pass took.  Pins go nowhere, the EEPROM is RAM and starts blank, so every
+//  run boots asking for a configuration (LoadGenerator's -k sends one).
+
+//  It spins a core flat out.  Timings are the host's, not a Teensy's; use them
+//  to compare changes and find protocol limits, not as the robot's numbers.
+
+//  Build:
+//    g++ -std=gnu++17 -O2 -pthread -DTEENSYBOT_HOST -I. -ITeensyShim -I../PlatformIO/src -o TeensyBotSim TeensyBotSim.cpp PtyTransport.cpp TeensyShim/TeensyShim.cpp ../PlatformIO/src/*.cpp
+//  Run:
+//    ./TeensyBotSim &
+//    ./LoadGenerator /dev/pts/N -k "2,0;01,02,03,500,250;04,05,06,500,250" -r 2000 -t 10 -c w
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <Arduino.h>
+
+void setup();
+void loop();
+
+int main(int argc, char **argv)
+{
+    setvbuf(stdout, NULL, _IONBF, 0);
+    setup();
+    while (true)
+    {
+        TeensyShimRunTimers();
+        loop();
+    }
+    return (0);
+}
@@ -0,0 +1,298 @@
+// ---------------------------------------------------------------------------
+// Teensy Host Shim - v0.0.1 - 07/12/2020
+//
+// AUTHOR/LICENSE:
+// Created by Imran Peerbhai -- ipeerbhai@aol.com
+// Copyright 2020 License:
+// Forks and derivitive works are NOT permitted without
+// permission. Permission is only granted to use as-is for private and
+// non-commercial use by natural persons or non-profit entities.
+// For-profit entities require a license.
+//
+// CONTRIBUTIONS:
+// If you wish to contribute, make changes, or enhancements,
+// please create a pull request.
+//
+// DISCLAIMER:
+// This software is furnished "as is", without technical support, and with no
+// warranty, express or implied, as to its usefulness for any purpose.
+// ---------------------------------------------------------------------------
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+// Theory of Operation:
+
+//  Just enough of the Teensyduino core for the firmware's subsystems to build
+//  and run on this machine, so host tools can drive the real code instead of a
+//  copy of it.  Put this directory ahead of PlatformIO/src on the include path
+//  and link TeensyShim.cpp.
+
+//  String is a real string with the Arduino formatting rules.  Pins are an
+//  array of levels: digitalWrite stores, digitalRead reads back.  micros(),
+//  millis() and the cycle counter run off the host's monotonic clock.  The
+//  EEPROM is RAM, erased to 0xFF.  Peripheral registers (GPIO, LPUART, FlexPWM,
+//  watchdog) are plain memory laid out like the chip's, so code that writes them
+//  does no harm, and DMA channels never move anything.
+
+//  Nothing here runs on its own.  attachInterrupt ignores the handler, and an
+//  IntervalTimer only fires when the host tool calls TeensyShimRunTimers(), which
+//  runs every handler that has come due on micros() since the last call, in
+//  order, as the timer interrupts would have.  Everything is on one thread, so
+//  noInterrupts() and interrupts() do nothing.
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string>
+#include <type_traits>
+
+#ifndef TEENSY_SHIM_ONCE
+#define TEENSY_SHIM_ONCE
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define FALLING 2
+#define RISING 3
+#define CHANGE 4
+#define HEX 16
+#define DEC 10
+#define PI 3.1415926535897932384626433832795
+#define NUM_DIGITAL_PINS 55
+#define F_BUS_ACTUAL 150000000
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+// functions rather than macros, so the C++ library's own min and max still build.
+template <class A, class B> inline typename std::common_type<A, B>::type min(A a, B b) { return ((a < b) ? a : b); }
+template <class A, class B> inline typename std::common_type<A, B>::type max(A a, B b) { return ((a > b) ? a : b); }
+
+class String
+{
+public:
+    String() {}
+    String(const char *text) : m_text(text ? text : "") {}
+    String(const std::string &text) : m_text(text) {}
+    explicit String(char c) : m_text(1, c) {}
+    explicit String(unsigned char value, unsigned char base = DEC);
+    explicit String(int value, unsigned char base = DEC);
+    explicit String(unsigned int value, unsigned char base = DEC);
+    explicit String(long value, unsigned char base = DEC);
+    explicit String(unsigned long value, unsigned char base = DEC);
+    explicit String(float value, unsigned char decimals = 2);
+    explicit String(double value, unsigned char decimals = 2);
+
+    String &operator+=(const String &other) { m_text += other.m_text; return (*this); }
+    String &operator+=(const char *text) { m_text += text; return (*this); }
+    String &operator+=(char c) { m_text += c; return (*this); }
+    String &operator+=(int value) { return (*this += String(value)); }
+    String &operator+=(unsigned int value) { return (*this += String(value)); }
+    String &operator+=(long value) { return (*this += String(value)); }
+    String &operator+=(unsigned long value) { return (*this += String(value)); }
+    String &operator+=(float value) { return (*this += String(value)); }
+    String &operator+=(double value) { return (*this += String(value)); }
+    bool operator==(const String &other) const { return (m_text == other.m_text); }
+    bool operator==(const char *text) const { return (m_text == text); }
+    bool operator!=(const String &other) const { return (m_text != other.m_text); }
+    char operator[](unsigned int index) const { return ((index < m_text.size()) ? m_text[index] : 0); }
+    char charAt(unsigned int index) const { return ((*this)[index]); }
+
+    unsigned int length() const { return ((unsigned int)m_text.size()); }
+    const char *c_str() const { return (m_text.c_str()); }
+    void reserve(unsigned int size) { m_text.reserve(size); }
+    String substring(unsigned int from) const;
+    String substring(unsigned int from, unsigned int to) const;
+    int indexOf(char c, unsigned int from = 0) const;
+    long toInt() const { return (atol(m_text.c_str())); }
+    float toFloat() const { return ((float)atof(m_text.c_str())); }
+    void toCharArray(char *buffer, unsigned int size) const;
+
+private:
+    std::string m_text;
+};
+
+String operator+(const String &left, const String &right);
+String operator+(const String &left, const char *right);
+
+class Stream
+{
+public:
+    virtual ~Stream() {}
+    virtual int available() { return (0); }
+    virtual int read() { return (-1); }
+    virtual int peek() { return (-1); }
+    virtual int availableForWrite() { return (0); }
+    virtual size_t write(uint8_t c) { return (write(&c, 1)); }
+    virtual size_t write(const uint8_t *buffer, size_t length) { return (length); }
+    size_t write(const char *buffer, size_t length) { return (write((const uint8_t *)buffer, length)); }
+    virtual void flush() {}
+    void begin(uint32_t baud) {}
+    operator bool() { return (true); }
+    size_t print(const String &text) { return (write((const uint8_t *)text.c_str(), text.length())); }
+    size_t print(const char *text) { return (write((const uint8_t *)text, strlen(text))); }
+    template <class T> size_t print(T value) { return (print(String(value))); }
+    template <class T> size_t print(T value, int format) { return (print(String(value, format))); }
+    size_t println() { return (print("\r\n")); }
+    template <class T> size_t println(T value) { size_t n = print(value); return (n + println()); }
+    template <class T> size_t println(T value, int format) { size_t n = print(value, format); return (n + println()); }
+};
+
+// USB serial writes to stdout; nothing ever arrives on it.
+class usb_serial_class : public Stream
+{
+public:
+    int availableForWrite();
+    size_t write(const uint8_t *buffer, size_t length);
+};
+
+// A hardware serial port with nothing on the other end.
+class HardwareSerial : public Stream
+{
+public:
+    void begin(uint32_t baud, uint16_t format = 0) {}
+    void addMemoryForRead(void *buffer, size_t length) {}
+    void addMemoryForWrite(void *buffer, size_t length) {}
+};
+
+extern usb_serial_class Serial;
+extern HardwareSerial Serial1, Serial2, Serial3, Serial4, Serial5, Serial6, Serial7, Serial8;
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t level);
+int digitalRead(uint8_t pin);
+#define digitalWriteFast digitalWrite
+#define digitalReadFast digitalRead
+int analogRead(uint8_t pin);
+#define digitalPinToInterrupt(p) (p)
+void attachInterrupt(uint8_t pin, void (*handler)(), int mode);
+void detachInterrupt(uint8_t pin);
+
+uint32_t micros();
+uint32_t millis();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+void noInterrupts();
+void interrupts();
+#define __disable_irq() noInterrupts()
+#define __enable_irq() interrupts()
+
+#define TEENSY_SHIM_TIMERS 8            // IntervalTimers running at once, as on the Teensy 4.
+#define TEENSY_SHIM_MAX_CATCH_UP 200000  // handler calls one TeensyShimRunTimers may make before it gives up the backlog.
+
+// An IntervalTimer fires every period uS from begin, when TeensyShimRunTimers says so.
+class IntervalTimer
+{
+public:
+    IntervalTimer() : m_handler(NULL), m_periodUS(0), m_dueUS(0) {}
+    ~IntervalTimer() { end(); }
+    bool begin(void (*handler)(), int period) { return (begin(handler, (double)period)); }
+    bool begin(void (*handler)(), unsigned int period) { return (begin(handler, (double)period)); }
+    bool begin(void (*handler)(), float period) { return (begin(handler, (double)period)); }
+    void update(int period) { m_periodUS = period; }
+    void update(unsigned int period) { m_periodUS = period; }
+    void update(float period) { m_periodUS = period; }
+    void end();
+    void priority(uint8_t level) {}
+
+private:
+    bool begin(void (*handler)(), double period);
+    friend void TeensyShimRunTimers();
+
+    void (*m_handler)();
+    double m_periodUS;
+    double m_dueUS;     // micros() the handler next fires at.
+};
+
+void TeensyShimRunTimers(); // fire every IntervalTimer that's due.  Call from the host tool's loop.
+
+// cycle counter, at F_CPU_ACTUAL, from the host clock.
+uint32_t TeensyShimCycles();
+#define ARM_DWT_CYCCNT (TeensyShimCycles())
+extern volatile uint32_t F_CPU_ACTUAL;
+
+// watchdog and reset status.
+extern volatile uint32_t WDOG1_WCR, WDOG1_WSR, WDOG1_WMCR, CCM_CCGR3, SRC_SRSR;
+#define WDOG_WCR_WT(n) ((uint16_t)(((n) & 0xFF) << 8))
+#define WDOG_WCR_WDE ((uint16_t)(1 << 2))
+#define WDOG_WCR_SRS ((uint16_t)(1 << 4))
+#define WDOG_WCR_WDA ((uint16_t)(1 << 5))
+#define CCM_CCGR_ON 3
+#define CCM_CCGR3_WDOG1(n) ((uint32_t)(((n) & 0x03) << 16))
+#define SRC_SRSR_WDOG_RST_B ((uint32_t)(1 << 4))
+
+// GPIO1-4 and their fast GPIO6-9 twins, 0x4000 bytes apart like the chip's.
+#define TEENSY_SHIM_GPIO_WORDS (4 * 0x4000 / 4)
+extern volatile uint32_t g_teensyShimGpio[TEENSY_SHIM_GPIO_WORDS];
+extern volatile uint32_t g_teensyShimFastGpio[TEENSY_SHIM_GPIO_WORDS];
+#define GPIO1_DR (g_teensyShimGpio[0x00 / 4])
+#define GPIO1_GDIR (g_teensyShimGpio[0x04 / 4])
+#define GPIO1_DR_SET (g_teensyShimGpio[0x84 / 4])
+#define GPIO1_DR_CLEAR (g_teensyShimGpio[0x88 / 4])
+#define GPIO1_DR_TOGGLE (g_teensyShimGpio[0x8C / 4])
+#define GPIO6_DR (g_teensyShimFastGpio[0x00 / 4])
+#define GPIO6_DR_SET (g_teensyShimFastGpio[0x84 / 4])
+#define GPIO6_DR_CLEAR (g_teensyShimFastGpio[0x88 / 4])
+extern volatile uint32_t IOMUXC_GPR_GPR26;
+volatile uint32_t *digitalPinToPortReg(int pin);  // pins 0-31 on the first port, the rest on the second.
+uint32_t digitalPinToBitMask(int pin);
+
+typedef struct
+{
+    volatile uint32_t VERID, PARAM, GLOBAL, PINCFG, BAUD, STAT, CTRL, DATA, MATCH, MODIR, FIFO, WATER;
+} IMXRT_LPUART_t;
+extern IMXRT_LPUART_t IMXRT_LPUART1, IMXRT_LPUART2, IMXRT_LPUART3, IMXRT_LPUART4, IMXRT_LPUART5, IMXRT_LPUART6, IMXRT_LPUART7, IMXRT_LPUART8;
+#define LPUART_CTRL_ILIE (1 << 20)
+#define LPUART_CTRL_RIE (1 << 21)
+#define LPUART_CTRL_TCIE (1 << 22)
+#define LPUART_CTRL_TIE (1 << 23)
+#define LPUART_BAUD_RDMAE (1 << 21)
+#define LPUART_BAUD_TDMAE (1 << 23)
+#define LPUART_WATER_RXWATER(n) ((uint32_t)(n) << 16)
+#define LPUART_WATER_TXWATER(n) ((uint32_t)(n))
+#define DMAMUX_SOURCE_LPUART1_TX 2
+#define DMAMUX_SOURCE_LPUART1_RX 3
+#define DMAMUX_SOURCE_LPUART3_TX 4
+#define DMAMUX_SOURCE_LPUART3_RX 5
+#define DMAMUX_SOURCE_LPUART5_TX 6
+#define DMAMUX_SOURCE_LPUART5_RX 7
+#define DMAMUX_SOURCE_LPUART7_TX 8
+#define DMAMUX_SOURCE_LPUART7_RX 9
+#define DMAMUX_SOURCE_LPUART2_TX 66
+#define DMAMUX_SOURCE_LPUART2_RX 67
+#define DMAMUX_SOURCE_LPUART4_TX 68
+#define DMAMUX_SOURCE_LPUART4_RX 69
+#define DMAMUX_SOURCE_LPUART6_TX 70
+#define DMAMUX_SOURCE_LPUART6_RX 71
+#define DMAMUX_SOURCE_LPUART8_TX 72
+#define DMAMUX_SOURCE_LPUART8_RX 73
+#define DMAMUX_SOURCE_FLEXPWM3_WRITE3 101
+
+typedef struct
+{
+    volatile uint16_t CNT, INIT, CTRL2, CTRL, RESERVED0, VAL0, FRACVAL1, VAL1, FRACVAL2, VAL2, FRACVAL3, VAL3, FRACVAL4, VAL4, FRACVAL5, VAL5, FRCTRL, OCTRL, STS, INTEN, DMAEN, TCTRL, DISMAP0, DISMAP1, DTCNT0, DTCNT1;
+} IMXRT_FLEXPWM_SM_t;
+typedef struct
+{
+    IMXRT_FLEXPWM_SM_t SM[4];
+    volatile uint16_t OUTEN, MASK, SWCOUT, DTSRCSEL, MCTRL, MCTRL2, FCTRL0, FSTS0, FFILT0, FTST0, FCTRL20;
+} IMXRT_FLEXPWM_t;
+extern IMXRT_FLEXPWM_t IMXRT_FLEXPWM3;
+#define FLEXPWM_MCTRL_LDOK(n) ((uint16_t)(((n) & 0x0F) << 0))
+#define FLEXPWM_MCTRL_CLDOK(n) ((uint16_t)(((n) & 0x0F) << 4))
+#define FLEXPWM_MCTRL_RUN(n) ((uint16_t)(((n) & 0x0F) << 8))
+#define FLEXPWM_SMCTRL2_INDEP ((uint16_t)(1 << 13))
+#define FLEXPWM_SMCTRL2_WAITEN ((uint16_t)(1 << 14))
+#define FLEXPWM_SMCTRL2_DBGEN ((uint16_t)(1 << 15))
+#define FLEXPWM_SMCTRL_FULL ((uint16_t)(1 << 10))
+#define FLEXPWM_SMDMAEN_VALDE ((uint16_t)(1 << 9))
+
+#endif
@@ -0,0 +1,83 @@
+// Teensy Host Shim: DMA channels that never move anything.  See Arduino.h.
+
+#include <stdint.h>
+
+#ifndef TEENSY_SHIM_DMA_ONCE
+#define TEENSY_SHIM_DMA_ONCE
+
+struct DMA_TCD_t
+{
+    volatile const void *SADDR;
+    int16_t SOFF;
+    uint16_t ATTR;
+    union
+    {
+        uint32_t NBYTES;
+        uint32_t NBYTES_MLOFFYES;
+    };
+    int32_t SLAST;
+    volatile void *DADDR;
+    int16_t DOFF;
+    union
+    {
+        volatile uint16_t CITER;
+        volatile uint16_t CITER_ELINKNO;
+    };
+    int32_t DLASTSGA;
+    volatile uint16_t CSR;
+    union
+    {
+        volatile uint16_t BITER;
+        volatile uint16_t BITER_ELINKNO;
+    };
+};
+
+#define DMA_TCD_ATTR_SSIZE(n) (((n) & 0x7) << 8)
+#define DMA_TCD_ATTR_DSIZE(n) ((n) & 0x7)
+#define DMA_TCD_NBYTES_DMLOE ((uint32_t)1 << 30)
+#define DMA_TCD_NBYTES_MLOFFYES_MLOFF(n) ((uint32_t)(((n) & 0xFFFFF) << 10))
+#define DMA_TCD_NBYTES_MLOFFYES_NBYTES(n) ((uint32_t)((n) & 0x3FF))
+#define DMA_TCD_CSR_INTHALF 0x0004
+#define DMA_TCD_CSR_INTMAJOR 0x0002
+
+class DMAChannel
+{
+public:
+    DMAChannel() : TCD(&m_tcd), channel(0) {}
+    DMA_TCD_t *TCD;
+    uint8_t channel;
+
+    void source(volatile const uint8_t &p) {}
+    void source(volatile const uint16_t &p) {}
+    void source(volatile const uint32_t &p) {}
+    void destination(volatile uint8_t &p) {}
+    void destination(volatile uint16_t &p) {}
+    void destination(volatile uint32_t &p) {}
+    void sourceBuffer(const volatile uint8_t *p, unsigned int length) {}
+    void sourceBuffer(const volatile uint16_t *p, unsigned int length) {}
+    void sourceBuffer(const volatile uint32_t *p, unsigned int length) {}
+    void sourceCircular(const volatile uint32_t *p, unsigned int length) {}
+    void destinationBuffer(volatile uint8_t *p, unsigned int length) { TCD->DADDR = p; }
+    void destinationBuffer(volatile uint16_t *p, unsigned int length) { TCD->DADDR = p; }
+    void destinationBuffer(volatile uint32_t *p, unsigned int length) { TCD->DADDR = p; }
+    void transferSize(unsigned int size) {}
+    void transferCount(unsigned int count) {}
+    void triggerAtHardwareEvent(uint8_t source) {}
+    void triggerContinuously() {}
+    void triggerAtCompletionOf(DMAChannel &other) {}
+    void disableOnCompletion() {}
+    void interruptAtCompletion() {}
+    void attachInterrupt(void (*isr)()) {}
+    void clearInterrupt() {}
+    void enable() {}
+    void disable() {}
+    bool complete() { return (true); }
+    void clearComplete() {}
+    bool error() { return (false); }
+    void clearError() {}
+
+private:
+    DMA_TCD_t m_tcd;
+};
+
+#endif
@@ -0,0 +1,25 @@
+// Teensy Host Shim: the emulated EEPROM, as RAM.  See Arduino.h.
+
+#include <stdint.h>
+
+#ifndef TEENSY_SHIM_EEPROM_ONCE
+#define TEENSY_SHIM_EEPROM_ONCE
+
+#define TEENSY_SHIM_EEPROM_LENGTH 4284  // what the Teensy 4.1 emulates.
+
+class EEPROMClass
+{
+public:
+    EEPROMClass();
+    uint8_t read(int address);
+    void write(int address, uint8_t value);
+    void update(int address, uint8_t value);
+    uint16_t length() { return (TEENSY_SHIM_EEPROM_LENGTH); }
+
+private:
+    uint8_t m_bytes[TEENSY_SHIM_EEPROM_LENGTH];
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
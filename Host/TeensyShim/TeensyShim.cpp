@@ -0,0 +1,321 @@
+#include "Arduino.h"
+#include "EEPROM.h"
+#include <stdio.h>
+#include <chrono>
+#include <thread>
+
+//-----------------------------------------------------------------------------------------
+// String formats numbers the way the Arduino core does: integers in any base, unsigned
+// when the type is, floats with a fixed number of decimals.
+static std::string FormatUnsigned(unsigned long value, unsigned char base)
+{
+    if ((base < 2) || (base > 36))
+    {
+        base = DEC;
+    }
+    char digits[65];
+    int at = sizeof(digits) - 1;
+    digits[at] = '\0';
+    do
+    {
+        int digit = (int)(value % base);
+        digits[--at] = (char)((digit < 10) ? ('0' + digit) : ('A' + digit - 10));
+        value /= base;
+    } while (value != 0);
+    return (std::string(&digits[at]));
+}
+
+static std::string FormatSigned(long value, unsigned char base)
+{
+    if ((base == DEC) && (value < 0))
+    {
+        return ("-" + FormatUnsigned(0ul - (unsigned long)value, base));
+    }
+    return (FormatUnsigned((unsigned long)value, base));
+}
+
+String::String(unsigned char value, unsigned char base) : m_text(FormatUnsigned(value, base)) {}
+String::String(int value, unsigned char base) : m_text(FormatSigned(value, base)) {}
+String::String(unsigned int value, unsigned char base) : m_text(FormatUnsigned(value, base)) {}
+String::String(long value, unsigned char base) : m_text(FormatSigned(value, base)) {}
+String::String(unsigned long value, unsigned char base) : m_text(FormatUnsigned(value, base)) {}
+String::String(float value, unsigned char decimals) : String((double)value, decimals) {}
+
+String::String(double value, unsigned char decimals)
+{
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "%.*f", (int)decimals, value);
+    m_text = buffer;
+}
+
+String String::substring(unsigned int from) const
+{
+    return (substring(from, length()));
+}
+
+String String::substring(unsigned int from, unsigned int to) const
+{
+    if (from > to)
+    {
+        unsigned int swap = from;
+        from = to;
+        to = swap;
+    }
+    if (from >= m_text.size())
+    {
+        return (String());
+    }
+    return (String(m_text.substr(from, to - from)));
+}
+
+int String::indexOf(char c, unsigned int from) const
+{
+    size_t at = m_text.find(c, from);
+    return ((at == std::string::npos) ? -1 : (int)at);
+}
+
+void String::toCharArray(char *buffer, unsigned int size) const
+{
+    if (size == 0)
+    {
+        return;
+    }
+    size_t count = (m_text.size() < size - 1) ? m_text.size() : size - 1;
+    memcpy(buffer, m_text.c_str(), count);
+    buffer[count] = '\0';
+}
+
+String operator+(const String &left, const String &right)
+{
+    String sum = left;
+    sum += right;
+    return (sum);
+}
+
+String operator+(const String &left, const char *right)
+{
+    String sum = left;
+    sum += right;
+    return (sum);
+}
+
+//-----------------------------------------------------------------------------------------
+// Serial ports.  USB goes to stdout, and never blocks.
+usb_serial_class Serial;
+HardwareSerial Serial1, Serial2, Serial3, Serial4, Serial5, Serial6, Serial7, Serial8;
+
+int usb_serial_class::availableForWrite()
+{
+    return (4096);
+}
+
+size_t usb_serial_class::write(const uint8_t *buffer, size_t length)
+{
+    return (fwrite(buffer, 1, length, stdout));
+}
+
+//-----------------------------------------------------------------------------------------
+// Pins are levels in an array.
+static uint8_t s_pinLevels[NUM_DIGITAL_PINS];
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+}
+
+void digitalWrite(uint8_t pin, uint8_t level)
+{
+    if (pin < NUM_DIGITAL_PINS)
+    {
+        s_pinLevels[pin] = level ? HIGH : LOW;
+    }
+}
+
+int digitalRead(uint8_t pin)
+{
+    return ((pin < NUM_DIGITAL_PINS) ? s_pinLevels[pin] : LOW);
+}
+
+int analogRead(uint8_t pin)
+{
+    return (0);
+}
+
+void attachInterrupt(uint8_t pin, void (*handler)(), int mode)
+{
+}
+
+void detachInterrupt(uint8_t pin)
+{
+}
+
+//-----------------------------------------------------------------------------------------
+// Time, from the host's monotonic clock, counted from the first call.
+static uint64_t HostNanoseconds()
+{
+    static const std::chrono::steady_clock::time_point s_start = std::chrono::steady_clock::now();
+    return ((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - s_start).count());
+}
+
+uint32_t micros()
+{
+    return ((uint32_t)(HostNanoseconds() / 1000));
+}
+
+uint32_t millis()
+{
+    return ((uint32_t)(HostNanoseconds() / 1000000));
+}
+
+void delay(uint32_t ms)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void delayMicroseconds(uint32_t us)
+{
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+uint32_t TeensyShimCycles()
+{
+    return ((uint32_t)((HostNanoseconds() * (F_CPU_ACTUAL / 1000000)) / 1000));
+}
+
+void noInterrupts()
+{
+}
+
+//-----------------------------------------------------------------------------------------
+// IntervalTimers.  The running ones are in a table; TeensyShimRunTimers fires whichever is due
+// soonest, over and over, until none is due.
+static IntervalTimer *s_timers[TEENSY_SHIM_TIMERS];
+
+static double HostMicroseconds()
+{
+    return (HostNanoseconds() / 1000.0);
+}
+
+bool IntervalTimer::begin(void (*handler)(), double period)
+{
+    if ((handler == NULL) || (period <= 0))
+    {
+        return (false);
+    }
+    int slot = -1;
+    for (int i = 0; i < TEENSY_SHIM_TIMERS; i++)
+    {
+        if (s_timers[i] == this)
+        {
+            slot = i; // restarting a running timer.
+            break;
+        }
+        if ((s_timers[i] == NULL) && (slot < 0))
+        {
+            slot = i;
+        }
+    }
+    if (slot < 0)
+    {
+        return (false); // out of timers, like the PIT.
+    }
+    m_handler = handler;
+    m_periodUS = period;
+    m_dueUS = HostMicroseconds() + period;
+    s_timers[slot] = this;
+    return (true);
+}
+
+void IntervalTimer::end()
+{
+    for (int i = 0; i < TEENSY_SHIM_TIMERS; i++)
+    {
+        if (s_timers[i] == this)
+        {
+            s_timers[i] = NULL;
+        }
+    }
+    m_handler = NULL;
+}
+
+void TeensyShimRunTimers()
+{
+    double now = HostMicroseconds();
+    for (int calls = 0; calls < TEENSY_SHIM_MAX_CATCH_UP; calls++)
+    {
+        IntervalTimer *next = NULL;
+        for (int i = 0; i < TEENSY_SHIM_TIMERS; i++)
+        {
+            if ((s_timers[i] != NULL) && ((next == NULL) || (s_timers[i]->m_dueUS < next->m_dueUS)))
+            {
+                next = s_timers[i];
+            }
+        }
+        if ((next == NULL) || (next->m_dueUS > now))
+        {
+            return;
+        }
+        // the handler may end or restart its own timer, so step it first.
+        next->m_dueUS += next->m_periodUS;
+        next->m_handler();
+    }
+
+    // too far behind to catch up: drop the backlog, like a core that couldn't keep up.
+    for (int i = 0; i < TEENSY_SHIM_TIMERS; i++)
+    {
+        if ((s_timers[i] != NULL) && (s_timers[i]->m_dueUS < now))
+        {
+            s_timers[i]->m_dueUS = now + s_timers[i]->m_periodUS;
+        }
+    }
+}
+
+void interrupts()
+{
+}
+
+//-----------------------------------------------------------------------------------------
+// Registers, as memory.
+volatile uint32_t F_CPU_ACTUAL = 600000000;
+volatile uint32_t WDOG1_WCR, WDOG1_WSR, WDOG1_WMCR, CCM_CCGR3, SRC_SRSR;
+volatile uint32_t IOMUXC_GPR_GPR26;
+volatile uint32_t g_teensyShimGpio[TEENSY_SHIM_GPIO_WORDS];
+volatile uint32_t g_teensyShimFastGpio[TEENSY_SHIM_GPIO_WORDS];
+IMXRT_LPUART_t IMXRT_LPUART1, IMXRT_LPUART2, IMXRT_LPUART3, IMXRT_LPUART4, IMXRT_LPUART5, IMXRT_LPUART6, IMXRT_LPUART7, IMXRT_LPUART8;
+IMXRT_FLEXPWM_t IMXRT_FLEXPWM3;
+
+volatile uint32_t *digitalPinToPortReg(int pin)
+{
+    return (&g_teensyShimFastGpio[((pin / 32) * 0x4000) / 4]);
+}
+
+uint32_t digitalPinToBitMask(int pin)
+{
+    return (1ul << (pin % 32));
+}
+
+//-----------------------------------------------------------------------------------------
+// EEPROM starts erased, like new flash.
+EEPROMClass EEPROM;
+
+EEPROMClass::EEPROMClass()
+{
+    memset(m_bytes, 0xFF, sizeof(m_bytes));
+}
+
+uint8_t EEPROMClass::read(int address)
+{
+    return (((address >= 0) && (address < TEENSY_SHIM_EEPROM_LENGTH)) ? m_bytes[address] : 0xFF);
+}
+
+void EEPROMClass::write(int address, uint8_t value)
+{
+    if ((address >= 0) && (address < TEENSY_SHIM_EEPROM_LENGTH))
+    {
+        m_bytes[address] = value;
+    }
+}
+
+void EEPROMClass::update(int address, uint8_t value)
+{
+    write(address, value);
+}
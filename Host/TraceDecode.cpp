@@ -0,0 +1,212 @@
+// ---------------------------------------------------------------------------
+// TeensyBot Trace Decoder - v0.0.1 - 07/12/2020
+//
+// AUTHOR/LICENSE:
+// Created by Imran Peerbhai -- ipeerbhai@aol.com
+// Copyright 2020 License:
+// Forks and derivitive works are NOT permitted without
+// permission. Permission is only granted to use as-is for private and
+// non-commercial use by natural persons or non-profit entities.
+// For-profit entities require a license.
+//
+// CONTRIBUTIONS:
+// If you wish to contribute, make changes, or enhancements,
+// please create a pull request.
+//
+// DISCLAIMER:
+// This software is furnished "as is", without technical support, and with no
+// warranty, express or implied, as to its usefulness for any purpose.
+// ---------------------------------------------------------------------------
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+// Theory of Operation:
+
+//  Reads a captured console log (a file, or stdin) and turns every trace dump
+//  in it back into a timeline.  The dump format and event layout are described
+//  in PlatformIO/src/TraceSystem.h; the event types and layout come straight
+//  from PlatformIO/src/TraceEvents.h.
+
+//  Each event is printed with its time relative to the dump, and with host time
+//  too if the firmware was clock-synced (the header has 'HostUS').  Everything
+//  else in the log is ignored.
+
+//  Build:
+//    g++ -std=c++11 -O2 -I../PlatformIO/src -o TraceDecode TraceDecode.cpp
+//  Run:
+//    ./TraceDecode console.log
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "TraceEvents.h"
+
+static const char *TypeName(uint8_t type)
+{
+    switch (type)
+    {
+    case TRACE_BOOT: return ("Boot");
+    case TRACE_COMMAND: return ("Command");
+    case TRACE_SAFETY_TRIP: return ("SafetyTrip");
+    case TRACE_SAFETY_RESET: return ("SafetyReset");
+    case TRACE_SAFETY_OVERRIDE: return ("SafetyOverride");
+    case TRACE_WATCHDOG_EXPIRED: return ("WatchdogExpired");
+    case TRACE_WATCHDOG_RESET: return ("WatchdogReset");
+    case TRACE_CONFIGURATION: return ("Configuration");
+    case TRACE_OUTPUT_DROP: return ("OutputDrop");
+    case TRACE_STEP_EDGE: return ("StepEdge");
+    case TRACE_PROGRAM: return ("Program");
+    default: return ("Unknown");
+    }
+}
+
+//-----------------------------------------------------------------------------------------
+// Function:
+//  Detail describes the code and value the way each event type uses them.
+static std::string Detail(const TraceEvent &event)
+{
+    char text[64];
+    switch (event.Type)
+    {
+    case TRACE_COMMAND:
+        snprintf(text, sizeof(text), (event.Value != 0) ? "'%c' seq %u" : "'%c'", event.Code, event.Value);
+        break;
+    case TRACE_SAFETY_TRIP:
+        snprintf(text, sizeof(text), "%s", (event.Code == TRACE_SAFETY_WATCHDOG) ? "watchdog" : (event.Code == TRACE_SAFETY_SENSOR) ? "sensor" : "?");
+        break;
+    case TRACE_SAFETY_OVERRIDE:
+        snprintf(text, sizeof(text), "%s", event.Code ? "on" : "off");
+        break;
+    case TRACE_WATCHDOG_EXPIRED:
+        snprintf(text, sizeof(text), "stopped in %uus", event.Value);
+        break;
+    case TRACE_CONFIGURATION:
+        snprintf(text, sizeof(text), "'%c' %u", event.Code, event.Value);
+        break;
+    case TRACE_OUTPUT_DROP:
+        snprintf(text, sizeof(text), "%u bytes", event.Value);
+        break;
+    case TRACE_STEP_EDGE:
+        snprintf(text, sizeof(text), "motor %u step %u", event.Code, event.Value);
+        break;
+    case TRACE_PROGRAM:
+        snprintf(text, sizeof(text), (event.Code == 'R') ? "'%c' slot %u" : "'%c' at step %u", event.Code, event.Value);
+        break;
+    default:
+        text[0] = '\0';
+        break;
+    }
+    return (std::string(text));
+}
+
+//-----------------------------------------------------------------------------------------
+// Function:
+//  FindNumber returns the number after key in line, or false if the key isn't there.
+static bool FindNumber(const std::string &line, const char *key, long long *value)
+{
+    size_t found = line.find(key);
+    if (found == std::string::npos)
+    {
+        return (false);
+    }
+    *value = strtoll(line.c_str() + found + strlen(key), NULL, 10);
+    return (true);
+}
+
+static int HexValue(char digit)
+{
+    if ((digit >= '0') && (digit <= '9')) return (digit - '0');
+    if ((digit >= 'A') && (digit <= 'F')) return (digit - 'A' + 10);
+    if ((digit >= 'a') && (digit <= 'f')) return (digit - 'a' + 10);
+    return (-1);
+}
+
+int main(int argc, char **argv)
+{
+    FILE *input = stdin;
+    if (argc > 1)
+    {
+        input = fopen(argv[1], "r");
+        if (input == NULL)
+        {
+            perror(argv[1]);
+            return (1);
+        }
+    }
+
+    std::vector<TraceEvent> events;
+    bool inDump = false;
+    long long dumpTick = 0;
+    long long dumpHostUS = 0;
+    bool hasHostTime = false;
+    int dumps = 0;
+    char buffer[8192];
+    while (fgets(buffer, sizeof(buffer), input) != NULL)
+    {
+        std::string line(buffer);
+        while (!line.empty() && ((line.back() == '\n') || (line.back() == '\r')))
+        {
+            line.pop_back();
+        }
+
+        if (line.compare(0, 10, "{'Trace': ") == 0)
+        {
+            inDump = true;
+            events.clear();
+            FindNumber(line, "'Tick':", &dumpTick);
+            hasHostTime = FindNumber(line, "'HostUS':", &dumpHostUS);
+            long long missed = 0;
+            FindNumber(line, "'Missed':", &missed);
+            dumps++;
+            printf("=== trace %d: %s", dumps, line.c_str());
+            printf("%s\n", missed ? "  (events were missed during an earlier dump)" : "");
+        }
+        else if (inDump && (line.compare(0, 3, "TR:") == 0))
+        {
+            const char *hex = line.c_str() + 3;
+            size_t length = line.size() - 3;
+            for (size_t offset = 0; offset + 16 <= length; offset += 16)
+            {
+                uint8_t bytes[8];
+                for (int b = 0; b < 8; b++)
+                {
+                    bytes[b] = (uint8_t)((HexValue(hex[offset + b * 2]) << 4) | HexValue(hex[offset + b * 2 + 1]));
+                }
+                TraceEvent event;
+                event.Tick = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+                event.Type = bytes[4];
+                event.Code = bytes[5];
+                event.Value = (uint16_t)(bytes[6] | (bytes[7] << 8));
+                events.push_back(event);
+            }
+        }
+        else if (inDump && (line.compare(0, 13, "{'TraceEnd' :") == 0))
+        {
+            inDump = false;
+            for (const TraceEvent &event : events)
+            {
+                // ticks are microseconds and wrap at 32 bits; work relative to the dump.
+                int32_t beforeDump = (int32_t)((uint32_t)dumpTick - event.Tick);
+                if (hasHostTime)
+                {
+                    printf("%16lld  %+12.3fms  %-16s %s\n", dumpHostUS - beforeDump, -beforeDump / 1000.0, TypeName(event.Type), Detail(event).c_str());
+                }
+                else
+                {
+                    printf("%10u  %+12.3fms  %-16s %s\n", event.Tick, -beforeDump / 1000.0, TypeName(event.Type), Detail(event).c_str());
+                }
+            }
+        }
+    }
+    if (inDump)
+    {
+        fprintf(stderr, "log ends in the middle of a trace dump\n");
+    }
+    return (0);
+}
@@ -0,0 +1,219 @@
+// ---------------------------------------------------------------------------
+// TeensyBot Velocity Check - v0.0.1 - 07/12/2020
+//
+// AUTHOR/LICENSE:
+// Created by Imran Peerbhai -- ipeerbhai@aol.com
+// Copyright 2020 License:
+// Forks and derivitive works are NOT permitted without
+// permission. Permission is only granted to use as-is for private and
+// non-commercial use by natural persons or non-profit entities.
+// For-profit entities require a license.
+//
+// CONTRIBUTIONS:
+// If you wish to contribute, make changes, or enhancements,
+// please create a pull request.
+//
+// DISCLAIMER:
+// This software is furnished "as is", without technical support, and with no
+// warranty, express or implied, as to its usefulness for any purpose.
+// ---------------------------------------------------------------------------
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+// Theory of Operation:
+
+//  Closes the firmware's VelocityPid (PlatformIO/src/VelocityPid.h) around a
+//  simulated motor, the way EncoderSystem's control timer does on the Teensy.
+//  The motor is first order: its speed lags the output it's given by a time
+//  constant.  The output is clamped like SetVelocityOutput clamps it, and the
+//  encoder is read as whole counts, so the measurement has the same
+//  quantization noise the real loop sees.  It checks:
+
+//    a step in setpoint settles within CHECK_SETTLE_BAND, in CHECK_SETTLE_S;
+//    once settled, the mean speed is within CHECK_STEADY_BAND of the setpoint;
+//    with the setpoint out of reach, the output sits at the clamp and the
+//    integral doesn't grow past what the clamp needs;
+//    when the setpoint comes back in reach, the loop leaves the clamp within
+//    CHECK_RECOVER_S, and settles as fast as it did from rest.
+
+//  The same windup run is repeated without VelocityPid::Limit, to show the
+//  check would catch a loop that winds up.  Exit status is 0 if every check
+//  passed.
+
+//  Build:
+//    g++ -std=c++11 -O2 -I../PlatformIO/src -o VelocityCheck VelocityCheck.cpp ../PlatformIO/src/VelocityPid.cpp
+//  Run:
+//    ./VelocityCheck
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "VelocityPid.h"
+#include "CheckReport.h"
+
+#define CHECK_RATE_HZ 1000         // control rate, as DEFAULT_CONTROL_RATE_HZ.
+#define CHECK_MOTOR_GAIN 2.0f      // encoder counts per step.
+#define CHECK_MOTOR_TAU_S 0.05f    // motor time constant.
+#define CHECK_MAX_OUTPUT 20000.0f  // step Hz the clamp allows.
+#define CHECK_KP 0.05f
+#define CHECK_KI 5.0f
+#define CHECK_KD 0.0f
+#define CHECK_SETPOINT 20000.0f    // counts per second, in reach.
+#define CHECK_OUT_OF_REACH 60000.0f
+#define CHECK_SETTLE_BAND 0.05f
+#define CHECK_SETTLE_S 0.5f
+#define CHECK_STEADY_BAND 0.01f
+#define CHECK_RECOVER_S 0.05f
+
+struct Motor
+{
+    double Speed;     // counts per second.
+    double Position;  // counts.
+    long Count;       // what the encoder reads.
+};
+
+struct StepResult
+{
+    float SettleS;        // when the speed last entered the settle band, or -1 if it never stayed.
+    float SteadyMean;     // mean speed over the last half of the run.
+    float RecoverS;       // when the output was first inside the clamp, or -1.
+    float MaxIntegralOut; // largest Ki * Integral seen.
+};
+
+//-----------------------------------------------------------------------------------------
+// Function:
+//  Clamp limits the output like SetVelocityOutput in frequency mode, returning what was applied.
+static float Clamp(float output)
+{
+    if (output > CHECK_MAX_OUTPUT)
+    {
+        return (CHECK_MAX_OUTPUT);
+    }
+    if (output < -CHECK_MAX_OUTPUT)
+    {
+        return (-CHECK_MAX_OUTPUT);
+    }
+    return (output);
+}
+
+//-----------------------------------------------------------------------------------------
+// Function:
+//  Run drives the loop at setpoint for seconds, starting from the motor and pid as they are.
+//  If useLimit is false, Limit is never called, as if the loop had no anti-windup.
+static StepResult Run(VelocityPidState *pid, Motor *motor, long *lastCount, float setpoint, float seconds, bool useLimit)
+{
+    const float dt = 1.0f / CHECK_RATE_HZ;
+    const int substeps = 20; // the motor is integrated finer than the loop runs.
+    int periods = (int)(seconds * CHECK_RATE_HZ);
+    StepResult result = {-1, 0, -1, 0};
+    double sum = 0;
+    int samples = 0;
+    float applied = 0;
+
+    for (int i = 0; i < periods; i++)
+    {
+        for (int s = 0; s < substeps; s++)
+        {
+            double h = dt / substeps;
+            motor->Speed += ((CHECK_MOTOR_GAIN * applied) - motor->Speed) * h / CHECK_MOTOR_TAU_S;
+            motor->Position += motor->Speed * h;
+        }
+        motor->Count = (long)floor(motor->Position);
+
+        float measured = (float)(motor->Count - *lastCount) / dt;
+        *lastCount = motor->Count;
+        float output = VelocityPid::Update(pid, setpoint, measured, dt);
+        applied = Clamp(output);
+        if (useLimit)
+        {
+            VelocityPid::Limit(pid, output, applied);
+        }
+
+        float t = (i + 1) * dt;
+        bool isClamped = (applied != output);
+        if (!isClamped && (result.RecoverS < 0))
+        {
+            result.RecoverS = t;
+        }
+        float integralOut = fabsf(pid->Ki * pid->Integral);
+        if (integralOut > result.MaxIntegralOut)
+        {
+            result.MaxIntegralOut = integralOut;
+        }
+        // the model's speed, not the quantized measurement, decides settling.
+        bool inBand = fabs(motor->Speed - setpoint) <= (CHECK_SETTLE_BAND * fabsf(setpoint));
+        if (!inBand)
+        {
+            result.SettleS = -1;
+        }
+        else if (result.SettleS < 0)
+        {
+            result.SettleS = t;
+        }
+        if (i >= (periods / 2))
+        {
+            sum += measured;
+            samples++;
+        }
+    }
+    result.SteadyMean = (float)(sum / samples);
+    return (result);
+}
+
+//-----------------------------------------------------------------------------------------
+// Procedure:
+//  Start puts the motor at rest and the pid where ConfigureLoop leaves it.
+static void Start(VelocityPidState *pid, Motor *motor, long *lastCount)
+{
+    pid->Kp = CHECK_KP;
+    pid->Ki = CHECK_KI;
+    pid->Kd = CHECK_KD;
+    VelocityPid::Reset(pid);
+    motor->Speed = 0;
+    motor->Position = 0;
+    motor->Count = 0;
+    *lastCount = 0;
+}
+
+int main(int argc, char **argv)
+{
+    VelocityPidState pid;
+    Motor motor;
+    long lastCount;
+
+    // from rest to a setpoint in reach.
+    Start(&pid, &motor, &lastCount);
+    StepResult step = Run(&pid, &motor, &lastCount, CHECK_SETPOINT, 2.0f, true);
+    printf("step:     settled in %.3fs, mean %.1f counts/s\n", step.SettleS, step.SteadyMean);
+    CheckReport((step.SettleS >= 0) && (step.SettleS <= CHECK_SETTLE_S), "step: settles within the band in time");
+    CheckReport(fabsf(step.SteadyMean - CHECK_SETPOINT) <= (CHECK_STEADY_BAND * CHECK_SETPOINT), "step: steady state error within the band");
+
+    // out of reach, then back: with Limit, and without it.
+    const char *names[2] = {"windup", "no limit"};
+    float recoverS[2];
+    float settleS[2];
+    float integralOut[2];
+    for (int run = 0; run < 2; run++)
+    {
+        bool useLimit = (run == 0);
+        Start(&pid, &motor, &lastCount);
+        StepResult saturated = Run(&pid, &motor, &lastCount, CHECK_OUT_OF_REACH, 2.0f, useLimit);
+        StepResult back = Run(&pid, &motor, &lastCount, CHECK_SETPOINT, 2.0f, useLimit);
+        recoverS[run] = back.RecoverS;
+        settleS[run] = back.SettleS;
+        integralOut[run] = saturated.MaxIntegralOut;
+        printf("%-9s integral out %.0f Hz while clamped, left the clamp in %.3fs, settled in %.3fs\n",
+               names[run], integralOut[run], recoverS[run], settleS[run]);
+    }
+    // the integral needs at most the clamp plus what Kp would take off the setpoint error.
+    float needed = CHECK_MAX_OUTPUT + (CHECK_KP * CHECK_OUT_OF_REACH);
+    CheckReport(integralOut[0] <= needed, "%s: integral bounded while clamped", names[0]);
+    CheckReport((recoverS[0] >= 0) && (recoverS[0] <= CHECK_RECOVER_S), "%s: leaves the clamp promptly", names[0]);
+    CheckReport((settleS[0] >= 0) && (settleS[0] <= CHECK_SETTLE_S), "%s: settles within the band in time", names[0]);
+    CheckReport((integralOut[1] > needed) && ((recoverS[1] < 0) || (recoverS[1] > CHECK_RECOVER_S)), "%s: without Limit, the check sees windup", names[1]);
+
+    return (CheckSummary());
+}
@@ -0,0 +1,261 @@
+// ---------------------------------------------------------------------------
+// TeensyBot Waveform Check - v0.0.1 - 07/12/2020
+//
+// AUTHOR/LICENSE:
+// Created by Imran Peerbhai -- ipeerbhai@aol.com
+// Copyright 2020 License:
+// Forks and derivitive works are NOT permitted without
+// permission. Permission is only granted to use as-is for private and
+// non-commercial use by natural persons or non-profit entities.
+// For-profit entities require a license.
+//
+// CONTRIBUTIONS:
+// If you wish to contribute, make changes, or enhancements,
+// please create a pull request.
+//
+// DISCLAIMER:
+// This software is furnished "as is", without technical support, and with no
+// warranty, express or implied, as to its usefulness for any purpose.
+// ---------------------------------------------------------------------------
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+// Theory of Operation:
+
+//  Runs the firmware's WaveformGenerator (PlatformIO/src/WaveformGenerator.h)
+//  on this machine, the way WaveSystem does on the Teensy: block after block
+//  of toggle words for a few steppers sharing two ports.  It plays the words
+//  back as pin levels, like the GPIO would, and checks every edge:
+
+//    interval steppers step every Interval slots, high for Duty of them;
+//    a phase stepper makes exactly the steps its accumulator carries, 2 high;
+//    no step starts within WAVE_DIR_SETUP_SLOTS of a dir edge;
+//    while unsafe, no step starts and every step pin is low from the first slot;
+//    the Steps each block reports are the rising edges it holds.
+
+//  It then times Fill, per block and per edge.  Exit status is 0 if every
+//  check passed.
+
+//  Build:
+//    g++ -std=c++11 -O2 -I../PlatformIO/src -o WaveformCheck WaveformCheck.cpp ../PlatformIO/src/WaveformGenerator.cpp
+//  Run:
+//    ./WaveformCheck 2000
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <vector>
+#include <chrono>
+#include "WaveformGenerator.h"
+#include "CheckReport.h"
+
+#define CHECK_SLOTS 512        // slots per block, as WAVE_HALF_SLOTS.
+#define CHECK_PORTS 2
+#define CHECK_CHANNELS 4
+#define CHECK_DIR_EVERY 4000   // slots between direction changes on the stepper with a dir pin.
+#define CHECK_UNSAFE_FROM 300  // blocks [from, to) are filled unsafe.
+#define CHECK_UNSAFE_TO 310
+
+struct PinHistory
+{
+    std::vector<uint64_t> Rises;
+    std::vector<uint64_t> Falls;
+    std::vector<uint64_t> DirEdges;
+    uint64_t ReportedSteps = 0;
+    uint64_t UnsafeRises = 0;
+    uint64_t PhaseCarries = 0; // what a slot-by-slot accumulator would have stepped.
+};
+
+static void SetUp(WaveChannel *channels)
+{
+    // 0: half-duty, long enough that most pulses span two blocks.
+    channels[0].StepPort = 0;
+    channels[0].StepMask = 1UL << 3;
+    channels[0].DirPort = WAVE_NO_PORT;
+    channels[0].Mode = WAVE_MODE_INTERVAL;
+    channels[0].Interval = 500;
+    channels[0].Duty = 250;
+    // 1: fast, with a dir pin on the other port that flips now and then.
+    channels[1].StepPort = 0;
+    channels[1].StepMask = 1UL << 5;
+    channels[1].DirPort = 1;
+    channels[1].DirMask = 1UL << 2;
+    channels[1].Mode = WAVE_MODE_INTERVAL;
+    channels[1].Interval = 7;
+    channels[1].Duty = 3;
+    // 2: phase mode at 33333.333Hz.
+    channels[2].StepPort = 1;
+    channels[2].StepMask = 1UL << 10;
+    channels[2].DirPort = WAVE_NO_PORT;
+    channels[2].Mode = WAVE_MODE_PHASE;
+    channels[2].PhaseIncrement = (uint32_t)((33333.333 * 4294967296.0) / 1000000.0);
+    // 3: duty as long as the interval, which must still leave a gap.
+    channels[3].StepPort = 1;
+    channels[3].StepMask = 1UL << 11;
+    channels[3].DirPort = WAVE_NO_PORT;
+    channels[3].Mode = WAVE_MODE_INTERVAL;
+    channels[3].Interval = 1000;
+    channels[3].Duty = 1000;
+    for (int idx = 0; idx < CHECK_CHANNELS; idx++)
+    {
+        channels[idx].DirLevel = 0;
+        WaveformGenerator::StartChannel(&channels[idx], false, 0);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int blocks = (argc > 1) ? atoi(argv[1]) : 2000;
+    if (blocks <= CHECK_UNSAFE_TO)
+    {
+        blocks = CHECK_UNSAFE_TO + 10;
+    }
+
+    WaveformGenerator generator;
+    WaveChannel channels[CHECK_CHANNELS];
+    PinHistory history[CHECK_CHANNELS];
+    std::vector<uint32_t> words(CHECK_SLOTS * CHECK_PORTS);
+    uint32_t levels[CHECK_PORTS] = {0, 0};
+    uint64_t phaseAccumulator = 0;
+    bool highWhileUnsafe = false;
+    SetUp(channels);
+
+    for (int block = 0; block < blocks; block++)
+    {
+        uint64_t start = (uint64_t)block * CHECK_SLOTS;
+        bool isSafe = (block < CHECK_UNSAFE_FROM) || (block >= CHECK_UNSAFE_TO);
+        channels[1].DirLevel = (uint8_t)((start / CHECK_DIR_EVERY) & 1);
+        generator.Fill(words.data(), CHECK_SLOTS, CHECK_PORTS, channels, CHECK_CHANNELS, isSafe);
+
+        for (uint32_t slot = 0; slot < CHECK_SLOTS; slot++)
+        {
+            uint64_t now = start + slot;
+            for (int port = 0; port < CHECK_PORTS; port++)
+            {
+                uint32_t word = words[slot * CHECK_PORTS + port];
+                levels[port] ^= word;
+                for (int idx = 0; (word != 0) && (idx < CHECK_CHANNELS); idx++)
+                {
+                    if ((channels[idx].StepPort == port) && (word & channels[idx].StepMask))
+                    {
+                        bool isHigh = (levels[port] & channels[idx].StepMask) != 0;
+                        (isHigh ? history[idx].Rises : history[idx].Falls).push_back(now);
+                        if (isHigh && !isSafe)
+                        {
+                            history[idx].UnsafeRises++;
+                        }
+                    }
+                    if ((channels[idx].DirPort == port) && (word & channels[idx].DirMask))
+                    {
+                        history[idx].DirEdges.push_back(now);
+                    }
+                }
+            }
+            if (!isSafe)
+            {
+                for (int idx = 0; idx < CHECK_CHANNELS; idx++)
+                {
+                    highWhileUnsafe |= (levels[channels[idx].StepPort] & channels[idx].StepMask) != 0;
+                }
+            }
+            if (isSafe)
+            {
+                phaseAccumulator += channels[2].PhaseIncrement;
+                history[2].PhaseCarries += phaseAccumulator >> 32;
+                phaseAccumulator &= 0xFFFFFFFFULL;
+            }
+        }
+        for (int idx = 0; idx < CHECK_CHANNELS; idx++)
+        {
+            history[idx].ReportedSteps += channels[idx].Steps;
+        }
+        if (block == CHECK_UNSAFE_TO - 1)
+        {
+            phaseAccumulator = channels[2].Phase; // the generator kept time while unsafe; so do we.
+        }
+    }
+
+    printf("%d blocks of %d slots, %llu slots in all\n", blocks, CHECK_SLOTS, (unsigned long long)blocks * CHECK_SLOTS);
+    uint64_t unsafeStart = (uint64_t)CHECK_UNSAFE_FROM * CHECK_SLOTS;
+    uint64_t unsafeEnd = (uint64_t)CHECK_UNSAFE_TO * CHECK_SLOTS;
+    for (int idx = 0; idx < CHECK_CHANNELS; idx++)
+    {
+        PinHistory &pin = history[idx];
+        WaveChannel &channel = channels[idx];
+        uint32_t duty = (channel.Mode == WAVE_MODE_PHASE) ? WAVE_PHASE_PULSE_SLOTS : ((channel.Duty < channel.Interval) ? channel.Duty : channel.Interval - 1);
+
+        bool widthsOk = !pin.Rises.empty();
+        for (size_t edge = 0; edge < pin.Rises.size(); edge++)
+        {
+            if (edge >= pin.Falls.size())
+            {
+                widthsOk &= (edge + 1 == pin.Rises.size()); // only the last pulse may still be high.
+                continue;
+            }
+            bool cutShort = (pin.Rises[edge] < unsafeStart) && (pin.Falls[edge] == unsafeStart);
+            widthsOk &= cutShort || (pin.Falls[edge] - pin.Rises[edge] == duty);
+        }
+        CheckReport(widthsOk, "channel %d: every pulse is Duty wide, or cut short going unsafe", idx);
+
+        if (channel.Mode == WAVE_MODE_INTERVAL)
+        {
+            bool spacingOk = true;
+            for (size_t edge = 1; edge < pin.Rises.size(); edge++)
+            {
+                uint64_t gap = pin.Rises[edge] - pin.Rises[edge - 1];
+                bool heldBack = !pin.DirEdges.empty() && (gap > channel.Interval) && (gap <= channel.Interval + WAVE_DIR_SETUP_SLOTS);
+                bool resumed = (pin.Rises[edge - 1] < unsafeStart) && (pin.Rises[edge] >= unsafeEnd);
+                spacingOk &= (gap == channel.Interval) || heldBack || resumed;
+            }
+            CheckReport(spacingOk, "channel %d: steps are Interval apart", idx);
+        }
+        else
+        {
+            bool countOk = (pin.Rises.size() == pin.PhaseCarries);
+            CheckReport(countOk, "channel %d: one step per phase carry", idx);
+            if (!countOk)
+            {
+                printf("      %zu steps, %llu carries\n", pin.Rises.size(), (unsigned long long)pin.PhaseCarries);
+            }
+        }
+
+        bool setupOk = true;
+        size_t dirEdge = 0;
+        for (size_t edge = 0; edge < pin.Rises.size(); edge++)
+        {
+            while ((dirEdge + 1 < pin.DirEdges.size()) && (pin.DirEdges[dirEdge + 1] <= pin.Rises[edge]))
+            {
+                dirEdge++;
+            }
+            if ((dirEdge < pin.DirEdges.size()) && (pin.DirEdges[dirEdge] <= pin.Rises[edge]))
+            {
+                setupOk &= (pin.Rises[edge] - pin.DirEdges[dirEdge]) >= WAVE_DIR_SETUP_SLOTS;
+            }
+        }
+        CheckReport(setupOk, "channel %d: no step within the dir setup time", idx);
+        CheckReport(pin.UnsafeRises == 0, "channel %d: no step while unsafe", idx);
+        CheckReport(pin.ReportedSteps == pin.Rises.size(), "channel %d: reported steps match the rising edges", idx);
+    }
+    CheckReport(!highWhileUnsafe, "every step pin low while unsafe");
+
+    // time Fill alone, on the same channels.
+    const int timedBlocks = 20000;
+    uint64_t edges = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for (int block = 0; block < timedBlocks; block++)
+    {
+        generator.Fill(words.data(), CHECK_SLOTS, CHECK_PORTS, channels, CHECK_CHANNELS, true);
+        for (int idx = 0; idx < CHECK_CHANNELS; idx++)
+        {
+            edges += 2 * channels[idx].Steps;
+        }
+    }
+    double totalNS = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count();
+    printf("Fill: %.0fns per block, %.1f edges per block, %.1fns per edge (this machine, not the Teensy)\n",
+           totalNS / timedBlocks, (double)edges / timedBlocks, (edges > 0) ? totalNS / edges : 0.0);
+
+    return (CheckSummary());
+}
@@ -0,0 +1,228 @@
+#include "BatchSystem.h"
+
+//-----------------------------------------------------------------------------------------
+// Constructor:
+//  Default constructor does nothing.
+BatchManager::BatchManager()
+{
+}
+
+//-----------------------------------------------------------------------------------------
+// Constructor:
+//  Store references to the motors a batch drives and the clock it stamps with.
+BatchManager::BatchManager(MotorControl *motorSystem, ClockManager *clock)
+{
+    Init(motorSystem, clock);
+}
+
+//-----------------------------------------------------------------------------------------
+// Init
+void BatchManager::Init(MotorControl *motorSystem, ClockManager *clock)
+{
+    m_motorControl = motorSystem;
+    m_clock = clock;
+}
+
+//-----------------------------------------------------------------------------------------
+// Function:
+//  Run parses every ';' separated item of a frame, and applies them all on one tick if every
+//  one is good.  Returns the reply, with each item's status in order.
+String BatchManager::Run(const char *frame)
+{
+    String Text = String("");
+    if (*frame == '\0')
+    {
+        Text += String("{'Error' : 'Empty batch'}");
+        return (Text);
+    }
+
+    const char *errors[BATCH_MAX_ITEMS];
+    int count = 0;
+    boolean isGood = true;
+    const char *cursor = frame;
+    while (true)
+    {
+        const char *end = strchr(cursor, ';');
+        int length = (end == NULL) ? (int)strlen(cursor) : (int)(end - cursor);
+        if (count >= BATCH_MAX_ITEMS)
+        {
+            Text += String("{'Error' : 'Batch too long'}");
+            return (Text);
+        }
+        errors[count] = ParseItem(cursor, length, m_items[count]);
+        isGood = isGood && (errors[count] == NULL);
+        count++;
+        if (end == NULL)
+        {
+            break;
+        }
+        cursor = end + 1;
+    }
+
+    uint32_t tick = 0;
+    if (isGood)
+    {
+        m_motorControl->BeginBatch();
+        for (int i = 0; i < count; i++)
+        {
+            Apply(m_items[i]);
+        }
+        tick = m_motorControl->CommitBatch();
+    }
+
+    Text += String("{'Batch' : {'Applied':");
+    Text += String(isGood ? 1 : 0);
+    Text += String(",'Items':[");
+    for (int i = 0; i < count; i++)
+    {
+        if (i > 0)
+        {
+            Text += String(",");
+        }
+        Text += String("'");
+        Text += String((errors[i] == NULL) ? "OK" : errors[i]);
+        Text += String("'");
+    }
+    Text += String("]");
+    if (isGood)
+    {
+        Text += String(",");
+        Text += m_clock->StampTick(tick);
+    }
+    Text += String("}}");
+    return (Text);
+}
+
+//-----------------------------------------------------------------------------------------
+// Function:
+//  ParseItem reads "<op>[,<motor>,<value>...]" from the length characters at text, and checks
+//  it against the motors as configured now.  Returns NULL if it's good, or what was wrong.
+const char *BatchManager::ParseItem(const char *text, int length, BatchItem &item)
+{
+    const char *cursor = text;
+    const char *last = text + length;
+    char *end;
+    if (length < 1)
+    {
+        return ("Empty item");
+    }
+    uint8_t op = (uint8_t)*cursor++;
+
+    // every op takes a fixed number of values, the motor first.
+    int wanted;
+    switch (op)
+    {
+    case BATCH_OP_STOP:
+        wanted = 0;
+        break;
+    case BATCH_OP_INTERVAL:
+    case BATCH_OP_FREQUENCY:
+    case BATCH_OP_SERVO:
+    case BATCH_OP_ENABLE:
+        wanted = 2;
+        break;
+    case BATCH_OP_MOVE:
+        wanted = 4;
+        break;
+    default:
+        return ("Bad op");
+    }
+    long values[4] = {0, 0, 0, 0};
+    for (int i = 0; i < wanted; i++)
+    {
+        if ((cursor >= last) || (*cursor++ != ','))
+        {
+            return ("Bad item");
+        }
+        values[i] = strtol(cursor, &end, 10);
+        if ((end == cursor) || (end > last))
+        {
+            return ("Bad item");
+        }
+        cursor = end;
+    }
+    if (cursor != last)
+    {
+        return ("Bad item");
+    }
+
+    item.Op = op;
+    item.Motor = 0;
+    item.A = values[1];
+    item.B = values[2];
+    item.C = values[3];
+    if (op == BATCH_OP_STOP)
+    {
+        return (NULL);
+    }
+    if ((values[0] < 0) || (values[0] >= m_motorControl->GetMotorCount()))
+    {
+        return ("Bad motor");
+    }
+    item.Motor = (uint8_t)values[0];
+    if ((op != BATCH_OP_ENABLE) && m_motorControl->IsLoopOwned(item.Motor))
+    {
+        return ("Loop owns motor");
+    }
+    switch (op)
+    {
+    case BATCH_OP_INTERVAL:
+    case BATCH_OP_FREQUENCY:
+        if (!m_motorControl->IsStepper(item.Motor))
+        {
+            return ("Not a stepper");
+        }
+        if (((op == BATCH_OP_INTERVAL) && ((values[1] < -MOTOR_MAX_STEP_INTERVAL) || (values[1] > MOTOR_MAX_STEP_INTERVAL))) ||
+            ((op == BATCH_OP_FREQUENCY) && ((values[1] < -MOTOR_MAX_STEP_MILLIHERTZ) || (values[1] > MOTOR_MAX_STEP_MILLIHERTZ))))
+        {
+            return ("Bad step value");
+        }
+        break;
+    case BATCH_OP_SERVO:
+    case BATCH_OP_MOVE:
+        if (m_motorControl->IsStepper(item.Motor))
+        {
+            return ("Not a servo");
+        }
+        if ((values[1] < 0) || (values[2] < 0) || (values[3] < 0))
+        {
+            return ("Bad servo value");
+        }
+        break;
+    case BATCH_OP_ENABLE:
+        if ((values[1] != 0) && (values[1] != 1))
+        {
+            return ("Bad enable level");
+        }
+        break;
+    }
+    return (NULL);
+}
+
+//-----------------------------------------------------------------------------------------
+// Procedure:
+//  Apply stages one checked item.  Nothing reaches the ISR until CommitBatch.
+void BatchManager::Apply(const BatchItem &item)
+{
+    switch (item.Op)
+    {
+    case BATCH_OP_INTERVAL:
+        m_motorControl->StageStepInterval(item.Motor, item.A);
+        break;
+    case BATCH_OP_FREQUENCY:
+        m_motorControl->StageStepMilliHertz(item.Motor, item.A);
+        break;
+    case BATCH_OP_SERVO:
+        m_motorControl->StageServoDuty(item.Motor, item.A);
+        break;
+    case BATCH_OP_MOVE:
+        m_motorControl->StageServoMove(item.Motor, item.A, item.B, item.C);
+        break;
+    case BATCH_OP_ENABLE:
+        m_motorControl->StageMotorState(item.Motor, item.A ? HIGH : LOW);
+        break;
+    case BATCH_OP_STOP:
+        m_motorControl->StageStop();
+        break;
+    }
+}
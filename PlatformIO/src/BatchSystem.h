@@ -0,0 +1,100 @@
+// ---------------------------------------------------------------------------
+// Motion Batch Library - v0.0.1 - 07/12/2020
+//
+// AUTHOR/LICENSE:
+// Created by Imran Peerbhai -- ipeerbhai@aol.com
+// Copyright 2020 License:
+// Forks and derivitive works are NOT permitted without
+// permission. Permission is only granted to use as-is for private and
+// non-commercial use by natural persons or non-profit entities.
+// For-profit entities require a license.
+//
+// CONTRIBUTIONS:
+// If you wish to contribute, make changes, or enhancements,
+// please create a pull request.
+//
+// DISCLAIMER:
+// This software is furnished "as is", without technical support, and with no
+// warranty, express or implied, as to its usefulness for any purpose.
+// ---------------------------------------------------------------------------
+
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+// Theory of Operation:
+
+//  Coordinated moves -- both wheels changing speed, a servo swinging as the
+//  base turns -- take one "m"/"f"/"v" frame per motor, and each lands on
+//  whatever tick its frame is parsed on.  A batch frame carries them all:
+//    "XI,0,+500;I,1,-500;V,2,1500;E,0,1~"
+//  Items are separated by ';' and use the program step forms (ProgramSystem.h):
+//    "I,<motor>,<signed interval>"        -- like "m", sign is direction.
+//    "F,<motor>,<signed millihertz>"      -- like "f".
+//    "V,<motor>,<duty>"                   -- like "v".
+//    "M,<motor>,<duty>,<rate>,<accel>"    -- like "vS".
+//    "E,<motor>,<0|1>"                    -- enable line low or high.
+//    "S"                                  -- stop every motor.
+
+//  Every item is parsed and checked before any is applied.  If one is bad,
+//  none are.  Timings for a motor a velocity loop owns are bad items.  Otherwise they are staged in order (see MotorControl.h; a later
+//  item for the same motor wins) and committed together: dir and enable pins,
+//  timings and servo moves all take effect on one tick.  Unlike "m", a motor
+//  doesn't finish its current period first -- a pulse in progress is cut off
+//  and the new period starts at the commit.  Steppers on the DMA waveform
+//  engine pick up the batch at its next refill.
+
+//  The reply is one object with a status per item, in order, and the tick the
+//  batch was applied on:
+//    {'Batch' : {'Applied':1,'Items':['OK','OK','OK','OK'],'HostUS':n}}
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+
+#include <Arduino.h>
+#include <stdint.h>
+#include "MotorControl.h"
+#include "ClockSystem.h"
+
+#ifndef BATCH_ONCE
+#define BATCH_ONCE
+
+#define BATCH_MAX_ITEMS 16       // items per frame.
+
+enum BatchOps
+{
+  BATCH_OP_INTERVAL = 'I',
+  BATCH_OP_FREQUENCY = 'F',
+  BATCH_OP_SERVO = 'V',
+  BATCH_OP_MOVE = 'M',
+  BATCH_OP_ENABLE = 'E',
+  BATCH_OP_STOP = 'S'
+};
+
+// One parsed item.  A, B and C are the values after the motor, as the op takes them.
+struct BatchItem
+{
+  uint8_t Op;      // a BatchOps value.
+  uint8_t Motor;
+  int32_t A;
+  int32_t B;
+  int32_t C;
+};
+
+class BatchManager
+{
+public:
+    BatchManager();
+    BatchManager(MotorControl *motorSystem, ClockManager *clock);
+    void Init(MotorControl *motorSystem, ClockManager *clock);
+    String Run(const char *frame); // parse, check and apply a batch.  Returns the JSON reply.
+
+private:
+    const char *ParseItem(const char *text, int length, BatchItem &item); // NULL if the item is good.
+    void Apply(const BatchItem &item);
+
+    BatchItem m_items[BATCH_MAX_ITEMS];
+    MotorControl *m_motorControl;
+    ClockManager *m_clock;
+};
+
+#endif
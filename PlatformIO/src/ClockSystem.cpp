@@ -0,0 +1,224 @@
+#include "ClockSystem.h"
+
+//-----------------------------------------------------------------------------------------
+// Function:
+//  ParseInt64 reads a signed decimal number and moves text past it.
+static int64_t ParseInt64(const char *&text)
+{
+    boolean isNegative = false;
+    if (*text == '-')
+    {
+        isNegative = true;
+        text++;
+    }
+    int64_t value = 0;
+    while ((*text >= '0') && (*text <= '9'))
+    {
+        value = (value * 10) + (*text - '0');
+        text++;
+    }
+    return (isNegative ? -value : value);
+}
+
+//-----------------------------------------------------------------------------------------
+// Constructor:
+//  Default constructor does nothing.
+ClockManager::ClockManager()
+{
+}
+
+//-----------------------------------------------------------------------------------------
+// Constructor:
+//  Store a reference to the tick counter and start unsynced.
+ClockManager::ClockManager(volatile uint32_t *tickCounter)
+{
+    Init(tickCounter);
+}
+
+//-----------------------------------------------------------------------------------------
+// Init forgets any sync and restarts the 64-bit clock from micros().
+void ClockManager::Init(volatile uint32_t *tickCounter)
+{
+    m_tickCounter = tickCounter;
+    m_lastMicros = micros();
+    m_microsHigh = 0;
+    m_lastTick = *m_tickCounter;
+    m_lastTickUS = m_lastMicros;
+    m_hasPending = false;
+    m_sampleCount = 0;
+    m_sampleNext = 0;
+    m_isSynced = false;
+    m_offsetUS = 0;
+    m_bestDelayUS = 0;
+    m_referenceUS = 0;
+    m_drift = 0.0;
+    m_hasDriftAnchor = false;
+    m_anchorOffsetUS = 0;
+    m_anchorUS = 0;
+    m_exchanges = 0;
+}
+
+//-----------------------------------------------------------------------------------------
+// NowUS extends micros() to 64 bits.  Call from loop(), not the ISR.
+uint64_t ClockManager::NowUS()
+{
+    uint32_t now = micros();
+    if (now < m_lastMicros)
+    {
+        m_microsHigh++; // wrapped since we last looked.
+    }
+    m_lastMicros = now;
+    return (((uint64_t)m_microsHigh << 32) | now);
+}
+
+//-----------------------------------------------------------------------------------------
+// Dispatch keeps the clock extended and pairs the current tick with our clock.
+void ClockManager::Dispatch()
+{
+    noInterrupts();
+    uint32_t tick = *m_tickCounter;
+    uint64_t now = NowUS();
+    interrupts();
+    m_lastTick = tick;
+    m_lastTickUS = now;
+}
+
+//-----------------------------------------------------------------------------------------
+// TickToLocalUS works back from the last pairing.  Ticks are 1uS apart.
+uint64_t ClockManager::TickToLocalUS(uint32_t tick)
+{
+    return (m_lastTickUS - (int32_t)(m_lastTick - tick));
+}
+
+//-----------------------------------------------------------------------------------------
+// LocalToHostUS removes the offset, extrapolated by the drift since the reference sample.
+int64_t ClockManager::LocalToHostUS(uint64_t localUS)
+{
+    double elapsed = (double)(int64_t)(localUS - m_referenceUS);
+    int64_t offset = m_offsetUS + (int64_t)(m_drift * elapsed);
+    return ((int64_t)localUS - offset);
+}
+
+boolean ClockManager::IsSynced()
+{
+    return (m_isSynced);
+}
+
+//-----------------------------------------------------------------------------------------
+// ReadSync handles "t<T1>,<T4>": completes the last exchange with T4, starts a new one with T1.
+String ClockManager::ReadSync(const char *command)
+{
+    uint64_t t2 = NowUS();
+    const char *position = command;
+    int64_t t1 = ParseInt64(position);
+    int64_t t4 = 0;
+    if (*position == ',')
+    {
+        position++;
+        t4 = ParseInt64(position);
+    }
+
+    // the host's T4 is for the reply we sent last time.
+    if (m_hasPending && (t4 > m_pendingT1))
+    {
+        int64_t offset = (((int64_t)m_pendingT2 - m_pendingT1) + ((int64_t)m_pendingT3 - t4)) / 2;
+        int64_t delay = (t4 - m_pendingT1) - (int64_t)(m_pendingT3 - m_pendingT2);
+        AddSample(offset, delay, m_pendingT2);
+    }
+
+    uint64_t t3 = NowUS();
+    m_pendingT1 = t1;
+    m_pendingT2 = t2;
+    m_pendingT3 = t3;
+    m_hasPending = true;
+
+    String Text = String("");
+    Text += String("{'Sync': {'T2':");
+    Text += Int64Text((int64_t)t2);
+    Text += String(",'T3':");
+    Text += Int64Text((int64_t)t3);
+    Text += String(",'Synced':");
+    Text += String(m_isSynced ? 1 : 0);
+    Text += String(",'OffsetUS':");
+    Text += Int64Text(m_offsetUS);
+    Text += String(",'DelayUS':");
+    Text += Int64Text(m_bestDelayUS);
+    Text += String(",'DriftPPB':");
+    Text += Int64Text((int64_t)(m_drift * 1000000000.0));
+    Text += String(",'Exchanges':");
+    Text += String(m_exchanges);
+    Text += String("}}");
+    return (Text);
+}
+
+//-----------------------------------------------------------------------------------------
+// AddSample runs the clock filter: keep the newest few, trust the one with the least delay.
+void ClockManager::AddSample(int64_t offsetUS, int64_t delayUS, uint64_t localUS)
+{
+    if (delayUS < 0)
+    {
+        return; // can't happen with sane clocks, so don't trust it.
+    }
+    m_exchanges++;
+    m_sampleOffset[m_sampleNext] = offsetUS;
+    m_sampleDelay[m_sampleNext] = delayUS;
+    m_sampleLocal[m_sampleNext] = localUS;
+    m_sampleNext = (m_sampleNext + 1) % CLOCK_FILTER_SIZE;
+    if (m_sampleCount < CLOCK_FILTER_SIZE)
+    {
+        m_sampleCount++;
+    }
+
+    int best = 0;
+    for (int i = 1; i < m_sampleCount; i++)
+    {
+        if (m_sampleDelay[i] < m_sampleDelay[best])
+        {
+            best = i;
+        }
+    }
+    m_offsetUS = m_sampleOffset[best];
+    m_bestDelayUS = m_sampleDelay[best];
+    m_referenceUS = m_sampleLocal[best];
+    m_isSynced = true;
+
+    // drift is the change in the best offset over a long enough span.
+    if (!m_hasDriftAnchor)
+    {
+        m_hasDriftAnchor = true;
+        m_anchorOffsetUS = m_offsetUS;
+        m_anchorUS = m_referenceUS;
+        return;
+    }
+    int64_t span = (int64_t)(m_referenceUS - m_anchorUS);
+    if (span >= CLOCK_MIN_DRIFT_SPAN_US)
+    {
+        double measured = (double)(m_offsetUS - m_anchorOffsetUS) / (double)span;
+        m_drift += (measured - m_drift) / CLOCK_DRIFT_SMOOTHING;
+        m_anchorOffsetUS = m_offsetUS;
+        m_anchorUS = m_referenceUS;
+    }
+}
+
+//-----------------------------------------------------------------------------------------
+// Stamp returns the JSON member telemetry replies use for their timestamp.
+String ClockManager::Stamp(uint64_t localUS)
+{
+    String Text = String("");
+    if (m_isSynced)
+    {
+        Text += String("'HostUS':");
+        Text += Int64Text(LocalToHostUS(localUS));
+    }
+    else
+    {
+        Text += String("'LocalUS':");
+        Text += Int64Text((int64_t)localUS);
+    }
+    return (Text);
+}
+
+String ClockManager::StampTick(uint32_t tick)
+{
+    return (Stamp(TickToLocalUS(tick)));
+}
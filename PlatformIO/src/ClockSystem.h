@@ -0,0 +1,110 @@
+// ---------------------------------------------------------------------------
+// Clock Sync Library - v0.0.1 - 07/12/2020
+//
+// AUTHOR/LICENSE:
+// Created by Imran Peerbhai -- ipeerbhai@aol.com
+// Copyright 2020 License:
+// Forks and derivitive works are NOT permitted without
+// permission. Permission is only granted to use as-is for private and
+// non-commercial use by natural persons or non-profit entities.
+// For-profit entities require a license.
+//
+// CONTRIBUTIONS:
+// If you wish to contribute, make changes, or enhancements,
+// please create a pull request.
+//
+// DISCLAIMER:
+// This software is furnished "as is", without technical support, and with no
+// warranty, express or implied, as to its usefulness for any purpose.
+// ---------------------------------------------------------------------------
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+// Theory of Operation:
+
+//  The main computer fuses our sensor readings with its own, so it needs to know
+//  when, in its own time, each reading was taken.  USB adds a variable delay, so
+//  the time a reply arrives isn't good enough.
+
+//  We keep our own 64-bit microsecond clock (micros() extended past its 71 minute
+//  wrap) and learn how it relates to the host's clock the way NTP does.  The host
+//  sends "t<T1>,<T4>~": T1 is its clock when it sent this ping, T4 is its clock
+//  when the previous ping's reply arrived.  We note our clock when the ping
+//  arrives (T2) and when we reply (T3), and send both back.  The next ping's T4
+//  completes the previous exchange, giving:
+//    offset = ((T2 - T1) + (T3 - T4)) / 2   -- our clock minus the host's.
+//    delay  = (T4 - T1) - (T3 - T2)         -- round trip spent on the wire.
+
+//  A sample with a long delay probably sat in a queue one way, so its offset is
+//  off by up to half the extra delay.  Like NTP's clock filter we keep the last
+//  few samples and trust the one with the shortest delay.  When the best sample
+//  is far enough from the last one we used, the change in offset over that span
+//  is the crystal drift, which we smooth and use to extrapolate between syncs.
+
+//  Telemetry replies then carry 'HostUS', the host time the data was taken.
+//  Until the first exchange completes, they carry 'LocalUS' instead.
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+
+#include <Arduino.h>
+#include <stdint.h>
+#include "EasyString.h"
+
+#ifndef CLOCK_ONCE
+#define CLOCK_ONCE
+
+#define CLOCK_FILTER_SIZE 8             // sync samples kept; the one with the least delay wins.
+#define CLOCK_MIN_DRIFT_SPAN_US 5000000 // only measure drift across at least 5 seconds.
+#define CLOCK_DRIFT_SMOOTHING 4         // each drift measurement moves the estimate 1/4 of the way.
+
+class ClockManager
+{
+public:
+    ClockManager();
+    ClockManager(volatile uint32_t *tickCounter);
+    void Init(volatile uint32_t *tickCounter);
+    void Dispatch();                          // keep the 64-bit clock extended.  Call at least hourly.
+    uint64_t NowUS();                         // our clock in microseconds.
+    uint64_t TickToLocalUS(uint32_t tick);    // when a dispatch tick happened, on our clock.
+    int64_t LocalToHostUS(uint64_t localUS);  // our clock to the host's.
+    boolean IsSynced();
+    String ReadSync(const char *command);     // handle a "t" ping and return the reply.
+    String Stamp(uint64_t localUS);           // "'HostUS':n" once synced, "'LocalUS':n" before.
+    String StampTick(uint32_t tick);
+
+private:
+    void AddSample(int64_t offsetUS, int64_t delayUS, uint64_t localUS);
+
+    volatile uint32_t *m_tickCounter;
+    uint32_t m_lastMicros;        // micros() when we last extended the clock.
+    uint32_t m_microsHigh;        // how many times micros() has wrapped.
+    uint32_t m_lastTick;          // dispatch tick and our clock at the same moment,
+    uint64_t m_lastTickUS;        // so ticks convert without another micros() call.
+
+    // the exchange waiting for its T4.
+    boolean m_hasPending;
+    int64_t m_pendingT1;
+    uint64_t m_pendingT2;
+    uint64_t m_pendingT3;
+
+    // clock filter.
+    int64_t m_sampleOffset[CLOCK_FILTER_SIZE];
+    int64_t m_sampleDelay[CLOCK_FILTER_SIZE];
+    uint64_t m_sampleLocal[CLOCK_FILTER_SIZE];
+    uint8_t m_sampleCount;
+    uint8_t m_sampleNext;
+
+    // the current estimate: offset at a reference time, and drift from there.
+    boolean m_isSynced;
+    int64_t m_offsetUS;
+    int64_t m_bestDelayUS;
+    uint64_t m_referenceUS;
+    double m_drift;               // microseconds of offset change per microsecond.
+    boolean m_hasDriftAnchor;     // the sample we measure the next drift against.
+    int64_t m_anchorOffsetUS;
+    uint64_t m_anchorUS;
+    uint32_t m_exchanges;
+};
+
+#endif
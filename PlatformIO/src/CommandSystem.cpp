@@ -5,42 +5,84 @@ CommandManager::CommandManager()
 
 }
 
-CommandManager::CommandManager(MotorControl *motorSystem, volatile uint32_t *tickCounter, uint32_t *prevTickCounter, SensorManager *sensorSystem, SafetyManager *safetySystem)
+CommandManager::CommandManager(MotorControl *motorSystem, volatile uint32_t *tickCounter, uint32_t *prevTickCounter, SensorManager *sensorSystem, SafetyManager *safetySystem, OdometryManager *odometrySystem, EncoderManager *encoderSystem, ConfigManager *configSystem, OutputQueue *outputQueue, Transport *transport, ClockManager *clock, LatencyManager *latencySystem, TraceRecorder *trace, ReflexManager *reflexSystem, ProgramManager *programSystem, PowerManager *powerSystem, MemoryManager *memorySystem, WaveformManager *waveformSystem, BatchManager *batchSystem)
 {
-    Init(motorSystem, tickCounter, prevTickCounter, sensorSystem, safetySystem);
+    Init(motorSystem, tickCounter, prevTickCounter, sensorSystem, safetySystem, odometrySystem, encoderSystem, configSystem, outputQueue, transport, clock, latencySystem, trace, reflexSystem, programSystem, powerSystem, memorySystem, waveformSystem, batchSystem);
 }
 
-void CommandManager::Init(MotorControl *motorSystem, volatile uint32_t *tickCounter, uint32_t *prevTickCounter, SensorManager *sensorSystem, SafetyManager *safetySystem)
+void CommandManager::Init(MotorControl *motorSystem, volatile uint32_t *tickCounter, uint32_t *prevTickCounter, SensorManager *sensorSystem, SafetyManager *safetySystem, OdometryManager *odometrySystem, EncoderManager *encoderSystem, ConfigManager *configSystem, OutputQueue *outputQueue, Transport *transport, ClockManager *clock, LatencyManager *latencySystem, TraceRecorder *trace, ReflexManager *reflexSystem, ProgramManager *programSystem, PowerManager *powerSystem, MemoryManager *memorySystem, WaveformManager *waveformSystem, BatchManager *batchSystem)
 {
+    m_outputQueue = outputQueue;
+    m_transport = transport;
+    m_clock = clock;
+    m_latency = latencySystem;
+    m_trace = trace;
+    m_reflex = reflexSystem;
+    m_program = programSystem;
+    m_power = powerSystem;
+    m_memory = memorySystem;
+    m_waveform = waveformSystem;
+    m_batch = batchSystem;
+    m_motorControl = motorSystem;
+    m_sensorManager = sensorSystem;
     m_tickCounter = tickCounter;
     m_prevTickCounter = prevTickCounter;
     m_safetyManager = safetySystem;
+    m_odometryManager = odometrySystem;
+    m_encoderManager = encoderSystem;
+    m_configManager = configSystem;
+    m_frameLength = 0;
+    m_frameOverflow = false;
+    m_hasSequence = false;
+    m_sequence = 0;
 }
 
 //-----------------------------------------------------------------------------------------------------------------------------
 // Procedure:
 //  Read the command, execute the command, and send a response back.
 // Expected command strings:
+//  "a~" -- read stack high-water, static RAM, free heap and largest block, and heap traffic per subsystem.  "a0~" clears.  See MemorySystem.h.
 //  "b~" -- respond with battery analog reading (raw)
 //  "c9,9~" -- we will configure 9 motors and 9 sensors.
 //  "d0~" -- disable all steppers.
 //  "d1~" -- disable stepper 1
 //  "e0~" -- enable motor 0
+//  "g~" -- read the motion program state.  "gA0,I,0,+500~" appends a step to slot 0, "gR0~" runs it, "gS~" stops it.  See ProgramSystem.h.
+//  "h~" -- read the configuration hash.  If it matches, the stored configuration is already active.
+//  "l~" -- read the per-stage latency histograms, "l0~" clears them.  See LatencySystem.h.
+//  "f0,+001234.567~" -- run stepper 0 in phase-accumulator mode at 1234.567 Hz in the + direction.
 //  "m+[5],-[5]~" -- set stepper 0, stepper 1 intervals to x and y
 //  "o" -- override safety system checks.
+//  "p~" -- read the dead-reckoning pose and step counters.
+//  "q~" -- read encoder counts and velocity loop state.
+//  "qE0,02,03~" -- configure encoder 0 on pins 2 (A) and 3 (B).
+//  "qL0,1,F~" -- close loop 0 (encoder 0) around motor 1.  F drives step frequency, D drives duty interval.
+//  "qS0,+1500.0~" -- loop 0 setpoint in encoder counts per second.
+//  "qP0,1.500~", "qI0,0.200~", "qD0,0.000~" -- loop 0 gains.
+//  "qR1000~" -- run the velocity loops at 1000Hz.
+//  "qX0~" -- open loop 0 and stop its motor.
 //  "r" -- reset safety system and disable override.
 //  "s~" -- read ultrasonic sensor and tell me the last duration.
-//  "w~" -- let the watchdog know to reset.
+//  "t1600000000000000,1599999999990000~" -- clock sync ping: host time now, host time the last sync reply arrived (0 the first time).  See ClockSystem.h.
+//  "T~" -- dump the event trace.  "T0~" clears it, "TS0010~" also traces every 10th step pulse ("TS0~" stops).  See TraceSystem.h.
+//  "u~" -- read output queue statistics: messages queued and dropped, bytes sent, USB writes, back-pressure.
+//  "v0,1500~" -- set servo 0's duty interval.  "vS0,1500,200,50~" moves it there at up to 200 ticks/s, ramping at 50 ticks/s/s (0 for no ramp).
+//  "w~" -- let the watchdog know to reset.  "wS~" reads watchdog trips and how long stopping took.  See SafetySystem.h.
+//  "z~" -- read idle residency and wakeup cost.  "z0~" keeps the tick at full rate, "z1~" allows idling.  See PowerSystem.h.
+//  "B~" -- read the motor ISR's cycles per tick on each dispatch path.  "B0~" clears, "BG~" forces the generic path, "BA~" lets a matching robot profile be used.  See RobotProfile.h.
 //  "C~" -- configuration complete.
+//  "W~" -- read the DMA waveform engine's refills, misses and cycles.  "W1~" hands the steppers to it, "W0~" gives them back.  See WaveSystem.h.
+//  "XI,0,+500;I,1,-500;V,2,1500;E,0,1~" -- check every item, then apply them all on one tick.  See BatchSystem.h.
+//  "O0,1,032500,150000,3200~" -- odometry: left motor 0, right motor 1, 32.5mm wheel radius, 150mm track, 3200 steps/rev.
+//  "P0100~" -- stream the pose every 100ms, "P0~" stops streaming.
 //  "M0,01,02,03,00000,00000~" -- configure motor 0 with enable pin 1, dir pin 2, pulse pin 3.
 //  "M1,-1,-1,20000,00200~" -- configure motor 1 as a servo
 //  "S0,01,01,700000,500~" -- configure sensor 0 with trigger and echo pin 01, 700,000 uS max allowed ping distance ( infinity) and 300uS min allowed ping distance (almost touching)
+//  "K2,1;01,02,03,500,250;-1,-1,04,20000,1500;05,05,700000,500~" -- configure the whole robot in one frame, all-or-nothing.  See ConfigSystem.h.
+//  "R0,3,0,300,3,0~" -- reflex rule 0: sensors 0 and 1 under 300mm stop motors 0 and 1.  "R~" reads the rules, "RX~" clears them.  See ReflexSystem.h.
+//  "@42:w~" -- any command can be tagged with a sequence number.  See CommandSystem.h.
 void CommandManager::ProcessCommandBuffer()
 {
-    Serial.print("Processing Command buffer with command = ");
-    Serial.println(m_commandBuffer.Get());
-    Serial.flush();
-
     // let's make a bunch of string object we can use to parse.
     EasyString subs[SUBSTRINGS_LIMIT];
     m_safetyManager->ResetWatchDog();
@@ -48,21 +90,33 @@ void CommandManager::ProcessCommandBuffer()
     switch (m_commandBuffer.Get()[0])
     {
 
+    case 'a':
+        // memory use
+        if (m_frameBuffer[1] == '0')
+        {
+            m_memory->Clear();
+            Text += "Memory statistics cleared";
+        }
+        else
+        {
+            m_outputQueue->Println(m_memory->ReadStatistics());
+        }
+        break;
+
     case 'b':
         // read and send back the battery analog level
-        Text.Append(m_sensorManager->ReadBatteryLevel());
+        m_outputQueue->Println(m_sensorManager->ReadBatteryLevel());
         break;
 
-    //c1,0~ -- 1 motor, 0
+    //c1,0~ -- 1 motor, 0 sensors.  The new configuration is built off to the side until "C~".
     case 'c':
         // setup a bunch of motors and sensors.
         subs[0] = m_commandBuffer.substring(1, 2);
         subs[1] = m_commandBuffer.substring(3, 4);
 
-        Serial.println("Beginning motor and sensor struct initialization");
-        Serial.flush();
-        m_motorControl->Init(subs[0].toInt(), m_tickCounter, m_prevTickCounter, m_safetyManager);
-        m_sensorManager->Init(subs[1].toInt(), m_tickCounter, m_safetyManager);
+        m_outputQueue->Println("Beginning motor and sensor struct initialization");
+        m_configManager->StageCounts(subs[0].toInt(), subs[1].toInt());
+        m_trace->Record(TRACE_CONFIGURATION, 'c', 0);
         break;
 
     case 'd':
@@ -81,10 +135,90 @@ void CommandManager::ProcessCommandBuffer()
         Text += subs[0];
         break;
 
+    // f0,+001234.567~ -- step motor 0 at 1234.567Hz.
+    case 'f':
+        subs[0] += m_commandBuffer.substring(1, 2); // which motor index to use?
+        subs[1] += m_commandBuffer.substring(3);    // signed frequency in Hz, 3 to end
+        if (m_motorControl->IsLoopOwned(subs[0].toInt()))
+        {
+            m_outputQueue->Println("{'Error' : 'Motor owned by a velocity loop'}");
+            break;
+        }
+        m_motorControl->SetStepFrequency(subs[0].toInt(), subs[1].toString());
+        Text += "frequency set";
+        break;
+
+    case 'g':
+    {
+        // motion programs.  Steps are longer than an EasyString, parse them straight out of the frame.
+        const char *error = NULL;
+        switch (m_frameBuffer[1])
+        {
+        case '\0':
+            m_outputQueue->Println(m_program->ReadState());
+            break;
+        case 'A':
+            error = m_program->AppendStep(&m_frameBuffer[2]);
+            if (error == NULL)
+            {
+                Text += "Program step added";
+            }
+            break;
+        case 'X':
+            error = m_program->ClearSlot(atoi(&m_frameBuffer[2]));
+            if (error == NULL)
+            {
+                Text += "Program cleared";
+            }
+            break;
+        case 'R':
+            error = m_program->Run(atoi(&m_frameBuffer[2]));
+            break; // the program reports its own start.
+        case 'S':
+            m_program->Stop();
+            Text += "Program stopped";
+            break;
+        case 'L':
+            m_outputQueue->Println(m_program->ReadSlot(atoi(&m_frameBuffer[2])));
+            break;
+        default:
+            error = "Bad program command";
+            break;
+        }
+        if (error != NULL)
+        {
+            m_outputQueue->Print("{'Error' : '");
+            m_outputQueue->Print(error);
+            m_outputQueue->Println("'}");
+        }
+        break;
+    }
+
+    case 'h':
+        m_outputQueue->Println(m_configManager->ReadHash());
+        break;
+
+    case 'l':
+        if (m_commandBuffer.Get()[1] == '0')
+        {
+            m_latency->Clear();
+            Text += "Latency cleared";
+        }
+        else
+        {
+            m_outputQueue->Println(m_latency->ReadHistograms());
+        }
+        break;
+
     case 'm':
         // Change motor speeds
         subs[0] += m_commandBuffer.substring(1, 7);
         subs[1] += m_commandBuffer.substring(8, 14);
+        if (m_motorControl->IsLoopOwned(0) || m_motorControl->IsLoopOwned(1))
+        {
+            m_outputQueue->Println("{'Error' : 'Motor owned by a velocity loop'}");
+            break;
+        }
         m_motorControl->UpdateMotorTimings(0, subs[0].toString());
         m_motorControl->UpdateMotorTimings(1, subs[1].toString());
         Text += String("motor strings::");
@@ -98,101 +232,477 @@ void CommandManager::ProcessCommandBuffer()
         m_safetyManager->SetSafetyOverride(true);
         break;
 
+    case 'p':
+        m_outputQueue->Println(m_odometryManager->ReadPose());
+        break;
+
+    case 'q':
+        // encoders and closed velocity loops
+        subs[0] += m_commandBuffer.substring(2, 3); // which encoder / loop?
+        switch (m_commandBuffer.Get()[1])
+        {
+        case 'E':
+            subs[1] += m_commandBuffer.substring(4, 6); // A pin
+            subs[2] += m_commandBuffer.substring(7, 9); // B pin
+            m_encoderManager->ConfigureEncoder(subs[0].toInt(), subs[1].toInt(), subs[2].toInt());
+            Text += "Encoder Configured";
+            break;
+        case 'L':
+            subs[1] += m_commandBuffer.substring(4, 5); // motor
+            if (!m_encoderManager->ConfigureLoop(subs[0].toInt(), subs[1].toInt(), (m_commandBuffer.Get()[6] == 'D') ? VELOCITY_OUTPUT_DUTY : VELOCITY_OUTPUT_FREQUENCY))
+            {
+                m_outputQueue->Println("{'Error' : 'Loop not closed'}");
+                break;
+            }
+            Text += "Loop closed";
+            break;
+        case 'S':
+            subs[1] += m_commandBuffer.substring(4);
+            m_encoderManager->SetSetpoint(subs[0].toInt(), subs[1].toFloat());
+            Text += "Setpoint set";
+            break;
+        case 'P':
+        case 'I':
+        case 'D':
+            subs[1] += m_commandBuffer.substring(4);
+            m_encoderManager->SetGain(subs[0].toInt(), m_commandBuffer.Get()[1], subs[1].toFloat());
+            Text += "Gain set";
+            break;
+        case 'R':
+            subs[1] += m_commandBuffer.substring(2);
+            m_encoderManager->SetControlRate(subs[1].toInt());
+            Text += "Loop rate set";
+            break;
+        case 'X':
+            m_encoderManager->DisableLoop(subs[0].toInt());
+            Text += "Loop opened";
+            break;
+        default:
+            m_outputQueue->Println(m_encoderManager->ReadEncoderState());
+            break;
+        }
+        break;
+
     case 'r':
         // reset safety system.
         m_safetyManager->Reset();
         break;
 
     case 's':
-        Text += m_sensorManager->ReadLatestUltrasonicState();
+        m_outputQueue->Println(m_sensorManager->ReadLatestUltrasonicState());
+        break;
+
+    case 't':
+        // the timestamps are longer than an EasyString, parse them straight out of the frame.
+        m_outputQueue->Println(m_clock->ReadSync(&m_frameBuffer[1]));
+        break;
+
+    case 'u':
+        m_outputQueue->Println(m_outputQueue->ReadStatistics());
         break;
 
     // v0,200~ -- update servo 0 duty interval to 200uS.
     case 'v':
+        if (m_frameBuffer[1] == 'S')
+        {
+            // "vS0,1500,200,50" -- move servo 0 to 1500 at up to 200 ticks/s, ramping at 50 ticks/s/s.
+            long fields[4];
+            const char *cursor = &m_frameBuffer[2];
+            int parsed = 0;
+            for (; parsed < 4; parsed++)
+            {
+                char *end;
+                fields[parsed] = strtol(cursor, &end, 10);
+                if ((end == cursor) || (fields[parsed] < 0) || ((*end != ',') && (*end != '\0')))
+                {
+                    break;
+                }
+                cursor = end + ((*end == ',') ? 1 : 0);
+            }
+            if (parsed < 4)
+            {
+                m_outputQueue->Println("{'Error' : 'Bad servo move'}");
+                break;
+            }
+            if (m_motorControl->IsLoopOwned(fields[0]))
+            {
+                m_outputQueue->Println("{'Error' : 'Motor owned by a velocity loop'}");
+                break;
+            }
+            m_motorControl->MoveServo(fields[0], fields[1], fields[2], fields[3]);
+            Text += "servo moving";
+            break;
+        }
         // handle a ser(v)o duty interval update
         subs[0] += m_commandBuffer.substring(1, 2); // which motor index to use?
         subs[1] += m_commandBuffer.substring(3);    // 3 to end
+        if (m_motorControl->IsLoopOwned(subs[0].toInt()))
+        {
+            m_outputQueue->Println("{'Error' : 'Motor owned by a velocity loop'}");
+            break;
+        }
         m_motorControl->UpdateMotorTimings(subs[0].toInt(), subs[1].toString());
         break;
 
     case 'w':
-        Text += m_safetyManager->ResetWatchDog();
+        if (m_frameBuffer[1] == 'S')
+        {
+            m_outputQueue->Println(m_safetyManager->ReadStatistics());
+        }
+        else
+        {
+            m_outputQueue->Println(m_safetyManager->ResetWatchDog());
+        }
         break;
 
-    //  "C~" -- configuration complete.
+    case 'z':
+        if (m_frameBuffer[1] == '0')
+        {
+            m_power->SetIdleAllowed(false);
+            Text += "Idle off";
+        }
+        else if (m_frameBuffer[1] == '1')
+        {
+            m_power->SetIdleAllowed(true);
+            Text += "Idle on";
+        }
+        else
+        {
+            m_outputQueue->Println(m_power->ReadStatistics());
+        }
+        break;
+
+    case 'B':
+        // dispatch benchmark
+        if (m_frameBuffer[1] == '0')
+        {
+            m_motorControl->ClearDispatchCycles();
+            Text += "Dispatch cycles cleared";
+        }
+        else if (m_frameBuffer[1] == 'G')
+        {
+            m_motorControl->SetForceGeneric(true);
+            Text += "Generic dispatch";
+        }
+        else if (m_frameBuffer[1] == 'A')
+        {
+            m_motorControl->SetForceGeneric(false);
+            Text += "Automatic dispatch";
+        }
+        else
+        {
+            m_outputQueue->Println(m_motorControl->ReadDispatchCycles());
+        }
+        break;
+
+    case 'W':
+    {
+        // DMA waveform engine
+        if (m_frameBuffer[1] == '1')
+        {
+            const char *error = m_waveform->Start();
+            if (error == NULL)
+            {
+                Text += "Waveform on";
+            }
+            else
+            {
+                m_outputQueue->Print("{'Error' : '");
+                m_outputQueue->Print(error);
+                m_outputQueue->Println("'}");
+            }
+        }
+        else if (m_frameBuffer[1] == '0')
+        {
+            m_waveform->Stop();
+            Text += "Waveform off";
+        }
+        else
+        {
+            m_outputQueue->Println(m_waveform->ReadStatistics());
+        }
+        break;
+    }
+
+    case 'X':
+        // batch of motor commands
+        m_outputQueue->Println(m_batch->Run(&m_frameBuffer[1]));
+        break;
+
+    //  "C~" -- configuration complete, switch to it.
     case 'C':
+    {
+        const char *error = m_configManager->Commit();
+        if (error != NULL)
+        {
+            m_outputQueue->Print("{'Error' : '");
+            m_outputQueue->Print(error);
+            m_outputQueue->Println("'}");
+            Text += "Configuration rejected";
+            break;
+        }
         m_safetyManager->SetConfigured(true);
+        m_configManager->Save();
+        m_trace->Record(TRACE_CONFIGURATION, 'C', 0);
         Text += "Finished configuration";
         break;
+    }
 
     //  "M0,01,02,03,00000,00000~" -- configure motor 0 with enable pin 1, dir pin 2, pulse pin 3.
     //  "M1,-1,-1,20000,000200~" -- configure motor 1 as a servo and set to 0 degrees.
     case 'M':
+    {
         subs[0] += m_commandBuffer.substring(1, 2);   // which motor?
         subs[1] += m_commandBuffer.substring(3, 5);   // enable pin ( or -1 for servos )
         subs[2] += m_commandBuffer.substring(6, 8);   // dir pin ( or -1 for servos )
         subs[3] += m_commandBuffer.substring(9, 11);  // pulse pin ( even for servos )
         subs[4] += m_commandBuffer.substring(12, 17); // interval
-        subs[5] += m_commandBuffer.substring(12, 18); // duty interval
-        m_motorControl->ConfigureMotor(subs[0].toInt(), (uint8_t)subs[1].toInt(), (uint8_t)subs[2].toInt(), (uint8_t)subs[3].toInt(), subs[4].toInt(), subs[5].toInt());
+        subs[5] += m_commandBuffer.substring(18);     // duty interval
+        const char *error = m_configManager->StageMotor(subs[0].toInt(), (uint8_t)subs[1].toInt(), (uint8_t)subs[2].toInt(), (uint8_t)subs[3].toInt(), subs[4].toInt(), subs[5].toInt());
+        if (error != NULL)
+        {
+            m_outputQueue->Print("{'Error' : '");
+            m_outputQueue->Print(error);
+            m_outputQueue->Println("'}");
+            break;
+        }
+        m_trace->Record(TRACE_CONFIGURATION, 'M', subs[0].toInt());
         Text += "Motor Configured";
         break;
+    }
 
     //"S0,01,01,700000,500~"
     case 'S':
+    {
         subs[0] += m_commandBuffer.substring(1, 2);  // which sensor?
         subs[1] += m_commandBuffer.substring(3, 5);  // trigger pin
         subs[2] += m_commandBuffer.substring(6, 8);  // echo pin
         subs[3] += m_commandBuffer.substring(9, 15); // max allowed duration
         subs[4] += m_commandBuffer.substring(16);    // min allowed duration
-        m_sensorManager->ConfigureUltrasonic(subs[0].toInt(), subs[2].toInt(), subs[3].toInt(), subs[4].toFloat(), subs[5].toFloat());
+        const char *error = m_configManager->StageUltrasonic(subs[0].toInt(), subs[2].toInt(), subs[1].toInt(), subs[3].toInt(), subs[4].toInt());
+        if (error != NULL)
+        {
+            m_outputQueue->Print("{'Error' : '");
+            m_outputQueue->Print(error);
+            m_outputQueue->Println("'}");
+            break;
+        }
+        m_trace->Record(TRACE_CONFIGURATION, 'S', subs[0].toInt());
         Text += "Sensor Configured";
         break;
+    }
+    //  "K<motors>,<sensors>;<motor>;...;<sensor>;...~" -- bulk configuration, validated before anything is applied.
+    case 'K':
+    {
+        // the description is longer than an EasyString, parse it straight out of the frame.
+        const char *error = m_configManager->ApplyDescription(&m_frameBuffer[1]);
+        if (error == NULL)
+        {
+            m_trace->Record(TRACE_CONFIGURATION, 'K', 0);
+            Text += "Configuration applied";
+        }
+        else
+        {
+            m_outputQueue->Print("{'Error' : '");
+            m_outputQueue->Print(error);
+            m_outputQueue->Println("'}");
+            Text += "Configuration rejected";
+        }
+        break;
+    }
+
+    case 'T':
+        // event trace
+        if (m_commandBuffer.Get()[1] == '0')
+        {
+            m_trace->Clear();
+            Text += "Trace cleared";
+        }
+        else if (m_commandBuffer.Get()[1] == 'S')
+        {
+            subs[0] += m_commandBuffer.substring(2);
+            m_trace->SetStepSampling(subs[0].toInt());
+            Text += "Step tracing set";
+        }
+        else
+        {
+            m_trace->RequestDump(false); // Dispatch sends it a piece at a time.
+        }
+        break;
+
+    case 'R':
+        // on-board reflexes
+        if (m_frameBuffer[1] == '\0')
+        {
+            m_outputQueue->Println(m_reflex->ReadRules());
+        }
+        else if (m_frameBuffer[1] == 'X')
+        {
+            m_reflex->ClearRules();
+            m_trace->Record(TRACE_CONFIGURATION, 'R', 0);
+            Text += "Reflexes cleared";
+        }
+        else
+        {
+            // a rule is longer than an EasyString, parse it straight out of the frame.
+            const char *error = m_reflex->ConfigureRule(&m_frameBuffer[1]);
+            if (error == NULL)
+            {
+                m_trace->Record(TRACE_CONFIGURATION, 'R', atoi(&m_frameBuffer[1]));
+                Text += "Reflex rule set";
+            }
+            else
+            {
+                m_outputQueue->Print("{'Error' : '");
+                m_outputQueue->Print(error);
+                m_outputQueue->Println("'}");
+            }
+        }
+        break;
+
+    //  "O0,1,032500,150000,3200~" -- configure differential drive odometry.
+    case 'O':
+        subs[0] += m_commandBuffer.substring(1, 2);   // left motor
+        subs[1] += m_commandBuffer.substring(3, 4);   // right motor
+        subs[2] += m_commandBuffer.substring(5, 11);  // wheel radius in uM
+        subs[3] += m_commandBuffer.substring(12, 18); // track width in uM
+        subs[4] += m_commandBuffer.substring(19);     // steps per wheel revolution
+        m_odometryManager->Configure(subs[0].toInt(), subs[1].toInt(), subs[2].toInt(), subs[3].toInt(), subs[4].toInt());
+        Text += "Odometry Configured";
+        break;
+
+    //  "P0100~" -- stream the pose every 100ms.
+    case 'P':
+        subs[0] += m_commandBuffer.substring(1);
+        m_odometryManager->SetStreamInterval(subs[0].toInt());
+        Text += "Pose stream set";
+        break;
+
     default:
-        Serial.println("{'Error' : 'Command not recognized'}");
+        m_outputQueue->Println("{'Error' : 'Command not recognized'}");
         break;
     }
-    Serial.println(Text.toString());
-    Serial.flush();
 
-    m_commandBuffer.Clear();
+    m_latency->MarkParsed();
 
-    Serial.println("Reset m_commandBuffer");
-    Serial.flush();
+    // short replies are built in Text, long JSON replies went straight to the queue above.
+    if (Text.Get()[0] != '\0')
+    {
+        m_outputQueue->Println(Text.Get());
+    }
+
+    // tagged commands end with a marker, so a pipelining host knows this reply is complete.
+    if (m_hasSequence)
+    {
+        String Done = String("{'Done' : ");
+        Done += String(m_sequence);
+        Done += String("}");
+        m_outputQueue->Println(Done);
+    }
+    m_latency->MarkReply();
+    m_commandBuffer.Clear();
 }
 
 //-----------------------------------------------------------------------------------------------------------------------------
 // Function:
-//  ReadSerialPortData keeps reading the port until it sees a ~ string.
-boolean CommandManager::ReadSerialPortData()
+//  StripSequence takes an "@<seq>:" tag off the front of the frame buffer and remembers the number.
+//  Returns false if the frame starts with @ but the tag is malformed.
+boolean CommandManager::StripSequence()
 {
-    boolean returnCode = false;
-    int serialBytesRecieved = 0;
-    serialBytesRecieved = Serial.available();
-    if (serialBytesRecieved > 0)
+    m_hasSequence = false;
+    if (m_frameBuffer[0] != '@')
+    {
+        return (true); // untagged, nothing to strip.
+    }
+    uint32_t sequence = 0;
+    int position = 1;
+    while ((m_frameBuffer[position] >= '0') && (m_frameBuffer[position] <= '9'))
+    {
+        sequence = (sequence * 10) + (m_frameBuffer[position] - '0');
+        position++;
+    }
+    if ((position == 1) || (m_frameBuffer[position] != ':'))
     {
-        returnCode = true;
-        Serial.println("ACK>");
-        Serial.flush();
+        return (false);
+    }
+    position++;
 
-        // we got a valid buffer but it's likely fragmented  Keep reading until we see the ~ character.
-        // Debugging -- we use "EasyString" type to get around an allocation crash in this reader.
-        String reader = String(""); 
+    // shift the command down so the parsers see it at the start of the buffer.
+    memmove(m_frameBuffer, &m_frameBuffer[position], strlen(&m_frameBuffer[position]) + 1);
+    m_sequence = sequence;
+    m_hasSequence = true;
+    return (true);
+}
 
-        Serial.println("I didn't crash 1");
-        Serial.flush();
-        reader += Serial.readStringUntil('~'); // this line of code seems to crash on second read, works on first.  Crash seems to be in allocating buffer.
+//-----------------------------------------------------------------------------------------------------------------------------
+// Function:
+//  ReadSerialPortData collects whatever bytes have arrived into the frame buffer, without blocking,
+//  and returns true once it has a whole frame (everything up to a ~).  Frames can arrive in pieces
+//  over several calls.  Reading byte-by-byte into a fixed buffer also avoids the String allocation
+//  that used to crash here on the second read.
+boolean CommandManager::ReadSerialPortData()
+{
+    while (m_transport->Available() > 0)
+    {
+        char incoming = (char)m_transport->Read();
+        if (incoming == '~')
+        {
+            m_frameBuffer[m_frameLength] = '\0';
+            m_frameLength = 0;
+            if (m_frameOverflow)
+            {
+                m_frameOverflow = false;
+                m_outputQueue->Println("{'Error' : 'Command too long'}");
+                continue;
+            }
+            if (!StripSequence())
+            {
+                m_outputQueue->Println("{'Error' : 'Bad sequence number'}");
+                continue;
+            }
+            // m, f, v and X change motor timings, so time them through to the pin.
+            char letter = m_frameBuffer[0];
+            m_trace->Record(TRACE_COMMAND, letter, m_hasSequence ? (uint16_t)m_sequence : 0); // untagged frames have no sequence.
+            m_latency->MarkFrame((letter == 'm') || (letter == 'f') || (letter == 'v') || (letter == 'X'));
 
-        Serial.println("I didn't crash 2");
-        Serial.flush();
-        
-        m_commandBuffer.Append(reader);
-        Serial.println(reader); // echo back what the user sent, prove we're still alive.
-        Serial.flush();
+            if (m_hasSequence)
+            {
+                String Ack = String("ACK>@");
+                Ack += String(m_sequence);
+                m_outputQueue->Println(Ack);
+            }
+            else
+            {
+                m_outputQueue->Println("ACK>");
+            }
+            m_outputQueue->Println(m_frameBuffer); // echo back what the user sent, prove we're still alive.
 
+            // short commands are parsed with EasyString, long ones straight from the frame buffer.
+            m_commandBuffer.Clear();
+            m_commandBuffer.Append(m_frameBuffer);
+            return (true);
+        }
+        if ((m_frameLength == 0) && ((incoming == '\r') || (incoming == '\n')))
+        {
+            continue; // line endings between frames.
+        }
+        if (m_frameLength == 0)
+        {
+            m_latency->MarkArrival(m_transport->ReadAgeUS());
+        }
+        if (m_frameLength < COMMAND_FRAME_SIZE - 1)
+        {
+            m_frameBuffer[m_frameLength] = incoming;
+            m_frameLength++;
+        }
+        else
+        {
+            m_frameOverflow = true;
+        }
     }
-    return (returnCode);
+    return (false);
 }
+
 //-----------------------------------------------------------------------------------------------------------------------------
 // Procedure:
 //  Dispatch is the thing we call to actually process a command.
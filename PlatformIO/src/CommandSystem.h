@@ -27,6 +27,11 @@
 //  commands start with a letter like "a", have the parameters, and end with "~"
 //  So a command looks like "m+00000~"
 
+//  A host that keeps several commands in flight can tag a frame with a sequence
+//  number, "@42:m+00500,-00500~".  The ACK then carries the number, "ACK>@42",
+//  and the last line of the reply is "{'Done' : 42}".  Frames are handled one
+//  at a time, so everything between the two belongs to that command.
+
 // Motors are difficult, because we don't know ahead of time how many we have.
 // So, we require motors commands in pairs.
 //  m01+00000,02-00000~ with 00 being an ignore m00+00000 is "ignore this"
@@ -35,28 +40,64 @@
 #include "MotorControl.h"
 #include "SensorSystem.h"
 #include "SafetySystem.h"
+#include "OdometrySystem.h"
+#include "EncoderSystem.h"
+#include "ConfigSystem.h"
 #include "EasyString.h"
+#include "OutputQueue.h"
+#include "Transport.h"
+#include "ClockSystem.h"
+#include "LatencySystem.h"
+#include "TraceSystem.h"
+#include "ReflexSystem.h"
+#include "ProgramSystem.h"
+#include "PowerSystem.h"
+#include "MemorySystem.h"
+#include "WaveSystem.h"
+#include "BatchSystem.h"
 
 #ifndef COMMAND_ONCE
 #define COMMAND_ONCE
 
 #define SUBSTRINGS_LIMIT 10
+#define COMMAND_FRAME_SIZE 512 // longest frame we accept, big enough for a full bulk "K" configuration.
 
 class CommandManager
 {
 public:
     CommandManager();
-    CommandManager(MotorControl *motorSystem, volatile uint32_t *tickCounter, uint32_t *prevTickCounter, SensorManager *sensorSystem, SafetyManager *safetySystem);
-    void Init(MotorControl *motorSystem, volatile uint32_t *tickCounter, uint32_t *prevTickCounter, SensorManager *sensorSystem, SafetyManager *safetySystem);
+    CommandManager(MotorControl *motorSystem, volatile uint32_t *tickCounter, uint32_t *prevTickCounter, SensorManager *sensorSystem, SafetyManager *safetySystem, OdometryManager *odometrySystem, EncoderManager *encoderSystem, ConfigManager *configSystem, OutputQueue *outputQueue, Transport *transport, ClockManager *clock, LatencyManager *latencySystem, TraceRecorder *trace, ReflexManager *reflexSystem, ProgramManager *programSystem, PowerManager *powerSystem, MemoryManager *memorySystem, WaveformManager *waveformSystem, BatchManager *batchSystem);
+    void Init(MotorControl *motorSystem, volatile uint32_t *tickCounter, uint32_t *prevTickCounter, SensorManager *sensorSystem, SafetyManager *safetySystem, OdometryManager *odometrySystem, EncoderManager *encoderSystem, ConfigManager *configSystem, OutputQueue *outputQueue, Transport *transport, ClockManager *clock, LatencyManager *latencySystem, TraceRecorder *trace, ReflexManager *reflexSystem, ProgramManager *programSystem, PowerManager *powerSystem, MemoryManager *memorySystem, WaveformManager *waveformSystem, BatchManager *batchSystem);
     void ProcessCommandBuffer();
     boolean ReadSerialPortData();
     void Dispatch();
 
 private:
+    boolean StripSequence();
+
     EasyString m_commandBuffer;         // for string handling
+    char m_frameBuffer[COMMAND_FRAME_SIZE]; // raw bytes of the frame being received, up to the ~.
+    int m_frameLength;                  // how many bytes of the current frame we have.
+    boolean m_frameOverflow;            // the current frame didn't fit, drop it when it ends.
+    boolean m_hasSequence;              // the current frame started with "@<seq>:".
+    uint32_t m_sequence;                // and this was its sequence number.
     MotorControl *m_motorControl;   // to hold the motor system
     SensorManager *m_sensorManager; // to talk with the sensor system
     SafetyManager *m_safetyManager; // to talk with the safety system
+    OdometryManager *m_odometryManager; // to talk with the odometry system
+    EncoderManager *m_encoderManager; // to talk with the encoders and velocity loops
+    ConfigManager *m_configManager; // to record and persist the robot configuration
+    OutputQueue *m_outputQueue;     // where replies and events go
+    Transport *m_transport;         // where commands come from
+    ClockManager *m_clock;          // host clock sync
+    LatencyManager *m_latency;      // times every frame through the pipeline
+    TraceRecorder *m_trace;         // flight recorder
+    ReflexManager *m_reflex;        // on-board obstacle reflexes
+    ProgramManager *m_program;      // on-board motion programs
+    PowerManager *m_power;          // idle tick and sleep
+    MemoryManager *m_memory;        // stack and heap instrumentation
+    WaveformManager *m_waveform;    // DMA step and dir waveforms
+    BatchManager *m_batch;          // multi-command frames applied on one tick
     volatile uint32_t *m_tickCounter;
     uint32_t *m_prevTickCounter;
 };
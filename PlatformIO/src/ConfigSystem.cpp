@@ -0,0 +1,572 @@
+#include "ConfigSystem.h"
+#include <EEPROM.h>
+
+//-----------------------------------------------------------------------------------------
+// EepromConfigStorage reads and writes the emulated EEPROM a byte at a time.
+// update() skips bytes that haven't changed, which saves flash wear.
+void EepromConfigStorage::Read(uint32_t address, uint8_t *buffer, uint32_t length)
+{
+    for (uint32_t i = 0; i < length; i++)
+    {
+        buffer[i] = EEPROM.read(address + i);
+    }
+}
+
+void EepromConfigStorage::Write(uint32_t address, const uint8_t *buffer, uint32_t length)
+{
+    for (uint32_t i = 0; i < length; i++)
+    {
+        EEPROM.update(address + i, buffer[i]);
+    }
+}
+
+uint32_t EepromConfigStorage::Length()
+{
+    return (EEPROM.length());
+}
+
+//-----------------------------------------------------------------------------------------
+// RamConfigStorage is plain memory.  Reads and writes past the end are dropped, like a
+// missing chip would; Save and LoadAndApply check Length() first anyway.
+RamConfigStorage::RamConfigStorage()
+{
+    Init(NULL, 0);
+}
+
+RamConfigStorage::RamConfigStorage(uint8_t *buffer, uint32_t length)
+{
+    Init(buffer, length);
+}
+
+void RamConfigStorage::Init(uint8_t *buffer, uint32_t length)
+{
+    m_bytes = buffer;
+    m_length = length;
+    m_writes = 0;
+}
+
+void RamConfigStorage::Read(uint32_t address, uint8_t *buffer, uint32_t length)
+{
+    for (uint32_t i = 0; i < length; i++)
+    {
+        buffer[i] = (address + i < m_length) ? m_bytes[address + i] : 0xFF;
+    }
+}
+
+void RamConfigStorage::Write(uint32_t address, const uint8_t *buffer, uint32_t length)
+{
+    for (uint32_t i = 0; (i < length) && (address + i < m_length); i++)
+    {
+        m_bytes[address + i] = buffer[i];
+    }
+    m_writes++;
+}
+
+uint32_t RamConfigStorage::Length()
+{
+    return (m_length);
+}
+
+uint32_t RamConfigStorage::GetWriteCount()
+{
+    return (m_writes);
+}
+
+//-----------------------------------------------------------------------------------------
+// Constructor:
+//  Default constructor does nothing.
+ConfigManager::ConfigManager()
+{
+}
+
+//-----------------------------------------------------------------------------------------
+// Constructor:
+//  Store references to the storage backend and the subsystems a configuration touches.
+ConfigManager::ConfigManager(ConfigStorage *storage, MotorControl *motorSystem, SensorManager *sensorSystem, SafetyManager *safetySystem, OutputQueue *outputQueue)
+{
+    Init(storage, motorSystem, sensorSystem, safetySystem, outputQueue);
+}
+
+//-----------------------------------------------------------------------------------------
+// Init initializes instance members and starts with an empty image.
+void ConfigManager::Init(ConfigStorage *storage, MotorControl *motorSystem, SensorManager *sensorSystem, SafetyManager *safetySystem, OutputQueue *outputQueue)
+{
+    m_storage = storage;
+    m_outputQueue = outputQueue;
+    m_motorControl = motorSystem;
+    m_sensorManager = sensorSystem;
+    m_safetyManager = safetySystem;
+
+    // zero everything, padding included, so the CRC only depends on the configuration.
+    memset(&m_image, 0, sizeof(m_image));
+    memset(&m_staged, 0, sizeof(m_staged));
+    m_isStaging = false;
+}
+
+//-----------------------------------------------------------------------------------------
+// StageCounts starts a new configuration for a "c" command.  Counts are clamped the same way the
+// subsystems clamp them.  Slots the host never configures have no pins.
+void ConfigManager::StageCounts(int motorCount, int ultrasonicCount)
+{
+    memset(&m_staged, 0, sizeof(m_staged));
+    m_staged.MotorCount = (uint8_t)constrain(motorCount, 0, MOTOR_CAPACITY);
+    m_staged.UltrasonicCount = (uint8_t)constrain(ultrasonicCount, 0, ULTRASONIC_CAPACITY);
+    for (int i = 0; i < m_staged.MotorCount; i++)
+    {
+        m_staged.Motors[i].EnablePin = -1;
+        m_staged.Motors[i].DirPin = -1;
+        m_staged.Motors[i].PulsePin = -1;
+    }
+    for (int i = 0; i < m_staged.UltrasonicCount; i++)
+    {
+        m_staged.Ultrasonics[i].EchoPin = 0xFF;
+        m_staged.Ultrasonics[i].TriggerPin = 0xFF;
+    }
+    m_isStaging = true;
+}
+
+//-----------------------------------------------------------------------------------------
+// StageMotor records an "M" command.  Outside a "c" ... "C" it changes that one motor of the
+// running configuration, at once, unless that would share a pin.  NULL on success.
+const char *ConfigManager::StageMotor(int motorIndex, int8_t enablePin, int8_t dirPin, int8_t pulsePin, uint32_t interval, uint32_t dutyInterval)
+{
+    boolean isSingle = !m_isStaging;
+    if (isSingle)
+    {
+        m_staged = m_image;
+    }
+    if ((motorIndex < 0) || (motorIndex >= m_staged.MotorCount))
+    {
+        return (NULL); // the motor system ignores these too.
+    }
+    m_staged.Motors[motorIndex].EnablePin = enablePin;
+    m_staged.Motors[motorIndex].DirPin = dirPin;
+    m_staged.Motors[motorIndex].PulsePin = pulsePin;
+    m_staged.Motors[motorIndex].Interval = interval;
+    m_staged.Motors[motorIndex].DutyInterval = dutyInterval;
+    if (isSingle)
+    {
+        return (ApplyChecked(&m_staged));
+    }
+    return (NULL);
+}
+
+//-----------------------------------------------------------------------------------------
+// StageUltrasonic records an "S" command, the same way.
+const char *ConfigManager::StageUltrasonic(int sensorIndex, uint8_t echoPin, uint8_t triggerPin, uint32_t maxDuration, uint32_t minDuration)
+{
+    boolean isSingle = !m_isStaging;
+    if (isSingle)
+    {
+        m_staged = m_image;
+    }
+    if ((sensorIndex < 0) || (sensorIndex >= m_staged.UltrasonicCount))
+    {
+        return (NULL); // the sensor system ignores these too.
+    }
+    m_staged.Ultrasonics[sensorIndex].EchoPin = echoPin;
+    m_staged.Ultrasonics[sensorIndex].TriggerPin = triggerPin;
+    m_staged.Ultrasonics[sensorIndex].MaxAllowedDurationUS = maxDuration;
+    m_staged.Ultrasonics[sensorIndex].MinAllowedDurationUS = minDuration;
+    if (isSingle)
+    {
+        return (ApplyChecked(&m_staged));
+    }
+    return (NULL);
+}
+
+//-----------------------------------------------------------------------------------------
+// Commit applies the configuration a "c" started.  Without one there is nothing to switch to.
+// An image that shares a pin is refused and stays staged, so "M" or "S" can still fix it.
+const char *ConfigManager::Commit()
+{
+    if (m_isStaging)
+    {
+        return (ApplyChecked(&m_staged));
+    }
+    return (NULL);
+}
+
+//-----------------------------------------------------------------------------------------
+// ApplyChecked applies an image the commands built, if no two things in it share a pin.
+const char *ConfigManager::ApplyChecked(RobotConfig *image)
+{
+    const char *error = FindPinConflict(image);
+    if (error != NULL)
+    {
+        return (error);
+    }
+    Apply(image);
+    return (NULL);
+}
+
+//-----------------------------------------------------------------------------------------
+// Seal stamps an image with magic, version, size and checksum.
+void ConfigManager::Seal(RobotConfig *image)
+{
+    image->Magic = CONFIG_MAGIC;
+    image->Version = CONFIG_VERSION;
+    image->Size = sizeof(RobotConfig);
+    image->Checksum = Crc32((const uint8_t *)image, offsetof(RobotConfig, Checksum));
+}
+
+//-----------------------------------------------------------------------------------------
+// IsValid checks an image read back from storage before we trust it with our pins.
+boolean ConfigManager::IsValid(RobotConfig *image)
+{
+    if ((image->Magic != CONFIG_MAGIC) || (image->Version != CONFIG_VERSION) || (image->Size != sizeof(RobotConfig)))
+    {
+        return (false);
+    }
+    if ((image->MotorCount > MOTOR_CAPACITY) || (image->UltrasonicCount > ULTRASONIC_CAPACITY))
+    {
+        return (false);
+    }
+    return (image->Checksum == Crc32((const uint8_t *)image, offsetof(RobotConfig, Checksum)));
+}
+
+//-----------------------------------------------------------------------------------------
+// Save seals the recorded image and writes it to storage, but only if it differs from
+// what's already there.
+boolean ConfigManager::Save()
+{
+    if (sizeof(RobotConfig) + CONFIG_ADDRESS > m_storage->Length())
+    {
+        m_outputQueue->Println("{'Error' : 'Configuration does not fit in storage'}");
+        return (false);
+    }
+    Seal(&m_image);
+
+    RobotConfig stored;
+    m_storage->Read(CONFIG_ADDRESS, (uint8_t *)&stored, sizeof(stored));
+    if (IsValid(&stored) && (stored.Checksum == m_image.Checksum))
+    {
+        return (false); // already there, spare the flash.
+    }
+    m_storage->Write(CONFIG_ADDRESS, (const uint8_t *)&m_image, sizeof(m_image));
+    return (true);
+}
+
+//-----------------------------------------------------------------------------------------
+// LoadAndApply reads the stored image and, if it's valid, configures the robot from it.
+boolean ConfigManager::LoadAndApply()
+{
+    if (sizeof(RobotConfig) + CONFIG_ADDRESS > m_storage->Length())
+    {
+        return (false);
+    }
+    RobotConfig stored;
+    m_storage->Read(CONFIG_ADDRESS, (uint8_t *)&stored, sizeof(stored));
+    if (!IsValid(&stored))
+    {
+        return (false);
+    }
+    Apply(&stored);
+    return (true);
+}
+
+//-----------------------------------------------------------------------------------------
+// ApplyDescription parses a bulk robot description into a scratch image and, only if all of
+// it is valid, applies it, marks the robot configured and saves it.  Returns NULL on success,
+// otherwise a short reason, and leaves the current configuration untouched.
+const char *ConfigManager::ApplyDescription(const char *description)
+{
+    RobotConfig candidate;
+    memset(&candidate, 0, sizeof(candidate));
+    const char *error = ParseDescription(description, &candidate);
+    if (error != NULL)
+    {
+        return (error);
+    }
+    Apply(&candidate);
+    Save();
+    return (NULL);
+}
+
+//-----------------------------------------------------------------------------------------
+// ParseDescription fills an image from "<m>,<s>;<motor>;...;<sensor>;..." and checks every field.
+const char *ConfigManager::ParseDescription(const char *description, RobotConfig *image)
+{
+    const char *cursor = description;
+    long fields[5];
+    if (!ParseFields(&cursor, fields, 2))
+    {
+        return ("Bad counts");
+    }
+    if ((fields[0] < 0) || (fields[0] > MOTOR_CAPACITY))
+    {
+        return ("Motor count exceeds capacity");
+    }
+    if ((fields[1] < 0) || (fields[1] > ULTRASONIC_CAPACITY))
+    {
+        return ("Sensor count exceeds capacity");
+    }
+    image->MotorCount = (uint8_t)fields[0];
+    image->UltrasonicCount = (uint8_t)fields[1];
+
+    for (int i = 0; i < image->MotorCount; i++)
+    {
+        if ((*cursor++ != ';') || !ParseFields(&cursor, fields, 5))
+        {
+            return ("Bad motor");
+        }
+        // enable and dir may be -1 (servos), but every motor needs a pulse pin.
+        if ((fields[0] < -1) || (fields[0] >= NUM_DIGITAL_PINS) || (fields[1] < -1) || (fields[1] >= NUM_DIGITAL_PINS) ||
+            (fields[2] < 0) || (fields[2] >= NUM_DIGITAL_PINS))
+        {
+            return ("Bad motor pin");
+        }
+        if ((fields[3] < 0) || (fields[4] < 0) || (fields[4] > fields[3]))
+        {
+            return ("Bad motor timing");
+        }
+        image->Motors[i].EnablePin = (int8_t)fields[0];
+        image->Motors[i].DirPin = (int8_t)fields[1];
+        image->Motors[i].PulsePin = (int8_t)fields[2];
+        image->Motors[i].Interval = (uint32_t)fields[3];
+        image->Motors[i].DutyInterval = (uint32_t)fields[4];
+    }
+
+    for (int i = 0; i < image->UltrasonicCount; i++)
+    {
+        if ((*cursor++ != ';') || !ParseFields(&cursor, fields, 4))
+        {
+            return ("Bad sensor");
+        }
+        if ((fields[0] < 0) || (fields[0] >= NUM_DIGITAL_PINS) || (fields[1] < 0) || (fields[1] >= NUM_DIGITAL_PINS))
+        {
+            return ("Bad sensor pin");
+        }
+        if ((fields[2] <= 0) || (fields[3] < 0) || (fields[3] >= fields[2]))
+        {
+            return ("Bad sensor range");
+        }
+        image->Ultrasonics[i].EchoPin = (uint8_t)fields[0];
+        image->Ultrasonics[i].TriggerPin = (uint8_t)fields[1];
+        image->Ultrasonics[i].MaxAllowedDurationUS = (uint32_t)fields[2];
+        image->Ultrasonics[i].MinAllowedDurationUS = (uint32_t)fields[3];
+    }
+
+    if (*cursor != '\0')
+    {
+        return ("Trailing data");
+    }
+    return (FindPinConflict(image));
+}
+
+//-----------------------------------------------------------------------------------------
+// ParseFields reads count comma separated integers, leaving the cursor just past the last one.
+boolean ConfigManager::ParseFields(const char **cursor, long *fields, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if ((i > 0) && (*(*cursor)++ != ','))
+        {
+            return (false);
+        }
+        char *end;
+        fields[i] = strtol(*cursor, &end, 10);
+        if (end == *cursor)
+        {
+            return (false); // no digits.
+        }
+        *cursor = end;
+    }
+    return (true);
+}
+
+//-----------------------------------------------------------------------------------------
+// Apply builds an image into the motor and sensor systems' spare banks, just like replaying the
+// commands, then switches both to it on the same tick and makes it the current image.
+void ConfigManager::Apply(RobotConfig *image)
+{
+    m_motorControl->BeginConfiguration(image->MotorCount);
+    for (int i = 0; i < image->MotorCount; i++)
+    {
+        MotorConfig *motor = &image->Motors[i];
+        m_motorControl->ConfigureMotor(i, motor->EnablePin, motor->DirPin, motor->PulsePin, motor->Interval, motor->DutyInterval);
+    }
+    m_sensorManager->BeginConfiguration(image->UltrasonicCount);
+    for (int i = 0; i < image->UltrasonicCount; i++)
+    {
+        UltrasonicConfig *sensor = &image->Ultrasonics[i];
+        m_sensorManager->ConfigureUltrasonic(i, sensor->EchoPin, sensor->TriggerPin, sensor->MaxAllowedDurationUS, sensor->MinAllowedDurationUS);
+    }
+
+    ClaimPins(&m_image, image);
+    noInterrupts();
+    m_motorControl->CommitConfiguration();
+    m_sensorManager->CommitConfiguration();
+    interrupts();
+    ReleasePins(&m_image, image);
+
+    m_image = *image;
+    m_isStaging = false;
+    m_safetyManager->SetConfigured(true);
+}
+
+//-----------------------------------------------------------------------------------------
+// Function:
+//  PinRole is what an image does with a pin.  A pin used as an output anywhere is an output --
+//  a single pin sensor's echo is its trigger, and the sensor switches it itself.
+uint8_t ConfigManager::PinRole(const RobotConfig *image, int pin)
+{
+    uint8_t role = CONFIG_PIN_UNUSED;
+    for (int i = 0; i < image->MotorCount; i++)
+    {
+        const MotorConfig *motor = &image->Motors[i];
+        if (motor->DirPin == pin)
+        {
+            return (CONFIG_PIN_OUTPUT_HIGH);
+        }
+        if ((motor->EnablePin == pin) || (motor->PulsePin == pin))
+        {
+            return (CONFIG_PIN_OUTPUT_LOW);
+        }
+    }
+    for (int i = 0; i < image->UltrasonicCount; i++)
+    {
+        if (image->Ultrasonics[i].TriggerPin == pin)
+        {
+            return (CONFIG_PIN_OUTPUT_LOW);
+        }
+        if (image->Ultrasonics[i].EchoPin == pin)
+        {
+            role = CONFIG_PIN_INPUT;
+        }
+    }
+    return (role);
+}
+
+//-----------------------------------------------------------------------------------------
+// Function:
+//  FindPinConflict returns why an image can't be applied if any pin is claimed twice, else NULL.
+//  Slots a "c" left unconfigured have no pins.  A single pin sensor's echo is its own trigger,
+//  so it is only counted once.
+const char *ConfigManager::FindPinConflict(const RobotConfig *image)
+{
+    int pins[(MOTOR_CAPACITY * 3) + (ULTRASONIC_CAPACITY * 2)];
+    int pinCount = 0;
+    for (int i = 0; i < image->MotorCount; i++)
+    {
+        const MotorConfig *motor = &image->Motors[i];
+        int8_t motorPins[3] = {motor->EnablePin, motor->DirPin, motor->PulsePin};
+        for (int j = 0; j < 3; j++)
+        {
+            if (motorPins[j] >= 0)
+            {
+                pins[pinCount++] = motorPins[j];
+            }
+        }
+    }
+    for (int i = 0; i < image->UltrasonicCount; i++)
+    {
+        const UltrasonicConfig *sensor = &image->Ultrasonics[i];
+        if (sensor->EchoPin != 0xFF)
+        {
+            pins[pinCount++] = sensor->EchoPin;
+        }
+        if ((sensor->TriggerPin != 0xFF) && (sensor->TriggerPin != sensor->EchoPin))
+        {
+            pins[pinCount++] = sensor->TriggerPin;
+        }
+    }
+    for (int i = 1; i < pinCount; i++)
+    {
+        for (int j = 0; j < i; j++)
+        {
+            if (pins[i] == pins[j])
+            {
+                return ("Pin used twice");
+            }
+        }
+    }
+    return (NULL);
+}
+
+//-----------------------------------------------------------------------------------------
+// ClaimPins runs before the switch.  Outputs the new image adds are set up and driven to their
+// starting level, so no motor ever pulses a pin that isn't an output yet.  Inputs are only set up
+// here if nothing drives them now.  Pins the running image already drives are left alone.
+void ConfigManager::ClaimPins(const RobotConfig *from, const RobotConfig *to)
+{
+    for (int pin = 0; pin < NUM_DIGITAL_PINS; pin++)
+    {
+        uint8_t was = PinRole(from, pin);
+        uint8_t now = PinRole(to, pin);
+        boolean wasOutput = (was == CONFIG_PIN_OUTPUT_LOW) || (was == CONFIG_PIN_OUTPUT_HIGH);
+        if (((now == CONFIG_PIN_OUTPUT_LOW) || (now == CONFIG_PIN_OUTPUT_HIGH)) && !wasOutput)
+        {
+            pinMode(pin, OUTPUT);
+            digitalWrite(pin, (now == CONFIG_PIN_OUTPUT_HIGH) ? HIGH : LOW);
+        }
+        else if ((now == CONFIG_PIN_INPUT) && (was == CONFIG_PIN_UNUSED))
+        {
+            pinMode(pin, INPUT);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------------------
+// ReleasePins runs after the switch, once nothing drives the old pins any more.  Outputs the new
+// image dropped are pulled low (a pulse pin could have been left high), and outputs it now reads
+// become inputs.
+void ConfigManager::ReleasePins(const RobotConfig *from, const RobotConfig *to)
+{
+    for (int pin = 0; pin < NUM_DIGITAL_PINS; pin++)
+    {
+        uint8_t was = PinRole(from, pin);
+        uint8_t now = PinRole(to, pin);
+        if ((was != CONFIG_PIN_OUTPUT_LOW) && (was != CONFIG_PIN_OUTPUT_HIGH))
+        {
+            continue;
+        }
+        if (now == CONFIG_PIN_UNUSED)
+        {
+            digitalWrite(pin, LOW);
+        }
+        else if (now == CONFIG_PIN_INPUT)
+        {
+            pinMode(pin, INPUT);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------------------
+// GetHash returns the CRC32 of the current configuration, the same value stored with the image.
+uint32_t ConfigManager::GetHash()
+{
+    RobotConfig sealed = m_image;
+    Seal(&sealed);
+    return (sealed.Checksum);
+}
+
+//-----------------------------------------------------------------------------------------
+// ReadHash returns a JSON object with the configuration hash for the host to compare.
+String ConfigManager::ReadHash()
+{
+    String Text = String("");
+    Text += String("{'ConfigHash': '");
+    Text += String(GetHash(), HEX);
+    Text += String("', 'Configured': ");
+    Text += String(m_safetyManager->IsConfigured() ? 1 : 0);
+    Text += String("}");
+    return (Text);
+}
+
+//-----------------------------------------------------------------------------------------
+// Crc32 is the standard reflected CRC-32 (polynomial 0xEDB88320), bit at a time.  The image
+// is a few hundred bytes and only checked at boot and on "C~", so no table.
+uint32_t ConfigManager::Crc32(const uint8_t *data, uint32_t length)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    for (uint32_t i = 0; i < length; i++)
+    {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+    }
+    return (~crc);
+}
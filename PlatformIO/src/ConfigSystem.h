@@ -0,0 +1,192 @@
+// ---------------------------------------------------------------------------
+// Configuration Library - v0.0.1 - 07/12/2020
+//
+// AUTHOR/LICENSE:
+// Created by Imran Peerbhai -- ipeerbhai@aol.com
+// Copyright 2020 License:
+// Forks and derivitive works are NOT permitted without
+// permission. Permission is only granted to use as-is for private and
+// non-commercial use by natural persons or non-profit entities.
+// For-profit entities require a license.
+//
+// CONTRIBUTIONS:
+// If you wish to contribute, make changes, or enhancements,
+// please create a pull request.
+//
+// DISCLAIMER:
+// This software is furnished "as is", without technical support, and with no
+// warranty, express or implied, as to its usefulness for any purpose.
+// ---------------------------------------------------------------------------
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+// Theory of Operation:
+
+//  Without this subsystem, every boot asks the host for a configuration and waits
+//  until all the c, M, S and C commands have been replayed.  That's seconds of
+//  dead time after every brownout.
+
+//  As the configuration commands arrive, we record them into a RobotConfig image.
+//  When the host sends "C~", the image gets a magic number, version and CRC32 and
+//  is written to storage (EEPROM emulated in flash on the Teensy 4.1).  Flash wears,
+//  so we only write when the CRC differs from what's already stored.
+
+//  On boot, the stored image is validated and applied directly.  The host can ask
+//  for the config hash ("h~") and only re-send the configuration if it doesn't match.
+
+//  The whole robot can also be described in one bulk "K" frame.  It is parsed into a
+//  scratch RobotConfig, validated as a unit, and only applied (and saved) if every
+//  motor and sensor in it makes sense -- a bad description never half-configures us.
+//  No pin may be claimed twice, by two motors, two sensors or one of each; the only
+//  exception is a single pin sensor, whose echo is its own trigger.
+//    K<motors>,<sensors>;<enable>,<dir>,<pulse>,<interval>,<duty>;...;<echo>,<trigger>,<max>,<min>;...~
+//  e.g. "K2,1;01,02,03,500,250;-1,-1,04,20000,1500;05,05,700000,500~"
+
+//  A reconfiguration never edits what the ISR is running.  "c" starts a new image off
+//  to the side, "M" and "S" fill it in, and "C" applies it; an "M" or "S" on its own
+//  is applied at once on top of the current configuration.  Either way the image is
+//  checked for shared pins first, as a "K" frame is.  Applying builds the new
+//  motor and sensor banks, sets up the pins the new configuration claims (outputs
+//  driven to a known level before the switch), swaps both banks between two ticks,
+//  and only then quiets the pins it dropped.  Motors and sensors on unchanged pins run
+//  straight through, so a running robot can be retuned or given another sensor
+//  without a reboot.
+
+//  Storage is behind the ConfigStorage interface so the image logic doesn't care
+//  whether it lands in EEPROM or somewhere else.  RamConfigStorage keeps it in a
+//  caller's buffer; Host/ConfigCheck.cpp uses it to check the seal, save and load
+//  path off the robot.
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+
+#include <Arduino.h>
+#include <stdint.h>
+#include "MotorControl.h"
+#include "SensorSystem.h"
+#include "SafetySystem.h"
+#include "OutputQueue.h"
+
+#ifndef CONFIG_ONCE
+#define CONFIG_ONCE
+
+#define CONFIG_MAGIC 0x544F4254 // "TBOT"
+#define CONFIG_VERSION 1        // bump whenever RobotConfig changes layout.
+#define CONFIG_ADDRESS 0        // where in storage the image lives.
+
+// what a configuration does with a pin, and the level a new output starts at.
+enum ConfigPinRoles
+{
+  CONFIG_PIN_UNUSED,
+  CONFIG_PIN_INPUT,       // echo pins.
+  CONFIG_PIN_OUTPUT_LOW,  // pulse, enable (disabled) and trigger pins.
+  CONFIG_PIN_OUTPUT_HIGH  // dir pins, matching the +1 direction a new motor starts with.
+};
+
+struct MotorConfig
+{
+  int8_t EnablePin;
+  int8_t DirPin;
+  int8_t PulsePin;
+  uint32_t Interval;
+  uint32_t DutyInterval;
+};
+
+struct UltrasonicConfig
+{
+  uint8_t EchoPin;
+  uint8_t TriggerPin;
+  uint32_t MaxAllowedDurationUS;
+  uint32_t MinAllowedDurationUS;
+};
+
+// Everything the host tells us about the robot's wiring, as one image.
+struct RobotConfig
+{
+  uint32_t Magic;
+  uint16_t Version;
+  uint16_t Size;           // sizeof(RobotConfig) when written.
+  uint8_t MotorCount;
+  uint8_t UltrasonicCount;
+  MotorConfig Motors[MOTOR_CAPACITY];
+  UltrasonicConfig Ultrasonics[ULTRASONIC_CAPACITY];
+  uint32_t Checksum;       // CRC32 of every byte above this one.
+};
+
+// Where configuration images are kept.
+class ConfigStorage
+{
+public:
+    virtual ~ConfigStorage() {}
+    virtual void Read(uint32_t address, uint8_t *buffer, uint32_t length) = 0;
+    virtual void Write(uint32_t address, const uint8_t *buffer, uint32_t length) = 0;
+    virtual uint32_t Length() = 0;
+};
+
+// ConfigStorage on the Teensy's flash-emulated EEPROM.
+class EepromConfigStorage : public ConfigStorage
+{
+public:
+    void Read(uint32_t address, uint8_t *buffer, uint32_t length);
+    void Write(uint32_t address, const uint8_t *buffer, uint32_t length);
+    uint32_t Length();
+};
+
+// ConfigStorage in a buffer the caller owns.  Counts writes, so a caller can see flash wear.
+class RamConfigStorage : public ConfigStorage
+{
+public:
+    RamConfigStorage();
+    RamConfigStorage(uint8_t *buffer, uint32_t length);
+    void Init(uint8_t *buffer, uint32_t length);
+    void Read(uint32_t address, uint8_t *buffer, uint32_t length);
+    void Write(uint32_t address, const uint8_t *buffer, uint32_t length);
+    uint32_t Length();
+    uint32_t GetWriteCount();
+
+private:
+    uint8_t *m_bytes;
+    uint32_t m_length;
+    uint32_t m_writes;
+};
+
+class ConfigManager
+{
+public:
+    ConfigManager();
+    ConfigManager(ConfigStorage *storage, MotorControl *motorSystem, SensorManager *sensorSystem, SafetyManager *safetySystem, OutputQueue *outputQueue);
+    void Init(ConfigStorage *storage, MotorControl *motorSystem, SensorManager *sensorSystem, SafetyManager *safetySystem, OutputQueue *outputQueue);
+    void StageCounts(int motorCount, int ultrasonicCount); // "c" -- start a new configuration.
+    const char *StageMotor(int motorIndex, int8_t enablePin, int8_t dirPin, int8_t pulsePin, uint32_t interval, uint32_t dutyInterval);
+    const char *StageUltrasonic(int sensorIndex, uint8_t echoPin, uint8_t triggerPin, uint32_t maxDuration, uint32_t minDuration);
+    const char *Commit();  // "C" -- apply the configuration started by "c", if there is one.  NULL on success.
+    boolean Save();        // seal the recorded image and write it if it changed.  true if written.
+    boolean LoadAndApply(); // validate the stored image and configure the robot from it.
+    const char *ApplyDescription(const char *description); // bulk "K" frame body.  NULL on success, else why not.
+    uint32_t GetHash();    // CRC32 of the current configuration.
+    String ReadHash();     // returns a JSON object with the current configuration hash.
+    static void Seal(RobotConfig *image);
+    static boolean IsValid(RobotConfig *image);
+
+private:
+    const char *ParseDescription(const char *description, RobotConfig *image);
+    static boolean ParseFields(const char **cursor, long *fields, int count);
+    void Apply(RobotConfig *image);
+    const char *ApplyChecked(RobotConfig *image);
+    void ClaimPins(const RobotConfig *from, const RobotConfig *to);
+    void ReleasePins(const RobotConfig *from, const RobotConfig *to);
+    static uint8_t PinRole(const RobotConfig *image, int pin);
+    static const char *FindPinConflict(const RobotConfig *image);
+    static uint32_t Crc32(const uint8_t *data, uint32_t length);
+
+    RobotConfig m_image;   // the configuration the robot is running.
+    RobotConfig m_staged;  // the one "c", "M" and "S" are building.
+    boolean m_isStaging;   // a "c" is waiting for its "C".
+    ConfigStorage *m_storage;
+    MotorControl *m_motorControl;
+    SensorManager *m_sensorManager;
+    SafetyManager *m_safetyManager;
+    OutputQueue *m_outputQueue;
+};
+
+#endif
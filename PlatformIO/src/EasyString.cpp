@@ -8,11 +8,7 @@ EasyString::EasyString()
 EasyString::EasyString(char *_item)
 {
     Clear();
-    for (int i = 0; _item[i] != '\0'; i++)
-    {
-        m_charBuffer[i] = _item[i];
-        m_lastIndex = i;
-    }
+    Append(_item);
 }
 
 char *EasyString::substring(int start)
@@ -36,10 +32,10 @@ char *EasyString::substring(int start, int end)
             break; // we're done
         }
 
-        m_substrings[m_lastSubstring][i] = m_charBuffer[i];
+        m_substrings[m_lastSubstring][i - start] = m_charBuffer[i];
     }
 
-    if (m_lastSubstring == EASY_BUFFER_SIZE)
+    if (m_lastSubstring == EASY_SUBSTRINGS_LIMIT - 1)
     {
         m_lastSubstring = 0;
     }
@@ -71,31 +67,18 @@ void EasyString::Clear()
 
 void EasyString::Append(const char *appendThis)
 {
-    Serial.print("Appending");
-    Serial.println(appendThis);
-    Serial.flush();
-    int len = strlen(appendThis);
-    Serial.println("Appending n characters:");
-    Serial.println(len);
-    Serial.println("::");
-    Serial.flush();
     int offsetIndex = m_lastIndex;
-    for (int i = 0; i <= len; i++)
+    for (int i = 0; appendThis[i] != '\0'; i++)
     {
         if (offsetIndex >= EASY_BUFFER_SIZE - 1)
         {
-            return; // can't add, we have no buffer room left, so just truncate here.
+            break; // can't add, we have no buffer room left, so just truncate here.
         }
         m_charBuffer[offsetIndex] = appendThis[i];
         offsetIndex++;
     }
-    m_lastIndex = offsetIndex + 1;
-
-    Serial.print("Append complete.  String now contains:");
-    Serial.println(Get());
-    Serial.println("Really");
-    
-    Serial.flush();
+    m_charBuffer[offsetIndex] = '\0';
+    m_lastIndex = offsetIndex; // the next append starts on the terminator.
 }
 
 void EasyString::Append(String appendThis)
@@ -145,3 +128,27 @@ EasyString EasyString::operator+=(EasyString appendThis)
     Append(appendThis.Get());
     return(*this);
 }
+
+//-----------------------------------------------------------------------------------------
+// Function:
+//  Int64Text formats a signed 64-bit number.  Arduino's String can't.
+String Int64Text(int64_t value)
+{
+    char digits[24];
+    int position = sizeof(digits) - 1;
+    boolean isNegative = (value < 0);
+    uint64_t magnitude = isNegative ? (uint64_t)(-(value + 1)) + 1 : (uint64_t)value;
+    digits[position] = '\0';
+    do
+    {
+        position--;
+        digits[position] = '0' + (magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude > 0);
+    if (isNegative)
+    {
+        position--;
+        digits[position] = '-';
+    }
+    return (String(&digits[position]));
+}
@@ -62,4 +62,6 @@ class EasyString{
         int m_lastIndex;
 };
 
+String Int64Text(int64_t value); // Arduino's String can't format 64-bit numbers.
+
 #endif
\ No newline at end of file
@@ -0,0 +1,297 @@
+#include "EncoderSystem.h"
+
+// (previous AB << 2 | current AB) -> count change.  0 for no change or an impossible double edge.
+static const int8_t QUADRATURE_TABLE[16] = {0, -1, 1, 0, 1, 0, 0, -1, -1, 0, 0, 1, 0, 1, -1, 0};
+
+// attachInterrupt and IntervalTimer want plain functions, so route them through the one instance.
+static EncoderManager *s_encoderManager = NULL;
+static void EncoderEdge0() { s_encoderManager->OnEdge(0); }
+static void EncoderEdge1() { s_encoderManager->OnEdge(1); }
+static void EncoderEdge2() { s_encoderManager->OnEdge(2); }
+static void EncoderEdge3() { s_encoderManager->OnEdge(3); }
+static void (*const s_edgeHandlers[ENCODER_CAPACITY])() = {EncoderEdge0, EncoderEdge1, EncoderEdge2, EncoderEdge3};
+static void ControlTimerISR() { s_encoderManager->ControlDispatch(); }
+
+//-----------------------------------------------------------------------------------------
+// Constructor:
+//  Default constructor does nothing.
+EncoderManager::EncoderManager()
+{
+}
+
+//-----------------------------------------------------------------------------------------
+// Constructor:
+//  Store a reference to the motor system the loops drive.
+EncoderManager::EncoderManager(MotorControl *motorSystem, ClockManager *clock)
+{
+    Init(motorSystem, clock);
+}
+
+//-----------------------------------------------------------------------------------------
+// Init initializes instance members.  No encoders or loops are active until configured.
+void EncoderManager::Init(MotorControl *motorSystem, ClockManager *clock)
+{
+    m_clock = clock;
+    s_encoderManager = this;
+    m_motorControl = motorSystem;
+    m_controlRateHz = DEFAULT_CONTROL_RATE_HZ;
+    m_timerRunning = false;
+    for (int i = 0; i < ENCODER_CAPACITY; i++)
+    {
+        m_encoders[i].IsConfigured = false;
+        m_encoders[i].Count = 0;
+        m_encoders[i].InvalidEdges = 0;
+        m_loops[i].IsEnabled = false;
+        m_loops[i].MotorIndex = -1;
+        m_loops[i].OutputMode = VELOCITY_OUTPUT_FREQUENCY;
+        m_loops[i].Setpoint = 0;
+        m_loops[i].Pid.Kp = 0;
+        m_loops[i].Pid.Ki = 0;
+        m_loops[i].Pid.Kd = 0;
+        VelocityPid::Reset(&m_loops[i].Pid);
+        m_loops[i].Output = 0;
+        m_loops[i].LastCount = 0;
+    }
+}
+
+//-----------------------------------------------------------------------------------------
+// ConfigureEncoder attaches an encoder to a pair of pins and starts counting from 0.
+void EncoderManager::ConfigureEncoder(int encoderIndex, uint8_t pinA, uint8_t pinB)
+{
+    if ((encoderIndex < 0) || (encoderIndex >= ENCODER_CAPACITY))
+    {
+        return; // do nothing, we don't have that encoder.
+    }
+    Encoder *theEncoder = &m_encoders[encoderIndex];
+    if (theEncoder->IsConfigured)
+    {
+        detachInterrupt(digitalPinToInterrupt(theEncoder->PinA));
+        detachInterrupt(digitalPinToInterrupt(theEncoder->PinB));
+    }
+    theEncoder->PinA = pinA;
+    theEncoder->PinB = pinB;
+    pinMode(pinA, INPUT_PULLUP);
+    pinMode(pinB, INPUT_PULLUP);
+    theEncoder->LastState = (digitalRead(pinA) << 1) | digitalRead(pinB);
+    theEncoder->Count = 0;
+    theEncoder->InvalidEdges = 0;
+    theEncoder->IsConfigured = true;
+    attachInterrupt(digitalPinToInterrupt(pinA), s_edgeHandlers[encoderIndex], CHANGE);
+    attachInterrupt(digitalPinToInterrupt(pinB), s_edgeHandlers[encoderIndex], CHANGE);
+}
+
+//-----------------------------------------------------------------------------------------
+// ConfigureLoop links velocity loop N (which reads encoder N) to a motor and enables it.
+// The loop becomes the motor's only timing writer, so a motor another loop owns is refused.
+// Returns true if the loop is closed.
+boolean EncoderManager::ConfigureLoop(int loopIndex, int motorIndex, uint8_t outputMode)
+{
+    if ((loopIndex < 0) || (loopIndex >= ENCODER_CAPACITY) || (!m_encoders[loopIndex].IsConfigured))
+    {
+        return (false); // no encoder to close the loop with.
+    }
+    if ((motorIndex < 0) || (motorIndex >= m_motorControl->GetMotorCount()))
+    {
+        return (false); // we don't have that motor.
+    }
+    VelocityLoop *theLoop = &m_loops[loopIndex];
+    boolean isSameMotor = theLoop->IsEnabled && (theLoop->MotorIndex == motorIndex);
+    if (m_motorControl->IsLoopOwned(motorIndex) && !isSameMotor)
+    {
+        return (false); // another loop drives that motor.
+    }
+    if (theLoop->IsEnabled && !isSameMotor)
+    {
+        DisableLoop(loopIndex); // stop and release the motor this loop drove before.
+    }
+    m_motorControl->SetLoopOwned(motorIndex, true);
+    noInterrupts();
+    theLoop->MotorIndex = motorIndex;
+    theLoop->OutputMode = outputMode;
+    VelocityPid::Reset(&theLoop->Pid);
+    theLoop->Output = 0;
+    theLoop->LastCount = m_encoders[loopIndex].Count;
+    theLoop->IsEnabled = true;
+    interrupts();
+    StartControlTimer();
+    return (true);
+}
+
+//-----------------------------------------------------------------------------------------
+// SetSetpoint sets the desired velocity of a loop in encoder counts per second.
+void EncoderManager::SetSetpoint(int loopIndex, float countsPerSecond)
+{
+    if ((loopIndex < 0) || (loopIndex >= ENCODER_CAPACITY))
+    {
+        return;
+    }
+    m_loops[loopIndex].Setpoint = countsPerSecond;
+}
+
+//-----------------------------------------------------------------------------------------
+// SetGain sets one of the P, I or D gains of a loop.
+void EncoderManager::SetGain(int loopIndex, char gain, float value)
+{
+    if ((loopIndex < 0) || (loopIndex >= ENCODER_CAPACITY))
+    {
+        return;
+    }
+    noInterrupts();
+    switch (gain)
+    {
+    case 'P':
+        m_loops[loopIndex].Pid.Kp = value;
+        break;
+    case 'I':
+        m_loops[loopIndex].Pid.Ki = value;
+        m_loops[loopIndex].Pid.Integral = 0; // old integral is meaningless with a new gain.
+        break;
+    case 'D':
+        m_loops[loopIndex].Pid.Kd = value;
+        break;
+    default:
+        break;
+    }
+    interrupts();
+}
+
+//-----------------------------------------------------------------------------------------
+// SetControlRate changes how often the velocity loops run.
+void EncoderManager::SetControlRate(uint32_t rateHz)
+{
+    if ((rateHz == 0) || (rateHz > MAX_CONTROL_RATE_HZ))
+    {
+        return; // keep the old rate.
+    }
+    m_controlRateHz = rateHz;
+    if (m_timerRunning)
+    {
+        m_controlTimer.update(1000000 / m_controlRateHz);
+    }
+}
+
+//-----------------------------------------------------------------------------------------
+// DisableLoop opens a loop again, stops its motor and hands it back to loop().
+void EncoderManager::DisableLoop(int loopIndex)
+{
+    if ((loopIndex < 0) || (loopIndex >= ENCODER_CAPACITY))
+    {
+        return;
+    }
+    noInterrupts();
+    m_loops[loopIndex].IsEnabled = false;
+    interrupts();
+    if (m_loops[loopIndex].MotorIndex >= 0)
+    {
+        m_motorControl->SetVelocityOutput(m_loops[loopIndex].MotorIndex, 0, m_loops[loopIndex].OutputMode);
+        m_motorControl->SetLoopOwned(m_loops[loopIndex].MotorIndex, false);
+    }
+}
+
+//-----------------------------------------------------------------------------------------
+// HasActiveLoop is true while any velocity loop is closed -- its motor can start at any moment.
+boolean EncoderManager::HasActiveLoop()
+{
+    for (int i = 0; i < ENCODER_CAPACITY; i++)
+    {
+        if (m_loops[i].IsEnabled)
+        {
+            return (true);
+        }
+    }
+    return (false);
+}
+
+//-----------------------------------------------------------------------------------------
+// GetCount returns an encoder's signed count.
+int32_t EncoderManager::GetCount(int encoderIndex)
+{
+    if ((encoderIndex < 0) || (encoderIndex >= ENCODER_CAPACITY))
+    {
+        return (0);
+    }
+    return (m_encoders[encoderIndex].Count);
+}
+
+//-----------------------------------------------------------------------------------------
+// ReadEncoderState returns a JSON object with each configured encoder and its loop.
+String EncoderManager::ReadEncoderState()
+{
+    String Text = String("");
+    Text += String("{'Encoders': [");
+    for (int i = 0; i < ENCODER_CAPACITY; i++)
+    {
+        if (!m_encoders[i].IsConfigured)
+        {
+            continue;
+        }
+        Text += String("{'Id':");
+        Text += String(i);
+        Text += String(",'Count':");
+        Text += String((long)m_encoders[i].Count);
+        Text += String(",'Invalid':");
+        Text += String((unsigned long)m_encoders[i].InvalidEdges);
+        Text += String(",'Loop':");
+        Text += String(m_loops[i].IsEnabled ? 1 : 0);
+        Text += String(",'Velocity':");
+        Text += String(m_loops[i].Pid.LastMeasurement);
+        Text += String(",'Output':");
+        Text += String(m_loops[i].Output);
+        Text += String("},");
+    }
+    Text += String("],");
+    Text += m_clock->Stamp(m_clock->NowUS());
+    Text += String("}");
+    return (Text);
+}
+
+//-----------------------------------------------------------------------------------------
+// OnEdge runs from a pin interrupt and decodes one quadrature transition.
+void EncoderManager::OnEdge(int encoderIndex)
+{
+    Encoder *theEncoder = &m_encoders[encoderIndex];
+    uint8_t state = (digitalReadFast(theEncoder->PinA) << 1) | digitalReadFast(theEncoder->PinB);
+    uint8_t transition = (theEncoder->LastState << 2) | state;
+    theEncoder->Count += QUADRATURE_TABLE[transition];
+    if ((transition == 0b0011) || (transition == 0b1100) || (transition == 0b0110) || (transition == 0b1001))
+    {
+        theEncoder->InvalidEdges++;
+    }
+    theEncoder->LastState = state;
+}
+
+//-----------------------------------------------------------------------------------------
+// ControlDispatch runs every control period from its own timer.  It measures each loop's
+// velocity and updates the motor it drives.
+void EncoderManager::ControlDispatch()
+{
+    float dt = 1.0f / m_controlRateHz;
+    for (int i = 0; i < ENCODER_CAPACITY; i++)
+    {
+        VelocityLoop *theLoop = &m_loops[i];
+        if (!theLoop->IsEnabled)
+        {
+            continue;
+        }
+        int32_t count = m_encoders[i].Count;
+        float measured = (float)(count - theLoop->LastCount) / dt;
+        theLoop->LastCount = count;
+
+        // the motor clamps the output; Limit undoes the integration if it did (anti-windup).
+        float output = VelocityPid::Update(&theLoop->Pid, theLoop->Setpoint, measured, dt);
+        float applied = m_motorControl->SetVelocityOutput(theLoop->MotorIndex, output, theLoop->OutputMode);
+        VelocityPid::Limit(&theLoop->Pid, output, applied);
+        theLoop->Output = applied;
+    }
+}
+
+//-----------------------------------------------------------------------------------------
+// StartControlTimer starts the fixed-rate loop timer the first time a loop is enabled.
+void EncoderManager::StartControlTimer()
+{
+    if (m_timerRunning)
+    {
+        return;
+    }
+    m_timerRunning = m_controlTimer.begin(ControlTimerISR, 1000000 / m_controlRateHz);
+}
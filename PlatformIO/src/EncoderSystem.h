@@ -0,0 +1,107 @@
+// ---------------------------------------------------------------------------
+// Encoder Library - v0.0.1 - 07/12/2020
+//
+// AUTHOR/LICENSE:
+// Created by Imran Peerbhai -- ipeerbhai@aol.com
+// Copyright 2020 License:
+// Forks and derivitive works are NOT permitted without
+// permission. Permission is only granted to use as-is for private and
+// non-commercial use by natural persons or non-profit entities.
+// For-profit entities require a license.
+//
+// CONTRIBUTIONS:
+// If you wish to contribute, make changes, or enhancements,
+// please create a pull request.
+//
+// DISCLAIMER:
+// This software is furnished "as is", without technical support, and with no
+// warranty, express or implied, as to its usefulness for any purpose.
+// ---------------------------------------------------------------------------
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+// Theory of Operation:
+
+//  The motor system is open loop -- it has no idea if a stepper skipped or a
+//  DC motor bogged down under load.  This subsystem closes the loop.
+
+//  Quadrature encoders are read with a CHANGE interrupt on both channels.  Each
+//  edge looks up (previous AB, current AB) in a 16 entry table to get -1, 0 or +1.
+//  Any pin can be used, and the Teensy 4.1 easily keeps up with wheel encoders.
+
+//  A second IntervalTimer runs the velocity loops at a fixed rate, independent of
+//  how busy loop() is.  Each loop measures counts per second from its encoder, runs
+//  a PID (VelocityPid.h), and pushes the result into its motor as either a step
+//  frequency (steppers) or a duty interval (DC motors on a PWM-style Interval).
+//  The motor clamps it to what it can do.  While a loop is enabled
+//  it owns its motor: m/v/f commands, batch items and program steps for that
+//  motor are refused, and a second loop can't claim it.  Stops still apply.
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+
+#include <Arduino.h>
+#include <stdint.h>
+#include "MotorControl.h"
+#include "ClockSystem.h"
+#include "VelocityPid.h"
+
+#ifndef ENCODER_ONCE
+#define ENCODER_ONCE
+
+#define ENCODER_CAPACITY 4           // encoders, and velocity loops, we can run at once.
+#define DEFAULT_CONTROL_RATE_HZ 1000 // how often the velocity loops run.
+#define MAX_CONTROL_RATE_HZ 20000
+
+struct Encoder
+{
+  uint8_t PinA;
+  uint8_t PinB;
+  boolean IsConfigured;
+  volatile uint8_t LastState;     // last AB state, A in bit 1, B in bit 0.
+  volatile int32_t Count;         // signed quadrature count.
+  volatile uint32_t InvalidEdges; // both channels changed at once -- we missed an edge.
+};
+
+struct VelocityLoop
+{
+  boolean IsEnabled;
+  int MotorIndex;                 // which motor does this loop drive?
+  uint8_t OutputMode;             // a VelocityOutputModes value.
+  float Setpoint;                 // desired counts per second.
+  VelocityPidState Pid;
+  float Output;
+  int32_t LastCount;
+};
+
+class EncoderManager
+{
+public:
+    EncoderManager();
+    EncoderManager(MotorControl *motorSystem, ClockManager *clock);
+    void Init(MotorControl *motorSystem, ClockManager *clock);
+    void ConfigureEncoder(int encoderIndex, uint8_t pinA, uint8_t pinB);
+    boolean ConfigureLoop(int loopIndex, int motorIndex, uint8_t outputMode); // false if the motor belongs to another loop.
+    void SetSetpoint(int loopIndex, float countsPerSecond);
+    void SetGain(int loopIndex, char gain, float value); // gain is 'P', 'I' or 'D'.
+    void SetControlRate(uint32_t rateHz);
+    void DisableLoop(int loopIndex);
+    int32_t GetCount(int encoderIndex);
+    boolean HasActiveLoop();        // true while any velocity loop is closed.
+    String ReadEncoderState(); // returns a JSON object with counts and loop state.
+    void OnEdge(int encoderIndex);  // called from the pin interrupts.
+    void ControlDispatch();         // called from the control loop timer.
+
+private:
+    void StartControlTimer();
+
+    Encoder m_encoders[ENCODER_CAPACITY];
+    VelocityLoop m_loops[ENCODER_CAPACITY]; // loop N reads encoder N.
+    MotorControl *m_motorControl;
+    ClockManager *m_clock;
+    IntervalTimer m_controlTimer;
+    uint32_t m_controlRateHz;
+    boolean m_timerRunning;
+};
+
+#endif
@@ -0,0 +1,157 @@
+#include "LatencySystem.h"
+
+static const char *s_stageNames[LATENCY_STAGE_COUNT] = {"Frame", "Parse", "Reply", "Actuate", "Total"};
+
+//-----------------------------------------------------------------------------------------
+// Constructor:
+//  Default constructor does nothing.
+LatencyManager::LatencyManager()
+{
+}
+
+//-----------------------------------------------------------------------------------------
+// Constructor:
+//  Store references to the tick counter and motor system.
+LatencyManager::LatencyManager(volatile uint32_t *tickCounter, MotorControl *motorSystem)
+{
+    Init(tickCounter, motorSystem);
+}
+
+//-----------------------------------------------------------------------------------------
+// Init initializes instance members and empties the histograms.
+void LatencyManager::Init(volatile uint32_t *tickCounter, MotorControl *motorSystem)
+{
+    m_tickCounter = tickCounter;
+    m_motorControl = motorSystem;
+    m_arrivalTick = 0;
+    m_frameTick = 0;
+    m_parsedTick = 0;
+    m_waitingForEdge = false;
+    Clear();
+}
+
+//-----------------------------------------------------------------------------------------
+// Clear empties every histogram.
+void LatencyManager::Clear()
+{
+    for (int stage = 0; stage < LATENCY_STAGE_COUNT; stage++)
+    {
+        for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++)
+        {
+            m_histograms[stage].Buckets[bucket] = 0;
+        }
+        m_histograms[stage].Count = 0;
+        m_histograms[stage].MinUS = 0xFFFFFFFF;
+        m_histograms[stage].MaxUS = 0;
+        m_histograms[stage].SumUS = 0;
+    }
+}
+
+//-----------------------------------------------------------------------------------------
+// The Mark functions stamp each point in a frame's life.
+void LatencyManager::MarkArrival(uint32_t ageUS)
+{
+    m_arrivalTick = *m_tickCounter - ageUS; // ticks are microseconds.
+}
+
+void LatencyManager::MarkFrame(boolean actuates)
+{
+    m_frameTick = *m_tickCounter;
+    Record(LATENCY_STAGE_FRAME, m_frameTick - m_arrivalTick);
+
+    // arm before the command publishes anything, so the ISR can't adopt it unseen.
+    m_waitingForEdge = actuates;
+    if (actuates)
+    {
+        m_motorControl->ArmActuationProbe();
+    }
+}
+
+void LatencyManager::MarkParsed()
+{
+    m_parsedTick = *m_tickCounter;
+    Record(LATENCY_STAGE_PARSE, m_parsedTick - m_frameTick);
+}
+
+void LatencyManager::MarkReply()
+{
+    uint32_t now = *m_tickCounter;
+    Record(LATENCY_STAGE_REPLY, now - m_parsedTick);
+    Record(LATENCY_STAGE_TOTAL, now - m_arrivalTick);
+}
+
+//-----------------------------------------------------------------------------------------
+// Dispatch picks up the actuation edge once the ISR has seen it.
+void LatencyManager::Dispatch()
+{
+    if (!m_waitingForEdge)
+    {
+        return;
+    }
+    uint32_t edgeTick;
+    if (m_motorControl->ReadActuationProbe(&edgeTick))
+    {
+        m_waitingForEdge = false;
+        Record(LATENCY_STAGE_ACTUATE, edgeTick - m_parsedTick);
+    }
+    else if ((*m_tickCounter - m_frameTick) >= LATENCY_ACTUATION_TIMEOUT)
+    {
+        m_waitingForEdge = false; // stopped or unsafe, no edge is coming.
+    }
+}
+
+//-----------------------------------------------------------------------------------------
+// Record drops one measurement into its power-of-two bucket.
+void LatencyManager::Record(int stage, uint32_t ticks)
+{
+    int bucket = 0;
+    uint32_t remaining = ticks;
+    while ((remaining > 0) && (bucket < LATENCY_BUCKETS - 1))
+    {
+        remaining >>= 1;
+        bucket++;
+    }
+    LatencyHistogram &histogram = m_histograms[stage];
+    histogram.Buckets[bucket]++;
+    histogram.Count++;
+    histogram.SumUS += ticks;
+    if (ticks < histogram.MinUS)
+    {
+        histogram.MinUS = ticks;
+    }
+    if (ticks > histogram.MaxUS)
+    {
+        histogram.MaxUS = ticks;
+    }
+}
+
+//-----------------------------------------------------------------------------------------
+// ReadHistograms returns a JSON object with count, min, max, mean and buckets for each stage.
+String LatencyManager::ReadHistograms()
+{
+    String Text = String("");
+    Text += String("{'Latency': {");
+    for (int stage = 0; stage < LATENCY_STAGE_COUNT; stage++)
+    {
+        LatencyHistogram &histogram = m_histograms[stage];
+        Text += String("'");
+        Text += String(s_stageNames[stage]);
+        Text += String("': {'Count':");
+        Text += String(histogram.Count);
+        Text += String(",'MinUS':");
+        Text += String((histogram.Count > 0) ? histogram.MinUS : 0);
+        Text += String(",'MaxUS':");
+        Text += String(histogram.MaxUS);
+        Text += String(",'MeanUS':");
+        Text += String((histogram.Count > 0) ? (uint32_t)(histogram.SumUS / histogram.Count) : 0);
+        Text += String(",'Buckets':[");
+        for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++)
+        {
+            Text += String(histogram.Buckets[bucket]);
+            Text += String(",");
+        }
+        Text += String("]},");
+    }
+    Text += String("}}");
+    return (Text);
+}
@@ -0,0 +1,103 @@
+// ---------------------------------------------------------------------------
+// Latency Probe Library - v0.0.1 - 07/12/2020
+//
+// AUTHOR/LICENSE:
+// Created by Imran Peerbhai -- ipeerbhai@aol.com
+// Copyright 2020 License:
+// Forks and derivitive works are NOT permitted without
+// permission. Permission is only granted to use as-is for private and
+// non-commercial use by natural persons or non-profit entities.
+// For-profit entities require a license.
+//
+// CONTRIBUTIONS:
+// If you wish to contribute, make changes, or enhancements,
+// please create a pull request.
+//
+// DISCLAIMER:
+// This software is furnished "as is", without technical support, and with no
+// warranty, express or implied, as to its usefulness for any purpose.
+// ---------------------------------------------------------------------------
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+// Theory of Operation:
+
+//  Every command frame is timed on the dispatch tick counter at five points:
+//    arrival   -- the first byte of the frame reached the transport.  For UART DMA
+//                 that's when we read it, less the wait the DMA's progress shows
+//                 (see Transport.h).  Over USB it's when we read it; time in the
+//                 USB buffer is invisible.
+//    frame     -- we read the ~ that ends it.
+//    parsed    -- ProcessCommandBuffer has parsed and executed it.
+//    reply     -- its last reply line is in the output queue.
+//    actuation -- for m, f and v, the first step pin edge after the motor ISR
+//                 picked up the new timings.
+//  The differences go into one histogram per stage, so the host can see exactly
+//  where time goes between ReadSerialPortData, ProcessCommandBuffer and the motors.
+
+//  Recording is a few counter reads per frame, so it's always on.  Histogram
+//  buckets are powers of two: bucket 0 is 0uS, bucket n is 2^(n-1) up to 2^n uS,
+//  and the last bucket takes everything longer.
+
+//  The actuation edge is caught by the motor ISR (see MotorControl::ArmActuationProbe).
+//  A command that stops a motor makes no edge; it gives up after a second.
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+
+#include <Arduino.h>
+#include <stdint.h>
+#include "MotorControl.h"
+
+#ifndef LATENCY_ONCE
+#define LATENCY_ONCE
+
+#define LATENCY_BUCKETS 21                  // 0uS, then powers of two up to about a second.
+#define LATENCY_ACTUATION_TIMEOUT 1000000   // ticks to wait for an actuation edge.
+
+enum LatencyStages
+{
+  LATENCY_STAGE_FRAME,    // arrival to frame
+  LATENCY_STAGE_PARSE,    // frame to parsed
+  LATENCY_STAGE_REPLY,    // parsed to reply
+  LATENCY_STAGE_ACTUATE,  // parsed to actuation
+  LATENCY_STAGE_TOTAL,    // arrival to reply
+  LATENCY_STAGE_COUNT
+};
+
+struct LatencyHistogram
+{
+  uint32_t Buckets[LATENCY_BUCKETS];
+  uint32_t Count;
+  uint32_t MinUS;
+  uint32_t MaxUS;
+  uint64_t SumUS;
+};
+
+class LatencyManager
+{
+public:
+    LatencyManager();
+    LatencyManager(volatile uint32_t *tickCounter, MotorControl *motorSystem);
+    void Init(volatile uint32_t *tickCounter, MotorControl *motorSystem);
+    void MarkArrival(uint32_t ageUS);        // first byte of a frame, read ageUS after it arrived.
+    void MarkFrame(boolean actuates);        // the ~.  actuates arms the motor edge probe.
+    void MarkParsed();
+    void MarkReply();
+    void Dispatch();                         // collect the actuation edge.  Call from loop().
+    void Clear();
+    String ReadHistograms();                 // returns a JSON object with every stage.
+
+private:
+    void Record(int stage, uint32_t ticks);
+
+    volatile uint32_t *m_tickCounter;
+    MotorControl *m_motorControl;
+    LatencyHistogram m_histograms[LATENCY_STAGE_COUNT];
+    uint32_t m_arrivalTick;
+    uint32_t m_frameTick;
+    uint32_t m_parsedTick;
+    boolean m_waitingForEdge;               // armed the motor probe, haven't seen the edge yet.
+};
+
+#endif
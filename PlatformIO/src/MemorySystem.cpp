@@ -0,0 +1,333 @@
+#include "MemorySystem.h"
+#include <malloc.h>
+
+#if defined(__arm__)
+// linker symbols that bound DTCM's data, bss and stack, and the heap in OCRAM.
+extern unsigned long _sdata;
+extern unsigned long _edata;
+extern unsigned long _sbss;
+extern unsigned long _ebss;
+extern unsigned long _estack;
+extern unsigned long _heap_start;
+extern unsigned long _heap_end;
+#endif
+
+static const char *s_tagNames[MEMORY_TAG_COUNT] = {"Boot", "Power", "Clock", "Safety", "Command", "Program", "Motor", "Odometry", "Latency", "Trace", "Output", "ISR"};
+
+// The allocator hooks are plain C functions, so route them through the one instance.  Anything
+// allocated before Init (static constructors) isn't counted.
+static MemoryManager *s_memoryManager = NULL;
+
+#if defined(__arm__)
+extern "C"
+{
+void *__real_malloc(size_t size);
+void __real_free(void *ptr);
+void *__real_realloc(void *ptr, size_t size);
+void *__real_calloc(size_t count, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    void *ptr = __real_malloc(size);
+    if (s_memoryManager != NULL)
+    {
+        s_memoryManager->OnAllocate(ptr);
+    }
+    return (ptr);
+}
+
+void __wrap_free(void *ptr)
+{
+    if (s_memoryManager != NULL)
+    {
+        s_memoryManager->OnFree(ptr);
+    }
+    __real_free(ptr);
+}
+
+// a realloc is a free of the old block and an allocation of the new one, even when it grows in place.
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    if (s_memoryManager != NULL)
+    {
+        s_memoryManager->OnFree(ptr);
+    }
+    void *grown = __real_realloc(ptr, size);
+    if (s_memoryManager != NULL)
+    {
+        s_memoryManager->OnAllocate((grown != NULL) ? grown : ((size > 0) ? ptr : NULL)); // a failed realloc keeps the old block.
+    }
+    return (grown);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+    void *ptr = __real_calloc(count, size);
+    if (s_memoryManager != NULL)
+    {
+        s_memoryManager->OnAllocate(ptr);
+    }
+    return (ptr);
+}
+}
+#endif
+
+//-----------------------------------------------------------------------------------------
+// Constructor:
+//  Default constructor does nothing.
+MemoryManager::MemoryManager()
+{
+}
+
+//-----------------------------------------------------------------------------------------
+// Init paints the unused stack and starts counting heap traffic, all of it under Boot until loop() runs.
+void MemoryManager::Init()
+{
+    m_tag = MEMORY_TAG_BOOT;
+    m_isProbing = false;
+    m_liveBytes = 0;
+    m_peakLiveBytes = 0;
+    Clear();
+    s_memoryManager = this;
+}
+
+void MemoryManager::SetTag(uint8_t tag)
+{
+    m_tag = tag;
+}
+
+//-----------------------------------------------------------------------------------------
+// Clear zeroes the per-tag counters and the peak, and repaints the stack so the high-water
+// mark starts over.  Live bytes are still live, so they stay.
+void MemoryManager::Clear()
+{
+    noInterrupts();
+    memset(m_counts, 0, sizeof(m_counts));
+    m_peakLiveBytes = m_liveBytes;
+#if defined(__arm__)
+    m_lowestInterruptedSP = (uint32_t)&_estack;
+#else
+    m_lowestInterruptedSP = 0;
+#endif
+    interrupts();
+    PaintStack();
+}
+
+//-----------------------------------------------------------------------------------------
+// Procedure:
+//  PaintStack fills the stack from the end of .bss up to a margin under our own stack pointer.
+//  An interrupt uses the stack under us while it runs and is done before we write again, so
+//  painting with interrupts on is safe.
+void MemoryManager::PaintStack()
+{
+#if defined(__arm__)
+    uint32_t sp;
+    asm volatile("mov %0, sp" : "=r"(sp));
+    volatile uint32_t *word = (volatile uint32_t *)&_ebss;
+    volatile uint32_t *top = (volatile uint32_t *)(sp - MEMORY_PAINT_MARGIN);
+    while (word < top)
+    {
+        *word++ = MEMORY_PAINT;
+    }
+#endif
+}
+
+//-----------------------------------------------------------------------------------------
+// Function:
+//  ReadStackUsed scans up from the end of .bss to the first word that isn't paint.  Everything
+//  above it has been used at some point.
+uint32_t MemoryManager::ReadStackUsed()
+{
+#if defined(__arm__)
+    const uint32_t *word = (const uint32_t *)&_ebss;
+    const uint32_t *top = (const uint32_t *)&_estack;
+    while ((word < top) && (*word == MEMORY_PAINT))
+    {
+        word++;
+    }
+    return ((uint32_t)top - (uint32_t)word);
+#else
+    return (0);
+#endif
+}
+
+//-----------------------------------------------------------------------------------------
+// Function:
+//  IsInInterrupt is true when the IPSR holds an exception number, i.e. we're in an ISR.
+boolean MemoryManager::IsInInterrupt()
+{
+#if defined(__arm__)
+    uint32_t ipsr;
+    asm volatile("mrs %0, ipsr" : "=r"(ipsr));
+    return (ipsr != 0);
+#else
+    return (false);
+#endif
+}
+
+//-----------------------------------------------------------------------------------------
+// Function:
+//  IsMasked is true when interrupts are already off, so the hooks leave them off when they're done.
+boolean MemoryManager::IsMasked()
+{
+#if defined(__arm__)
+    uint32_t primask;
+    asm volatile("mrs %0, primask" : "=r"(primask));
+    return (primask != 0);
+#else
+    return (false);
+#endif
+}
+
+//-----------------------------------------------------------------------------------------
+// OnAllocate counts a block against whoever is running.  Sizes are what the allocator really
+// handed out, so they match what OnFree sees later.
+void MemoryManager::OnAllocate(void *ptr)
+{
+    if ((ptr == NULL) || m_isProbing)
+    {
+        return;
+    }
+    uint32_t size = malloc_usable_size(ptr);
+    uint8_t tag = IsInInterrupt() ? (uint8_t)MEMORY_TAG_ISR : m_tag;
+    MemoryCounts &counts = m_counts[tag];
+    boolean wasMasked = IsMasked();
+    noInterrupts(); // an ISR's allocation must not land between our read and write.
+    counts.Allocations++;
+    counts.BytesAllocated += size;
+    m_liveBytes += size;
+    if (m_liveBytes > m_peakLiveBytes)
+    {
+        m_peakLiveBytes = m_liveBytes;
+    }
+    if (!wasMasked)
+    {
+        interrupts();
+    }
+}
+
+void MemoryManager::OnFree(void *ptr)
+{
+    if ((ptr == NULL) || m_isProbing)
+    {
+        return;
+    }
+    uint32_t size = malloc_usable_size(ptr);
+    uint8_t tag = IsInInterrupt() ? (uint8_t)MEMORY_TAG_ISR : m_tag;
+    MemoryCounts &counts = m_counts[tag];
+    boolean wasMasked = IsMasked();
+    noInterrupts();
+    counts.Frees++;
+    counts.BytesFreed += size;
+    m_liveBytes -= size;
+    if (!wasMasked)
+    {
+        interrupts();
+    }
+}
+
+//-----------------------------------------------------------------------------------------
+// Function:
+//  FindLargestFreeBlock binary searches for the biggest malloc that succeeds, up to freeBytes.
+//  Fragmentation is free heap that isn't in this block.
+uint32_t MemoryManager::FindLargestFreeBlock(uint32_t freeBytes)
+{
+    uint32_t low = 0;
+    uint32_t high = freeBytes;
+    m_isProbing = true;
+    while (low < high)
+    {
+        uint32_t size = low + ((high - low + 1) / 2);
+        void *probe = malloc(size);
+        if (probe != NULL)
+        {
+            free(probe);
+            low = size;
+        }
+        else
+        {
+            high = size - 1;
+        }
+    }
+    m_isProbing = false;
+    return (low);
+}
+
+//-----------------------------------------------------------------------------------------
+// ReadStatistics returns a JSON object with the stack high-water mark, static RAM, heap free and
+// largest block, and each tag's heap traffic as [allocations, frees, bytes allocated, bytes freed].
+String MemoryManager::ReadStatistics()
+{
+#if defined(__arm__)
+    uint32_t stackSize = (uint32_t)&_estack - (uint32_t)&_ebss;
+    uint32_t stackUsed = ReadStackUsed();
+    uint32_t dataSize = (uint32_t)&_edata - (uint32_t)&_sdata;
+    uint32_t bssSize = (uint32_t)&_ebss - (uint32_t)&_sbss;
+    uint32_t dmaMemSize = (uint32_t)&_heap_start - MEMORY_RAM2_START;
+    uint32_t heapSize = (uint32_t)&_heap_end - (uint32_t)&_heap_start;
+    struct mallinfo info = mallinfo();
+    uint32_t heapFree = (heapSize - info.arena) + info.fordblks; // never claimed from sbrk, plus freed inside the arena.
+    uint32_t largest = FindLargestFreeBlock(heapFree);
+    uint32_t stackTop = (uint32_t)&_estack;
+#else
+    uint32_t stackSize = 0;
+    uint32_t stackUsed = 0;
+    uint32_t dataSize = 0;
+    uint32_t bssSize = 0;
+    uint32_t dmaMemSize = 0;
+    uint32_t heapSize = 0;
+    uint32_t heapFree = 0;
+    uint32_t largest = 0;
+    uint32_t stackTop = 0;
+#endif
+    noInterrupts();
+    MemoryCounts counts[MEMORY_TAG_COUNT];
+    memcpy(counts, m_counts, sizeof(counts));
+    uint32_t interruptedDepth = stackTop - m_lowestInterruptedSP;
+    int32_t liveBytes = m_liveBytes;
+    int32_t peakLiveBytes = m_peakLiveBytes;
+    interrupts();
+
+    String Text = String("");
+    Text += String("{'Memory' : {'Stack':{'Size':");
+    Text += String(stackSize);
+    Text += String(",'Used':");
+    Text += String(stackUsed);
+    Text += String(",'Free':");
+    Text += String(stackSize - stackUsed);
+    Text += String(",'ISREntryDepth':");
+    Text += String(interruptedDepth);
+    Text += String("},'Static':{'Data':");
+    Text += String(dataSize);
+    Text += String(",'Bss':");
+    Text += String(bssSize);
+    Text += String(",'DmaMem':");
+    Text += String(dmaMemSize);
+    Text += String("},'Heap':{'Size':");
+    Text += String(heapSize);
+    Text += String(",'Free':");
+    Text += String(heapFree);
+    Text += String(",'Largest':");
+    Text += String(largest);
+    Text += String(",'Live':");
+    Text += String(liveBytes);
+    Text += String(",'Peak':");
+    Text += String(peakLiveBytes);
+    Text += String("},'Allocs':{");
+    for (int tag = 0; tag < MEMORY_TAG_COUNT; tag++)
+    {
+        Text += String((tag > 0) ? ",'" : "'");
+        Text += String(s_tagNames[tag]);
+        Text += String("':[");
+        Text += String(counts[tag].Allocations);
+        Text += String(",");
+        Text += String(counts[tag].Frees);
+        Text += String(",");
+        Text += String(counts[tag].BytesAllocated);
+        Text += String(",");
+        Text += String(counts[tag].BytesFreed);
+        Text += String("]");
+    }
+    Text += String("}}}");
+    return (Text);
+}
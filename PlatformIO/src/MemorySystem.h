@@ -0,0 +1,129 @@
+// ---------------------------------------------------------------------------
+// Memory Library - v0.0.1 - 07/12/2020
+//
+// AUTHOR/LICENSE:
+// Created by Imran Peerbhai -- ipeerbhai@aol.com
+// Copyright 2020 License:
+// Forks and derivitive works are NOT permitted without
+// permission. Permission is only granted to use as-is for private and
+// non-commercial use by natural persons or non-profit entities.
+// For-profit entities require a license.
+//
+// CONTRIBUTIONS:
+// If you wish to contribute, make changes, or enhancements,
+// please create a pull request.
+//
+// DISCLAIMER:
+// This software is furnished "as is", without technical support, and with no
+// warranty, express or implied, as to its usefulness for any purpose.
+// ---------------------------------------------------------------------------
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+// Theory of Operation:
+
+//  Arduino Strings allocate, and the Teensy has crashed on allocation before
+//  (see ReadSerialPortData).  This subsystem shows where memory goes, so we can
+//  prove the hot paths allocate nothing and see fragmentation coming.
+
+//  Stack: the Teensy runs loop() and every interrupt on one stack, at the top of
+//  DTCM above .bss.  Init paints everything below the stack pointer with a known
+//  word; the deepest word no longer painted is the high-water mark, interrupts
+//  nested on top of the deepest loop() call included.  There is no separate ISR
+//  stack to paint, so the tick ISR also samples the stack pointer on entry: that
+//  is how deep loop() was when an interrupt arrived.  The difference between the
+//  two is roughly what the interrupts themselves used.
+
+//  Heap: platformio.ini links with --wrap for malloc, free, realloc and calloc, so
+//  every allocation passes through here.  loop() tags each subsystem before it
+//  runs, and allocations are counted against the current tag -- or against ISR,
+//  which should always read 0.  Free heap comes from mallinfo(); the largest free
+//  block is found by probing malloc, since newlib doesn't keep it.
+
+//  "a~" returns all of it, "a0~" clears the counters and repaints the stack.  The
+//  report is built with Strings, so it counts its own allocations under Command.
+
+//  Off ARM -- the host build, Host/TeensyBotSim.cpp -- there is no DTCM stack,
+//  linker map or wrapped newlib heap to look at.  The report keeps its shape, but
+//  every number in it reads 0.
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+
+#include <Arduino.h>
+#include <stdint.h>
+
+#ifndef MEMORY_ONCE
+#define MEMORY_ONCE
+
+#define MEMORY_PAINT 0xC5C5C5C5      // unused stack words hold this.
+#define MEMORY_PAINT_MARGIN 256      // bytes under the stack pointer left alone while painting.
+#define MEMORY_RAM2_START 0x20200000 // OCRAM, where DMAMEM and then the heap live.
+
+// who was running when memory was allocated or freed.
+enum MemoryTags
+{
+  MEMORY_TAG_BOOT,
+  MEMORY_TAG_POWER,
+  MEMORY_TAG_CLOCK,
+  MEMORY_TAG_SAFETY,
+  MEMORY_TAG_COMMAND,
+  MEMORY_TAG_PROGRAM,
+  MEMORY_TAG_MOTOR,
+  MEMORY_TAG_ODOMETRY,
+  MEMORY_TAG_LATENCY,
+  MEMORY_TAG_TRACE,
+  MEMORY_TAG_OUTPUT,
+  MEMORY_TAG_ISR,
+  MEMORY_TAG_COUNT
+};
+
+// heap traffic for one tag.
+struct MemoryCounts
+{
+  uint32_t Allocations;
+  uint32_t Frees;
+  uint32_t BytesAllocated;
+  uint32_t BytesFreed;
+};
+
+class MemoryManager
+{
+public:
+    MemoryManager();
+    void Init();                 // paint the stack and start counting.  Call first thing in setup().
+    void SetTag(uint8_t tag);    // what loop() is about to run.
+    void Clear();                // zero the counters and repaint the stack.
+    String ReadStatistics();     // returns a JSON object with stack, static RAM and heap use.
+    void OnAllocate(void *ptr);  // from the allocator hooks.
+    void OnFree(void *ptr);
+
+    // call at the top of the tick ISR.  A move and a compare.
+    inline void SampleInterruptedStack()
+    {
+#if defined(__arm__)
+        uint32_t sp;
+        asm volatile("mov %0, sp" : "=r"(sp));
+        if (sp < m_lowestInterruptedSP)
+        {
+            m_lowestInterruptedSP = sp;
+        }
+#endif
+    }
+
+private:
+    void PaintStack();
+    uint32_t ReadStackUsed();
+    uint32_t FindLargestFreeBlock(uint32_t freeBytes);
+    static boolean IsInInterrupt();
+    static boolean IsMasked();
+
+    volatile uint8_t m_tag;
+    boolean m_isProbing;         // FindLargestFreeBlock's own mallocs aren't counted.
+    MemoryCounts m_counts[MEMORY_TAG_COUNT];
+    int32_t m_liveBytes;         // allocated and not yet freed, by usable size.
+    int32_t m_peakLiveBytes;
+    volatile uint32_t m_lowestInterruptedSP;
+};
+
+#endif
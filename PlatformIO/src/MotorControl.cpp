@@ -1,4 +1,22 @@
 #include "MotorControl.h"
+#include "WaveSystem.h"
+
+// How DispatchMotor writes a pulse pin: from the bank at runtime, or a pin known at compile time.
+struct RuntimePinWriter
+{
+    int8_t Pin;
+    void operator()(uint8_t level) const { digitalWrite(Pin, level); }
+};
+
+template <int8_t Pin>
+struct ConstantPinWriter
+{
+    void operator()(uint8_t level) const { digitalWriteFast(Pin, level); }
+};
+
+#ifdef ROBOT_PROFILE_MOTOR_COUNT
+static_assert(ROBOT_PROFILE_MOTOR_COUNT <= MOTOR_CAPACITY, "the robot profile has more motors than MOTOR_CAPACITY");
+#endif
 
 // --------------------------------------------------------------------------------------------------------------------
 // Constructor:
@@ -10,78 +28,422 @@ MotorControl::MotorControl()
 // --------------------------------------------------------------------------------------------------------------------
 // Constructor:
 //  MotorControl is a class that defines tick-counts needed to control different types of motors.
-MotorControl::MotorControl(int howMany, volatile uint32_t *tickCounter, uint32_t *prevTickCounter, SafetyManager *safetyPtr)
+MotorControl::MotorControl(int howMany, volatile uint32_t *tickCounter, uint32_t *prevTickCounter, SafetyManager *safetyPtr, OutputQueue *outputQueue, TraceRecorder *trace, ClockManager *clock, WaveformManager *waveform)
 {
-    Init(howMany, tickCounter, prevTickCounter, safetyPtr);
+    Init(howMany, tickCounter, prevTickCounter, safetyPtr, outputQueue, trace, clock, waveform);
 }
 
 // --------------------------------------------------------------------------------------------------------------------
 // Procedure:
 //  Initialize the instance
-void MotorControl::Init(int howMany, volatile uint32_t *tickCounter, uint32_t *prevTickCounter, SafetyManager *safetyPtr)
+void MotorControl::Init(int howMany, volatile uint32_t *tickCounter, uint32_t *prevTickCounter, SafetyManager *safetyPtr, OutputQueue *outputQueue, TraceRecorder *trace, ClockManager *clock, WaveformManager *waveform)
 {
+    m_outputQueue = outputQueue;
+    m_trace = trace;
+    m_clock = clock;
+    m_waveform = waveform;
 
+    // the bank can't hold more than its compile-time capacity.
+    if (howMany < 0)
+    {
+        howMany = 0;
+    }
+    if (howMany > MotorBank<MOTOR_CAPACITY>::capacity)
+    {
+        m_outputQueue->Println("{'Error' : 'Motor count exceeds capacity'}");
+        howMany = MotorBank<MOTOR_CAPACITY>::capacity;
+    }
+    m_motors = &m_banks[0];
+    m_staged = &m_banks[1];
     m_motorCount = (uint8_t)howMany;
+    m_stagedCount = 0;
     m_tickCounter = tickCounter;
     m_prevTickCounter = prevTickCounter;
     m_selectedMotor = 0;
+    m_probeArmed = false;
+    m_probeAdopted = false;
+    m_probeEdgeTick = 0;
+    m_profileMatches = false;
+    m_forceGeneric = false;
+    ClearDispatchCycles();
+    for (int i = 0; i < MOTOR_CAPACITY; i++)
+    {
+        m_isLoopOwned[i] = false;
+    }
+
+    // start every motor with an empty, already-adopted shadow set.
+    for (m_selectedMotor = 0; m_selectedMotor < m_motorCount; m_selectedMotor++)
+    {
+        ResetMotor(m_motors, m_selectedMotor);
+    }
+    m_selectedMotor = 0;
 
     // grab pointer to the global safety manager.
     m_safetyManager = safetyPtr;
-    Serial.println("Motor system Initialized");
-    Serial.flush();
+    m_outputQueue->Println("Motor system Initialized");
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Procedure:
+//  ResetMotor puts one slot of a bank back to a motor with no pins that has never run.
+void MotorControl::ResetMotor(MotorBank<MOTOR_CAPACITY> *bank, int idx)
+{
+    bank->EnablePin[idx] = -1;
+    bank->DirPin[idx] = -1;
+    bank->PulsePin[idx] = -1;
+    bank->PulseState[idx] = MOTOR_PULSE_UNKNOWN;
+    bank->Interval[idx] = 0;
+    bank->DutyInterval[idx] = 0;
+    bank->ShadowInterval[idx] = 0;
+    bank->ShadowDutyInterval[idx] = 0;
+    bank->ShadowSequence[idx] = 0;
+    bank->AppliedSequence[idx] = 0;
+    bank->PeriodStartTick[idx] = 0;
+    bank->Mode[idx] = MOTOR_MODE_INTERVAL;
+    bank->ShadowMode[idx] = MOTOR_MODE_INTERVAL;
+    bank->Phase[idx] = 0;
+    bank->PhaseIncrement[idx] = 0;
+    bank->ShadowPhaseIncrement[idx] = 0;
+    bank->PulseTicksLeft[idx] = 0;
+    bank->Direction[idx] = 0;
+    bank->StepCount[idx] = 0;
+    bank->SpeedCap[idx] = MOTOR_SPEED_CAP_FULL;
+    bank->CappedInterval[idx] = 0;
+    bank->CappedIncrement[idx] = 0;
+    bank->SlewState[idx] = SERVO_SLEW_IDLE;
+    bank->SlewArrivedTick[idx] = 0;
+    bank->ExternalDrive[idx] = 0;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Procedure:
+//  BeginConfiguration empties the spare bank for howMany motors.  The live bank keeps running untouched
+//  until CommitConfiguration.
+void MotorControl::BeginConfiguration(int howMany)
+{
+    if (howMany < 0)
+    {
+        howMany = 0;
+    }
+    if (howMany > m_staged->capacity)
+    {
+        m_outputQueue->Println("{'Error' : 'Motor count exceeds capacity'}");
+        howMany = m_staged->capacity;
+    }
+    m_stagedCount = (uint8_t)howMany;
+    for (int idx = 0; idx < m_stagedCount; idx++)
+    {
+        ResetMotor(m_staged, idx);
+    }
 }
 
 // --------------------------------------------------------------------------------------------------------------------
 // Procedure:
-//  Configure a specific motor.
+//  Configure a specific motor in the configuration being built.  Its timings become the shadow set the ISR
+//  adopts after the switch.
 void MotorControl::ConfigureMotor(int motorIndex, int8_t enablePin, int8_t dirPin, int8_t pulsePin, uint32_t interval, uint32_t dutyInterval)
 {
-    Serial.println("Configuring Specific Motor");
-    Serial.flush();
+    m_outputQueue->Println("Configuring Specific Motor");
     // only run if the motor index is between 0 and motorcount -1
-    if ((motorIndex < 0) || (motorIndex >= m_motorCount))
+    if ((motorIndex < 0) || (motorIndex >= m_stagedCount))
     {
         return;
     }
-    m_motors[motorIndex].EnablePin = enablePin;
-    m_motors[motorIndex].DirPin = dirPin;
-    m_motors[motorIndex].PulsePin = pulsePin;
-    m_motors[motorIndex].Interval = interval;
-    m_motors[motorIndex].DutyInterval = dutyInterval;
+    if (dutyInterval > interval)
+    {
+        dutyInterval = interval; // can't be high for longer than the period.
+    }
+    m_staged->EnablePin[motorIndex] = enablePin;
+    m_staged->DirPin[motorIndex] = dirPin;
+    m_staged->PulsePin[motorIndex] = pulsePin;
+    m_staged->Direction[motorIndex] = (dirPin >= 0) ? 1 : 0;
+    m_staged->ShadowMode[motorIndex] = MOTOR_MODE_INTERVAL;
+    m_staged->ShadowInterval[motorIndex] = interval;
+    m_staged->ShadowDutyInterval[motorIndex] = dutyInterval;
 }
 
 // --------------------------------------------------------------------------------------------------------------------
 // Procedure:
-//  Actually set output pin levels based on time.  Call this from a 1 microsecond interrupt timer via a function pointer for performance.
-void MotorControl::Dispatch()
+//  CommitConfiguration makes the configuration being built the live one.  It must run with interrupts off,
+//  so the ISR finishes one tick on the old bank and starts the next on the new one.
+void MotorControl::CommitConfiguration()
 {
-    for (m_selectedMotor = 0; m_selectedMotor < m_motorCount; m_selectedMotor++)
+    m_waveform->Release(); // pins are about to change, the ISR takes every motor back first.
+    for (int idx = 0; idx < m_stagedCount; idx++)
+    {
+        if ((idx < m_motorCount) &&
+            (m_staged->EnablePin[idx] == m_motors->EnablePin[idx]) &&
+            (m_staged->DirPin[idx] == m_motors->DirPin[idx]) &&
+            (m_staged->PulsePin[idx] == m_motors->PulsePin[idx]))
+        {
+            CarryMotor(idx);
+        }
+        m_staged->ShadowSequence[idx] = m_staged->AppliedSequence[idx] + 2; // complete and not yet adopted.
+    }
+
+    MotorBank<MOTOR_CAPACITY> *previous = m_motors;
+    m_motors = m_staged;
+    m_staged = previous;
+    m_motorCount = m_stagedCount;
+    m_stagedCount = 0;
+    UpdateProfileMatch();
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Procedure:
+//  CarryMotor copies a live motor's running state into the same slot of the new bank: where it is in its
+//  pulse, its phase, its step count and its speed cap.  The new timings stay in the shadow set.  A servo move
+//  in progress is dropped, the new configuration sets the servo's position.
+void MotorControl::CarryMotor(int idx)
+{
+    m_staged->PulseState[idx] = m_motors->PulseState[idx];
+    m_staged->Interval[idx] = m_motors->Interval[idx];
+    m_staged->DutyInterval[idx] = m_motors->DutyInterval[idx];
+    m_staged->PeriodStartTick[idx] = m_motors->PeriodStartTick[idx];
+    m_staged->AppliedSequence[idx] = m_motors->AppliedSequence[idx];
+    m_staged->Mode[idx] = m_motors->Mode[idx];
+    m_staged->Phase[idx] = m_motors->Phase[idx];
+    m_staged->PhaseIncrement[idx] = m_motors->PhaseIncrement[idx];
+    m_staged->PulseTicksLeft[idx] = m_motors->PulseTicksLeft[idx];
+    m_staged->Direction[idx] = m_motors->Direction[idx];
+    m_staged->StepCount[idx] = m_motors->StepCount[idx];
+    m_staged->SpeedCap[idx] = m_motors->SpeedCap[idx];
+    m_staged->CappedInterval[idx] = m_motors->CappedInterval[idx];
+    m_staged->CappedIncrement[idx] = m_motors->CappedIncrement[idx];
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Procedure:
+//  One motor's share of a tick.  IsStepper is a template argument so servos don't carry the phase mode and
+//  step counting branches, and writePulse is too so a constant pin compiles to a single GPIO store.
+template <bool IsStepper, typename PinWriter>
+inline void MotorControl::DispatchMotor(uint8_t idx, uint32_t now, const PinWriter &writePulse)
+{
+    if (IsStepper && m_motors->ExternalDrive[idx])
+    {
+        return; // the waveform engine has it.
+    }
+    uint8_t desiredState = LOW;
+    if (IsStepper && (m_motors->Mode[idx] == MOTOR_MODE_PHASE))
+    {
+        desiredState = DispatchPhaseMode(idx);
+    }
+    else
     {
-        m_motors[m_selectedMotor].TicksLeft = *m_tickCounter % m_motors[m_selectedMotor].Interval;
+        uint32_t ticksIntoPeriod = now - m_motors->PeriodStartTick[idx];
+
+        // at the end of a pulse period, pick up any newly published timings.
+        // An interval of 0 has no period, so every tick is a boundary.
+        if (ticksIntoPeriod >= m_motors->CappedInterval[idx])
+        {
+            AdoptShadowTimings(idx);
+            if (!IsStepper && (m_motors->SlewState[idx] != SERVO_SLEW_IDLE))
+            {
+                SlewServo(idx, now);
+            }
+            m_motors->PeriodStartTick[idx] = now;
+            ticksIntoPeriod = 0;
+        }
 
         // figure out if we've hit the cycle
-        if (m_motors[m_selectedMotor].TicksLeft < m_motors[m_selectedMotor].DutyInterval)
+        if ((m_motors->CappedInterval[idx] > 0) && (ticksIntoPeriod < m_motors->DutyInterval[idx]))
         {
-            m_motors[m_selectedMotor].PulseDesiredState = HIGH;
+            desiredState = HIGH;
         }
-        else
+    }
+
+    // change pin state only on an edge.  Pulling low is always allowed,
+    // but only drive high if the safety system says we're safe.
+    if (desiredState != m_motors->PulseState[idx])
+    {
+        if ((desiredState == LOW) || m_safetyManager->IsSafe())
         {
-            m_motors[m_selectedMotor].PulseDesiredState = LOW;
+            writePulse(desiredState);
+            m_motors->PulseState[idx] = desiredState;
+            if (m_probeAdopted)
+            {
+                m_probeEdgeTick = now;
+                m_probeAdopted = false;
+            }
+            if (IsStepper && (desiredState == HIGH))
+            {
+                m_motors->StepCount[idx] += m_motors->Direction[idx];
+                m_trace->RecordStepEdge(idx, m_motors->StepCount[idx]);
+            }
         }
+    }
+}
+
+#ifdef ROBOT_PROFILE_MOTOR_COUNT
+// --------------------------------------------------------------------------------------------------------------------
+// Procedure:
+//  The profiled dispatch: motor Index with its type and pulse pin from the profile, then the next one.
+//  The recursion is resolved at compile time, so this is a straight line of DispatchMotor bodies.
+template <uint8_t Index>
+inline void MotorControl::DispatchProfile(uint32_t now)
+{
+    DispatchMotor<(s_robotProfile[Index].DirPin >= 0)>(Index, now, ConstantPinWriter<s_robotProfile[Index].PulsePin>());
+    DispatchProfile<Index + 1>(now);
+}
 
-        // change pin state and dispatch the pin if needed
+template <>
+inline void MotorControl::DispatchProfile<ROBOT_PROFILE_MOTOR_COUNT>(uint32_t now)
+{
+}
+#endif
 
-        if (m_motors[m_selectedMotor].DutyInterval > 0)
+// --------------------------------------------------------------------------------------------------------------------
+// Procedure:
+//  Actually set output pin levels based on time.  Call this from a 1 microsecond interrupt timer via a function pointer for performance.
+void MotorControl::Dispatch()
+{
+    uint32_t startCycles = ARM_DWT_CYCCNT;
+    uint32_t now = *m_tickCounter;
+    uint8_t path = DISPATCH_GENERIC;
+#ifdef ROBOT_PROFILE_MOTOR_COUNT
+    if (m_profileMatches && !m_forceGeneric)
+    {
+        DispatchProfile<0>(now);
+        path = DISPATCH_PROFILE;
+    }
+    else
+#endif
+    {
+        for (m_selectedMotor = 0; m_selectedMotor < m_motorCount; m_selectedMotor++)
         {
-            // verify we're safe before we actually write...
-            // but only if we're safe to do so.
-            if (m_safetyManager->IsSafe())
+            RuntimePinWriter writePulse = {m_motors->PulsePin[m_selectedMotor]};
+            if (m_motors->DirPin[m_selectedMotor] >= 0)
+            {
+                DispatchMotor<true>(m_selectedMotor, now, writePulse);
+            }
+            else
             {
-                digitalWrite(m_motors[m_selectedMotor].PulsePin, m_motors[m_selectedMotor].PulseDesiredState);
+                DispatchMotor<false>(m_selectedMotor, now, writePulse);
             }
         }
     }
+
+    uint32_t cycles = ARM_DWT_CYCCNT - startCycles;
+    DispatchCycles &stats = m_cycles[path];
+    stats.Ticks++;
+    stats.TotalCycles += cycles;
+    if (cycles > stats.MaxCycles)
+    {
+        stats.MaxCycles = cycles;
+    }
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Procedure:
+//  Called from the ISR at a period boundary.  Copy the shadow timings into the live set if a complete,
+//  not yet adopted, set has been published.  An odd sequence means the command path is mid-write; we
+//  keep the old timings and try again on the next tick.
+void MotorControl::AdoptShadowTimings(int idx)
+{
+    uint32_t sequence = m_motors->ShadowSequence[idx];
+    if (((sequence & 1) == 0) && (sequence != m_motors->AppliedSequence[idx]))
+    {
+        if (m_motors->ShadowMode[idx] != m_motors->Mode[idx])
+        {
+            // switching modes, start the new one from a clean phase.
+            m_motors->Mode[idx] = m_motors->ShadowMode[idx];
+            m_motors->Phase[idx] = 0;
+            m_motors->PulseTicksLeft[idx] = 0;
+        }
+        m_motors->Interval[idx] = m_motors->ShadowInterval[idx];
+        m_motors->DutyInterval[idx] = m_motors->ShadowDutyInterval[idx];
+        m_motors->PhaseIncrement[idx] = m_motors->ShadowPhaseIncrement[idx];
+        m_motors->AppliedSequence[idx] = sequence;
+        ApplySpeedCap(idx);
+        if (m_probeArmed)
+        {
+            m_probeArmed = false;
+            m_probeAdopted = true;
+        }
+    }
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Procedure:
+//  AdoptNow takes a motor's published shadow set without waiting for its period boundary, ends any pulse in
+//  progress, and starts a fresh period on this tick.  Call with interrupts off.  Motors the waveform engine
+//  drives pick the set up at its next refill instead.
+void MotorControl::AdoptNow(int idx)
+{
+    AdoptShadowTimings(idx);
+    m_motors->PeriodStartTick[idx] = *m_tickCounter;
+    m_motors->PulseTicksLeft[idx] = 0;
+    if (!m_motors->ExternalDrive[idx] && (m_motors->PulseState[idx] != LOW))
+    {
+        SafeDigitalWrite(m_motors->PulsePin[idx], LOW);
+        m_motors->PulseState[idx] = LOW;
+    }
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Function:
+//  Called from the ISR for a motor in phase-accumulator mode.  Advances the phase by one tick and
+//  returns the level the pulse pin should have.  A carry out of the phase starts a step pulse.
+uint8_t MotorControl::DispatchPhaseMode(int idx)
+{
+    // between pulses is the only safe point to pick up a new frequency or mode.
+    if (m_motors->PulseTicksLeft[idx] == 0)
+    {
+        AdoptShadowTimings(idx);
+        if (m_motors->Mode[idx] != MOTOR_MODE_PHASE)
+        {
+            return (LOW); // switched back to interval mode, it takes over next tick.
+        }
+    }
+
+    uint32_t previousPhase = m_motors->Phase[idx];
+    m_motors->Phase[idx] = previousPhase + m_motors->CappedIncrement[idx];
+    if (m_motors->Phase[idx] < previousPhase)
+    {
+        m_motors->PulseTicksLeft[idx] = PHASE_PULSE_TICKS;
+    }
+
+    if (m_motors->PulseTicksLeft[idx] > 0)
+    {
+        m_motors->PulseTicksLeft[idx]--;
+        return (HIGH);
+    }
+    return (LOW);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Procedure:
+//  Fill the shadow timings for a motor and publish them to the ISR.  Never touches the live timings.
+void MotorControl::PublishTimings(int idx, uint32_t interval, uint32_t dutyInterval)
+{
+    if (dutyInterval > interval)
+    {
+        dutyInterval = interval; // can't be high for longer than the period.
+    }
+    m_motors->ShadowSequence[idx]++; // odd -- ISR ignores the shadow until we finish.
+    m_motors->ShadowMode[idx] = MOTOR_MODE_INTERVAL;
+    m_motors->ShadowInterval[idx] = interval;
+    m_motors->ShadowDutyInterval[idx] = dutyInterval;
+    m_motors->ShadowSequence[idx]++; // even -- complete, adopt at the next period boundary.
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Procedure:
+//  Publish a phase increment to the ISR and put the motor in phase-accumulator mode.
+void MotorControl::PublishFrequency(int idx, uint32_t phaseIncrement)
+{
+    if (m_motors->DirPin[idx] < 0)
+    {
+        return; // servos have a position, not a step rate.
+    }
+    if (phaseIncrement > PHASE_MAX_INCREMENT)
+    {
+        phaseIncrement = PHASE_MAX_INCREMENT;
+    }
+    m_motors->ShadowSequence[idx]++; // odd -- ISR ignores the shadow until we finish.
+    m_motors->ShadowMode[idx] = MOTOR_MODE_PHASE;
+    m_motors->ShadowPhaseIncrement[idx] = phaseIncrement;
+    m_motors->ShadowSequence[idx]++; // even -- complete, adopt between step pulses.
 }
 
 // --------------------------------------------------------------------------------------------------------------------
@@ -95,23 +457,40 @@ void MotorControl::SafeDigitalWrite(int pin, int level)
     }
 }
 
+// --------------------------------------------------------------------------------------------------------------------
+// Procedure:
+//  Write the dir pin and remember which way step counts should go.  Motors without a dir pin don't count.
+void MotorControl::SetDirection(int idx, int level)
+{
+    if (m_motors->DirPin[idx] < 0)
+    {
+        return;
+    }
+    SafeDigitalWrite(m_motors->DirPin[idx], level);
+    m_motors->Direction[idx] = (level == HIGH) ? 1 : -1;
+}
+
 // --------------------------------------------------------------------------------------------------------------------
 // Procedure:
 //  Update the timings the motor is using for dispatch.  Basically, re-configure the running motor.
 void MotorControl::UpdateMotorTimings(int idx, String command)
 {
+    if ((idx < 0) || (idx >= m_motorCount) || m_isLoopOwned[idx])
+    {
+        return; // do nothing, we don't have that motor or its loop drives it.
+    }
     boolean isStepper = false;
     if (command[0] == '+')
     {
         // stepper, moving in + direction
         isStepper = true;
-        SafeDigitalWrite(m_motors[idx].DirPin, HIGH);
+        SetDirection(idx, HIGH);
     }
     else if (command[0] == '-')
     {
         // stepper, moving in - direction
         isStepper = true;
-        SafeDigitalWrite(m_motors[idx].DirPin, LOW);
+        SetDirection(idx, LOW);
     }
     // extract the interval or dutyinterval
     int32_t someInterval = 0;
@@ -119,17 +498,303 @@ void MotorControl::UpdateMotorTimings(int idx, String command)
     if (isStepper)
     {
         // It's a stepper, we're getting an interval with 50% duty cycle.
-        String intervalString = command.substring(1, command.length() - 1);
+        String intervalString = command.substring(1);
         someInterval = intervalString.toInt();
-        m_motors[idx].Interval = someInterval;
-        m_motors[idx].DutyInterval = someInterval / 2;
+        PublishTimings(idx, someInterval, someInterval / 2);
     }
     else
     {
         // It's a servo, with a fixed interval and we need to set the duty interval.
         someInterval = command.toInt();
-        m_motors[idx].DutyInterval = someInterval;
+        SetServoDuty(idx, someInterval);
+    }
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Procedure:
+//  SetStepInterval is UpdateMotorTimings for a stepper without the string: the sign sets direction,
+//  the magnitude is the interval in ticks, run at a 50% duty cycle.  0 keeps the direction and stops pulsing.
+void MotorControl::SetStepInterval(int idx, int32_t signedInterval)
+{
+    if ((idx < 0) || (idx >= m_motorCount) || m_isLoopOwned[idx])
+    {
+        return; // do nothing, we don't have that motor or its loop drives it.
+    }
+    if (signedInterval != 0)
+    {
+        SetDirection(idx, (signedInterval > 0) ? HIGH : LOW);
     }
+    uint32_t interval = (signedInterval >= 0) ? (uint32_t)signedInterval : 0u - (uint32_t)signedInterval;
+    PublishTimings(idx, interval, interval / 2);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Procedure:
+//  SetServoDuty sets a servo's on-time, keeping its interval.
+void MotorControl::SetServoDuty(int idx, uint32_t dutyInterval)
+{
+    if ((idx < 0) || (idx >= m_motorCount) || m_isLoopOwned[idx])
+    {
+        return; // do nothing, we don't have that motor or its loop drives it.
+    }
+    m_motors->SlewState[idx] = SERVO_SLEW_IDLE; // a direct position overrides a move in progress.
+    PublishTimings(idx, m_motors->ShadowInterval[idx], dutyInterval);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Procedure:
+//  MoveServo starts a servo toward targetDuty at up to ratePerSecond duty ticks per second, speeding up and
+//  slowing down at accelPerSecond ticks per second squared (0 for no ramp).  Rates are turned into per-frame
+//  fixed point here, so the ISR only adds and compares.
+void MotorControl::MoveServo(int idx, uint32_t targetDuty, uint32_t ratePerSecond, uint32_t accelPerSecond)
+{
+    if ((idx < 0) || (idx >= m_motorCount) || (m_motors->DirPin[idx] >= 0) || m_isLoopOwned[idx])
+    {
+        return; // only servos slew, and not under a velocity loop.
+    }
+    uint32_t target;
+    uint32_t maxRate;
+    uint32_t accel;
+    ComputeSlew(m_motors->ShadowInterval[idx], targetDuty, ratePerSecond, accelPerSecond, &target, &maxRate, &accel);
+
+    noInterrupts();
+    m_motors->SlewTarget[idx] = target;
+    m_motors->SlewMaxRate[idx] = maxRate;
+    m_motors->SlewAccel[idx] = accel;
+    m_motors->SlewArrivedTick[idx] = 0;
+    m_motors->SlewState[idx] = SERVO_SLEW_STARTING;
+    interrupts();
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Procedure:
+//  ComputeSlew turns a move into the fixed point target, rate and acceleration the ISR runs on, for a servo
+//  with the given frame interval.
+void MotorControl::ComputeSlew(uint32_t interval, uint32_t targetDuty, uint32_t ratePerSecond, uint32_t accelPerSecond, uint32_t *target, uint32_t *maxRate, uint32_t *accel)
+{
+    if (targetDuty > interval)
+    {
+        targetDuty = interval; // can't be high for longer than the period.
+    }
+    double framesPerSecond = (interval > 0) ? ((double)TICK_RATE_HZ / interval) : 1.0;
+    double rate = (ratePerSecond * (double)(1 << SERVO_SLEW_SHIFT)) / framesPerSecond;
+    double ramp = (accelPerSecond * (double)(1 << SERVO_SLEW_SHIFT)) / (framesPerSecond * framesPerSecond);
+    *target = targetDuty << SERVO_SLEW_SHIFT;
+    *maxRate = (rate < 1.0) ? 1 : (uint32_t)rate;
+    *accel = (accelPerSecond == 0) ? 0 : ((ramp < 1.0) ? 1 : (uint32_t)ramp);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Procedure:
+//  Called from the ISR once per servo frame while a move is in progress.  Steps the live duty interval one
+//  frame's worth toward the target.  While the safety system says stop, the servo holds where it is.
+void MotorControl::SlewServo(int idx, uint32_t now)
+{
+    if (m_motors->SlewState[idx] == SERVO_SLEW_STARTING)
+    {
+        m_motors->SlewPosition[idx] = m_motors->DutyInterval[idx] << SERVO_SLEW_SHIFT;
+        m_motors->SlewRate[idx] = (m_motors->SlewAccel[idx] == 0) ? m_motors->SlewMaxRate[idx] : 0;
+        m_motors->SlewState[idx] = SERVO_SLEW_MOVING;
+    }
+    if (!m_safetyManager->IsSafe())
+    {
+        return;
+    }
+
+    uint32_t position = m_motors->SlewPosition[idx];
+    uint32_t target = m_motors->SlewTarget[idx];
+    uint32_t remaining = (target > position) ? (target - position) : (position - target);
+    uint32_t accel = m_motors->SlewAccel[idx];
+    uint32_t rate = m_motors->SlewRate[idx];
+    if (accel > 0)
+    {
+        // ramp up to the max rate, and down again once the stopping distance reaches what's left.
+        uint64_t stopping = ((uint64_t)rate * rate) / (2 * accel);
+        if (stopping >= remaining)
+        {
+            rate = (rate > (2 * accel)) ? (rate - accel) : accel;
+        }
+        else if (rate < m_motors->SlewMaxRate[idx])
+        {
+            rate += accel;
+            if (rate > m_motors->SlewMaxRate[idx])
+            {
+                rate = m_motors->SlewMaxRate[idx];
+            }
+        }
+        m_motors->SlewRate[idx] = rate;
+    }
+
+    if (rate >= remaining)
+    {
+        position = target;
+        m_motors->SlewState[idx] = SERVO_SLEW_IDLE;
+        m_motors->SlewArrivedTick[idx] = (now != 0) ? now : 1; // 0 means nothing to report.
+    }
+    else
+    {
+        position = (target > position) ? (position + rate) : (position - rate);
+    }
+    m_motors->SlewPosition[idx] = position;
+    m_motors->DutyInterval[idx] = (position + (1 << (SERVO_SLEW_SHIFT - 1))) >> SERVO_SLEW_SHIFT;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Procedure:
+//  DispatchEvents sends one {'Servo' : ...} event for each servo that finished a move since the last call.
+void MotorControl::DispatchEvents()
+{
+    for (int idx = 0; idx < m_motorCount; idx++)
+    {
+        noInterrupts();
+        uint32_t arrivedTick = m_motors->SlewArrivedTick[idx];
+        m_motors->SlewArrivedTick[idx] = 0;
+        interrupts();
+        if (arrivedTick == 0)
+        {
+            continue;
+        }
+        String Text = String("{'Servo' : {'Motor':");
+        Text += String(idx);
+        Text += String(",'Arrived':");
+        Text += String(m_motors->SlewTarget[idx] >> SERVO_SLEW_SHIFT);
+        Text += String(",");
+        Text += m_clock->StampTick(arrivedTick);
+        Text += String("}}");
+        m_outputQueue->Println(Text);
+    }
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Procedure:
+//  Run a stepper in phase-accumulator mode at a step frequency given in Hz, e.g. "+001234.567".
+//  The sign sets direction.  Up to 3 fractional digits are honored (millihertz), the rest are ignored.
+void MotorControl::SetStepFrequency(int idx, String command)
+{
+    if ((idx < 0) || (idx >= m_motorCount) || m_isLoopOwned[idx])
+    {
+        return; // do nothing, we don't have that motor or its loop drives it.
+    }
+    unsigned int position = 0;
+    if (command[0] == '+')
+    {
+        SetDirection(idx, HIGH);
+        position++;
+    }
+    else if (command[0] == '-')
+    {
+        SetDirection(idx, LOW);
+        position++;
+    }
+
+    // parse by hand into millihertz -- a float can't hold 100kHz to a millihertz.
+    uint64_t milliHertz = 0;
+    int fractionDigits = -1; // -1 until we see the decimal point.
+    for (; position < command.length(); position++)
+    {
+        char digit = command[position];
+        if ((digit == '.') && (fractionDigits < 0))
+        {
+            fractionDigits = 0;
+            continue;
+        }
+        if ((digit < '0') || (digit > '9') || (fractionDigits >= 3))
+        {
+            break;
+        }
+        if (milliHertz < 1000ULL * TICK_RATE_HZ)
+        {
+            milliHertz = (milliHertz * 10) + (digit - '0');
+        }
+        if (fractionDigits >= 0)
+        {
+            fractionDigits++;
+        }
+    }
+    for (int scale = (fractionDigits < 0) ? 0 : fractionDigits; scale < 3; scale++)
+    {
+        milliHertz *= 10;
+    }
+    PublishMilliHertz(idx, milliHertz);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Procedure:
+//  SetStepMilliHertz is SetStepFrequency without the string: the sign sets direction, 0 keeps it and stops stepping.
+void MotorControl::SetStepMilliHertz(int idx, int32_t signedMilliHertz)
+{
+    if ((idx < 0) || (idx >= m_motorCount) || m_isLoopOwned[idx])
+    {
+        return; // do nothing, we don't have that motor or its loop drives it.
+    }
+    if (signedMilliHertz != 0)
+    {
+        SetDirection(idx, (signedMilliHertz > 0) ? HIGH : LOW);
+    }
+    PublishMilliHertz(idx, (signedMilliHertz >= 0) ? (uint32_t)signedMilliHertz : 0u - (uint32_t)signedMilliHertz);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Procedure:
+//  PublishMilliHertz turns a step frequency into a phase increment and publishes it.
+void MotorControl::PublishMilliHertz(int idx, uint64_t milliHertz)
+{
+    PublishFrequency(idx, MilliHertzToIncrement(milliHertz));
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Function:
+//  MilliHertzToIncrement turns a step frequency into a phase increment, clamped to what phase mode can do.
+uint32_t MotorControl::MilliHertzToIncrement(uint64_t milliHertz)
+{
+    if (milliHertz > 1000ULL * TICK_RATE_HZ)
+    {
+        milliHertz = 1000ULL * TICK_RATE_HZ;
+    }
+
+    // increment = frequency / tick rate, as a fraction of 2^32.
+    uint64_t phaseIncrement = (milliHertz << 32) / (1000ULL * TICK_RATE_HZ);
+    if (phaseIncrement > PHASE_MAX_INCREMENT)
+    {
+        phaseIncrement = PHASE_MAX_INCREMENT;
+    }
+    return ((uint32_t)phaseIncrement);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Function:
+//  Drive a motor from a velocity loop.  The sign of output sets direction, the magnitude is a step frequency
+//  in Hz or a duty interval in ticks depending on outputMode.  Returns the output actually applied after clamping.
+//  Safe to call from the control loop timer ISR.
+float MotorControl::SetVelocityOutput(int idx, float output, uint8_t outputMode)
+{
+    if ((idx < 0) || (idx >= m_motorCount))
+    {
+        return (0);
+    }
+    SetDirection(idx, (output >= 0) ? HIGH : LOW);
+    float magnitude = (output >= 0) ? output : -output;
+
+    if (outputMode == VELOCITY_OUTPUT_FREQUENCY)
+    {
+        // Hz to a fraction of 2^32 per tick.
+        float maxHz = ((float)PHASE_MAX_INCREMENT * TICK_RATE_HZ) / 4294967296.0f;
+        if (magnitude > maxHz)
+        {
+            magnitude = maxHz;
+        }
+        PublishFrequency(idx, (uint32_t)((magnitude * 4294967296.0f) / TICK_RATE_HZ));
+    }
+    else
+    {
+        float maxDuty = (float)m_motors->ShadowInterval[idx];
+        if (magnitude > maxDuty)
+        {
+            magnitude = maxDuty;
+        }
+        PublishTimings(idx, m_motors->ShadowInterval[idx], (uint32_t)magnitude);
+    }
+    return ((output >= 0) ? magnitude : -magnitude);
 }
 
 // --------------------------------------------------------------------------------------------------------------------
@@ -137,12 +802,17 @@ void MotorControl::UpdateMotorTimings(int idx, String command)
 //   Motors are not just PWM dispatches, but state machines.  A motor can be disabled, running, enabled and holding, etc...
 void MotorControl::SetMotorState(int motorId, int state)
 {
-    if (motorId >= m_motorCount)
+    if ((motorId < 0) || (motorId >= m_motorCount))
     {
         return; // do nothing, we don't have that motor.
     }
-    m_motors[motorId].DutyInterval = 0;
-    SafeDigitalWrite(m_motors[motorId].EnablePin, state);
+    // don't wait for the period boundary: a servo has no enable pin to stop it.  The publish is inside the
+    // masked section too, since a velocity loop's ISR may be the motor's other writer.
+    noInterrupts();
+    PublishTimings(motorId, m_motors->ShadowInterval[motorId], 0);
+    AdoptNow(motorId);
+    interrupts();
+    SafeDigitalWrite(m_motors->EnablePin[motorId], state);
 }
 
 // --------------------------------------------------------------------------------------------------------------------
@@ -150,10 +820,516 @@ void MotorControl::SetMotorState(int motorId, int state)
 //  This sets all variabled to 0 to halt all motor signals.
 void MotorControl::StopMotors()
 {
-    // set all duty intervals to 0, forcing a pull-down whenever the ISR fires.
+    // set all duty intervals to 0 and pull every pulse pin low now.
     int motorCounter = 0;
     for (motorCounter = 0; motorCounter < m_motorCount; motorCounter++)
     {
         SetMotorState(motorCounter, LOW);
     }
 }
+
+// --------------------------------------------------------------------------------------------------------------------
+// Procedure:
+//  ForceOutputsLow drives every pulse and enable pin low without waiting for a period boundary.  The watchdog
+//  calls it from its deadline ISR once IsSafe() is false, so the dispatch ISR won't drive them high again.
+//  Steppers handed to the waveform engine are stopped and pulled low there.
+void MotorControl::ForceOutputsLow()
+{
+    m_waveform->ForceLow();
+    for (int idx = 0; idx < m_motorCount; idx++)
+    {
+        SafeDigitalWrite(m_motors->PulsePin[idx], LOW);
+        m_motors->PulseState[idx] = LOW;
+        SafeDigitalWrite(m_motors->EnablePin[idx], LOW);
+    }
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Function:
+//  Read a motor's signed step counter.  The ISR updates it, so read the 64 bits with interrupts off.
+int64_t MotorControl::GetStepCount(int motorId)
+{
+    if ((motorId < 0) || (motorId >= m_motorCount))
+    {
+        return (0);
+    }
+    noInterrupts();
+    int64_t steps = m_motors->StepCount[motorId];
+    interrupts();
+    return (steps);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Function:
+//  How many motors are configured.
+int MotorControl::GetMotorCount()
+{
+    return (m_motorCount);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Function:
+//  IsIdle is true when no motor can make a pulse: no timings waiting to be adopted, no pulse high,
+//  no servo move, and every live interval, duty or increment is 0.  The power system polls it from loop().
+boolean MotorControl::IsIdle()
+{
+    for (int idx = 0; idx < m_motorCount; idx++)
+    {
+        if ((m_motors->ShadowSequence[idx] != m_motors->AppliedSequence[idx]) ||
+            (m_motors->PulseState[idx] != LOW) ||
+            (m_motors->SlewState[idx] != SERVO_SLEW_IDLE))
+        {
+            return (false);
+        }
+        if (m_motors->Mode[idx] == MOTOR_MODE_PHASE)
+        {
+            if (m_motors->CappedIncrement[idx] != 0)
+            {
+                return (false);
+            }
+        }
+        else if ((m_motors->CappedInterval[idx] != 0) && (m_motors->DutyInterval[idx] != 0))
+        {
+            return (false);
+        }
+    }
+    return (true);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Function:
+//  ReadStepperPins is true for a configured stepper with a pulse and a dir pin, and gives them.
+boolean MotorControl::ReadStepperPins(int idx, int8_t *dirPin, int8_t *pulsePin)
+{
+    if ((idx < 0) || (idx >= m_motorCount) || (m_motors->DirPin[idx] < 0) || (m_motors->PulsePin[idx] < 0))
+    {
+        return (false);
+    }
+    *dirPin = m_motors->DirPin[idx];
+    *pulsePin = m_motors->PulsePin[idx];
+    return (true);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Procedure:
+//  SetExternalDrive hands a stepper's pins to the waveform engine, or takes them back.  Taken back, the ISR
+//  writes the pulse pin on its next tick whatever level it was left at, and starts a fresh period.
+//  Call with interrupts off.
+void MotorControl::SetExternalDrive(int idx, boolean isExternal)
+{
+    if ((idx < 0) || (idx >= m_motorCount))
+    {
+        return;
+    }
+    m_motors->ExternalDrive[idx] = isExternal ? 1 : 0;
+    if (!isExternal)
+    {
+        m_motors->PulseState[idx] = MOTOR_PULSE_UNKNOWN;
+        m_motors->PulseTicksLeft[idx] = 0;
+        m_motors->PeriodStartTick[idx] = *m_tickCounter;
+    }
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Procedure:
+//  TakeWaveTimings is the waveform engine's period boundary: adopt any published timings, then hand over
+//  the capped rate the ISR would run on, and the direction.  Called from the engine's ISR.
+void MotorControl::TakeWaveTimings(int idx, uint8_t *mode, uint32_t *interval, uint32_t *dutyInterval, uint32_t *increment, int8_t *direction)
+{
+    AdoptShadowTimings(idx);
+    *mode = m_motors->Mode[idx];
+    *interval = m_motors->CappedInterval[idx];
+    *dutyInterval = m_motors->DutyInterval[idx];
+    *increment = m_motors->CappedIncrement[idx];
+    *direction = m_motors->Direction[idx];
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Procedure:
+//  AddSteps counts steps the waveform engine made, already signed by direction.
+void MotorControl::AddSteps(int idx, int32_t steps)
+{
+    m_motors->StepCount[idx] += steps;
+    m_trace->RecordStepEdge(idx, m_motors->StepCount[idx]);
+    if (m_probeAdopted)
+    {
+        m_probeEdgeTick = *m_tickCounter; // when the edges were generated, up to a buffer ahead of the pin.
+        m_probeAdopted = false;
+    }
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Function:
+//  IsStepper is true for a configured motor with a dir pin.  Motors without one are servos.
+boolean MotorControl::IsStepper(int idx)
+{
+    return ((idx >= 0) && (idx < m_motorCount) && (m_motors->DirPin[idx] >= 0));
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Procedure:
+//  SetLoopOwned hands a motor's timings to a velocity loop, or takes them back.  The EncoderManager claims a motor
+//  before enabling its loop and releases it after disabling, so there is never a moment with two writers.
+void MotorControl::SetLoopOwned(int idx, boolean isOwned)
+{
+    if ((idx >= 0) && (idx < MOTOR_CAPACITY))
+    {
+        m_isLoopOwned[idx] = isOwned;
+    }
+}
+
+boolean MotorControl::IsLoopOwned(int idx)
+{
+    return ((idx >= 0) && (idx < MOTOR_CAPACITY) && m_isLoopOwned[idx]);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Procedure:
+//  BeginBatch empties the stage.  The Stage calls fill it from loop(), and CommitBatch applies it.  Nothing is
+//  published until then, so the ISR and the control loop never see part of a batch.
+void MotorControl::BeginBatch()
+{
+    for (int idx = 0; idx < MOTOR_CAPACITY; idx++)
+    {
+        m_stage[idx].Fields = 0;
+    }
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Procedure:
+//  StageStepInterval stages what SetStepInterval publishes.
+void MotorControl::StageStepInterval(int idx, int32_t signedInterval)
+{
+    if ((idx < 0) || (idx >= m_motorCount))
+    {
+        return; // do nothing, we don't have that motor.
+    }
+    if (signedInterval != 0)
+    {
+        StageDirection(idx, (signedInterval > 0) ? 1 : -1);
+    }
+    uint32_t interval = (signedInterval >= 0) ? (uint32_t)signedInterval : 0u - (uint32_t)signedInterval;
+    StageTimings(idx, MOTOR_MODE_INTERVAL, interval, interval / 2, 0);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Procedure:
+//  StageStepMilliHertz stages what SetStepMilliHertz publishes.
+void MotorControl::StageStepMilliHertz(int idx, int32_t signedMilliHertz)
+{
+    if ((idx < 0) || (idx >= m_motorCount) || (m_motors->DirPin[idx] < 0))
+    {
+        return; // servos have a position, not a step rate.
+    }
+    if (signedMilliHertz != 0)
+    {
+        StageDirection(idx, (signedMilliHertz > 0) ? 1 : -1);
+    }
+    uint32_t milliHertz = (signedMilliHertz >= 0) ? (uint32_t)signedMilliHertz : 0u - (uint32_t)signedMilliHertz;
+    StageTimings(idx, MOTOR_MODE_PHASE, 0, 0, MilliHertzToIncrement(milliHertz));
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Procedure:
+//  StageServoDuty stages what SetServoDuty publishes, cancelling a move at commit.
+void MotorControl::StageServoDuty(int idx, uint32_t dutyInterval)
+{
+    if ((idx < 0) || (idx >= m_motorCount))
+    {
+        return; // do nothing, we don't have that motor.
+    }
+    m_stage[idx].Fields |= MOTOR_STAGE_SLEW;
+    m_stage[idx].SlewState = SERVO_SLEW_IDLE;
+    StageTimings(idx, MOTOR_MODE_INTERVAL, StagedInterval(idx), dutyInterval, 0);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Procedure:
+//  StageServoMove stages what MoveServo writes, so a servo already moving keeps its old target until commit.
+void MotorControl::StageServoMove(int idx, uint32_t targetDuty, uint32_t ratePerSecond, uint32_t accelPerSecond)
+{
+    if ((idx < 0) || (idx >= m_motorCount) || (m_motors->DirPin[idx] >= 0))
+    {
+        return; // only servos slew.
+    }
+    MotorStage &stage = m_stage[idx];
+    ComputeSlew(StagedInterval(idx), targetDuty, ratePerSecond, accelPerSecond, &stage.SlewTarget, &stage.SlewMaxRate, &stage.SlewAccel);
+    stage.Fields |= MOTOR_STAGE_SLEW;
+    stage.SlewState = SERVO_SLEW_STARTING;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Procedure:
+//  StageMotorState stages what SetMotorState does: no more pulses, and the enable pin at state.
+void MotorControl::StageMotorState(int idx, int state)
+{
+    if ((idx < 0) || (idx >= m_motorCount))
+    {
+        return; // do nothing, we don't have that motor.
+    }
+    StageTimings(idx, MOTOR_MODE_INTERVAL, StagedInterval(idx), 0, 0);
+    m_stage[idx].Fields |= MOTOR_STAGE_ENABLE;
+    m_stage[idx].Enable = (uint8_t)state;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Procedure:
+//  StageStop stages StopMotors.
+void MotorControl::StageStop()
+{
+    for (int idx = 0; idx < m_motorCount; idx++)
+    {
+        StageMotorState(idx, LOW);
+    }
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Procedure:
+//  StageTimings replaces the staged shadow set.  In phase mode only the increment counts, as with
+//  PublishFrequency; in interval mode only the interval and duty.
+void MotorControl::StageTimings(int idx, uint8_t mode, uint32_t interval, uint32_t dutyInterval, uint32_t phaseIncrement)
+{
+    MotorStage &stage = m_stage[idx];
+    stage.Fields |= MOTOR_STAGE_TIMINGS;
+    stage.Mode = mode;
+    stage.Interval = interval;
+    stage.DutyInterval = (dutyInterval > interval) ? interval : dutyInterval; // can't be high for longer than the period.
+    stage.PhaseIncrement = phaseIncrement;
+}
+
+void MotorControl::StageDirection(int idx, int8_t direction)
+{
+    if (m_motors->DirPin[idx] < 0)
+    {
+        return;
+    }
+    m_stage[idx].Fields |= MOTOR_STAGE_DIRECTION;
+    m_stage[idx].Direction = direction;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Function:
+//  StagedInterval is the interval a motor will run after commit: the staged one, else the published one.
+uint32_t MotorControl::StagedInterval(int idx)
+{
+    const MotorStage &stage = m_stage[idx];
+    if ((stage.Fields & MOTOR_STAGE_TIMINGS) && (stage.Mode == MOTOR_MODE_INTERVAL))
+    {
+        return (stage.Interval);
+    }
+    return (m_motors->ShadowInterval[idx]);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Function:
+//  CommitBatch applies the stage with interrupts off, between two ticks.  Every motor it touches gets its dir
+//  and enable pins, its shadow set and its servo move, and then adopts them on the spot (AdoptNow): a pulse in
+//  progress ends, and the new period starts on this tick.  So every motor in the batch runs its new timings
+//  from the next tick on, not from its own next period boundary.  Steppers the waveform engine drives pick them
+//  up at its next refill.  Returns the tick the batch was applied on.
+uint32_t MotorControl::CommitBatch()
+{
+    noInterrupts();
+    uint32_t tick = *m_tickCounter;
+    for (int idx = 0; idx < m_motorCount; idx++)
+    {
+        MotorStage &stage = m_stage[idx];
+        if (stage.Fields == 0)
+        {
+            continue;
+        }
+        if (stage.Fields & MOTOR_STAGE_DIRECTION)
+        {
+            SafeDigitalWrite(m_motors->DirPin[idx], (stage.Direction > 0) ? HIGH : LOW);
+            m_motors->Direction[idx] = stage.Direction;
+        }
+        if (stage.Fields & MOTOR_STAGE_ENABLE)
+        {
+            SafeDigitalWrite(m_motors->EnablePin[idx], stage.Enable);
+        }
+        if (stage.Fields & MOTOR_STAGE_TIMINGS)
+        {
+            m_motors->ShadowMode[idx] = stage.Mode;
+            if (stage.Mode == MOTOR_MODE_PHASE)
+            {
+                m_motors->ShadowPhaseIncrement[idx] = stage.PhaseIncrement;
+            }
+            else
+            {
+                m_motors->ShadowInterval[idx] = stage.Interval;
+                m_motors->ShadowDutyInterval[idx] = stage.DutyInterval;
+            }
+            m_motors->ShadowSequence[idx] += 2; // complete and new to the ISR.  Nothing runs in between.
+        }
+        if (stage.Fields & MOTOR_STAGE_SLEW)
+        {
+            if (stage.SlewState == SERVO_SLEW_STARTING)
+            {
+                m_motors->SlewTarget[idx] = stage.SlewTarget;
+                m_motors->SlewMaxRate[idx] = stage.SlewMaxRate;
+                m_motors->SlewAccel[idx] = stage.SlewAccel;
+                m_motors->SlewArrivedTick[idx] = 0;
+            }
+            m_motors->SlewState[idx] = stage.SlewState;
+        }
+        AdoptNow(idx);
+        if ((m_motors->DirPin[idx] < 0) && (m_motors->SlewState[idx] != SERVO_SLEW_IDLE))
+        {
+            SlewServo(idx, tick); // the first frame of the move, as at a period boundary.
+        }
+        stage.Fields = 0;
+    }
+    interrupts();
+    return (tick);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Procedure:
+//  ArmActuationProbe asks the ISR to note the tick of the first pulse pin edge after it next adopts
+//  published timings.  Call it before publishing, so the adoption can't be missed.
+void MotorControl::ArmActuationProbe()
+{
+    noInterrupts();
+    m_probeEdgeTick = 0;
+    m_probeAdopted = false;
+    m_probeArmed = true;
+    interrupts();
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Function:
+//  ReadActuationProbe returns true, with the edge tick, once the armed probe has seen its edge.
+boolean MotorControl::ReadActuationProbe(uint32_t *edgeTick)
+{
+    noInterrupts();
+    uint32_t tick = m_probeEdgeTick;
+    interrupts();
+    if (tick == 0)
+    {
+        return (false);
+    }
+    *edgeTick = tick;
+    return (true);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Procedure:
+//  SetSpeedCap limits a motor to capQ8/256 of its commanded rate, from the next tick on.  The reflex
+//  system calls it from the sensor ISR, so it does nothing when the cap hasn't changed.
+void MotorControl::SetSpeedCap(int idx, uint16_t capQ8)
+{
+    if ((idx < 0) || (idx >= m_motorCount))
+    {
+        return;
+    }
+    if (capQ8 > MOTOR_SPEED_CAP_FULL)
+    {
+        capQ8 = MOTOR_SPEED_CAP_FULL;
+    }
+    if (capQ8 == m_motors->SpeedCap[idx])
+    {
+        return;
+    }
+    m_motors->SpeedCap[idx] = capQ8;
+    ApplySpeedCap(idx);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Procedure:
+//  ApplySpeedCap recomputes the live rate the ISR runs on from the adopted timings and the cap.
+//  A slower step rate is a longer interval with the same pulse width; a cap of 0 is an interval of 0,
+//  which never pulses.  Servos keep their commanded timings, their duty is a position.
+void MotorControl::ApplySpeedCap(int idx)
+{
+    uint32_t cap = m_motors->SpeedCap[idx];
+    if ((m_motors->DirPin[idx] < 0) || (cap >= MOTOR_SPEED_CAP_FULL))
+    {
+        m_motors->CappedInterval[idx] = m_motors->Interval[idx];
+        m_motors->CappedIncrement[idx] = m_motors->PhaseIncrement[idx];
+        return;
+    }
+    if (cap == 0)
+    {
+        m_motors->CappedInterval[idx] = 0;
+        m_motors->CappedIncrement[idx] = 0;
+        return;
+    }
+    uint64_t stretched = ((uint64_t)m_motors->Interval[idx] * MOTOR_SPEED_CAP_FULL) / cap;
+    m_motors->CappedInterval[idx] = (stretched > 0xFFFFFFFFULL) ? 0xFFFFFFFFUL : (uint32_t)stretched;
+    m_motors->CappedIncrement[idx] = (uint32_t)(((uint64_t)m_motors->PhaseIncrement[idx] * cap) / MOTOR_SPEED_CAP_FULL);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Procedure:
+//  UpdateProfileMatch switches the ISR to the profiled dispatch when the configured motors are exactly the
+//  compile-time profile -- same count, same pins in the same slots -- and back to the generic one otherwise.
+void MotorControl::UpdateProfileMatch()
+{
+#ifdef ROBOT_PROFILE_MOTOR_COUNT
+    boolean matches = (m_motorCount == ROBOT_PROFILE_MOTOR_COUNT);
+    for (int idx = 0; matches && (idx < ROBOT_PROFILE_MOTOR_COUNT); idx++)
+    {
+        matches = (m_motors->EnablePin[idx] == s_robotProfile[idx].EnablePin) &&
+                  (m_motors->DirPin[idx] == s_robotProfile[idx].DirPin) &&
+                  (m_motors->PulsePin[idx] == s_robotProfile[idx].PulsePin);
+    }
+    m_profileMatches = matches;
+#endif
+}
+
+void MotorControl::SetForceGeneric(boolean isForced)
+{
+    m_forceGeneric = isForced;
+}
+
+void MotorControl::ClearDispatchCycles()
+{
+    noInterrupts();
+    for (int path = 0; path < DISPATCH_PATH_COUNT; path++)
+    {
+        m_cycles[path].Ticks = 0;
+        m_cycles[path].TotalCycles = 0;
+        m_cycles[path].MaxCycles = 0;
+    }
+    interrupts();
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Function:
+//  ReadDispatchCycles returns a JSON object with the ticks, average and worst cycles of each dispatch path,
+//  and which one the ISR is using now.
+String MotorControl::ReadDispatchCycles()
+{
+    static const char *pathNames[DISPATCH_PATH_COUNT] = {"Generic", "Profile"};
+    DispatchCycles snapshot[DISPATCH_PATH_COUNT];
+    noInterrupts();
+    memcpy(snapshot, m_cycles, sizeof(snapshot));
+    interrupts();
+
+    String Text = String("");
+    Text += String("{'Dispatch' : {'Profile':'");
+#ifdef ROBOT_PROFILE_NAME
+    Text += String(ROBOT_PROFILE_NAME);
+#endif
+    Text += String("','Using':'");
+#ifdef ROBOT_PROFILE_MOTOR_COUNT
+    Text += String(pathNames[(m_profileMatches && !m_forceGeneric) ? DISPATCH_PROFILE : DISPATCH_GENERIC]);
+#else
+    Text += String(pathNames[DISPATCH_GENERIC]);
+#endif
+    Text += String("'");
+    for (int path = 0; path < DISPATCH_PATH_COUNT; path++)
+    {
+        Text += String(",'");
+        Text += String(pathNames[path]);
+        Text += String("':{'Ticks':");
+        Text += String(snapshot[path].Ticks);
+        Text += String(",'AvgCycles':");
+        Text += String((snapshot[path].Ticks > 0) ? (float)snapshot[path].TotalCycles / snapshot[path].Ticks : 0.0f);
+        Text += String(",'MaxCycles':");
+        Text += String(snapshot[path].MaxCycles);
+        Text += String("}");
+    }
+    Text += String("}}");
+    return (Text);
+}
@@ -35,48 +35,287 @@
 //  The library uses GPIO to simulate PWM.  No need to use a PWM enabled pin.
 //  The library has been tested on the Sparkfun Artemis ATP, and should work on anything faster.
 
+//  Timing changes from the command path never touch the live Interval/DutyInterval pair.
+//  They are written into a per-motor shadow set and published with a sequence counter
+//  (odd while being written, even when complete).  The ISR only adopts a published shadow
+//  at the end of the current pulse period, so it never sees a torn pair or a partial pulse.
+//  Stops are the exception: SetMotorState and StopMotors publish a duty of 0 and adopt it at
+//  once, with interrupts off, pulling the pulse pin low rather than finishing the period.
+
+//  The sequence counter only works with one writer per motor.  A motor driven by a closed
+//  velocity loop is written from the loop's timer ISR, so SetLoopOwned marks it and every
+//  loop()-side timing setter ignores it until the loop is opened again.  Stops still work:
+//  they publish with interrupts off, so nothing can land between their two increments.
+
+//  Steppers can also run in phase-accumulator (DDS) mode.  The host sets a step frequency in Hz
+//  with millihertz resolution, which becomes a 32-bit phase increment.  Every tick adds the
+//  increment to the motor's phase, and a carry out of the top bit emits one step pulse.
+//  Frequency resolution is TICK_RATE_HZ / 2^32 (about 0.23 mHz) regardless of the tick period.
+
+//  Every rising edge the ISR writes to a pulse pin adds the motor's direction (+1/-1, or 0 for
+//  motors without a dir pin) to a signed 64-bit step counter, which odometry reads back.
+
+//  A speed cap (set by the reflex system) scales the live rate without touching what the host
+//  commanded: the ISR runs on CappedInterval/CappedIncrement, recomputed whenever the cap or the
+//  adopted timings change.  Motors without a dir pin are servos and are never capped.
+
+//  A servo can also be moved to a target duty interval at a limited rate, with optional acceleration
+//  ("vS").  Once per servo frame, at the period boundary, the ISR steps the live duty interval toward the
+//  target in fixed point, slowing down in time to stop on it, and notes the tick it arrived.  The next
+//  DispatchEvents() from loop() reports the arrival.  A plain "v" cancels a move in progress.
+
+//  The per-motor work is one template, DispatchMotor, specialised on stepper/servo and on how the pulse
+//  pin is written.  The generic path calls it in a loop with pins from the bank; a compile-time robot
+//  profile (see RobotProfile.h) gets an unrolled call per motor with constant pins.  Every tick's cost
+//  is measured with the cycle counter, per path, for "B~".
+
+//  There are two banks.  The ISR runs the live one; a reconfiguration (BeginConfiguration, ConfigureMotor)
+//  is built in the other, where the ISR never looks.  CommitConfiguration, called with interrupts off so it
+//  lands between two ticks, carries the running state of every motor whose pins didn't change into the new
+//  bank and swaps the two.  Those motors keep stepping and pick up their new timings at their next period
+//  boundary, like any other timing change; the rest start fresh.
+
+//  Steppers can be handed to the DMA waveform engine (see WaveSystem.h).  The ISR then skips them; the
+//  engine takes their adopted timings and direction once per buffer half, and adds back the steps it made.
+
+//  A batch is staged, not published: BeginBatch empties a per-motor stage, the Stage calls fill it with what
+//  the matching setters would publish, and nothing reaches the bank until CommitBatch.  So the encoder control
+//  loop, which publishes from its ISR, never mixes with a batch.  CommitBatch writes the staged pins, shadow
+//  sets and servo moves with interrupts off and adopts them on the spot, so every motor in the batch runs its
+//  new timings and direction from the same tick.  See BatchSystem.h.
+
 // ---------------------------------------------------------------------------
 // ---------------------------------------------------------------------------
 
 #include <Arduino.h>
 #include <stdint.h>
 #include "SafetySystem.h"
+#include "OutputQueue.h"
+#include "TraceSystem.h"
+#include "ClockSystem.h"
+#include "RobotProfile.h"
+
+class WaveformManager;
 
 #ifndef MOTOR_ONCE
 #define MOTOR_ONCE
 
-typedef struct 
+// How many motor slots to compile in.  Override with -DMOTOR_CAPACITY=n for smaller robots.
+#ifndef MOTOR_CAPACITY
+#define MOTOR_CAPACITY 9
+#endif
+
+#define TICK_RATE_HZ 1000000  // the dispatch ISR runs once per microsecond.
+#define PHASE_PULSE_TICKS 2   // how long a phase-accumulator step pulse stays high.
+
+// the fastest step rate phase mode allows -- a pulse must fall before the next one can start.
+#define PHASE_MAX_INCREMENT (0xFFFFFFFFUL / (2 * PHASE_PULSE_TICKS))
+
+// the largest signed values the parsers pass to SetStepInterval and SetStepMilliHertz.
+#define MOTOR_MAX_STEP_INTERVAL 100000000L                                       // 100s per step.
+#define MOTOR_MAX_STEP_MILLIHERTZ ((1000L * TICK_RATE_HZ) / (2 * PHASE_PULSE_TICKS)) // what phase mode can do.
+
+// servo slew positions and rates are duty interval ticks in 24.8 fixed point.
+#define SERVO_SLEW_SHIFT 8
+
+enum ServoSlewStates
+{
+    SERVO_SLEW_IDLE,     // duty interval is whatever was last published.
+    SERVO_SLEW_STARTING, // a move was just requested, the ISR starts it from the live duty interval.
+    SERVO_SLEW_MOVING
+};
+
+// PulseState of a motor that hasn't written its pulse pin yet, so its first tick always does.
+#define MOTOR_PULSE_UNKNOWN 0xFF
+
+// speed caps are fractions of the commanded rate in 1/256ths.  This is no cap at all.
+#define MOTOR_SPEED_CAP_FULL 256
+
+// how a closed velocity loop drives its motor.
+enum VelocityOutputModes
 {
-    int8_t EnablePin;
-    int8_t DirPin;
-    int8_t PulsePin;
-    uint8_t PulsePrevState;
-    uint8_t PulseDesiredState;
+    VELOCITY_OUTPUT_FREQUENCY, // output is a signed step frequency in Hz (steppers).
+    VELOCITY_OUTPUT_DUTY       // output is a signed duty interval in ticks (DC motors).
+};
+
+// which ISR path ran a tick.
+enum DispatchPaths
+{
+    DISPATCH_GENERIC, // loop over the bank, pins from RAM.
+    DISPATCH_PROFILE, // unrolled over the compile-time robot profile.
+    DISPATCH_PATH_COUNT
+};
+
+// cycles the ISR spent in Dispatch, for one path.
+struct DispatchCycles
+{
+    uint32_t Ticks;
+    uint64_t TotalCycles;
+    uint32_t MaxCycles;
+};
+
+enum MotorModes
+{
+    MOTOR_MODE_INTERVAL, // fixed integer Interval/DutyInterval in ticks.
+    MOTOR_MODE_PHASE     // phase accumulator, steps on overflow.
+};
+
+// Motor state, laid out structure-of-arrays so the ISR streams through contiguous data.
+// Capacity is part of the type; nothing may index past it.
+template <uint8_t Capacity>
+struct MotorBank
+{
+    static const uint8_t capacity = Capacity;
+
+    int8_t EnablePin[Capacity];
+    int8_t DirPin[Capacity];
+    int8_t PulsePin[Capacity];
+    uint8_t PulseState[Capacity];                   // last level written to the pulse pin.
+    uint32_t Interval[Capacity];
+    uint32_t DutyInterval[Capacity];
+    uint32_t PeriodStartTick[Capacity];             // tick the current pulse period started on.
+    uint8_t Mode[Capacity];                         // a MotorModes value.
+    uint32_t Phase[Capacity];                       // phase accumulator, a step is emitted on overflow.
+    uint32_t PhaseIncrement[Capacity];              // added to Phase every tick.
+    uint8_t PulseTicksLeft[Capacity];               // ticks left in the current phase-mode step pulse.
+    volatile uint8_t ShadowMode[Capacity];          // mode waiting to be adopted by the ISR.
+    volatile uint32_t ShadowPhaseIncrement[Capacity]; // phase increment waiting to be adopted by the ISR.
+    volatile int8_t Direction[Capacity];            // +1/-1 as last written to the dir pin, 0 if there is none.
+    volatile int64_t StepCount[Capacity];           // signed steps emitted, updated on every rising pulse edge.
+    volatile uint32_t ShadowInterval[Capacity];     // interval waiting to be adopted by the ISR.
+    volatile uint32_t ShadowDutyInterval[Capacity]; // duty interval waiting to be adopted by the ISR.
+    volatile uint32_t ShadowSequence[Capacity];     // odd while the shadow set is being written.
+    uint32_t AppliedSequence[Capacity];             // last shadow sequence the ISR adopted.
+    uint16_t SpeedCap[Capacity];                    // MOTOR_SPEED_CAP_FULL is uncapped, 0 is stopped.
+    uint32_t CappedInterval[Capacity];              // Interval stretched by the cap; what the ISR runs on.
+    uint32_t CappedIncrement[Capacity];             // PhaseIncrement scaled by the cap; what the ISR runs on.
+    volatile uint8_t SlewState[Capacity];           // a ServoSlewStates value.
+    uint32_t SlewPosition[Capacity];                // current duty interval, fixed point.
+    uint32_t SlewRate[Capacity];                    // current change per frame, fixed point.
+    volatile uint32_t SlewTarget[Capacity];         // duty interval to stop at, fixed point.
+    volatile uint32_t SlewMaxRate[Capacity];        // largest change per frame, fixed point.
+    volatile uint32_t SlewAccel[Capacity];          // change in rate per frame, fixed point.  0 moves at SlewMaxRate.
+    volatile uint32_t SlewArrivedTick[Capacity];    // tick the servo reached its target, 0 once reported.
+    uint8_t ExternalDrive[Capacity];                // the waveform engine drives the pins, the ISR leaves them alone.
+};
+
+enum MotorStageFields
+{
+    MOTOR_STAGE_TIMINGS = 1,
+    MOTOR_STAGE_DIRECTION = 2,
+    MOTOR_STAGE_ENABLE = 4,
+    MOTOR_STAGE_SLEW = 8
+};
+
+// What a batch will apply to one motor.  Fields says which parts are staged.
+struct MotorStage
+{
+    uint8_t Fields;          // MotorStageFields bits.
+    uint8_t Mode;            // the shadow set to publish.
     uint32_t Interval;
     uint32_t DutyInterval;
-    uint32_t TicksLeft;
-} MotorController;
+    uint32_t PhaseIncrement;
+    int8_t Direction;        // +1/-1 to write to the dir pin.
+    uint8_t Enable;          // level to write to the enable pin.
+    uint8_t SlewState;       // SERVO_SLEW_STARTING starts the move below, SERVO_SLEW_IDLE cancels one.
+    uint32_t SlewTarget;
+    uint32_t SlewMaxRate;
+    uint32_t SlewAccel;
+};
 
 class MotorControl
 {
 public:
     MotorControl();
-    MotorControl(int howMany, volatile uint32_t *tickCounter, uint32_t *prevTickCounter, SafetyManager *safetyPtr);
-    void Init(int howMany, volatile uint32_t *tickCounter, uint32_t *prevTickCounter, SafetyManager *safetyPtr);
+    MotorControl(int howMany, volatile uint32_t *tickCounter, uint32_t *prevTickCounter, SafetyManager *safetyPtr, OutputQueue *outputQueue, TraceRecorder *trace, ClockManager *clock, WaveformManager *waveform);
+    void Init(int howMany, volatile uint32_t *tickCounter, uint32_t *prevTickCounter, SafetyManager *safetyPtr, OutputQueue *outputQueue, TraceRecorder *trace, ClockManager *clock, WaveformManager *waveform);
+    void BeginConfiguration(int howMany);     // start a new configuration in the spare bank.
     void ConfigureMotor(int motorIndex, int8_t enablePin, int8_t dirPin, int8_t pulsePin, uint32_t interval, uint32_t dutyInterval);
+    void CommitConfiguration();               // switch the ISR to the new configuration.  Call with interrupts off.
     void Dispatch();
     void SafeDigitalWrite(int pin, int level);
     void UpdateMotorTimings(int idx, String command);
+    void SetStepFrequency(int idx, String command);
+    void SetStepInterval(int idx, int32_t signedInterval);     // like "m": sign is direction, 50% duty.
+    void SetStepMilliHertz(int idx, int32_t signedMilliHertz); // like "f": sign is direction.
+    void SetServoDuty(int idx, uint32_t dutyInterval);         // like "v".
+    void MoveServo(int idx, uint32_t targetDuty, uint32_t ratePerSecond, uint32_t accelPerSecond); // like "vS".
+    void DispatchEvents();                    // report servo arrivals.  Call from loop().
+    float SetVelocityOutput(int idx, float output, uint8_t outputMode);
     void SetMotorState(int motorId, int state);
     void StopMotors();
+    void ForceOutputsLow();                   // every pulse and enable pin low, now.  For the watchdog ISR.
+    int64_t GetStepCount(int motorId);
+    int GetMotorCount();
+    boolean IsIdle();                         // true if no motor can make a pulse until something is published.
+    boolean ReadStepperPins(int idx, int8_t *dirPin, int8_t *pulsePin); // true for a stepper, with its pins.
+    void SetExternalDrive(int idx, boolean isExternal); // hand a motor's pins to the waveform engine or back.  Interrupts off.
+    void TakeWaveTimings(int idx, uint8_t *mode, uint32_t *interval, uint32_t *dutyInterval, uint32_t *increment, int8_t *direction); // from the waveform ISR.
+    void AddSteps(int idx, int32_t steps);    // steps the waveform engine made.  From its ISR.
+    boolean IsStepper(int idx);               // a configured motor with a dir pin.
+    void SetLoopOwned(int idx, boolean isOwned); // a velocity loop becomes, or stops being, the motor's only timing writer.
+    boolean IsLoopOwned(int idx);             // m/f/v, batch and program timings are refused while true.
+    void BeginBatch();                        // empty the stage.  Batches are staged and committed from loop().
+    void StageStepInterval(int idx, int32_t signedInterval);
+    void StageStepMilliHertz(int idx, int32_t signedMilliHertz);
+    void StageServoDuty(int idx, uint32_t dutyInterval);
+    void StageServoMove(int idx, uint32_t targetDuty, uint32_t ratePerSecond, uint32_t accelPerSecond);
+    void StageMotorState(int idx, int state);
+    void StageStop();
+    uint32_t CommitBatch();                   // apply the stage between two ticks.  Returns the tick it landed on.
+    void SetForceGeneric(boolean isForced);   // keep to the generic dispatch even if the profile matches.
+    void ClearDispatchCycles();
+    String ReadDispatchCycles();              // returns a JSON object with the cycles per tick of each path.
+    void ArmActuationProbe();                 // catch the first pin edge after the next timings are adopted.
+    boolean ReadActuationProbe(uint32_t *edgeTick); // true once that edge happened, with its tick.
+    void SetSpeedCap(int idx, uint16_t capQ8);      // call from the ISR, or with interrupts off.
 
 private:
-    MotorController m_motors[9];
-    uint8_t m_motorCount;    // how many motors do we have? Set once, then don't change.
+    void PublishTimings(int idx, uint32_t interval, uint32_t dutyInterval);
+    void PublishFrequency(int idx, uint32_t phaseIncrement);
+    void PublishMilliHertz(int idx, uint64_t milliHertz);
+    void SetDirection(int idx, int level);
+    static uint32_t MilliHertzToIncrement(uint64_t milliHertz);
+    static void ComputeSlew(uint32_t interval, uint32_t targetDuty, uint32_t ratePerSecond, uint32_t accelPerSecond, uint32_t *target, uint32_t *maxRate, uint32_t *accel);
+    void StageTimings(int idx, uint8_t mode, uint32_t interval, uint32_t dutyInterval, uint32_t phaseIncrement);
+    void StageDirection(int idx, int8_t direction);
+    uint32_t StagedInterval(int idx);
+    void AdoptShadowTimings(int idx);
+    void AdoptNow(int idx);
+    uint8_t DispatchPhaseMode(int idx);
+    void ApplySpeedCap(int idx);
+    void SlewServo(int idx, uint32_t now);
+    void UpdateProfileMatch();
+    void ResetMotor(MotorBank<MOTOR_CAPACITY> *bank, int idx);
+    void CarryMotor(int idx);
+    template <bool IsStepper, typename PinWriter>
+    void DispatchMotor(uint8_t idx, uint32_t now, const PinWriter &writePulse);
+#ifdef ROBOT_PROFILE_MOTOR_COUNT
+    template <uint8_t Index>
+    void DispatchProfile(uint32_t now);
+#endif
+
+    MotorBank<MOTOR_CAPACITY> m_banks[2];
+    MotorBank<MOTOR_CAPACITY> *m_motors; // the bank the ISR runs.
+    MotorBank<MOTOR_CAPACITY> *m_staged; // the bank a reconfiguration is built in.
+    uint8_t m_motorCount;    // how many motors the live bank has.  Only changes with the bank.  Never more than MOTOR_CAPACITY.
+    uint8_t m_stagedCount;
     int m_selectedMotor; // use this to iterate over the motors without doing an alloc.
     volatile uint32_t *m_tickCounter;
     uint32_t *m_prevTickCounter;
     SafetyManager *m_safetyManager; // to listen to the safety system
+    OutputQueue *m_outputQueue;     // where replies and events go
+    TraceRecorder *m_trace;         // samples step edges when asked
+    ClockManager *m_clock;          // turns ticks into host time for events
+    WaveformManager *m_waveform;    // the DMA engine some steppers may be handed to
+    volatile boolean m_probeArmed;     // latency probe: waiting for an adoption,
+    volatile boolean m_probeAdopted;   // then for the edge after it.
+    volatile uint32_t m_probeEdgeTick; // 0 until the edge happens.
+    volatile boolean m_profileMatches; // the configured motors are exactly the compile-time profile.
+    volatile boolean m_forceGeneric;
+    DispatchCycles m_cycles[DISPATCH_PATH_COUNT];
+    MotorStage m_stage[MOTOR_CAPACITY];          // what the next CommitBatch applies.
+    volatile boolean m_isLoopOwned[MOTOR_CAPACITY]; // a velocity loop publishes this motor's timings.
 };
 
 #endif
\ No newline at end of file
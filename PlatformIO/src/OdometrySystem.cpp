@@ -0,0 +1,148 @@
+#include "OdometrySystem.h"
+
+//-----------------------------------------------------------------------------------------
+// Constructor:
+//  Default constructor does nothing.
+OdometryManager::OdometryManager()
+{
+}
+
+//-----------------------------------------------------------------------------------------
+// Constructor:
+//  Store references to the motor system, tick counter, output queue and clock.
+OdometryManager::OdometryManager(MotorControl *motorSystem, volatile uint32_t *tickCounter, OutputQueue *outputQueue, ClockManager *clock)
+{
+    Init(motorSystem, tickCounter, outputQueue, clock);
+}
+
+//-----------------------------------------------------------------------------------------
+// Init initializes instance members.  Odometry stays off until Configure is called.
+void OdometryManager::Init(MotorControl *motorSystem, volatile uint32_t *tickCounter, OutputQueue *outputQueue, ClockManager *clock)
+{
+    m_motorControl = motorSystem;
+    m_tickCounter = tickCounter;
+    m_outputQueue = outputQueue;
+    m_clock = clock;
+    m_isConfigured = false;
+    m_streamIntervalMS = 0;
+    m_lastStreamMS = 0;
+    m_leftMotor = 0;
+    m_rightMotor = 0;
+    ResetPose();
+}
+
+//-----------------------------------------------------------------------------------------
+// Configure sets up the differential drive model and resets the pose to the origin.
+void OdometryManager::Configure(int leftMotor, int rightMotor, uint32_t wheelRadiusUM, uint32_t trackWidthUM, uint32_t stepsPerRev)
+{
+    if ((stepsPerRev == 0) || (trackWidthUM == 0))
+    {
+        m_isConfigured = false;
+        return; // can't integrate without a wheel and a track.
+    }
+    m_leftMotor = leftMotor;
+    m_rightMotor = rightMotor;
+    m_trackWidthNM = trackWidthUM * 1000;
+    m_stepLengthNM_Q16 = (int64_t)((2.0 * PI * wheelRadiusUM * 1000.0 * 65536.0) / stepsPerRev);
+    m_isConfigured = true;
+    ResetPose();
+}
+
+//-----------------------------------------------------------------------------------------
+// ResetPose puts the robot back at the origin facing +X.
+void OdometryManager::ResetPose()
+{
+    m_x_NM = 0;
+    m_y_NM = 0;
+    m_heading = 0;
+    m_lastUpdateTick = *m_tickCounter;
+    if (m_isConfigured)
+    {
+        m_lastLeftSteps = m_motorControl->GetStepCount(m_leftMotor);
+        m_lastRightSteps = m_motorControl->GetStepCount(m_rightMotor);
+    }
+    else
+    {
+        m_lastLeftSteps = 0;
+        m_lastRightSteps = 0;
+    }
+}
+
+//-----------------------------------------------------------------------------------------
+// SetStreamInterval asks Dispatch to send the pose every intervalMS milliseconds.  0 stops it.
+void OdometryManager::SetStreamInterval(uint32_t intervalMS)
+{
+    m_streamIntervalMS = intervalMS;
+    m_lastStreamMS = millis();
+}
+
+//-----------------------------------------------------------------------------------------
+// Integrate folds the step counts since the last update into the pose.
+void OdometryManager::Integrate()
+{
+    int64_t leftSteps = m_motorControl->GetStepCount(m_leftMotor);
+    int64_t rightSteps = m_motorControl->GetStepCount(m_rightMotor);
+    int64_t leftNM = ((leftSteps - m_lastLeftSteps) * m_stepLengthNM_Q16) >> 16;
+    int64_t rightNM = ((rightSteps - m_lastRightSteps) * m_stepLengthNM_Q16) >> 16;
+    m_lastLeftSteps = leftSteps;
+    m_lastRightSteps = rightSteps;
+    if ((leftNM == 0) && (rightNM == 0))
+    {
+        return; // didn't move.
+    }
+
+    // heading change in radians is (right - left) / track.  2^32 / 2PI converts to a binary angle.
+    int32_t headingChange = (int32_t)(((double)(rightNM - leftNM) * (4294967296.0 / (2.0 * PI))) / m_trackWidthNM);
+    int64_t centerNM = (leftNM + rightNM) / 2;
+
+    // move along the average heading over this update.
+    uint32_t midHeading = m_heading + (headingChange / 2);
+    float radians = (float)midHeading * (float)(2.0 * PI / 4294967296.0);
+    m_x_NM += (int64_t)(centerNM * cosf(radians));
+    m_y_NM += (int64_t)(centerNM * sinf(radians));
+    m_heading += headingChange;
+}
+
+//-----------------------------------------------------------------------------------------
+// ReadPose returns a JSON object with the pose and the raw step counters.
+String OdometryManager::ReadPose()
+{
+    // 2^32 binary angle to milliradians, wrapped to -PI..PI
+    int32_t headingMRAD = (int32_t)(((double)(int32_t)m_heading * 2000.0 * PI) / 4294967296.0);
+    String Text = String("");
+    Text += String("{'Pose': {'X_UM':");
+    Text += String((long)(m_x_NM / 1000));
+    Text += String(",'Y_UM':");
+    Text += String((long)(m_y_NM / 1000));
+    Text += String(",'Heading_MRAD':");
+    Text += String((long)headingMRAD);
+    Text += String(",'LeftSteps':");
+    Text += Int64Text(m_lastLeftSteps);
+    Text += String(",'RightSteps':");
+    Text += Int64Text(m_lastRightSteps);
+    Text += String(",");
+    Text += m_clock->StampTick(m_lastUpdateTick); // when the pose was last integrated.
+    Text += String("}}");
+    return (Text);
+}
+
+//-----------------------------------------------------------------------------------------
+// Dispatch integrates the pose at a fixed tick interval and streams it if requested.
+// Call this from loop(), not the ISR.
+void OdometryManager::Dispatch()
+{
+    if (!m_isConfigured)
+    {
+        return;
+    }
+    if ((*m_tickCounter - m_lastUpdateTick) >= ODOMETRY_UPDATE_INTERVAL)
+    {
+        m_lastUpdateTick = *m_tickCounter;
+        Integrate();
+    }
+    if ((m_streamIntervalMS > 0) && ((millis() - m_lastStreamMS) >= m_streamIntervalMS))
+    {
+        m_lastStreamMS = millis();
+        m_outputQueue->Println(ReadPose());
+    }
+}
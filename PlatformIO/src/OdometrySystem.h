@@ -0,0 +1,85 @@
+// ---------------------------------------------------------------------------
+// Odometry Library - v0.0.1 - 07/12/2020
+//
+// AUTHOR/LICENSE:
+// Created by Imran Peerbhai -- ipeerbhai@aol.com
+// Copyright 2020 License:
+// Forks and derivitive works are NOT permitted without
+// permission. Permission is only granted to use as-is for private and
+// non-commercial use by natural persons or non-profit entities.
+// For-profit entities require a license.
+//
+// CONTRIBUTIONS:
+// If you wish to contribute, make changes, or enhancements,
+// please create a pull request.
+//
+// DISCLAIMER:
+// This software is furnished "as is", without technical support, and with no
+// warranty, express or implied, as to its usefulness for any purpose.
+// ---------------------------------------------------------------------------
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+// Theory of Operation:
+
+//  The motor system counts every step pulse it emits.  For a differential drive
+//  rover, that's all we need for dead-reckoning: the left and right step deltas
+//  give distance travelled and change in heading.
+
+//  Pose is kept in fixed point so it never loses precision as it grows:
+//  X and Y are signed 64-bit nanometers, heading is a 32-bit binary angle
+//  (2^32 == one full turn), which wraps for free.  The trig for each update
+//  runs on the FPU, but is never accumulated.
+
+//  The host can query the pose or ask for it to be streamed at a fixed period.
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+
+#include <Arduino.h>
+#include <stdint.h>
+#include "MotorControl.h"
+#include "OutputQueue.h"
+#include "ClockSystem.h"
+#include "EasyString.h"
+
+#ifndef ODOMETRY_ONCE
+#define ODOMETRY_ONCE
+
+#define ODOMETRY_UPDATE_INTERVAL 1000 // integrate the pose every millisecond worth of ticks.
+
+class OdometryManager
+{
+public:
+    OdometryManager();
+    OdometryManager(MotorControl *motorSystem, volatile uint32_t *tickCounter, OutputQueue *outputQueue, ClockManager *clock);
+    void Init(MotorControl *motorSystem, volatile uint32_t *tickCounter, OutputQueue *outputQueue, ClockManager *clock);
+    void Configure(int leftMotor, int rightMotor, uint32_t wheelRadiusUM, uint32_t trackWidthUM, uint32_t stepsPerRev);
+    void ResetPose();
+    void SetStreamInterval(uint32_t intervalMS); // 0 turns streaming off.
+    String ReadPose(); // returns a JSON object with the current pose and step counters.
+    void Dispatch();   // integrate the pose and stream it if asked.
+
+private:
+    void Integrate();
+
+    MotorControl *m_motorControl;
+    volatile uint32_t *m_tickCounter;
+    OutputQueue *m_outputQueue;
+    ClockManager *m_clock;
+    boolean m_isConfigured;
+    int m_leftMotor;
+    int m_rightMotor;
+    uint32_t m_trackWidthNM;
+    int64_t m_stepLengthNM_Q16;  // nanometers of travel per step, Q16 fixed point.
+    int64_t m_lastLeftSteps;
+    int64_t m_lastRightSteps;
+    int64_t m_x_NM;
+    int64_t m_y_NM;
+    uint32_t m_heading;          // binary angle, 2^32 is a full turn.
+    uint32_t m_lastUpdateTick;
+    uint32_t m_streamIntervalMS;
+    uint32_t m_lastStreamMS;
+};
+
+#endif
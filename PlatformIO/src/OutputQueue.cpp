@@ -0,0 +1,176 @@
+#include "OutputQueue.h"
+
+//-----------------------------------------------------------------------------------------
+// Constructor:
+//  Start out empty.  Nothing gets sent until Init gives us a transport.
+OutputQueue::OutputQueue()
+{
+    Init(NULL, NULL);
+}
+
+//-----------------------------------------------------------------------------------------
+// Constructor:
+//  Start out empty, sending to transport.
+OutputQueue::OutputQueue(Transport *transport, TraceRecorder *trace)
+{
+    Init(transport, trace);
+}
+
+//-----------------------------------------------------------------------------------------
+// Init empties the queue, resets every counter and picks where Drain sends to.
+void OutputQueue::Init(Transport *transport, TraceRecorder *trace)
+{
+    m_transport = transport;
+    m_trace = trace;
+    m_head = 0;
+    m_tail = 0;
+    m_used = 0;
+    m_peakUsed = 0;
+    m_messagesQueued = 0;
+    m_messagesDropped = 0;
+    m_bytesDropped = 0;
+    m_bytesSent = 0;
+    m_writes = 0;
+    m_backPressure = 0;
+}
+
+//-----------------------------------------------------------------------------------------
+// Print appends text without a line ending.
+boolean OutputQueue::Print(const char *text)
+{
+    return (Enqueue(text, strlen(text), NULL, 0));
+}
+
+//-----------------------------------------------------------------------------------------
+// Println appends text and a line ending as one message, like Serial.println.
+boolean OutputQueue::Println(const char *text)
+{
+    return (Enqueue(text, strlen(text), "\r\n", 2));
+}
+
+boolean OutputQueue::Println(const String &text)
+{
+    return (Enqueue(text.c_str(), text.length(), "\r\n", 2));
+}
+
+//-----------------------------------------------------------------------------------------
+// Enqueue copies up to two pieces into the ring as one message, or drops the whole thing.
+// Interrupts are off while we copy, so an ISR can append too without tearing a message.
+boolean OutputQueue::Enqueue(const char *first, uint32_t firstLength, const char *second, uint32_t secondLength)
+{
+    uint32_t length = firstLength + secondLength;
+    noInterrupts();
+    if (length > (OUTPUT_QUEUE_SIZE - m_used))
+    {
+        m_messagesDropped++;
+        m_bytesDropped += length;
+        interrupts();
+        if (m_trace != NULL)
+        {
+            m_trace->Record(TRACE_OUTPUT_DROP, 0, (uint16_t)length);
+        }
+        return (false);
+    }
+    uint32_t head = m_head;
+    for (uint32_t i = 0; i < firstLength; i++)
+    {
+        m_buffer[head] = first[i];
+        head = (head + 1) % OUTPUT_QUEUE_SIZE;
+    }
+    for (uint32_t i = 0; i < secondLength; i++)
+    {
+        m_buffer[head] = second[i];
+        head = (head + 1) % OUTPUT_QUEUE_SIZE;
+    }
+    m_head = head;
+    m_used += length;
+    if (m_used > m_peakUsed)
+    {
+        m_peakUsed = m_used;
+    }
+    m_messagesQueued++;
+    interrupts();
+    return (true);
+}
+
+//-----------------------------------------------------------------------------------------
+// Drain writes as much as the transport will take, in contiguous chunks.  Never waits.
+void OutputQueue::Drain()
+{
+    if (m_transport == NULL)
+    {
+        return;
+    }
+    while (m_used > 0)
+    {
+        int room = m_transport->AvailableForWrite();
+        if (room <= 0)
+        {
+            m_backPressure++;
+            return; // host isn't reading, try again next pass.
+        }
+
+        // send up to the end of the ring in one go; a wrap takes a second pass.
+        uint32_t chunk = m_used;
+        if (chunk > (OUTPUT_QUEUE_SIZE - m_tail))
+        {
+            chunk = OUTPUT_QUEUE_SIZE - m_tail;
+        }
+        if (chunk > (uint32_t)room)
+        {
+            chunk = room;
+        }
+        chunk = m_transport->Write((const uint8_t *)&m_buffer[m_tail], chunk);
+        if (chunk == 0)
+        {
+            m_backPressure++;
+            return;
+        }
+        m_writes++;
+        m_bytesSent += chunk;
+
+        noInterrupts();
+        m_tail = (m_tail + chunk) % OUTPUT_QUEUE_SIZE;
+        m_used -= chunk;
+        interrupts();
+    }
+}
+
+//-----------------------------------------------------------------------------------------
+// IsEmpty tells the caller if there's anything left to send.
+boolean OutputQueue::IsEmpty()
+{
+    return (m_used == 0);
+}
+
+//-----------------------------------------------------------------------------------------
+// Room tells the caller how big a message would fit right now.
+uint32_t OutputQueue::Room()
+{
+    return (OUTPUT_QUEUE_SIZE - m_used);
+}
+
+//-----------------------------------------------------------------------------------------
+// ReadStatistics returns a JSON object with the queue counters.
+String OutputQueue::ReadStatistics()
+{
+    String Text = String("");
+    Text += String("{'Output': {'Queued':");
+    Text += String(m_messagesQueued);
+    Text += String(",'Dropped':");
+    Text += String(m_messagesDropped);
+    Text += String(",'DroppedBytes':");
+    Text += String(m_bytesDropped);
+    Text += String(",'SentBytes':");
+    Text += String(m_bytesSent);
+    Text += String(",'Writes':");
+    Text += String(m_writes);
+    Text += String(",'BackPressure':");
+    Text += String(m_backPressure);
+    Text += String(",'Used':");
+    Text += String(m_used);
+    Text += String(",'Peak':");
+    Text += String(m_peakUsed);
+    Text += String("}}");
+    return (Text);
+}
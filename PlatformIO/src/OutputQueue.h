@@ -0,0 +1,82 @@
+// ---------------------------------------------------------------------------
+// Output Queue Library - v0.0.1 - 07/12/2020
+//
+// AUTHOR/LICENSE:
+// Created by Imran Peerbhai -- ipeerbhai@aol.com
+// Copyright 2020 License:
+// Forks and derivitive works are NOT permitted without
+// permission. Permission is only granted to use as-is for private and
+// non-commercial use by natural persons or non-profit entities.
+// For-profit entities require a license.
+//
+// CONTRIBUTIONS:
+// If you wish to contribute, make changes, or enhancements,
+// please create a pull request.
+//
+// DISCLAIMER:
+// This software is furnished "as is", without technical support, and with no
+// warranty, express or implied, as to its usefulness for any purpose.
+// ---------------------------------------------------------------------------
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+// Theory of Operation:
+
+//  Serial.println followed by Serial.flush waits for the USB host to drain every
+//  line, so one command used to cost five or more USB transactions.
+
+//  Instead, every reply and event is appended to a fixed-size ring buffer, which
+//  never blocks and never allocates.  A message either fits completely or is
+//  dropped and counted -- we never send half a line.  Once per loop pass, Drain
+//  hands as much as the transport will take in large contiguous chunks, so many
+//  small messages go out together in full packets.
+
+//  If the host stops reading, Drain notices the transport is full, counts the
+//  back-pressure, and tries again next pass instead of stalling the robot.
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+
+#include <Arduino.h>
+#include <stdint.h>
+#include "Transport.h"
+#include "TraceSystem.h"
+
+#ifndef OUTPUT_ONCE
+#define OUTPUT_ONCE
+
+#define OUTPUT_QUEUE_SIZE 4096 // bytes of replies and events we can hold before dropping.
+
+class OutputQueue
+{
+public:
+    OutputQueue();
+    OutputQueue(Transport *transport, TraceRecorder *trace);
+    void Init(Transport *transport, TraceRecorder *trace);
+    boolean Print(const char *text);      // append text as-is.  false if it was dropped.
+    boolean Println(const char *text);    // append text and a line ending as one message.
+    boolean Println(const String &text);
+    void Drain();                         // hand queued bytes to the transport.  Call once per loop pass.
+    boolean IsEmpty();
+    uint32_t Room();                      // bytes that can be queued right now.
+    String ReadStatistics();              // returns a JSON object with the queue counters.
+
+private:
+    boolean Enqueue(const char *first, uint32_t firstLength, const char *second, uint32_t secondLength);
+
+    Transport *m_transport;
+    TraceRecorder *m_trace;               // drops are recorded here, if set.
+    char m_buffer[OUTPUT_QUEUE_SIZE];
+    volatile uint32_t m_head;             // next byte to write into.
+    volatile uint32_t m_tail;             // next byte to send.
+    volatile uint32_t m_used;             // bytes waiting to be sent.
+    uint32_t m_peakUsed;                  // most bytes ever waiting.
+    uint32_t m_messagesQueued;
+    uint32_t m_messagesDropped;
+    uint32_t m_bytesDropped;
+    uint32_t m_bytesSent;
+    uint32_t m_writes;                    // transport writes -- compare with m_messagesQueued to see coalescing.
+    uint32_t m_backPressure;              // drains that found the transport full.
+};
+
+#endif
@@ -0,0 +1,189 @@
+#include "PowerSystem.h"
+
+//-----------------------------------------------------------------------------------------
+// Constructor:
+//  Default constructor does nothing.
+PowerManager::PowerManager()
+{
+}
+
+//-----------------------------------------------------------------------------------------
+// Constructor:
+//  Store references to the tick, its timer, and everything that decides whether it can slow down.
+PowerManager::PowerManager(volatile uint32_t *tickCounter, volatile uint32_t *tickPeriod, IntervalTimer *timer, void (*tickISR)(), MotorControl *motorSystem, SensorManager *sensorSystem, EncoderManager *encoderSystem, ProgramManager *programSystem, Transport *transport, OutputQueue *outputQueue, ClockManager *clock)
+{
+    Init(tickCounter, tickPeriod, timer, tickISR, motorSystem, sensorSystem, encoderSystem, programSystem, transport, outputQueue, clock);
+}
+
+//-----------------------------------------------------------------------------------------
+// Init starts at the full rate, with idling allowed.
+void PowerManager::Init(volatile uint32_t *tickCounter, volatile uint32_t *tickPeriod, IntervalTimer *timer, void (*tickISR)(), MotorControl *motorSystem, SensorManager *sensorSystem, EncoderManager *encoderSystem, ProgramManager *programSystem, Transport *transport, OutputQueue *outputQueue, ClockManager *clock)
+{
+    m_tickCounter = tickCounter;
+    m_tickPeriod = tickPeriod;
+    m_timer = timer;
+    m_tickISR = tickISR;
+    m_motorControl = motorSystem;
+    m_sensorManager = sensorSystem;
+    m_encoderManager = encoderSystem;
+    m_programManager = programSystem;
+    m_transport = transport;
+    m_outputQueue = outputQueue;
+    m_clock = clock;
+    m_isAllowed = true;
+    m_isIdle = false;
+    m_isCandidate = false;
+    m_idleUS = 0;
+    m_wakes = 0;
+    m_lastWakeCycles = 0;
+    m_maxWakeCycles = 0;
+    m_statsStartUS = m_clock->NowUS();
+}
+
+void PowerManager::SetIdleAllowed(boolean isAllowed)
+{
+    m_isAllowed = isAllowed;
+    if (!isAllowed)
+    {
+        Wake();
+    }
+}
+
+//-----------------------------------------------------------------------------------------
+// Function:
+//  CanIdle is true when nothing needs the full rate tick.
+boolean PowerManager::CanIdle()
+{
+    return (m_isAllowed &&
+            m_motorControl->IsIdle() &&
+            (m_sensorManager->GetUltrasonicCount() == 0) &&
+            !m_encoderManager->HasActiveLoop() &&
+            !m_programManager->IsRunning());
+}
+
+//-----------------------------------------------------------------------------------------
+// Dispatch wakes up for incoming bytes, and slows the tick once CanIdle() has held for a while.
+void PowerManager::Dispatch()
+{
+    if (m_isIdle)
+    {
+        if ((m_transport->Available() > 0) || !CanIdle())
+        {
+            Wake();
+        }
+        return;
+    }
+
+    if (!CanIdle())
+    {
+        m_isCandidate = false;
+        return;
+    }
+    uint32_t now = *m_tickCounter;
+    if (!m_isCandidate)
+    {
+        m_isCandidate = true;
+        m_idleCandidateTick = now;
+        return;
+    }
+    if ((now - m_idleCandidateTick) >= POWER_IDLE_DELAY_US)
+    {
+        EnterIdle();
+    }
+}
+
+//-----------------------------------------------------------------------------------------
+// EnterIdle restarts the timer at the slow rate.  From here the ISR adds the slow period
+// to the tick counter; Wake() squares it up with micros().
+void PowerManager::EnterIdle()
+{
+    noInterrupts();
+    m_idleStartTick = *m_tickCounter;
+    m_idleStartMicros = micros();
+    *m_tickPeriod = POWER_IDLE_TICK_US;
+    m_timer->begin(m_tickISR, POWER_IDLE_TICK_US);
+    interrupts();
+    m_isIdle = true;
+    m_isCandidate = false;
+}
+
+//-----------------------------------------------------------------------------------------
+// Wake brings the tick counter up to the real elapsed time and restarts the 1uS tick.
+void PowerManager::Wake()
+{
+    if (!m_isIdle)
+    {
+        return;
+    }
+    uint32_t startCycles = ARM_DWT_CYCCNT;
+    noInterrupts();
+    uint32_t elapsedUS = micros() - m_idleStartMicros;
+    *m_tickCounter = m_idleStartTick + elapsedUS;
+    *m_tickPeriod = 1;
+    m_timer->begin(m_tickISR, 1);
+    interrupts();
+    m_lastWakeCycles = ARM_DWT_CYCCNT - startCycles;
+    if (m_lastWakeCycles > m_maxWakeCycles)
+    {
+        m_maxWakeCycles = m_lastWakeCycles;
+    }
+    m_idleUS += elapsedUS;
+    m_wakes++;
+    m_isIdle = false;
+}
+
+//-----------------------------------------------------------------------------------------
+// Sleep waits for the next interrupt, if we're idle and loop() has nothing left to do.
+// Something this pass may have published new timings, so check once more first.
+void PowerManager::Sleep()
+{
+    if (!m_isIdle)
+    {
+        return;
+    }
+    if (!CanIdle())
+    {
+        Wake();
+        return;
+    }
+    if ((m_transport->Available() > 0) || !m_outputQueue->IsEmpty())
+    {
+        return; // more work for the next pass.
+    }
+#if defined(__arm__)
+    asm volatile("wfi");
+#endif
+}
+
+//-----------------------------------------------------------------------------------------
+// ReadStatistics returns a JSON object with how much of the time the tick was slowed,
+// and what restarting it costs.
+String PowerManager::ReadStatistics()
+{
+    uint64_t totalUS = m_clock->NowUS() - m_statsStartUS;
+    uint64_t idleUS = m_idleUS;
+    if (m_isIdle)
+    {
+        idleUS += micros() - m_idleStartMicros;
+    }
+    uint32_t cyclesPerUS = F_CPU_ACTUAL / 1000000;
+    String Text = String("");
+    Text += String("{'Power' : {'Idle':");
+    Text += String(m_isIdle ? 1 : 0);
+    Text += String(",'Allowed':");
+    Text += String(m_isAllowed ? 1 : 0);
+    Text += String(",'IdleMS':");
+    Text += String((uint32_t)(idleUS / 1000));
+    Text += String(",'TotalMS':");
+    Text += String((uint32_t)(totalUS / 1000));
+    Text += String(",'IdlePercent':");
+    Text += String((totalUS > 0) ? ((float)idleUS * 100.0f) / (float)totalUS : 0.0f);
+    Text += String(",'Wakes':");
+    Text += String(m_wakes);
+    Text += String(",'LastWakeNS':");
+    Text += String((m_lastWakeCycles * 1000) / cyclesPerUS);
+    Text += String(",'MaxWakeNS':");
+    Text += String((m_maxWakeCycles * 1000) / cyclesPerUS);
+    Text += String("}}");
+    return (Text);
+}
@@ -0,0 +1,104 @@
+// ---------------------------------------------------------------------------
+// Power Library - v0.0.1 - 07/12/2020
+//
+// AUTHOR/LICENSE:
+// Created by Imran Peerbhai -- ipeerbhai@aol.com
+// Copyright 2020 License:
+// Forks and derivitive works are NOT permitted without
+// permission. Permission is only granted to use as-is for private and
+// non-commercial use by natural persons or non-profit entities.
+// For-profit entities require a license.
+//
+// CONTRIBUTIONS:
+// If you wish to contribute, make changes, or enhancements,
+// please create a pull request.
+//
+// DISCLAIMER:
+// This software is furnished "as is", without technical support, and with no
+// warranty, express or implied, as to its usefulness for any purpose.
+// ---------------------------------------------------------------------------
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+// Theory of Operation:
+
+//  A parked rover still takes a million timer interrupts a second, and loop()
+//  spins flat out.  When nothing needs the 1uS tick, we slow it down and sleep.
+
+//  The tick is idle when no motor can make a pulse (nothing published and not
+//  yet adopted, no pulse high, no servo move, every interval or increment 0), no
+//  ultrasonic sensors are configured (echo timing needs the 1uS tick), no velocity
+//  loop is closed, and no motion program runs.  After POWER_IDLE_DELAY_US of that,
+//  the timer is restarted at POWER_IDLE_TICK_US and the ISR adds that much to the
+//  tick counter each time, skipping motor and sensor dispatch.  Everything that
+//  runs from loop() on the tick counter -- the watchdog, clock sync, pose streaming
+//  -- keeps working at that resolution.
+
+//  While idle, loop() ends with WFI, so the core sleeps until the next slow tick
+//  or the link interrupt.  The first received byte, or anything that makes a motor
+//  non-idle, wakes it: the tick counter is brought up to date from micros() and
+//  the timer restarted at 1uS, before the command is parsed.  So new timings are
+//  adopted on the first full-rate tick, as if we'd never slept.
+
+//  "z~" reads residency and wakeup cost (the restart, measured with the cycle
+//  counter), "z0~" keeps the tick at full rate, "z1~" allows idling again.
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+
+#include <Arduino.h>
+#include <stdint.h>
+#include "MotorControl.h"
+#include "SensorSystem.h"
+#include "EncoderSystem.h"
+#include "ProgramSystem.h"
+#include "Transport.h"
+#include "ClockSystem.h"
+
+#ifndef POWER_ONCE
+#define POWER_ONCE
+
+#define POWER_IDLE_TICK_US 1000      // tick period while idle.
+#define POWER_IDLE_DELAY_US 250000   // how long things must be idle before the tick slows down.
+
+class PowerManager
+{
+public:
+    PowerManager();
+    PowerManager(volatile uint32_t *tickCounter, volatile uint32_t *tickPeriod, IntervalTimer *timer, void (*tickISR)(), MotorControl *motorSystem, SensorManager *sensorSystem, EncoderManager *encoderSystem, ProgramManager *programSystem, Transport *transport, OutputQueue *outputQueue, ClockManager *clock);
+    void Init(volatile uint32_t *tickCounter, volatile uint32_t *tickPeriod, IntervalTimer *timer, void (*tickISR)(), MotorControl *motorSystem, SensorManager *sensorSystem, EncoderManager *encoderSystem, ProgramManager *programSystem, Transport *transport, OutputQueue *outputQueue, ClockManager *clock);
+    void SetIdleAllowed(boolean isAllowed);
+    void Wake();               // back to the full rate tick now.  Not from the ISR.
+    void Dispatch();           // wake on input, or slow down once idle long enough.  Call at the start of loop().
+    void Sleep();              // WFI if idle and there's nothing left to do.  Call at the end of loop().
+    String ReadStatistics();   // returns a JSON object with residency and wakeup cost.
+
+private:
+    boolean CanIdle();
+    void EnterIdle();
+
+    boolean m_isAllowed;
+    boolean m_isIdle;
+    uint32_t m_idleCandidateTick;  // tick CanIdle() last turned true.
+    boolean m_isCandidate;
+    uint32_t m_idleStartTick;      // tick counter and micros() when the tick slowed down.
+    uint32_t m_idleStartMicros;
+    uint64_t m_statsStartUS;
+    uint64_t m_idleUS;             // time spent on the slow tick.
+    uint32_t m_wakes;
+    uint32_t m_lastWakeCycles;     // cycles Wake() took to restart the full rate tick.
+    uint32_t m_maxWakeCycles;
+    volatile uint32_t *m_tickCounter;
+    volatile uint32_t *m_tickPeriod;
+    IntervalTimer *m_timer;
+    void (*m_tickISR)();
+    MotorControl *m_motorControl;
+    SensorManager *m_sensorManager;
+    EncoderManager *m_encoderManager;
+    ProgramManager *m_programManager;
+    Transport *m_transport;
+    OutputQueue *m_outputQueue;
+    ClockManager *m_clock;
+};
+
+#endif
@@ -0,0 +1,457 @@
+#include "ProgramSystem.h"
+
+//-----------------------------------------------------------------------------------------
+// Constructor:
+//  Default constructor does nothing.
+ProgramManager::ProgramManager()
+{
+}
+
+//-----------------------------------------------------------------------------------------
+// Constructor:
+//  Store references to the systems a program drives and reports through.
+ProgramManager::ProgramManager(MotorControl *motorSystem, SensorManager *sensorSystem, SafetyManager *safetySystem, volatile uint32_t *tickCounter, OutputQueue *outputQueue, ClockManager *clock, TraceRecorder *trace)
+{
+    Init(motorSystem, sensorSystem, safetySystem, tickCounter, outputQueue, clock, trace);
+}
+
+//-----------------------------------------------------------------------------------------
+// Init empties every slot.
+void ProgramManager::Init(MotorControl *motorSystem, SensorManager *sensorSystem, SafetyManager *safetySystem, volatile uint32_t *tickCounter, OutputQueue *outputQueue, ClockManager *clock, TraceRecorder *trace)
+{
+    m_motorControl = motorSystem;
+    m_sensorManager = sensorSystem;
+    m_safetyManager = safetySystem;
+    m_tickCounter = tickCounter;
+    m_outputQueue = outputQueue;
+    m_clock = clock;
+    m_trace = trace;
+    m_runningSlot = -1;
+    m_step = 0;
+    m_stepStarted = false;
+    for (int slot = 0; slot < PROGRAM_SLOTS; slot++)
+    {
+        m_stepCount[slot] = 0;
+    }
+}
+
+//-----------------------------------------------------------------------------------------
+// AppendStep parses "<slot>,<op>[,<value>...]" and adds the step to the end of the slot.
+// Returns NULL if the step was stored, or what was wrong with it.
+const char *ProgramManager::AppendStep(const char *description)
+{
+    const char *cursor = description;
+    char *end;
+    long slot = strtol(cursor, &end, 10);
+    if ((end == cursor) || (*end != ',') || (slot < 0) || (slot >= PROGRAM_SLOTS))
+    {
+        return ("Bad program slot");
+    }
+    if (slot == m_runningSlot)
+    {
+        return ("Program is running");
+    }
+    if (m_stepCount[slot] >= PROGRAM_STEPS)
+    {
+        return ("Program is full");
+    }
+    cursor = end + 1;
+    uint8_t op = (uint8_t)*cursor++;
+
+    // every op takes a fixed number of values.
+    int wanted;
+    switch (op)
+    {
+    case PROGRAM_OP_STOP:
+        wanted = 0;
+        break;
+    case PROGRAM_OP_DELAY:
+    case PROGRAM_OP_EVENT:
+        wanted = 1;
+        break;
+    case PROGRAM_OP_INTERVAL:
+    case PROGRAM_OP_FREQUENCY:
+    case PROGRAM_OP_SERVO:
+    case PROGRAM_OP_LOOP:
+        wanted = 2;
+        break;
+    case PROGRAM_OP_WAIT:
+        wanted = 3;
+        break;
+    default:
+        return ("Bad program op");
+    }
+    long values[3] = {0, 0, 0};
+    for (int i = 0; i < wanted; i++)
+    {
+        if (*cursor++ != ',')
+        {
+            return ("Bad program step");
+        }
+        values[i] = strtol(cursor, &end, 10);
+        if (end == cursor)
+        {
+            return ("Bad program step");
+        }
+        cursor = end;
+    }
+    if (*cursor != '\0')
+    {
+        return ("Bad program step");
+    }
+
+    ProgramStep step;
+    step.Op = op;
+    step.Target = 0;
+    step.A = 0;
+    step.B = 0;
+    switch (op)
+    {
+    case PROGRAM_OP_INTERVAL:
+    case PROGRAM_OP_FREQUENCY:
+    case PROGRAM_OP_SERVO:
+        if ((values[0] < 0) || (values[0] >= MOTOR_CAPACITY))
+        {
+            return ("Bad program motor");
+        }
+        if (((op == PROGRAM_OP_INTERVAL) && ((values[1] < -MOTOR_MAX_STEP_INTERVAL) || (values[1] > MOTOR_MAX_STEP_INTERVAL))) ||
+            ((op == PROGRAM_OP_FREQUENCY) && ((values[1] < -MOTOR_MAX_STEP_MILLIHERTZ) || (values[1] > MOTOR_MAX_STEP_MILLIHERTZ))) ||
+            ((op == PROGRAM_OP_SERVO) && (values[1] < 0)))
+        {
+            return ("Bad program value");
+        }
+        step.Target = (uint8_t)values[0];
+        step.A = values[1];
+        break;
+    case PROGRAM_OP_DELAY:
+        if ((values[0] < 0) || (values[0] > PROGRAM_MAX_MS))
+        {
+            return ("Bad program time");
+        }
+        step.A = values[0];
+        break;
+    case PROGRAM_OP_WAIT:
+        if ((values[0] < 0) || (values[0] >= ULTRASONIC_CAPACITY))
+        {
+            return ("Bad program sensor");
+        }
+        if ((values[1] == 0) || (values[2] < 0) || (values[2] > PROGRAM_MAX_MS))
+        {
+            return ("Bad program wait");
+        }
+        step.Target = (uint8_t)values[0];
+        step.A = values[1];
+        step.B = values[2];
+        break;
+    case PROGRAM_OP_LOOP:
+        // loops only go backwards, to a step that already exists.
+        if ((values[0] < 0) || (values[0] >= m_stepCount[slot]) || (values[1] < 0) || (values[1] >= PROGRAM_NO_LOOP))
+        {
+            return ("Bad program loop");
+        }
+        step.Target = (uint8_t)values[0];
+        step.A = values[1];
+        break;
+    case PROGRAM_OP_EVENT:
+        step.A = values[0];
+        break;
+    default:
+        break;
+    }
+    m_steps[slot][m_stepCount[slot]] = step;
+    m_stepCount[slot]++;
+    return (NULL);
+}
+
+//-----------------------------------------------------------------------------------------
+// ClearSlot forgets a program.  The running one can't be cleared.
+const char *ProgramManager::ClearSlot(int slot)
+{
+    if ((slot < 0) || (slot >= PROGRAM_SLOTS))
+    {
+        return ("Bad program slot");
+    }
+    if (slot == m_runningSlot)
+    {
+        return ("Program is running");
+    }
+    m_stepCount[slot] = 0;
+    return (NULL);
+}
+
+//-----------------------------------------------------------------------------------------
+// Run starts a program from its first step.  Anything already running is replaced.
+const char *ProgramManager::Run(int slot)
+{
+    if ((slot < 0) || (slot >= PROGRAM_SLOTS))
+    {
+        return ("Bad program slot");
+    }
+    if (m_stepCount[slot] == 0)
+    {
+        return ("Program is empty");
+    }
+    if (!m_safetyManager->IsSafe())
+    {
+        return ("Not safe to run");
+    }
+    for (int i = 0; i < PROGRAM_STEPS; i++)
+    {
+        m_loopsLeft[i] = PROGRAM_NO_LOOP;
+    }
+    m_runningSlot = slot;
+    m_step = 0;
+    m_stepStarted = false;
+    m_trace->Record(TRACE_PROGRAM, 'R', slot);
+    SendEvent("Start", 0);
+    return (NULL);
+}
+
+//-----------------------------------------------------------------------------------------
+// Stop ends the program where it is and stops every motor.
+void ProgramManager::Stop()
+{
+    if (IsRunning())
+    {
+        Finish("Stopped", 'S');
+    }
+    m_motorControl->StopMotors();
+}
+
+boolean ProgramManager::IsRunning()
+{
+    return (m_runningSlot >= 0);
+}
+
+//-----------------------------------------------------------------------------------------
+// Dispatch runs steps until one has to wait, or a pass has run a whole program's worth --
+// a loop with nothing to wait on must not hold up loop() forever.
+void ProgramManager::Dispatch()
+{
+    if (!IsRunning())
+    {
+        return;
+    }
+    if (!m_safetyManager->IsSafe())
+    {
+        m_motorControl->StopMotors();
+        Finish("Safety", 'F');
+        return;
+    }
+
+    uint32_t now = *m_tickCounter;
+    for (int ran = 0; ran < PROGRAM_STEPS; ran++)
+    {
+        if (m_step >= m_stepCount[m_runningSlot])
+        {
+            Finish("Done", 'D');
+            return;
+        }
+        if (!m_stepStarted)
+        {
+            m_stepStartTick = now;
+            m_stepStarted = true;
+        }
+        int current = m_step;
+        if (!RunStep(m_steps[m_runningSlot][current], now))
+        {
+            return; // waiting.
+        }
+        if (!IsRunning())
+        {
+            return; // the step ended the program.
+        }
+        if (m_step == current)
+        {
+            m_step++; // didn't jump.
+        }
+        m_stepStarted = false;
+    }
+}
+
+//-----------------------------------------------------------------------------------------
+// RunStep does one step's work.  Returns true once the step is finished; a loop step
+// moves m_step itself.
+boolean ProgramManager::RunStep(ProgramStep &step, uint32_t now)
+{
+    uint32_t elapsedUS = now - m_stepStartTick;
+    if (((step.Op == PROGRAM_OP_INTERVAL) || (step.Op == PROGRAM_OP_FREQUENCY) || (step.Op == PROGRAM_OP_SERVO)) &&
+        m_motorControl->IsLoopOwned(step.Target))
+    {
+        // a velocity loop drives that motor; running on without this step would be a different program.
+        m_motorControl->StopMotors();
+        Finish("Loop owns motor", 'L');
+        return (false);
+    }
+    switch (step.Op)
+    {
+    case PROGRAM_OP_INTERVAL:
+        m_motorControl->SetStepInterval(step.Target, step.A);
+        return (true);
+
+    case PROGRAM_OP_FREQUENCY:
+        m_motorControl->SetStepMilliHertz(step.Target, step.A);
+        return (true);
+
+    case PROGRAM_OP_SERVO:
+        m_motorControl->SetServoDuty(step.Target, step.A);
+        return (true);
+
+    case PROGRAM_OP_DELAY:
+        return (elapsedUS >= ((uint32_t)step.A * 1000));
+
+    case PROGRAM_OP_WAIT:
+    {
+        // only a reading taken since the wait began counts.
+        uint32_t durationUS;
+        uint32_t readingTick;
+        if (m_sensorManager->ReadUltrasonic(step.Target, &durationUS, &readingTick) && ((int32_t)(readingTick - m_stepStartTick) > 0))
+        {
+            uint32_t thresholdUS = (uint32_t)(((step.A > 0) ? step.A : -step.A) * REFLEX_US_PER_MM);
+            if ((step.A > 0) ? (durationUS < thresholdUS) : (durationUS > thresholdUS))
+            {
+                return (true);
+            }
+        }
+        if ((step.B > 0) && (elapsedUS >= ((uint32_t)step.B * 1000)))
+        {
+            m_motorControl->StopMotors();
+            Finish("Timeout", 'T');
+        }
+        return (false);
+    }
+
+    case PROGRAM_OP_LOOP:
+        if (step.A == 0)
+        {
+            m_step = step.Target; // forever.
+        }
+        else
+        {
+            if (m_loopsLeft[m_step] == PROGRAM_NO_LOOP)
+            {
+                m_loopsLeft[m_step] = step.A - 1; // the pass that got us here counts.
+            }
+            if (m_loopsLeft[m_step] > 0)
+            {
+                m_loopsLeft[m_step]--;
+                m_step = step.Target;
+            }
+            else
+            {
+                m_loopsLeft[m_step] = PROGRAM_NO_LOOP; // ready again if an outer loop comes back.
+            }
+        }
+        return (true);
+
+    case PROGRAM_OP_EVENT:
+        SendEvent("Mark", step.A);
+        return (true);
+
+    case PROGRAM_OP_STOP:
+        m_motorControl->StopMotors();
+        return (true);
+
+    default:
+        return (true);
+    }
+}
+
+//-----------------------------------------------------------------------------------------
+// Finish ends the running program and says why, on the link and in the trace.
+void ProgramManager::Finish(const char *event, uint8_t traceCode)
+{
+    SendEvent(event, 0);
+    m_trace->Record(TRACE_PROGRAM, traceCode, m_step);
+    m_runningSlot = -1;
+    m_stepStarted = false;
+}
+
+//-----------------------------------------------------------------------------------------
+// SendEvent queues one progress event for the running program.
+void ProgramManager::SendEvent(const char *event, int32_t code)
+{
+    String Text = String("{'Program' : {'Slot':");
+    Text += String(m_runningSlot);
+    Text += String(",'Step':");
+    Text += String(m_step);
+    Text += String(",'Event':'");
+    Text += String(event);
+    Text += String("','Code':");
+    Text += String(code);
+    Text += String(",");
+    Text += m_clock->Stamp(m_clock->NowUS());
+    Text += String("}}");
+    m_outputQueue->Println(Text);
+}
+
+//-----------------------------------------------------------------------------------------
+// ReadSlot returns a JSON object listing a slot's steps the way they were appended.
+String ProgramManager::ReadSlot(int slot)
+{
+    String Text = String("");
+    if ((slot < 0) || (slot >= PROGRAM_SLOTS))
+    {
+        Text += String("{'Error' : 'Bad program slot'}");
+        return (Text);
+    }
+    Text += String("{'Slot':");
+    Text += String(slot);
+    Text += String(",'Steps': [");
+    for (int i = 0; i < m_stepCount[slot]; i++)
+    {
+        const ProgramStep &step = m_steps[slot][i];
+        Text += String("'");
+        Text += String((char)step.Op);
+        switch (step.Op)
+        {
+        case PROGRAM_OP_INTERVAL:
+        case PROGRAM_OP_FREQUENCY:
+        case PROGRAM_OP_SERVO:
+        case PROGRAM_OP_LOOP:
+            Text += String(",");
+            Text += String(step.Target);
+            Text += String(",");
+            Text += String(step.A);
+            break;
+        case PROGRAM_OP_WAIT:
+            Text += String(",");
+            Text += String(step.Target);
+            Text += String(",");
+            Text += String(step.A);
+            Text += String(",");
+            Text += String(step.B);
+            break;
+        case PROGRAM_OP_DELAY:
+        case PROGRAM_OP_EVENT:
+            Text += String(",");
+            Text += String(step.A);
+            break;
+        default:
+            break;
+        }
+        Text += String("',");
+    }
+    Text += String("]}");
+    return (Text);
+}
+
+//-----------------------------------------------------------------------------------------
+// ReadState returns a JSON object with the running slot (-1 for none), its step, and how
+// many steps each slot holds.
+String ProgramManager::ReadState()
+{
+    String Text = String("");
+    Text += String("{'Program' : {'Running':");
+    Text += String(m_runningSlot);
+    Text += String(",'Step':");
+    Text += String(m_step);
+    Text += String(",'Slots': [");
+    for (int slot = 0; slot < PROGRAM_SLOTS; slot++)
+    {
+        Text += String(m_stepCount[slot]);
+        Text += String(",");
+    }
+    Text += String("]}}");
+    return (Text);
+}
@@ -0,0 +1,129 @@
+// ---------------------------------------------------------------------------
+// Motion Program Library - v0.0.1 - 07/12/2020
+//
+// AUTHOR/LICENSE:
+// Created by Imran Peerbhai -- ipeerbhai@aol.com
+// Copyright 2020 License:
+// Forks and derivitive works are NOT permitted without
+// permission. Permission is only granted to use as-is for private and
+// non-commercial use by natural persons or non-profit entities.
+// For-profit entities require a license.
+//
+// CONTRIBUTIONS:
+// If you wish to contribute, make changes, or enhancements,
+// please create a pull request.
+//
+// DISCLAIMER:
+// This software is furnished "as is", without technical support, and with no
+// warranty, express or implied, as to its usefulness for any purpose.
+// ---------------------------------------------------------------------------
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+// Theory of Operation:
+
+//  Docking, scanning sweeps and turning in place are the same few "m"/"v"
+//  commands over and over, each one a host round trip.  A motion program is
+//  that sequence uploaded once into a RAM slot and run on board, so its timing
+//  no longer depends on the link.
+
+//  A program is a list of steps, appended one per frame:
+//    "gA0,I,0,+500~"      -- slot 0: stepper 0 at interval 500 (like "m"), sign is direction.
+//    "gA0,F,1,-1234567~"  -- stepper 1 at 1234.567 Hz (like "f"), the value is millihertz.
+//    "gA0,V,2,1500~"      -- servo 2 duty interval 1500 (like "v").
+//    "gA0,D,250~"         -- hold for 250ms.
+//    "gA0,W,0,300,5000~"  -- wait until sensor 0 reads nearer than 300mm (-300 is farther),
+//                            give up after 5000ms (0 waits forever).
+//    "gA0,L,0,4~"         -- run from step 0 to here 4 times in all (0 is forever).
+//    "gA0,E,7~"           -- send a progress event with code 7.
+//    "gA0,S~"             -- stop every motor.
+//  "gR0~" runs slot 0, "gS~" stops the program and the motors, "gX0~" clears
+//  slot 0, "gL0~" lists it and "g~" reads what's running.
+
+//  Dispatch runs the program from loop().  Steps that don't wait run back to
+//  back in one pass; D and W hold the program on the tick counter.  Start,
+//  finish, stop, timeout and E steps each send one {'Program' : ...} event.
+//  A motor step for a motor a velocity loop owns ends the program the way a
+//  timeout does, with a "Loop owns motor" event.
+//  If the safety system trips while a program runs, the program is stopped --
+//  it must not resume on its own once the trip is reset.  The host watchdog
+//  still applies, so a host running a long program keeps sending "w".
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+
+#include <Arduino.h>
+#include <stdint.h>
+#include "MotorControl.h"
+#include "SensorSystem.h"
+#include "SafetySystem.h"
+#include "OutputQueue.h"
+#include "ClockSystem.h"
+#include "TraceSystem.h"
+
+#ifndef PROGRAM_ONCE
+#define PROGRAM_ONCE
+
+#define PROGRAM_SLOTS 4          // programs kept in RAM.
+#define PROGRAM_STEPS 32         // steps per program.
+#define PROGRAM_MAX_MS 2000000   // longest hold or timeout; the tick counter wraps at 71 minutes.
+#define PROGRAM_NO_LOOP 0xFFFF   // a loop step that isn't counting yet.
+
+enum ProgramOps
+{
+  PROGRAM_OP_INTERVAL = 'I',
+  PROGRAM_OP_FREQUENCY = 'F',
+  PROGRAM_OP_SERVO = 'V',
+  PROGRAM_OP_DELAY = 'D',
+  PROGRAM_OP_WAIT = 'W',
+  PROGRAM_OP_LOOP = 'L',
+  PROGRAM_OP_EVENT = 'E',
+  PROGRAM_OP_STOP = 'S'
+};
+
+// One program step.  What Target, A and B mean depends on Op, see the theory above.
+struct ProgramStep
+{
+  uint8_t Op;      // a ProgramOps value.
+  uint8_t Target;  // motor, sensor or loop-back step.
+  int32_t A;
+  int32_t B;
+};
+
+class ProgramManager
+{
+public:
+    ProgramManager();
+    ProgramManager(MotorControl *motorSystem, SensorManager *sensorSystem, SafetyManager *safetySystem, volatile uint32_t *tickCounter, OutputQueue *outputQueue, ClockManager *clock, TraceRecorder *trace);
+    void Init(MotorControl *motorSystem, SensorManager *sensorSystem, SafetyManager *safetySystem, volatile uint32_t *tickCounter, OutputQueue *outputQueue, ClockManager *clock, TraceRecorder *trace);
+    const char *AppendStep(const char *description); // "<slot>,<op>[,<value>...]".  NULL on success.
+    const char *ClearSlot(int slot);
+    const char *Run(int slot);
+    void Stop();          // stops the program and every motor.
+    boolean IsRunning();
+    String ReadSlot(int slot);  // returns a JSON object listing a slot's steps.
+    String ReadState();         // returns a JSON object with what is running, and how far along it is.
+    void Dispatch();            // run the program.  Call from loop().
+
+private:
+    boolean RunStep(ProgramStep &step, uint32_t now); // true once the step is finished.
+    void Finish(const char *event, uint8_t traceCode);
+    void SendEvent(const char *event, int32_t code);
+
+    ProgramStep m_steps[PROGRAM_SLOTS][PROGRAM_STEPS];
+    uint8_t m_stepCount[PROGRAM_SLOTS];
+    uint16_t m_loopsLeft[PROGRAM_STEPS]; // per loop step of the running program, PROGRAM_NO_LOOP until it starts counting.
+    int m_runningSlot;                   // -1 when nothing runs.
+    int m_step;                          // the step being run.
+    boolean m_stepStarted;               // m_stepStartTick is for this step.
+    uint32_t m_stepStartTick;
+    MotorControl *m_motorControl;
+    SensorManager *m_sensorManager;
+    SafetyManager *m_safetyManager;
+    volatile uint32_t *m_tickCounter;
+    OutputQueue *m_outputQueue;
+    ClockManager *m_clock;
+    TraceRecorder *m_trace;
+};
+
+#endif
@@ -0,0 +1,196 @@
+#include "ReflexSystem.h"
+
+//-----------------------------------------------------------------------------------------
+// Constructor:
+//  Default constructor does nothing.
+ReflexManager::ReflexManager()
+{
+}
+
+//-----------------------------------------------------------------------------------------
+// Constructor:
+//  Store references to the motor and safety systems.
+ReflexManager::ReflexManager(MotorControl *motorSystem, SafetyManager *safetySystem)
+{
+    Init(motorSystem, safetySystem);
+}
+
+//-----------------------------------------------------------------------------------------
+// Init starts with no rules and nothing capped.
+void ReflexManager::Init(MotorControl *motorSystem, SafetyManager *safetySystem)
+{
+    m_motorControl = motorSystem;
+    m_safetyManager = safetySystem;
+    m_hasReading = 0;
+    for (int i = 0; i < REFLEX_SENSORS; i++)
+    {
+        m_latestUS[i] = 0;
+    }
+    for (int i = 0; i < MOTOR_CAPACITY; i++)
+    {
+        m_appliedCapQ8[i] = MOTOR_SPEED_CAP_FULL;
+    }
+    ClearRules();
+}
+
+//-----------------------------------------------------------------------------------------
+// ClearRules disables every rule and lifts every cap.
+void ReflexManager::ClearRules()
+{
+    noInterrupts();
+    for (int i = 0; i < REFLEX_CAPACITY; i++)
+    {
+        m_rules[i].IsEnabled = false;
+    }
+    for (int i = 0; i < m_motorControl->GetMotorCount(); i++)
+    {
+        m_motorControl->SetSpeedCap(i, MOTOR_SPEED_CAP_FULL);
+        m_appliedCapQ8[i] = MOTOR_SPEED_CAP_FULL;
+    }
+    interrupts();
+}
+
+//-----------------------------------------------------------------------------------------
+// ConfigureRule parses "<rule>,<sensor mask>,<near mm>,<far mm>,<motor mask>,<percent>".
+// Returns NULL if the rule was stored, or what was wrong with it.
+const char *ReflexManager::ConfigureRule(const char *description)
+{
+    long fields[6];
+    const char *cursor = description;
+    for (int i = 0; i < 6; i++)
+    {
+        if ((i > 0) && (*cursor++ != ','))
+        {
+            return ("Bad reflex rule");
+        }
+        char *end;
+        fields[i] = strtol(cursor, &end, 10);
+        if (end == cursor)
+        {
+            return ("Bad reflex rule");
+        }
+        cursor = end;
+    }
+    if ((fields[0] < 0) || (fields[0] >= REFLEX_CAPACITY))
+    {
+        return ("Reflex rule index exceeds capacity");
+    }
+    if ((fields[1] <= 0) || (fields[1] > 0xFFFF) || (fields[4] <= 0) || (fields[4] > 0xFFFF))
+    {
+        return ("Bad reflex mask");
+    }
+    if ((fields[2] < 0) || (fields[3] <= fields[2]) || (fields[5] < 0) || (fields[5] > 100))
+    {
+        return ("Bad reflex band");
+    }
+
+    // build it aside, then swap it in with the ISR held off.
+    ReflexRule rule;
+    rule.IsEnabled = true;
+    rule.SensorMask = (uint16_t)fields[1];
+    rule.NearUS = (uint32_t)(fields[2] * REFLEX_US_PER_MM);
+    rule.FarUS = (uint32_t)(fields[3] * REFLEX_US_PER_MM);
+    rule.MotorMask = (uint16_t)fields[4];
+    rule.CapQ8 = (uint16_t)((fields[5] * MOTOR_SPEED_CAP_FULL) / 100);
+    noInterrupts();
+    m_rules[fields[0]] = rule;
+    interrupts();
+    return (NULL);
+}
+
+//-----------------------------------------------------------------------------------------
+// OnReading runs in the sensor ISR when an echo completes.  Recompute every motor's cap
+// from the latest readings and hand them all to MotorControl.
+void ReflexManager::OnReading(int sensorIndex, uint32_t durationUS)
+{
+    if ((sensorIndex >= 0) && (sensorIndex < REFLEX_SENSORS))
+    {
+        m_latestUS[sensorIndex] = durationUS;
+        m_hasReading |= (1 << sensorIndex);
+    }
+
+    uint16_t caps[MOTOR_CAPACITY];
+    int motorCount = m_motorControl->GetMotorCount();
+    for (int motor = 0; motor < motorCount; motor++)
+    {
+        caps[motor] = MOTOR_SPEED_CAP_FULL;
+    }
+
+    if (!m_safetyManager->IsOverridden())
+    {
+        for (int i = 0; i < REFLEX_CAPACITY; i++)
+        {
+            ReflexRule &rule = m_rules[i];
+            if (!rule.IsEnabled)
+            {
+                continue;
+            }
+
+            // nearest reading among the rule's sensors.
+            uint32_t nearest = 0xFFFFFFFF;
+            uint16_t sensors = rule.SensorMask & m_hasReading;
+            for (int sensor = 0; sensors != 0; sensor++, sensors >>= 1)
+            {
+                if ((sensors & 1) && (m_latestUS[sensor] < nearest))
+                {
+                    nearest = m_latestUS[sensor];
+                }
+            }
+            if ((nearest < rule.NearUS) || (nearest >= rule.FarUS))
+            {
+                continue;
+            }
+
+            for (int motor = 0; motor < motorCount; motor++)
+            {
+                if ((rule.MotorMask & (1 << motor)) && (rule.CapQ8 < caps[motor]))
+                {
+                    caps[motor] = rule.CapQ8;
+                }
+            }
+        }
+    }
+
+    // MotorControl ignores a cap it already has, so pushing them all is cheap.
+    for (int motor = 0; motor < motorCount; motor++)
+    {
+        m_motorControl->SetSpeedCap(motor, caps[motor]);
+        m_appliedCapQ8[motor] = caps[motor];
+    }
+}
+
+//-----------------------------------------------------------------------------------------
+// ReadRules returns a JSON object with the enabled rules, in mm and percent, and the caps in force.
+String ReflexManager::ReadRules()
+{
+    String Text = String("");
+    Text += String("{'Reflexes': [");
+    for (int i = 0; i < REFLEX_CAPACITY; i++)
+    {
+        if (!m_rules[i].IsEnabled)
+        {
+            continue;
+        }
+        Text += String("{'Rule':");
+        Text += String(i);
+        Text += String(",'Sensors':");
+        Text += String(m_rules[i].SensorMask);
+        Text += String(",'NearMM':");
+        Text += String((uint32_t)(m_rules[i].NearUS / REFLEX_US_PER_MM + 0.5f));
+        Text += String(",'FarMM':");
+        Text += String((uint32_t)(m_rules[i].FarUS / REFLEX_US_PER_MM + 0.5f));
+        Text += String(",'Motors':");
+        Text += String(m_rules[i].MotorMask);
+        Text += String(",'Percent':");
+        Text += String((m_rules[i].CapQ8 * 100 + (MOTOR_SPEED_CAP_FULL / 2)) / MOTOR_SPEED_CAP_FULL);
+        Text += String("},");
+    }
+    Text += String("],'Caps': [");
+    for (int motor = 0; motor < m_motorControl->GetMotorCount(); motor++)
+    {
+        Text += String((m_appliedCapQ8[motor] * 100 + (MOTOR_SPEED_CAP_FULL / 2)) / MOTOR_SPEED_CAP_FULL);
+        Text += String(",");
+    }
+    Text += String("]}");
+    return (Text);
+}
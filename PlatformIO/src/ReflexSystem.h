@@ -0,0 +1,88 @@
+// ---------------------------------------------------------------------------
+// Reflex Library - v0.0.1 - 07/12/2020
+//
+// AUTHOR/LICENSE:
+// Created by Imran Peerbhai -- ipeerbhai@aol.com
+// Copyright 2020 License:
+// Forks and derivitive works are NOT permitted without
+// permission. Permission is only granted to use as-is for private and
+// non-commercial use by natural persons or non-profit entities.
+// For-profit entities require a license.
+//
+// CONTRIBUTIONS:
+// If you wish to contribute, make changes, or enhancements,
+// please create a pull request.
+//
+// DISCLAIMER:
+// This software is furnished "as is", without technical support, and with no
+// warranty, express or implied, as to its usefulness for any purpose.
+// ---------------------------------------------------------------------------
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+// Theory of Operation:
+
+//  Slowing down near an obstacle used to need the host: read "s", decide, send
+//  "m" -- tens of milliseconds over USB.  Reflexes do it on board, in the same
+//  interrupt that finishes the ultrasonic reading.
+
+//  A rule says: when the nearest of these sensors is between near and far mm,
+//  cap these motors at this percent of their commanded speed.  0% is a stop.
+//  Every time a reading completes, all rules are checked against the latest
+//  reading of every sensor, and each motor gets the lowest cap of the rules that
+//  match (100% if none do).  MotorControl applies the cap to the live step rate,
+//  so the host's commanded speed comes back as soon as the obstacle clears.
+
+//  Servos (motors with no dir pin) are never capped -- their duty is a position.
+//  While the safety override ("o") is on, every cap is lifted at the next reading.
+
+//  "R0,3,0,300,3,0~"     -- rule 0: sensors 0 and 1 (mask 3) under 300mm, stop motors 0 and 1.
+//  "R1,3,300,800,3,40~"  -- rule 1: same sensors 300 to 800mm, motors 0 and 1 at 40%.
+//  "RX~" clears every rule, "R~" reads the rules and the caps in force.
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+
+#include <Arduino.h>
+#include <stdint.h>
+#include "MotorControl.h"
+#include "SafetySystem.h"
+
+#ifndef REFLEX_ONCE
+#define REFLEX_ONCE
+
+#define REFLEX_CAPACITY 8          // rules in the table.
+#define REFLEX_SENSORS 16          // sensor masks are 16 bits.
+#define REFLEX_US_PER_MM 5.831f    // echo round trip at 343 m/s.
+
+struct ReflexRule
+{
+  boolean IsEnabled;
+  uint16_t SensorMask;   // bit n is ultrasonic sensor n.
+  uint32_t NearUS;       // band start, as echo duration.
+  uint32_t FarUS;        // band end, not included.
+  uint16_t MotorMask;    // bit n is motor n.
+  uint16_t CapQ8;        // 256 is full speed, 0 is stop.
+};
+
+class ReflexManager
+{
+public:
+    ReflexManager();
+    ReflexManager(MotorControl *motorSystem, SafetyManager *safetySystem);
+    void Init(MotorControl *motorSystem, SafetyManager *safetySystem);
+    const char *ConfigureRule(const char *description); // "<rule>,<sensors>,<near>,<far>,<motors>,<percent>".  NULL on success.
+    void ClearRules();
+    void OnReading(int sensorIndex, uint32_t durationUS); // called from the sensor ISR.
+    String ReadRules();   // returns a JSON object with the rules and the caps in force.
+
+private:
+    ReflexRule m_rules[REFLEX_CAPACITY];
+    uint32_t m_latestUS[REFLEX_SENSORS];  // latest echo duration of each sensor.
+    uint16_t m_hasReading;                // bit n set once sensor n has a reading.
+    uint16_t m_appliedCapQ8[MOTOR_CAPACITY];
+    MotorControl *m_motorControl;
+    SafetyManager *m_safetyManager;
+};
+
+#endif
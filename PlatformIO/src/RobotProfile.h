@@ -0,0 +1,68 @@
+// ---------------------------------------------------------------------------
+// Robot Profile - v0.0.1 - 07/12/2020
+//
+// AUTHOR/LICENSE:
+// Created by Imran Peerbhai -- ipeerbhai@aol.com
+// Copyright 2020 License:
+// Forks and derivitive works are NOT permitted without
+// permission. Permission is only granted to use as-is for private and
+// non-commercial use by natural persons or non-profit entities.
+// For-profit entities require a license.
+//
+// CONTRIBUTIONS:
+// If you wish to contribute, make changes, or enhancements,
+// please create a pull request.
+//
+// DISCLAIMER:
+// This software is furnished "as is", without technical support, and with no
+// warranty, express or implied, as to its usefulness for any purpose.
+// ---------------------------------------------------------------------------
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+// Theory of Operation:
+
+//  MotorControl learns pins, counts and motor types at runtime, so its ISR loops
+//  over the bank, branches on the motor type and calls digitalWrite with a pin
+//  from RAM.  A production robot's harness never changes, so it can describe its
+//  motors here at compile time instead.
+
+//  With a profile selected (build_flags = -DROBOT_PROFILE_ROVER), MotorControl
+//  instantiates a dispatch for exactly these motors: the loop is unrolled, the
+//  stepper/servo branches are decided by the compiler, and each pulse pin is a
+//  constant, so digitalWriteFast compiles to a single store to its GPIO register.
+
+//  The profile doesn't configure anything.  The host still sends "c"/"M"/"K" (or
+//  the stored configuration is loaded) as usual; whenever the configured motors
+//  match the profile exactly, the ISR switches to the profiled dispatch, and back
+//  to the generic one if they stop matching.  "B~" reports the cycles each path
+//  takes per tick, "BG~" forces the generic path to compare.
+
+//  To add a robot, copy the ROVER block with your own name and pin table.
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+
+#include <stdint.h>
+
+#ifndef ROBOT_PROFILE_ONCE
+#define ROBOT_PROFILE_ONCE
+
+// A motor's fixed wiring.  -1 is not connected; a motor without a dir pin is a servo.
+struct ProfileMotor
+{
+  int8_t EnablePin;
+  int8_t DirPin;
+  int8_t PulsePin;
+};
+
+#if defined(ROBOT_PROFILE_ROVER)
+// A stepper on pins 1/2/3 and a servo on pin 4 -- the robot in the "K" example.
+#define ROBOT_PROFILE_NAME "Rover"
+#define ROBOT_PROFILE_MOTOR_COUNT 2
+static constexpr ProfileMotor s_robotProfile[ROBOT_PROFILE_MOTOR_COUNT] = {
+    {1, 2, 3},
+    {-1, -1, 4}};
+#endif
+
+#endif
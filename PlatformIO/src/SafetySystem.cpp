@@ -1,4 +1,9 @@
 #include "SafetySystem.h"
+#include "MotorControl.h"
+
+// IntervalTimer wants a plain function, so route it through the one instance.
+static SafetyManager *s_safetyManager = NULL;
+static void DeadlineISR() { s_safetyManager->OnDeadline(); }
 
 //-----------------------------------------------------------------------------------------
 // Constructor:
@@ -9,21 +14,60 @@ SafetyManager::SafetyManager()
 //-----------------------------------------------------------------------------------------
 // Constructor:
 //  Reset the safety system and store a reference to the global tick counter.
-SafetyManager::SafetyManager(volatile uint32_t *tickCounter)
+SafetyManager::SafetyManager(volatile uint32_t *tickCounter, OutputQueue *outputQueue, ClockManager *clock, TraceRecorder *trace, MotorControl *motorSystem)
 {
-    Init(tickCounter);
+    Init(tickCounter, outputQueue, clock, trace, motorSystem);
 }
 
 //-----------------------------------------------------------------------------------------
 // Init initializes instance members.
-void SafetyManager::Init(volatile uint32_t *tickCounter)
+void SafetyManager::Init(volatile uint32_t *tickCounter, OutputQueue *outputQueue, ClockManager *clock, TraceRecorder *trace, MotorControl *motorSystem)
 {
+    s_safetyManager = this;
     m_tickCounter = tickCounter;
-    m_watchDogRequestcount = 0;
+    m_outputQueue = outputQueue;
+    m_clock = clock;
+    m_trace = trace;
+    m_motorControl = motorSystem;
+    m_watcdogLastTick = *m_tickCounter;
+    m_deadlineTick = m_watcdogLastTick + SAFETY_INTERVAL;
+    m_watchdogFired = false;
+    m_expiryPending = false;
+    m_isArmed = false;
+    m_timeouts = 0;
+    m_lastStopNS = 0;
+    m_maxStopNS = 0;
     m_IsConfigured = false;
+
+    // the reset status survives the reset itself; clear it so the next boot reads its own.
+    m_wasHardwareReset = ((SRC_SRSR & SRC_SRSR_WDOG_RST_B) != 0);
+    SRC_SRSR = SRC_SRSR_WDOG_RST_B;
     Reset();
 }
 
+//-----------------------------------------------------------------------------------------
+// StartWatchdog arms the deadline from now, and starts WDOG1.  Once started, WDOG1 can't be
+// stopped until the next reset.
+void SafetyManager::StartWatchdog()
+{
+    noInterrupts();
+    m_watcdogLastTick = *m_tickCounter;
+    m_deadlineTick = m_watcdogLastTick + SAFETY_INTERVAL;
+    interrupts();
+    m_isArmed = m_deadlineTimer.begin(DeadlineISR, (uint32_t)SAFETY_INTERVAL);
+
+    CCM_CCGR3 |= CCM_CCGR3_WDOG1(CCM_CCGR_ON);
+    WDOG1_WMCR = 0; // no power-down counter.
+    WDOG1_WCR = WDOG_WCR_WT(SAFETY_HARDWARE_TIMEOUT) | WDOG_WCR_WDE | WDOG_WCR_WDA | WDOG_WCR_SRS;
+    FeedHardwareWatchdog();
+}
+
+void SafetyManager::FeedHardwareWatchdog()
+{
+    WDOG1_WSR = 0x5555;
+    WDOG1_WSR = 0xAAAA;
+}
+
 //-----------------------------------------------------------------------------------------
 //  IsSafe verifies that it is still safe for motors to turn.
 //  It will always honor the watchdog counter, but allows the user
@@ -41,6 +85,14 @@ bool SafetyManager::IsSafe()
     return (false);
 }
 
+//-----------------------------------------------------------------------------------------
+// Function:
+//  IsOverridden tells the reflex system the user has taken responsibility for the sensors.
+bool SafetyManager::IsOverridden()
+{
+    return (m_userOverride);
+}
+
 //-----------------------------------------------------------------------------------------
 //  IsConfigured verifies we got a valid configuration from the host PC.
 bool SafetyManager::IsConfigured()
@@ -59,6 +111,11 @@ void SafetyManager::SetConfigured(boolean value)
 // SetSensorTrigger allows the sensor manager to set safety flags.
 void SafetyManager::SetSensorTrigger(boolean value)
 {
+    if (value && !m_sensorTriggered)
+    {
+        m_trace->Record(TRACE_SAFETY_TRIP, TRACE_SAFETY_SENSOR, 0);
+        m_trace->RequestDump(true);
+    }
     m_sensorTriggered = value;
 }
 
@@ -66,6 +123,7 @@ void SafetyManager::SetSensorTrigger(boolean value)
 // SetSafetyOverride allows the user (via communication manager) to over-ride a sensor trigger.
 void SafetyManager::SetSafetyOverride(boolean value)
 {
+    m_trace->Record(TRACE_SAFETY_OVERRIDE, value ? 1 : 0, 0);
     m_userOverride = value;
 }
 
@@ -73,30 +131,69 @@ void SafetyManager::SetSafetyOverride(boolean value)
 // Reset fully resets the safety manager for sensors/communication triggers.
 void SafetyManager::Reset()
 {
+    m_trace->Record(TRACE_SAFETY_RESET, 0, 0);
     m_sensorTriggered = false;
     m_userOverride = false;
 }
 
 //-----------------------------------------------------------------------------------------
-// Dispatch updates the watchdog timers, can fire a request to the main computer.
+// Procedure:
+//  OnDeadline runs from the deadline timer.  If the host was heard from since the timer was armed,
+//  wait out the rest of the new deadline.  Otherwise trip: outputs low first, then the bookkeeping.
+void SafetyManager::OnDeadline()
+{
+    uint32_t startCycles = ARM_DWT_CYCCNT;
+    uint32_t now = *m_tickCounter;
+    int32_t remaining = (int32_t)(m_deadlineTick - now);
+    if (remaining > 0)
+    {
+        m_deadlineTimer.begin(DeadlineISR, (uint32_t)remaining);
+        return;
+    }
+    m_deadlineTimer.end();
+    m_watchdogFired = true;
+    m_motorControl->ForceOutputsLow();
+
+    // how late the timer was, plus how long it took to get the pins down.
+    uint32_t cyclesPerUS = F_CPU_ACTUAL / 1000000;
+    uint32_t stopNS = ((now - m_deadlineTick) * 1000) + (((ARM_DWT_CYCCNT - startCycles) * 1000) / cyclesPerUS);
+    m_lastStopNS = stopNS;
+    if (stopNS > m_maxStopNS)
+    {
+        m_maxStopNS = stopNS;
+    }
+    m_timeouts++;
+    m_expiryPending = true;
+
+    // note it for the post-mortem.
+    uint32_t stopUS = (stopNS + 999) / 1000;
+    m_trace->Record(TRACE_WATCHDOG_EXPIRED, 0, (stopUS > 0xFFFF) ? 0xFFFF : stopUS);
+    m_trace->Record(TRACE_SAFETY_TRIP, TRACE_SAFETY_WATCHDOG, 0);
+    m_trace->RequestDump(true);
+}
+
+//-----------------------------------------------------------------------------------------
+// Dispatch feeds the hardware watchdog, and finishes a trip the deadline ISR started: the motors
+// are stopped for good, so they don't pick up where they were when the host comes back, and the
+// main computer is sent a request.
 void SafetyManager::Dispatch()
 {
-    uint32_t computedInterval = m_watcdogLastTick - *m_tickCounter;
-    if (computedInterval >= SAFETY_INTERVAL)
+    if (m_isArmed)
     {
-        m_watchdogFired = true;
-        if (m_watchDogRequestcount == 0)
-        {
-            // send a request to the main computer
-            Serial.println("{'Request' : 'Watchdog'}");
-            m_watchDogRequestcount++;
-        }
+        FeedHardwareWatchdog();
     }
-    else
+    if (!m_expiryPending)
     {
-        m_watchdogFired = false;
-        m_watchDogRequestcount = 0;
+        return;
     }
+    m_expiryPending = false;
+    m_motorControl->StopMotors();
+    String Request = String("{'Request' : 'Watchdog', 'StopUS':");
+    Request += String(m_lastStopNS / 1000.0f, 3);
+    Request += String(",");
+    Request += m_clock->Stamp(m_clock->NowUS());
+    Request += String("}");
+    m_outputQueue->Println(Request);
 }
 
 //-----------------------------------------------------------------------------------------
@@ -109,10 +206,53 @@ String SafetyManager::ResetWatchDog()
     Watchdog += (*m_tickCounter);
     Watchdog += ("::");
     Watchdog += (m_watcdogLastTick);
+    Watchdog += ("::");
+    Watchdog += m_clock->StampTick(*m_tickCounter);
 
-    // reset the members needed.
-    m_watchdogFired = false;
+    // move the deadline out first, so the timer can't trip on the old one.
     m_watcdogLastTick = *m_tickCounter;
+    m_deadlineTick = m_watcdogLastTick + SAFETY_INTERVAL;
+    if (m_watchdogFired)
+    {
+        m_trace->Record(TRACE_WATCHDOG_RESET, 0, 0); // recovered from an expiry.
+        noInterrupts();
+        m_watchdogFired = false;
+        interrupts();
+        if (m_isArmed)
+        {
+            m_deadlineTimer.begin(DeadlineISR, (uint32_t)SAFETY_INTERVAL);
+        }
+    }
 
     return (Watchdog);
+}
+
+//-----------------------------------------------------------------------------------------
+// ReadStatistics returns a JSON object with how often each watchdog has fired, and how long
+// the deadline ISR took to get the outputs low.
+String SafetyManager::ReadStatistics()
+{
+    noInterrupts();
+    uint32_t timeouts = m_timeouts;
+    uint32_t lastStopNS = m_lastStopNS;
+    uint32_t maxStopNS = m_maxStopNS;
+    interrupts();
+
+    String Text = String("");
+    Text += String("{'Watchdog' : {'Armed':");
+    Text += String(m_isArmed ? 1 : 0);
+    Text += String(",'Fired':");
+    Text += String(m_watchdogFired ? 1 : 0);
+    Text += String(",'Timeouts':");
+    Text += String(timeouts);
+    Text += String(",'LastStopNS':");
+    Text += String(lastStopNS);
+    Text += String(",'MaxStopNS':");
+    Text += String(maxStopNS);
+    Text += String(",'DeadlineUS':");
+    Text += String(SAFETY_INTERVAL);
+    Text += String(",'HardwareReset':");
+    Text += String(m_wasHardwareReset ? 1 : 0);
+    Text += String("}}");
+    return (Text);
 }
\ No newline at end of file
@@ -30,23 +30,44 @@
 
 // It's really nothing more than a few simple booleans and access functions.
 
+//  The host watchdog is a deadline, not a poll.  Every command from the host moves
+//  the deadline SAFETY_INTERVAL ticks out, which is a single store.  A one-shot
+//  IntervalTimer is armed for the deadline; when it fires and finds the deadline
+//  moved, it re-arms for the rest, otherwise it trips the watchdog and drives every
+//  pulse and enable pin low right there in the interrupt.  So the time to stop
+//  doesn't depend on how long loop() spends parsing commands.  loop() then stops
+//  the motors properly, tells the host, and they stay stopped until commanded again.
+
+//  If loop() itself hangs, nothing reports or feeds anything.  The i.MX RT WDOG1 is
+//  fed from Dispatch() and resets the chip after SAFETY_HARDWARE_TIMEOUT of silence.
+//  "wS~" reads how many times each has fired, and how long stopping took.
+
 // ---------------------------------------------------------------------------
 // ---------------------------------------------------------------------------
 
 #include <Arduino.h>
 #include "EasyString.h"
+#include "OutputQueue.h"
+#include "ClockSystem.h"
+#include "TraceSystem.h"
+
+class MotorControl;
 
 #ifndef SAFE_ONCE
 #define SAFE_ONCE
 
-#define SAFETY_INTERVAL 1000000
+#define SAFETY_INTERVAL 1000000        // host heartbeat deadline, in ticks.
+#define SAFETY_HARDWARE_TIMEOUT 3      // WDOG1 resets after (n + 1) / 2 seconds without a loop() pass.
+
 class SafetyManager
 {
 public:
     SafetyManager();
-    SafetyManager(volatile uint32_t *tickCounter);
-    void Init(volatile uint32_t *tickCounter);
+    SafetyManager(volatile uint32_t *tickCounter, OutputQueue *outputQueue, ClockManager *clock, TraceRecorder *trace, MotorControl *motorSystem);
+    void Init(volatile uint32_t *tickCounter, OutputQueue *outputQueue, ClockManager *clock, TraceRecorder *trace, MotorControl *motorSystem);
+    void StartWatchdog(); // arm the deadline and the hardware watchdog.  Call once the tick is running.
     bool IsSafe();
+    bool IsOverridden(); // has the user overridden the sensors?
     bool IsConfigured(); // robot is configured or not yet?
     void SetConfigured(boolean value);
     void SetSensorTrigger(boolean value);
@@ -54,14 +75,29 @@ public:
     void Reset();
     void Dispatch();
     String ResetWatchDog();
+    String ReadStatistics(); // returns a JSON object with watchdog trips and stop latency.
+    void OnDeadline();       // the deadline timer's ISR.
 
 private:
+    void FeedHardwareWatchdog();
+
     boolean m_sensorTriggered; // did a sensor trigger a safety problem?
     boolean m_userOverride; // did the user request an override of the sensor system?
     volatile uint32_t *m_tickCounter;
+    OutputQueue *m_outputQueue; // where replies and events go
+    ClockManager *m_clock; // turns ticks into host time for replies
+    TraceRecorder *m_trace; // flight recorder for trips and resets
+    MotorControl *m_motorControl; // what the deadline ISR stops
+    IntervalTimer m_deadlineTimer;
     uint32_t m_watcdogLastTick; // When was the watchdog last reset?
-    boolean m_watchdogFired; // did the watchdog fire a timeout?
-    uint32_t m_watchDogRequestcount;
+    volatile uint32_t m_deadlineTick; // the host must be heard from by this tick.
+    volatile boolean m_watchdogFired; // did the watchdog fire a timeout?
+    volatile boolean m_expiryPending; // the ISR tripped, loop() hasn't reported it yet.
+    boolean m_isArmed;
+    boolean m_wasHardwareReset; // the last reset came from WDOG1.
+    volatile uint32_t m_timeouts;
+    volatile uint32_t m_lastStopNS; // deadline to outputs low, for the last trip.
+    volatile uint32_t m_maxStopNS;
     boolean m_IsConfigured;
 };
 #endif
\ No newline at end of file
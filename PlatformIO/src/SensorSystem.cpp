@@ -4,34 +4,118 @@ SensorManager::SensorManager()
 {
 }
 
-SensorManager::SensorManager(int howManyUS, volatile uint32_t *tickCount, SafetyManager *safetyPtr)
+SensorManager::SensorManager(int howManyUS, volatile uint32_t *tickCount, SafetyManager *safetyPtr, OutputQueue *outputQueue, ClockManager *clock, ReflexManager *reflex)
 {
-    Init(howManyUS, tickCount, safetyPtr);
+    Init(howManyUS, tickCount, safetyPtr, outputQueue, clock, reflex);
 }
 
-void SensorManager::Init(int howManyUS, volatile uint32_t *tickCount, SafetyManager *safetyPtr)
+void SensorManager::Init(int howManyUS, volatile uint32_t *tickCount, SafetyManager *safetyPtr, OutputQueue *outputQueue, ClockManager *clock, ReflexManager *reflex)
 {
-    Serial.println("Initializing Sensor System");
-    Serial.flush();
+    m_outputQueue = outputQueue;
+    m_clock = clock;
+    m_reflex = reflex;
+    m_outputQueue->Println("Initializing Sensor System");
 
     m_safetyManager = safetyPtr; // so we can tell the sensor manager something's wrong.
+    // the bank can't hold more than its compile-time capacity.
+    if (howManyUS < 0)
+    {
+        howManyUS = 0;
+    }
+    m_ultrasonics = &m_banks[0];
+    m_staged = &m_banks[1];
+    if (howManyUS > m_ultrasonics->capacity)
+    {
+        m_outputQueue->Println("{'Error' : 'Sensor count exceeds capacity'}");
+        howManyUS = m_ultrasonics->capacity;
+    }
     m_ultrasonicCount = howManyUS;
+    m_stagedCount = 0;
     m_tickCount = tickCount;
+    for (int i = 0; i < m_ultrasonics->capacity; i++)
+    {
+        ResetUltrasonic(m_ultrasonics, i);
+    }
 
-    Serial.println("Sensor system initialized");
-    Serial.flush();
+    m_outputQueue->Println("Sensor system initialized");
+}
+
+//-----------------------------------------------------------------------------------------
+// ResetUltrasonic puts one slot of a bank back to a sensor that has never read.
+void SensorManager::ResetUltrasonic(UltrasonicBank<ULTRASONIC_CAPACITY> *bank, int idx)
+{
+    bank->LastDurationUS[idx] = 0;
+    bank->LastReadingTick[idx] = 0;
+    bank->CurrentPhase[idx] = TRIGGER_OFF;
+    bank->PhaseChangeTimeUS[idx] = *m_tickCount;
+}
+
+//-----------------------------------------------------------------------------------------
+// BeginConfiguration empties the spare bank for howManyUS sensors.  The live bank keeps running
+// untouched until CommitConfiguration.
+void SensorManager::BeginConfiguration(int howManyUS)
+{
+    if (howManyUS < 0)
+    {
+        howManyUS = 0;
+    }
+    if (howManyUS > m_staged->capacity)
+    {
+        m_outputQueue->Println("{'Error' : 'Sensor count exceeds capacity'}");
+        howManyUS = m_staged->capacity;
+    }
+    m_stagedCount = howManyUS;
+    for (int i = 0; i < m_stagedCount; i++)
+    {
+        ResetUltrasonic(m_staged, i);
+        m_staged->EchoPin[i] = 0xFF; // no pin until configured.
+        m_staged->TriggerPin[i] = 0xFF;
+    }
 }
 
 void SensorManager::ConfigureUltrasonic(int sensorIndex, uint8_t echoPin, uint8_t triggerPin, unsigned long maxDuration, unsigned long minDuration)
 {
-    if ((sensorIndex >= m_ultrasonicCount) || (sensorIndex < 0))
+    if ((sensorIndex >= m_stagedCount) || (sensorIndex < 0))
     {
         return; // do nothing, this sensor makes no sense.
     }
-    m_ultrasonics[sensorIndex].EchoPin = echoPin;
-    m_ultrasonics[sensorIndex].TriggerPin = triggerPin;
-    m_ultrasonics[sensorIndex].MaxAllowedDurationUS = maxDuration;
-    m_ultrasonics[sensorIndex].MinAllowedDurationUS = minDuration;
+    m_staged->EchoPin[sensorIndex] = echoPin;
+    m_staged->TriggerPin[sensorIndex] = triggerPin;
+    m_staged->MaxAllowedDurationUS[sensorIndex] = maxDuration;
+    m_staged->MinAllowedDurationUS[sensorIndex] = minDuration;
+}
+
+//-----------------------------------------------------------------------------------------
+// CommitConfiguration makes the configuration being built the live one.  It must run with
+// interrupts off, so the ISR finishes one tick on the old bank and starts the next on the new one.
+// Sensors on the same pins carry on where they were; new ones wait a full TRIGGER_OFF_TIME from now.
+void SensorManager::CommitConfiguration()
+{
+    uint32_t now = *m_tickCount;
+    for (int i = 0; i < m_stagedCount; i++)
+    {
+        if ((i < m_ultrasonicCount) &&
+            (m_staged->EchoPin[i] == m_ultrasonics->EchoPin[i]) &&
+            (m_staged->TriggerPin[i] == m_ultrasonics->TriggerPin[i]))
+        {
+            m_staged->CurrentPhase[i] = m_ultrasonics->CurrentPhase[i];
+            m_staged->StateFilter[i] = m_ultrasonics->StateFilter[i];
+            m_staged->PhaseChangeTimeUS[i] = m_ultrasonics->PhaseChangeTimeUS[i];
+            m_staged->EchoStartTick[i] = m_ultrasonics->EchoStartTick[i];
+            m_staged->LastDurationUS[i] = m_ultrasonics->LastDurationUS[i];
+            m_staged->LastReadingTick[i] = m_ultrasonics->LastReadingTick[i];
+        }
+        else
+        {
+            m_staged->PhaseChangeTimeUS[i] = now;
+        }
+    }
+
+    UltrasonicBank<ULTRASONIC_CAPACITY> *previous = m_ultrasonics;
+    m_ultrasonics = m_staged;
+    m_staged = previous;
+    m_ultrasonicCount = m_stagedCount;
+    m_stagedCount = 0;
 }
 
 void SensorManager::ConfigureBattery(int pin)
@@ -54,13 +138,47 @@ String SensorManager::ReadLatestUltrasonicState()
         Text += String("'");
         Text += String(m_selectedSensor);
         Text += String("':");
-        Text += String(m_ultrasonics[m_selectedSensor].LastDurationUS);
+        Text += String(m_ultrasonics->LastDurationUS[m_selectedSensor]);
         Text += String(",");
     }
-    Text += String("]}");
+    // when each reading was taken, so the host can tell how stale it is.
+    Text += String("],'Readings': [");
+    for (m_selectedSensor = 0; m_selectedSensor < m_ultrasonicCount; m_selectedSensor++)
+    {
+        Text += String("{");
+        if (m_ultrasonics->LastReadingTick[m_selectedSensor] != 0)
+        {
+            Text += m_clock->StampTick(m_ultrasonics->LastReadingTick[m_selectedSensor]);
+        }
+        Text += String("},");
+    }
+    Text += String("],");
+    Text += m_clock->Stamp(m_clock->NowUS());
+    Text += String("}");
     return (Text);
 }
 
+int SensorManager::GetUltrasonicCount()
+{
+    return (m_ultrasonicCount);
+}
+
+//-----------------------------------------------------------------------------------------
+// ReadUltrasonic copies one sensor's latest reading and when it was taken.  The ISR writes
+// both, so read them together with interrupts off.
+boolean SensorManager::ReadUltrasonic(int sensorIndex, uint32_t *durationUS, uint32_t *readingTick)
+{
+    if ((sensorIndex < 0) || (sensorIndex >= m_ultrasonicCount))
+    {
+        return (false);
+    }
+    noInterrupts();
+    *durationUS = m_ultrasonics->LastDurationUS[sensorIndex];
+    *readingTick = m_ultrasonics->LastReadingTick[sensorIndex];
+    interrupts();
+    return (*readingTick != 0);
+}
+
 String SensorManager::ReadBatteryLevel()
 {
     // switch to read mode, and then read it.
@@ -75,7 +193,9 @@ String SensorManager::ReadBatteryLevel()
         Text += String(battery);
         Text += String(",");
     }
-    Text += String("]}");
+    Text += String("],");
+    Text += m_clock->Stamp(m_clock->NowUS());
+    Text += String("}");
     return (Text);
 }
 
@@ -83,41 +203,79 @@ String SensorManager::ReadBatteryLevel()
 // Dispatch iterates over all sensors ( ultrasonic and battery level ), and does whatever it takes to read them
 void SensorManager::Dispatch()
 {
+    uint32_t now = *m_tickCount;
     for (m_selectedSensor = 0; m_selectedSensor < m_ultrasonicCount; m_selectedSensor++)
     {
+        uint32_t ticksInPhase = now - m_ultrasonics->PhaseChangeTimeUS[m_selectedSensor];
+
         // for this ultrasonic sensor, determine its phase and do the approporiate action.
-        UltrasonicSensor *theSensor = &m_ultrasonics[m_selectedSensor];
-        switch (theSensor->CurrentPhase)
+        switch (m_ultrasonics->CurrentPhase[m_selectedSensor])
         {
         case TRIGGER_OFF:
             // has it been long enough?
-            if ((*m_tickCount - theSensor->PhaseChangeTimeUS) >= TRIGGER_OFF_TIME)
+            if (ticksInPhase >= TRIGGER_OFF_TIME)
             {
                 // phase change to trigger on
-                theSensor->CurrentPhase = TRIGGER_ON;
-                pinMode(theSensor->TriggerPin, OUTPUT);
-                digitalWrite(theSensor->TriggerPin, LOW);
+                m_ultrasonics->CurrentPhase[m_selectedSensor] = TRIGGER_ON;
+                m_ultrasonics->PhaseChangeTimeUS[m_selectedSensor] = now;
+                pinMode(m_ultrasonics->TriggerPin[m_selectedSensor], OUTPUT);
+                digitalWrite(m_ultrasonics->TriggerPin[m_selectedSensor], HIGH);
             }
             break;
 
         case TRIGGER_ON:
-            if ((*m_tickCount - theSensor->PhaseChangeTimeUS) >= TRIGGER_ON_TIME)
+            if (ticksInPhase >= TRIGGER_ON_TIME)
             {
-                // trigger has been on for a while, phase change to listen.
-                theSensor->CurrentPhase = LISTEN; // request a listen.
+                // trigger has been on for a while, drop it and listen for the echo.
+                digitalWrite(m_ultrasonics->TriggerPin[m_selectedSensor], LOW);
+                pinMode(m_ultrasonics->EchoPin[m_selectedSensor], INPUT);
+                m_ultrasonics->StateFilter[m_selectedSensor] = HIGH; // wait for the echo to rise.
+                m_ultrasonics->CurrentPhase[m_selectedSensor] = LISTEN;
+                m_ultrasonics->PhaseChangeTimeUS[m_selectedSensor] = now;
             }
             break;
 
         case LISTEN:
-            // The hard part -- attach rise and fall interrupt ISRs to get the echo time.
-            digitalWrite(theSensor->TriggerPin, LOW);
-            pinMode(theSensor->EchoPin, INPUT);
-            Serial.println("Not implimented yet");
-            // TODO: Reset phase to trigger_off
+            // poll for the edge we're filtering for: the rise starts the echo, the fall ends it.
+            if (digitalRead(m_ultrasonics->EchoPin[m_selectedSensor]) == m_ultrasonics->StateFilter[m_selectedSensor])
+            {
+                if (m_ultrasonics->StateFilter[m_selectedSensor] == HIGH)
+                {
+                    m_ultrasonics->EchoStartTick[m_selectedSensor] = now;
+                    m_ultrasonics->StateFilter[m_selectedSensor] = LOW;
+                }
+                else
+                {
+                    CompleteReading(m_selectedSensor, now - m_ultrasonics->EchoStartTick[m_selectedSensor]);
+                    break;
+                }
+            }
+            if (ticksInPhase >= ((m_ultrasonics->MaxAllowedDurationUS[m_selectedSensor] > 0) ? m_ultrasonics->MaxAllowedDurationUS[m_selectedSensor] : ULTRASONIC_TIMEOUT))
+            {
+                // no echo back in time, nothing is in range.
+                CompleteReading(m_selectedSensor, ticksInPhase);
+            }
             break;
 
         default:
             break;
         }
     }
-}
\ No newline at end of file
+}
+
+//-----------------------------------------------------------------------------------------
+// CompleteReading stores a finished echo, lets the safety and reflex systems act on it,
+// and starts the sensor's next cycle.  Runs in the ISR.
+void SensorManager::CompleteReading(int idx, uint32_t durationUS)
+{
+    uint32_t now = *m_tickCount;
+    m_ultrasonics->LastDurationUS[idx] = durationUS;
+    m_ultrasonics->LastReadingTick[idx] = (now != 0) ? now : 1; // 0 means never read.
+    if (durationUS < m_ultrasonics->MinAllowedDurationUS[idx])
+    {
+        m_safetyManager->SetSensorTrigger(true); // too close, stays tripped until reset.
+    }
+    m_reflex->OnReading(idx, durationUS);
+    m_ultrasonics->CurrentPhase[idx] = TRIGGER_OFF;
+    m_ultrasonics->PhaseChangeTimeUS[idx] = now;
+}
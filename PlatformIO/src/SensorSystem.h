@@ -28,13 +28,23 @@
 //  We want to use only 1 signal pin per sensor, and we want to not wait around for the 85ms per sensor.
 
 //  To achieve this, we set up a phase system that carefully monitors the single pin and changes how we use it.
-//  We also create ISRs and enable them when the phase is correct for reading the echo.
+//  The listen phase polls the echo pin from the 1uS dispatch ISR, so the echo is timed to the tick
+//  without a pin interrupt per sensor.  No echo by MaxAllowedDurationUS means nothing is in range.
+//  A completed reading under MinAllowedDurationUS trips the safety system, and every completed
+//  reading is handed to the reflex system.
+
+//  Like the motors, the sensors have two banks.  A reconfiguration is built in the one the ISR isn't
+//  using, and CommitConfiguration swaps them between two ticks.  A sensor whose pins didn't change keeps
+//  its phase and last reading through the switch; a new one starts from TRIGGER_OFF.
 
 // ---------------------------------------------------------------------------
 // ---------------------------------------------------------------------------
 
 #include <Arduino.h>
 #include "SafetySystem.h"
+#include "OutputQueue.h"
+#include "ClockSystem.h"
+#include "ReflexSystem.h"
 
 #ifndef SENSOR_ONCE
 #define SENSOR_ONCE
@@ -54,20 +64,32 @@ enum UltrasonicSensorPhases
   LISTEN
 };
 
-struct UltrasonicSensor
+// How many ultrasonic slots to compile in.  Override with -DULTRASONIC_CAPACITY=n for smaller robots.
+#ifndef ULTRASONIC_CAPACITY
+#define ULTRASONIC_CAPACITY 12
+#endif
+
+// Ultrasonic sensor state, laid out structure-of-arrays so the ISR streams through contiguous data.
+// Capacity is part of the type; nothing may index past it.
+template <uint8_t Capacity>
+struct UltrasonicBank
 {
+  static const uint8_t capacity = Capacity;
+
   // Pins and pads.
-  uint8_t EchoPin;
-  uint8_t TriggerPin;
-  uint8_t EchoPad; // for sparkfun artemis.  Unsure if used in Teensy 4.1
+  uint8_t EchoPin[Capacity];
+  uint8_t TriggerPin[Capacity];
+  uint8_t EchoPad[Capacity]; // for sparkfun artemis.  Unsure if used in Teensy 4.1
 
   // Assistant variables like trackers, timers, etc
-  UltrasonicSensorPhases CurrentPhase; // What's the current sensor phase?
-  uint8_t StateFilter;                 // What pin state should we filter for when reading a return pulse?
-  unsigned long PhaseChangeTimeUS;     // when did we change to this phase in microseconds?
-  unsigned long LastDurationUS;        // how long was the last read duration ( use to compute distance )
-  unsigned long MaxAllowedDurationUS;  // For safety, what will I allow before I say kaput.
-  unsigned long MinAllowedDurationUS;  // For safety, what will the minimum I allow before I require over-ride?
+  UltrasonicSensorPhases CurrentPhase[Capacity]; // What's the current sensor phase?
+  uint8_t StateFilter[Capacity];                 // What pin state should we filter for when reading a return pulse?
+  unsigned long PhaseChangeTimeUS[Capacity];     // when did we change to this phase in microseconds?
+  unsigned long LastDurationUS[Capacity];        // how long was the last read duration ( use to compute distance )
+  uint32_t LastReadingTick[Capacity];            // tick when LastDurationUS was measured, 0 if never.
+  uint32_t EchoStartTick[Capacity];              // tick the echo pulse rose on, while listening.
+  unsigned long MaxAllowedDurationUS[Capacity];  // For safety, what will I allow before I say kaput.
+  unsigned long MinAllowedDurationUS[Capacity];  // For safety, what will the minimum I allow before I require over-ride?
 };
 
 
@@ -75,21 +97,34 @@ class SensorManager
 {
 public:
     SensorManager();
-    SensorManager(int howManyUS, volatile uint32_t *tickCount, SafetyManager *safetyPtr);
-    void Init(int howManyUS, volatile uint32_t *tickCount, SafetyManager *safetyPtr);
+    SensorManager(int howManyUS, volatile uint32_t *tickCount, SafetyManager *safetyPtr, OutputQueue *outputQueue, ClockManager *clock, ReflexManager *reflex);
+    void Init(int howManyUS, volatile uint32_t *tickCount, SafetyManager *safetyPtr, OutputQueue *outputQueue, ClockManager *clock, ReflexManager *reflex);
+    void BeginConfiguration(int howManyUS); // start a new configuration in the spare bank.
     void ConfigureUltrasonic(int sensorIndex, uint8_t echoPin, uint8_t TriggerPin, unsigned long maxDuration, unsigned long minDuration);
+    void CommitConfiguration();             // switch the ISR to the new configuration.  Call with interrupts off.
     void ConfigureBattery(int pin); // what analog pin is the battery voltage divider attached to?
     uint8_t GetBatteryLevel(); // returns a best-guess representing percent 0..100
     String ReadBatteryLevel(); // returns a JSON object with a number of samples
     String ReadLatestUltrasonicState(); // returns a JSON object with the last processed state of every sensor.
+    int GetUltrasonicCount();
+    boolean ReadUltrasonic(int sensorIndex, uint32_t *durationUS, uint32_t *readingTick); // false if it has never read.
     void Dispatch(); // actually run the sensors and update the state machine.
 private:
-    UltrasonicSensor m_ultrasonics[12]; // array of ultrasonic sensors.
-    int m_ultrasonicCount; // how many do we have attached to robot?
+    void CompleteReading(int idx, uint32_t durationUS);
+    void ResetUltrasonic(UltrasonicBank<ULTRASONIC_CAPACITY> *bank, int idx);
+
+    UltrasonicBank<ULTRASONIC_CAPACITY> m_banks[2];
+    UltrasonicBank<ULTRASONIC_CAPACITY> *m_ultrasonics; // all the ultrasonic sensors, the bank the ISR runs.
+    UltrasonicBank<ULTRASONIC_CAPACITY> *m_staged;      // the bank a reconfiguration is built in.
+    int m_ultrasonicCount; // how many do we have attached to robot?  Never more than ULTRASONIC_CAPACITY.
+    int m_stagedCount;
     int m_selectedSensor; // use for iterating or working with an individual ultrasonic sensor.
     int m_batteryPin; // use for reading the battery level.
     uint32_t m_batteryLevel; // What's the best-guess battery level?
     SafetyManager *m_safetyManager;
+    OutputQueue *m_outputQueue; // where replies and events go
+    ClockManager *m_clock; // turns ticks into host time for replies
+    ReflexManager *m_reflex; // acts on every completed reading
     volatile uint32_t *m_tickCount;
 };
 
@@ -0,0 +1,67 @@
+// ---------------------------------------------------------------------------
+// Trace Event Library - v0.0.1 - 07/12/2020
+//
+// AUTHOR/LICENSE:
+// Created by Imran Peerbhai -- ipeerbhai@aol.com
+// Copyright 2020 License:
+// Forks and derivitive works are NOT permitted without
+// permission. Permission is only granted to use as-is for private and
+// non-commercial use by natural persons or non-profit entities.
+// For-profit entities require a license.
+//
+// CONTRIBUTIONS:
+// If you wish to contribute, make changes, or enhancements,
+// please create a pull request.
+//
+// DISCLAIMER:
+// This software is furnished "as is", without technical support, and with no
+// warranty, express or implied, as to its usefulness for any purpose.
+// ---------------------------------------------------------------------------
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+// Theory of Operation:
+
+//  The flight recorder's event types and layout (see TraceSystem.h), kept in
+//  plain C++ with no Arduino headers so Host/TraceDecode reads the same enums
+//  the firmware writes.
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+
+#include <stdint.h>
+
+#ifndef TRACE_EVENTS_ONCE
+#define TRACE_EVENTS_ONCE
+
+enum TraceTypes
+{
+  TRACE_BOOT = 1,
+  TRACE_COMMAND,          // code: command letter, value: low 16 bits of the sequence number, 0 if untagged.
+  TRACE_SAFETY_TRIP,      // code: a TraceSafetyCodes value.
+  TRACE_SAFETY_RESET,
+  TRACE_SAFETY_OVERRIDE,
+  TRACE_WATCHDOG_EXPIRED, // value: uS from the deadline until the motor outputs were low.
+  TRACE_WATCHDOG_RESET,
+  TRACE_CONFIGURATION,    // code: the configuring command letter, 'L' for loaded from storage.
+  TRACE_OUTPUT_DROP,      // value: bytes in the dropped message.
+  TRACE_STEP_EDGE,        // code: motor, value: low 16 bits of its step count.
+  TRACE_PROGRAM           // code: 'R'un (value: slot), or 'D'one, 'S'topped, 'T'imeout, 'F'ault, 'L'oop owns motor (value: step).
+};
+
+enum TraceSafetyCodes
+{
+  TRACE_SAFETY_WATCHDOG = 1,
+  TRACE_SAFETY_SENSOR
+};
+
+// One recorded event.  Packed to 8 bytes; the host decoder depends on this layout.
+struct TraceEvent
+{
+  uint32_t Tick;
+  uint8_t Type;
+  uint8_t Code;
+  uint16_t Value;
+};
+
+#endif
@@ -0,0 +1,220 @@
+#include "TraceSystem.h"
+#include "OutputQueue.h"
+#include "ClockSystem.h"
+
+static const char s_hexDigits[] = "0123456789ABCDEF";
+
+//-----------------------------------------------------------------------------------------
+// Constructor:
+//  Default constructor does nothing.
+TraceRecorder::TraceRecorder()
+{
+}
+
+//-----------------------------------------------------------------------------------------
+// Constructor:
+//  Store references to the tick counter, output queue and clock.
+TraceRecorder::TraceRecorder(volatile uint32_t *tickCounter, OutputQueue *outputQueue, ClockManager *clock)
+{
+    Init(tickCounter, outputQueue, clock);
+}
+
+//-----------------------------------------------------------------------------------------
+// Init empties the ring.  Step edge sampling starts off.
+void TraceRecorder::Init(volatile uint32_t *tickCounter, OutputQueue *outputQueue, ClockManager *clock)
+{
+    m_tickCounter = tickCounter;
+    m_outputQueue = outputQueue;
+    m_clock = clock;
+    m_stepSampleEvery = 0;
+    m_stepSampleCount = 0;
+    Clear();
+}
+
+//-----------------------------------------------------------------------------------------
+// Clear forgets every event and cancels any dump.
+void TraceRecorder::Clear()
+{
+    noInterrupts();
+    m_head = 0;
+    m_missed = 0;
+    m_isDumping = false;
+    m_dumpRequested = false;
+    m_dumpForSafety = false;
+    m_safetyDumpPending = false;
+    m_heldCount = 0;
+    interrupts();
+}
+
+//-----------------------------------------------------------------------------------------
+// Record claims the next slot and fills it with interrupts off, so an ISR can't tear it.
+// During a dump, safety trips are held aside rather than missed.
+void TraceRecorder::Record(uint8_t type, uint8_t code, uint16_t value)
+{
+    noInterrupts();
+    if (m_isDumping)
+    {
+        if ((type == TRACE_SAFETY_TRIP) && (m_heldCount < TRACE_HELD_EVENTS))
+        {
+            TraceEvent &held = m_held[m_heldCount++];
+            held.Tick = *m_tickCounter;
+            held.Type = type;
+            held.Code = code;
+            held.Value = value;
+        }
+        else
+        {
+            m_missed++;
+        }
+        interrupts();
+        return;
+    }
+    TraceEvent &event = m_events[m_head % TRACE_CAPACITY];
+    event.Tick = *m_tickCounter;
+    event.Type = type;
+    event.Code = code;
+    event.Value = value;
+    m_head++;
+    interrupts();
+}
+
+//-----------------------------------------------------------------------------------------
+// RecordStepEdge is called by the motor ISR on every step.  Only every Nth is kept.
+void TraceRecorder::RecordStepEdge(uint8_t motor, int64_t stepCount)
+{
+    if (m_stepSampleEvery == 0)
+    {
+        return;
+    }
+    m_stepSampleCount++;
+    if (m_stepSampleCount < m_stepSampleEvery)
+    {
+        return;
+    }
+    m_stepSampleCount = 0;
+    Record(TRACE_STEP_EDGE, motor, (uint16_t)stepCount);
+}
+
+void TraceRecorder::SetStepSampling(uint32_t everyN)
+{
+    m_stepSampleEvery = everyN;
+    m_stepSampleCount = 0;
+}
+
+//-----------------------------------------------------------------------------------------
+// RequestDump only sets flags; Dispatch does the work from loop().  A safety trip during a dump
+// is latched and dumped once the current one ends; a "T~" during a dump is dropped.
+void TraceRecorder::RequestDump(boolean isSafetyTrip)
+{
+    noInterrupts();
+    if (m_isDumping)
+    {
+        m_safetyDumpPending = m_safetyDumpPending || isSafetyTrip;
+    }
+    else if (!m_dumpRequested || isSafetyTrip)
+    {
+        m_dumpForSafety = isSafetyTrip;
+        m_dumpRequested = true;
+    }
+    interrupts();
+}
+
+//-----------------------------------------------------------------------------------------
+// Procedure:
+//  FinishDump resumes recording, moves the held safety trips into the ring, and starts a
+//  latched safety dump.
+void TraceRecorder::FinishDump()
+{
+    noInterrupts();
+    for (uint8_t i = 0; i < m_heldCount; i++)
+    {
+        m_events[m_head % TRACE_CAPACITY] = m_held[i];
+        m_head++;
+    }
+    m_heldCount = 0;
+    m_isDumping = false; // recording resumes.
+    if (m_safetyDumpPending)
+    {
+        m_safetyDumpPending = false;
+        m_dumpForSafety = true;
+        m_dumpRequested = true;
+    }
+    interrupts();
+}
+
+//-----------------------------------------------------------------------------------------
+// Dispatch sends a dump a line at a time, only when the output queue has room for the whole line.
+void TraceRecorder::Dispatch()
+{
+    if (m_dumpRequested && !m_isDumping)
+    {
+        // header first, then freeze the ring until we're done.
+        String Header = String("{'Trace': {'Reason':'");
+        Header += String(m_dumpForSafety ? "Safety" : "Command");
+        Header += String("','Events':");
+        Header += String((m_head > TRACE_CAPACITY) ? TRACE_CAPACITY : m_head);
+        Header += String(",'Missed':");
+        Header += String(m_missed);
+        Header += String(",'Tick':");
+        Header += String(*m_tickCounter);
+        Header += String(",");
+        Header += m_clock->StampTick(*m_tickCounter);
+        Header += String("}}");
+        if (m_outputQueue->Room() < Header.length() + 2)
+        {
+            return; // try again next pass.
+        }
+        noInterrupts();
+        m_isDumping = true;
+        m_dumpRequested = false;
+        m_dumpEnd = m_head;
+        m_dumpNext = (m_head > TRACE_CAPACITY) ? (m_head - TRACE_CAPACITY) : 0;
+        interrupts();
+        m_outputQueue->Println(Header);
+    }
+    if (!m_isDumping)
+    {
+        return;
+    }
+
+    char line[3 + (TRACE_DUMP_EVENTS * 16) + 1];
+    while (m_dumpNext < m_dumpEnd)
+    {
+        uint32_t count = m_dumpEnd - m_dumpNext;
+        if (count > TRACE_DUMP_EVENTS)
+        {
+            count = TRACE_DUMP_EVENTS;
+        }
+        if (m_outputQueue->Room() < (3 + (count * 16) + 2))
+        {
+            return; // the queue is busy with replies, carry on next pass.
+        }
+        int position = 0;
+        line[position++] = 'T';
+        line[position++] = 'R';
+        line[position++] = ':';
+        for (uint32_t i = 0; i < count; i++)
+        {
+            uint8_t bytes[sizeof(TraceEvent)];
+            memcpy(bytes, &m_events[(m_dumpNext + i) % TRACE_CAPACITY], sizeof(TraceEvent));
+            for (uint32_t b = 0; b < sizeof(TraceEvent); b++)
+            {
+                line[position++] = s_hexDigits[bytes[b] >> 4];
+                line[position++] = s_hexDigits[bytes[b] & 0x0F];
+            }
+        }
+        line[position] = '\0';
+        m_outputQueue->Println(line);
+        m_dumpNext += count;
+    }
+
+    String Footer = String("{'TraceEnd' : ");
+    Footer += String(m_dumpEnd);
+    Footer += String("}");
+    if (m_outputQueue->Room() < Footer.length() + 2)
+    {
+        return;
+    }
+    m_outputQueue->Println(Footer);
+    FinishDump();
+}
@@ -0,0 +1,98 @@
+// ---------------------------------------------------------------------------
+// Trace Recorder Library - v0.0.1 - 07/12/2020
+//
+// AUTHOR/LICENSE:
+// Created by Imran Peerbhai -- ipeerbhai@aol.com
+// Copyright 2020 License:
+// Forks and derivitive works are NOT permitted without
+// permission. Permission is only granted to use as-is for private and
+// non-commercial use by natural persons or non-profit entities.
+// For-profit entities require a license.
+//
+// CONTRIBUTIONS:
+// If you wish to contribute, make changes, or enhancements,
+// please create a pull request.
+//
+// DISCLAIMER:
+// This software is furnished "as is", without technical support, and with no
+// warranty, express or implied, as to its usefulness for any purpose.
+// ---------------------------------------------------------------------------
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+// Theory of Operation:
+
+//  When a rover stops in the field, the console has usually scrolled away.  So
+//  we keep a flight recorder: a fixed ring of small binary events, each an 8 byte
+//  {tick, type, code, value}.  Recording is a handful of stores with interrupts
+//  off, so the ISR can record too.  Once full, the oldest events are overwritten.
+
+//  Events are commands received, safety trips, resets and overrides, watchdog
+//  expiries and resets, configuration changes, output queue drops, motion
+//  program starts and ends and, optionally, every Nth step pulse.
+
+//  Nothing is sent until asked: "T~" dumps the ring, and a safety trip dumps it
+//  on its own.  Recording pauses while a dump is in progress so it's a clean
+//  snapshot, except for safety trips: up to TRACE_HELD_EVENTS of them are held
+//  aside and written to the ring when the dump ends.  A trip during any dump
+//  also latches a safety dump to start after it.  The dump is hex text, so it
+//  can share the line-based link:
+//    {'Trace': {'Reason':'Command','Events':n,'Missed':m,'Tick':t,'HostUS':h}}
+//    TR:<16 hex digits per event, oldest first, up to TRACE_DUMP_EVENTS per line>
+//    {'TraceEnd' : n}
+//  Each event is the little-endian bytes of TraceEvent.  Host/TraceDecode turns a
+//  captured console log back into a timeline.  Lines go out only when the output
+//  queue has room, so a dump never pushes replies out.
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+
+#include <Arduino.h>
+#include <stdint.h>
+#include "TraceEvents.h"
+
+#ifndef TRACE_ONCE
+#define TRACE_ONCE
+
+#define TRACE_CAPACITY 1024   // events kept, 8 bytes each.
+#define TRACE_DUMP_EVENTS 32  // events per dump line.
+#define TRACE_HELD_EVENTS 4   // safety trips kept aside while a dump is in progress.
+
+class OutputQueue;
+class ClockManager;
+
+class TraceRecorder
+{
+public:
+    TraceRecorder();
+    TraceRecorder(volatile uint32_t *tickCounter, OutputQueue *outputQueue, ClockManager *clock);
+    void Init(volatile uint32_t *tickCounter, OutputQueue *outputQueue, ClockManager *clock);
+    void Record(uint8_t type, uint8_t code, uint16_t value); // safe from the ISR.
+    void RecordStepEdge(uint8_t motor, int64_t stepCount);   // records every Nth call, if enabled.
+    void SetStepSampling(uint32_t everyN);                   // 0 turns step edges off.
+    void RequestDump(boolean isSafetyTrip);                  // safe from the ISR.
+    void Clear();
+    void Dispatch();                                         // send the next piece of a dump.  Call from loop().
+
+private:
+    void FinishDump();
+
+    TraceEvent m_events[TRACE_CAPACITY];
+    volatile uint32_t m_head;         // total events ever recorded; m_head % TRACE_CAPACITY is the next slot.
+    volatile uint32_t m_missed;       // events not recorded because a dump was in progress.
+    volatile boolean m_isDumping;
+    volatile boolean m_dumpRequested;
+    volatile boolean m_dumpForSafety;
+    volatile boolean m_safetyDumpPending; // a trip came in during a dump; dump again when it's done.
+    TraceEvent m_held[TRACE_HELD_EVENTS];
+    volatile uint8_t m_heldCount;
+    uint32_t m_dumpNext;              // next event index to send.
+    uint32_t m_dumpEnd;
+    uint32_t m_stepSampleEvery;
+    uint32_t m_stepSampleCount;
+    volatile uint32_t *m_tickCounter;
+    OutputQueue *m_outputQueue;
+    ClockManager *m_clock;
+};
+
+#endif
@@ -0,0 +1,181 @@
+#include "Transport.h"
+
+//-----------------------------------------------------------------------------------------
+// UsbTransport passes straight through to the USB serial port.
+void UsbTransport::Begin()
+{
+    // wait a few seconds for the host to open the port, but don't hang without one.
+    while (!Serial && millis() < 4000)
+        Serial.begin(USB_BAUD);
+}
+
+int UsbTransport::Available()
+{
+    return (Serial.available());
+}
+
+int UsbTransport::Read()
+{
+    return (Serial.read());
+}
+
+int UsbTransport::AvailableForWrite()
+{
+    return (Serial.availableForWrite());
+}
+
+size_t UsbTransport::Write(const uint8_t *buffer, size_t length)
+{
+    return (Serial.write(buffer, length));
+}
+
+//-----------------------------------------------------------------------------------------
+// Which LPUART and DMA requests sit behind each Teensy 4.1 hardware serial port.
+struct UartDmaPort
+{
+    HardwareSerial *Port;
+    IMXRT_LPUART_t *Lpuart;
+    uint8_t RxSource;
+    uint8_t TxSource;
+};
+
+static const UartDmaPort s_uartDmaPorts[] = {
+    {&Serial1, &IMXRT_LPUART6, DMAMUX_SOURCE_LPUART6_RX, DMAMUX_SOURCE_LPUART6_TX},
+    {&Serial2, &IMXRT_LPUART4, DMAMUX_SOURCE_LPUART4_RX, DMAMUX_SOURCE_LPUART4_TX},
+    {&Serial3, &IMXRT_LPUART2, DMAMUX_SOURCE_LPUART2_RX, DMAMUX_SOURCE_LPUART2_TX},
+    {&Serial4, &IMXRT_LPUART3, DMAMUX_SOURCE_LPUART3_RX, DMAMUX_SOURCE_LPUART3_TX},
+    {&Serial5, &IMXRT_LPUART8, DMAMUX_SOURCE_LPUART8_RX, DMAMUX_SOURCE_LPUART8_TX},
+    {&Serial6, &IMXRT_LPUART1, DMAMUX_SOURCE_LPUART1_RX, DMAMUX_SOURCE_LPUART1_TX},
+    {&Serial7, &IMXRT_LPUART7, DMAMUX_SOURCE_LPUART7_RX, DMAMUX_SOURCE_LPUART7_TX},
+    {&Serial8, &IMXRT_LPUART5, DMAMUX_SOURCE_LPUART5_RX, DMAMUX_SOURCE_LPUART5_TX}};
+
+//-----------------------------------------------------------------------------------------
+// Constructor:
+//  Default constructor picks Serial1 at 115200.
+UartDmaTransport::UartDmaTransport()
+{
+    Init(1, 115200);
+}
+
+//-----------------------------------------------------------------------------------------
+// Constructor:
+//  Store which port and baud rate to use.
+UartDmaTransport::UartDmaTransport(int portNumber, uint32_t baud)
+{
+    Init(portNumber, baud);
+}
+
+//-----------------------------------------------------------------------------------------
+// Init picks the port.  Nothing touches the hardware until Begin.
+void UartDmaTransport::Init(int portNumber, uint32_t baud)
+{
+    m_portNumber = constrain(portNumber, 1, 8);
+    m_baud = baud;
+    m_isStarted = false;
+    m_lpuart = s_uartDmaPorts[m_portNumber - 1].Lpuart;
+    m_txBusy = false;
+    m_rxTail = 0;
+}
+
+//-----------------------------------------------------------------------------------------
+// Begin lets HardwareSerial set up the pins and baud, then hands the LPUART to the DMA.
+void UartDmaTransport::Begin()
+{
+    const UartDmaPort &port = s_uartDmaPorts[m_portNumber - 1];
+    port.Port->begin(m_baud);
+
+    // HardwareSerial's per-byte interrupts off, DMA requests on.
+    // A watermark of 0 asks for the DMA as soon as one byte is in the FIFO.
+    m_lpuart->CTRL &= ~(LPUART_CTRL_RIE | LPUART_CTRL_TIE | LPUART_CTRL_TCIE | LPUART_CTRL_ILIE);
+    m_lpuart->WATER = LPUART_WATER_RXWATER(0) | LPUART_WATER_TXWATER(0);
+
+    // receive forever into the circular buffer.  No disableOnCompletion, so it wraps.
+    m_rxDma.source(*(volatile uint8_t *)&m_lpuart->DATA);
+    m_rxDma.destinationBuffer(m_rxBuffer, UART_DMA_RX_SIZE);
+    m_rxDma.triggerAtHardwareEvent(port.RxSource);
+    m_rxDma.enable();
+
+    // transmit a block at a time.  Source is set by each Write.
+    m_txDma.destination(*(volatile uint8_t *)&m_lpuart->DATA);
+    m_txDma.disableOnCompletion();
+    m_txDma.triggerAtHardwareEvent(port.TxSource);
+
+    m_lpuart->BAUD |= LPUART_BAUD_RDMAE | LPUART_BAUD_TDMAE;
+    m_rxTail = 0;
+    m_txBusy = false;
+    m_isStarted = true;
+}
+
+//-----------------------------------------------------------------------------------------
+// ReceivePosition is where the receive DMA will write its next byte.
+uint32_t UartDmaTransport::ReceivePosition()
+{
+    uint32_t position = (uint32_t)((volatile uint8_t *)m_rxDma.TCD->DADDR - m_rxBuffer);
+    if (position >= UART_DMA_RX_SIZE)
+    {
+        position = 0; // caught it right as the major loop wrapped.
+    }
+    return (position);
+}
+
+int UartDmaTransport::Available()
+{
+    if (!m_isStarted)
+    {
+        return (0);
+    }
+    return ((ReceivePosition() + UART_DMA_RX_SIZE - m_rxTail) % UART_DMA_RX_SIZE);
+}
+
+int UartDmaTransport::Read()
+{
+    if (Available() == 0)
+    {
+        return (-1);
+    }
+    int incoming = m_rxBuffer[m_rxTail];
+    m_rxTail = (m_rxTail + 1) % UART_DMA_RX_SIZE;
+    return (incoming);
+}
+
+//-----------------------------------------------------------------------------------------
+// ReadAgeUS is the bytes the DMA has received behind the one just read, in 8N1 byte times.
+uint32_t UartDmaTransport::ReadAgeUS()
+{
+    return ((uint32_t)(((uint64_t)Available() * 10 * 1000000) / m_baud));
+}
+
+//-----------------------------------------------------------------------------------------
+// AvailableForWrite is a whole block when the last transmit is done, otherwise nothing.
+int UartDmaTransport::AvailableForWrite()
+{
+    if (!m_isStarted)
+    {
+        return (0);
+    }
+    if (m_txBusy && !m_txDma.complete())
+    {
+        return (0);
+    }
+    return (UART_DMA_TX_SIZE);
+}
+
+//-----------------------------------------------------------------------------------------
+// Write copies the block into our buffer and starts the transmit DMA.  Returns right away.
+size_t UartDmaTransport::Write(const uint8_t *buffer, size_t length)
+{
+    if ((length == 0) || (AvailableForWrite() == 0))
+    {
+        return (0);
+    }
+    if (length > UART_DMA_TX_SIZE)
+    {
+        length = UART_DMA_TX_SIZE;
+    }
+    memcpy(m_txBuffer, buffer, length);
+    m_txDma.clearComplete();
+    m_txDma.sourceBuffer(m_txBuffer, length);
+    m_txBusy = true;
+    m_txDma.enable();
+    return (length);
+}
@@ -0,0 +1,115 @@
+// ---------------------------------------------------------------------------
+// Transport Library - v0.0.1 - 07/12/2020
+//
+// AUTHOR/LICENSE:
+// Created by Imran Peerbhai -- ipeerbhai@aol.com
+// Copyright 2020 License:
+// Forks and derivitive works are NOT permitted without
+// permission. Permission is only granted to use as-is for private and
+// non-commercial use by natural persons or non-profit entities.
+// For-profit entities require a license.
+//
+// CONTRIBUTIONS:
+// If you wish to contribute, make changes, or enhancements,
+// please create a pull request.
+//
+// DISCLAIMER:
+// This software is furnished "as is", without technical support, and with no
+// warranty, express or implied, as to its usefulness for any purpose.
+// ---------------------------------------------------------------------------
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+// Theory of Operation:
+
+//  The command system only needs four things from the link to the main computer:
+//  how many bytes are waiting, read one, how much room there is to send, and
+//  send a block.  Transport is that interface, so the framing, the parser and
+//  the output queue don't care which wire they're on.
+
+//  UsbTransport is the Teensy's USB CDC port, the original link.
+
+//  UartDmaTransport is one of the hardware serial ports, Serial1 to Serial8.
+//  HardwareSerial takes an interrupt for every byte, which hurts when a rover
+//  sits behind a fast UART bridge.  Instead, we let HardwareSerial set up the
+//  pins and baud rate, then turn its interrupts off and point two DMA channels
+//  at the LPUART data register.  Receive DMA runs forever into a circular buffer;
+//  we find new bytes by looking at where the DMA is writing.  Transmit DMA sends
+//  one block at a time and we report no room until it's done.
+
+//  ReadAgeUS says how long the byte Read just returned had been waiting.  The
+//  receive DMA tells us: every byte it has written since then took at least 10
+//  bit times on the wire, so that many byte times is a floor on the wait.  The
+//  USB stack gives no such hint, so UsbTransport says 0 and the latency system's
+//  arrival is when loop() read the byte.
+
+//  The host build of the firmware (Host/TeensyBotSim.cpp) runs over a pty
+//  instead; its PtyTransport lives in Host/PtyTransport.h.
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+
+#include <Arduino.h>
+#include <stdint.h>
+#include <DMAChannel.h>
+
+#ifndef TRANSPORT_ONCE
+#define TRANSPORT_ONCE
+
+#define USB_BAUD 115200          // USB ignores this, but Serial.begin wants it.
+#define UART_DMA_RX_SIZE 1024    // bytes the receive DMA can get ahead of us.
+#define UART_DMA_TX_SIZE 512     // largest block one transmit DMA sends.
+
+class Transport
+{
+public:
+    virtual ~Transport() {}
+    virtual void Begin() = 0;
+    virtual int Available() = 0;        // bytes waiting to be read.
+    virtual int Read() = 0;             // next byte, or -1 if none.
+    virtual int AvailableForWrite() = 0; // bytes Write can take right now without waiting.
+    virtual size_t Write(const uint8_t *buffer, size_t length) = 0; // returns bytes taken.
+    virtual uint32_t ReadAgeUS() { return (0); } // how long, at least, the last byte read sat waiting.  0 if unknown.
+};
+
+// Transport on the USB CDC serial port.
+class UsbTransport : public Transport
+{
+public:
+    void Begin();
+    int Available();
+    int Read();
+    int AvailableForWrite();
+    size_t Write(const uint8_t *buffer, size_t length);
+};
+
+// Transport on a hardware serial port, with DMA for both directions.
+class UartDmaTransport : public Transport
+{
+public:
+    UartDmaTransport();
+    UartDmaTransport(int portNumber, uint32_t baud);
+    void Init(int portNumber, uint32_t baud); // portNumber 1 is Serial1, up to 8.
+    void Begin();
+    int Available();
+    int Read();
+    int AvailableForWrite();
+    size_t Write(const uint8_t *buffer, size_t length);
+    uint32_t ReadAgeUS();
+
+private:
+    uint32_t ReceivePosition();
+
+    int m_portNumber;
+    uint32_t m_baud;
+    boolean m_isStarted;
+    IMXRT_LPUART_t *m_lpuart;
+    DMAChannel m_rxDma;
+    DMAChannel m_txDma;
+    boolean m_txBusy;
+    uint32_t m_rxTail;                  // next byte we haven't read yet.
+    uint8_t m_rxBuffer[UART_DMA_RX_SIZE];
+    uint8_t m_txBuffer[UART_DMA_TX_SIZE];
+};
+
+#endif
@@ -0,0 +1,36 @@
+#include "VelocityPid.h"
+
+//-----------------------------------------------------------------------------------------
+// Procedure:
+//  Reset starts the loop over from rest.
+void VelocityPid::Reset(VelocityPidState *pid)
+{
+    pid->Integral = 0;
+    pid->LastMeasurement = 0;
+    pid->LastIntegralStep = 0;
+}
+
+//-----------------------------------------------------------------------------------------
+// Function:
+//  Update runs one control period and returns the output to request.
+float VelocityPid::Update(VelocityPidState *pid, float setpoint, float measured, float dt)
+{
+    float error = setpoint - measured;
+    float derivative = -(measured - pid->LastMeasurement) / dt; // on measurement, no setpoint kick.
+    pid->LastMeasurement = measured;
+
+    pid->LastIntegralStep = (pid->Ki != 0) ? error * dt : 0;
+    pid->Integral += pid->LastIntegralStep;
+    return ((pid->Kp * error) + (pid->Ki * pid->Integral) + (pid->Kd * derivative));
+}
+
+//-----------------------------------------------------------------------------------------
+// Procedure:
+//  Limit undoes the last integration step if the motor clamped the output (anti-windup).
+void VelocityPid::Limit(VelocityPidState *pid, float requested, float applied)
+{
+    if (applied != requested)
+    {
+        pid->Integral -= pid->LastIntegralStep;
+    }
+}
@@ -0,0 +1,62 @@
+// ---------------------------------------------------------------------------
+// Velocity PID Library - v0.0.1 - 07/12/2020
+//
+// AUTHOR/LICENSE:
+// Created by Imran Peerbhai -- ipeerbhai@aol.com
+// Copyright 2020 License:
+// Forks and derivitive works are NOT permitted without
+// permission. Permission is only granted to use as-is for private and
+// non-commercial use by natural persons or non-profit entities.
+// For-profit entities require a license.
+//
+// CONTRIBUTIONS:
+// If you wish to contribute, make changes, or enhancements,
+// please create a pull request.
+//
+// DISCLAIMER:
+// This software is furnished "as is", without technical support, and with no
+// warranty, express or implied, as to its usefulness for any purpose.
+// ---------------------------------------------------------------------------
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+// Theory of Operation:
+
+//  One velocity loop's PID update, for EncoderSystem's control timer.  Update
+//  takes the setpoint and measured velocity (counts per second) and returns the
+//  output to ask the motor for.  The integral is only kept while Ki isn't 0,
+//  and the derivative is on the measurement, so a setpoint change doesn't kick.
+
+//  The motor clamps what it's asked for.  Limit is told what it actually took;
+//  if that isn't what was asked, the integration step Update just made is
+//  undone, so the integral doesn't wind up while the motor is saturated.
+
+//  This is plain C++ with no Arduino or Teensy headers, so the host can build it
+//  too.  Host/VelocityCheck.cpp closes it around a simulated motor and checks
+//  that it settles and doesn't wind up.
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+
+#ifndef VELOCITY_PID_ONCE
+#define VELOCITY_PID_ONCE
+
+struct VelocityPidState
+{
+  float Kp;
+  float Ki;
+  float Kd;
+  float Integral;
+  float LastMeasurement;
+  float LastIntegralStep;   // what the last Update added to Integral, for Limit to undo.
+};
+
+class VelocityPid
+{
+public:
+    static void Reset(VelocityPidState *pid);  // forget the integral and the last measurement.  Gains stay.
+    static float Update(VelocityPidState *pid, float setpoint, float measured, float dt);
+    static void Limit(VelocityPidState *pid, float requested, float applied);
+};
+
+#endif
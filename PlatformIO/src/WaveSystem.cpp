@@ -0,0 +1,362 @@
+#include "WaveSystem.h"
+
+// The DMA wants a plain function for its interrupt, so route it through the one instance.
+static WaveformManager *s_waveformManager = NULL;
+static void RefillISR() { s_waveformManager->OnRefill(); }
+
+//-----------------------------------------------------------------------------------------
+// Constructor:
+//  Default constructor does nothing.
+WaveformManager::WaveformManager()
+{
+}
+
+//-----------------------------------------------------------------------------------------
+// Constructor:
+//  Store the motor, safety and output systems.  Nothing runs until Start.
+WaveformManager::WaveformManager(MotorControl *motorSystem, SafetyManager *safetySystem, OutputQueue *outputQueue)
+{
+    Init(motorSystem, safetySystem, outputQueue);
+}
+
+//-----------------------------------------------------------------------------------------
+// Init initializes instance members.
+void WaveformManager::Init(MotorControl *motorSystem, SafetyManager *safetySystem, OutputQueue *outputQueue)
+{
+    s_waveformManager = this;
+    m_motorControl = motorSystem;
+    m_safetyManager = safetySystem;
+    m_outputQueue = outputQueue;
+    m_channelCount = 0;
+    m_firstPort = 0;
+    m_portCount = 0;
+    m_isRunning = false;
+    m_isHalted = false;
+    m_nextHalf = 0;
+    m_refills = 0;
+    m_misses = 0;
+    m_totalCycles = 0;
+    m_maxCycles = 0;
+}
+
+//-----------------------------------------------------------------------------------------
+// Function:
+//  PortOf is which of GPIO1-4 a pin is on, as 0-3.  The core's port register for a pin is
+//  its fast GPIO6-9 DR, and the ports are WAVE_GPIO_STRIDE apart in the same order.
+uint8_t WaveformManager::PortOf(int8_t pin)
+{
+    return ((uint8_t)(((uintptr_t)digitalPinToPortReg(pin) - (uintptr_t)&GPIO6_DR) / WAVE_GPIO_STRIDE));
+}
+
+//-----------------------------------------------------------------------------------------
+// Function:
+//  PortRegister is the same register as gpioRegister (a GPIO1 or GPIO6 one) on port.
+volatile uint32_t *WaveformManager::PortRegister(volatile uint32_t *gpioRegister, uint8_t port)
+{
+    return ((volatile uint32_t *)((uintptr_t)gpioRegister + (port * WAVE_GPIO_STRIDE)));
+}
+
+//-----------------------------------------------------------------------------------------
+// Procedure:
+//  RoutePin moves a pin from the fast GPIO to the DMA's, or back, at the level it has now.
+//  Call with interrupts off.
+void WaveformManager::RoutePin(int8_t pin, boolean toDma)
+{
+    if (pin < 0)
+    {
+        return;
+    }
+    uint8_t port = PortOf(pin);
+    uint32_t mask = digitalPinToBitMask(pin);
+    volatile uint32_t *select = &IOMUXC_GPR_GPR26 + port; // a set bit puts the pin on GPIO6-9.
+    if (toDma)
+    {
+        boolean isHigh = ((*PortRegister(&GPIO6_DR, port) & mask) != 0);
+        *PortRegister(isHigh ? &GPIO1_DR_SET : &GPIO1_DR_CLEAR, port) = mask;
+        *PortRegister(&GPIO1_GDIR, port) |= mask;
+        *select &= ~mask;
+    }
+    else
+    {
+        boolean isHigh = ((*PortRegister(&GPIO1_DR, port) & mask) != 0);
+        *PortRegister(isHigh ? &GPIO6_DR_SET : &GPIO6_DR_CLEAR, port) = mask;
+        *select |= mask;
+    }
+}
+
+//-----------------------------------------------------------------------------------------
+// Function:
+//  Start hands every configured stepper to the DMA: pins moved, both halves filled, timer and
+//  DMA running.  Servos stay with the motor ISR.  Returns NULL, or why it didn't start.
+const char *WaveformManager::Start()
+{
+    if (m_isRunning)
+    {
+        return ("Waveform already running");
+    }
+
+    // which steppers, and the span of ports their pins are on.
+    uint8_t lowPort = WAVE_MAX_PORTS - 1;
+    uint8_t highPort = 0;
+    m_channelCount = 0;
+    for (int idx = 0; idx < m_motorControl->GetMotorCount(); idx++)
+    {
+        int8_t dirPin;
+        int8_t pulsePin;
+        if (!m_motorControl->ReadStepperPins(idx, &dirPin, &pulsePin))
+        {
+            continue;
+        }
+        WaveChannel &channel = m_channels[m_channelCount];
+        channel.StepPort = PortOf(pulsePin);
+        channel.StepMask = digitalPinToBitMask(pulsePin);
+        channel.DirPort = PortOf(dirPin);
+        channel.DirMask = digitalPinToBitMask(dirPin);
+        channel.Mode = WAVE_MODE_INTERVAL;
+        lowPort = min(lowPort, min(channel.StepPort, channel.DirPort));
+        highPort = max(highPort, max(channel.StepPort, channel.DirPort));
+        m_motorIndex[m_channelCount] = idx;
+        m_channelCount++;
+    }
+    if (m_channelCount == 0)
+    {
+        return ("No steppers to drive");
+    }
+    m_firstPort = lowPort;
+    m_portCount = highPort - lowPort + 1;
+
+    noInterrupts();
+    for (int idx = 0; idx < m_channelCount; idx++)
+    {
+        WaveChannel &channel = m_channels[idx];
+        int8_t dirPin;
+        int8_t pulsePin;
+        m_motorControl->ReadStepperPins(m_motorIndex[idx], &dirPin, &pulsePin);
+        m_motorControl->SetExternalDrive(m_motorIndex[idx], true);
+        boolean isPulseHigh = ((*PortRegister(&GPIO6_DR, channel.StepPort) & channel.StepMask) != 0);
+        boolean isDirHigh = ((*PortRegister(&GPIO6_DR, channel.DirPort) & channel.DirMask) != 0);
+        WaveformGenerator::StartChannel(&channel, isPulseHigh, isDirHigh ? 1 : 0);
+        RoutePin(pulsePin, true);
+        RoutePin(dirPin, true);
+        channel.StepPort -= m_firstPort;
+        channel.DirPort -= m_firstPort;
+    }
+    Fill(0);
+    Fill(1);
+    m_nextHalf = 0;
+
+    // one slot per request: each port's word to its DR_TOGGLE, then back to the first port.
+    m_dma.disable();
+    m_dma.TCD->SADDR = m_buffer;
+    m_dma.TCD->SOFF = sizeof(uint32_t);
+    m_dma.TCD->ATTR = DMA_TCD_ATTR_SSIZE(2) | DMA_TCD_ATTR_DSIZE(2);
+    m_dma.TCD->NBYTES_MLOFFYES = DMA_TCD_NBYTES_DMLOE |
+                                 DMA_TCD_NBYTES_MLOFFYES_MLOFF(-(int32_t)(m_portCount * WAVE_GPIO_STRIDE)) |
+                                 DMA_TCD_NBYTES_MLOFFYES_NBYTES(m_portCount * sizeof(uint32_t));
+    m_dma.TCD->SLAST = -(int32_t)(2 * WAVE_HALF_SLOTS * m_portCount * sizeof(uint32_t));
+    m_dma.TCD->DADDR = PortRegister(&GPIO1_DR_TOGGLE, m_firstPort);
+    m_dma.TCD->DOFF = WAVE_GPIO_STRIDE;
+    m_dma.TCD->CITER_ELINKNO = 2 * WAVE_HALF_SLOTS;
+    m_dma.TCD->DLASTSGA = 0;
+    m_dma.TCD->BITER_ELINKNO = 2 * WAVE_HALF_SLOTS;
+    m_dma.TCD->CSR = DMA_TCD_CSR_INTHALF | DMA_TCD_CSR_INTMAJOR;
+    m_dma.triggerAtHardwareEvent(WAVE_DMA_SOURCE);
+    m_dma.attachInterrupt(RefillISR);
+    m_dma.enable();
+    StartTimer();
+    m_isHalted = false;
+    m_isRunning = true;
+    interrupts();
+    return (NULL);
+}
+
+//-----------------------------------------------------------------------------------------
+// Procedure:
+//  StartTimer runs the FlexPWM submodule at the tick rate with a DMA request on every reload.
+//  Its outputs aren't routed to any pin.
+void WaveformManager::StartTimer()
+{
+    uint16_t submodule = 1 << WAVE_PWM_SUBMODULE;
+    WAVE_PWM.MCTRL |= FLEXPWM_MCTRL_CLDOK(submodule);
+    WAVE_PWM.SM[WAVE_PWM_SUBMODULE].CTRL2 = FLEXPWM_SMCTRL2_INDEP | FLEXPWM_SMCTRL2_WAITEN | FLEXPWM_SMCTRL2_DBGEN; // keep going through WFI.
+    WAVE_PWM.SM[WAVE_PWM_SUBMODULE].CTRL = FLEXPWM_SMCTRL_FULL;
+    WAVE_PWM.SM[WAVE_PWM_SUBMODULE].INIT = 0;
+    WAVE_PWM.SM[WAVE_PWM_SUBMODULE].VAL1 = (F_BUS_ACTUAL / TICK_RATE_HZ) - 1;
+    WAVE_PWM.SM[WAVE_PWM_SUBMODULE].DMAEN = FLEXPWM_SMDMAEN_VALDE;
+    WAVE_PWM.MCTRL |= FLEXPWM_MCTRL_LDOK(submodule);
+    WAVE_PWM.MCTRL |= FLEXPWM_MCTRL_RUN(submodule);
+}
+
+void WaveformManager::StopTimer()
+{
+    uint16_t submodule = 1 << WAVE_PWM_SUBMODULE;
+    WAVE_PWM.MCTRL &= ~FLEXPWM_MCTRL_RUN(submodule);
+    WAVE_PWM.SM[WAVE_PWM_SUBMODULE].DMAEN = 0;
+}
+
+//-----------------------------------------------------------------------------------------
+// Procedure:
+//  Fill brings each channel's timings and direction up to date from MotorControl, writes one
+//  half of the buffer, and counts the steps it holds.
+void WaveformManager::Fill(uint8_t half)
+{
+    uint32_t startCycles = ARM_DWT_CYCCNT;
+    for (int idx = 0; idx < m_channelCount; idx++)
+    {
+        WaveChannel &channel = m_channels[idx];
+        uint8_t mode;
+        int8_t direction;
+        m_motorControl->TakeWaveTimings(m_motorIndex[idx], &mode, &channel.Interval, &channel.Duty, &channel.PhaseIncrement, &direction);
+        uint8_t waveMode = (mode == MOTOR_MODE_PHASE) ? WAVE_MODE_PHASE : WAVE_MODE_INTERVAL;
+        if (waveMode != channel.Mode)
+        {
+            channel.Mode = waveMode;
+            channel.Phase = 0; // as the ISR does on a mode switch.
+        }
+        channel.DirLevel = (direction > 0) ? 1 : 0;
+    }
+
+    m_generator.Fill(&m_buffer[half * WAVE_HALF_SLOTS * m_portCount], WAVE_HALF_SLOTS, m_portCount, m_channels, m_channelCount, m_safetyManager->IsSafe());
+
+    for (int idx = 0; idx < m_channelCount; idx++)
+    {
+        int32_t steps = (int32_t)m_channels[idx].Steps;
+        if (steps > 0)
+        {
+            m_motorControl->AddSteps(m_motorIndex[idx], m_channels[idx].DirLevel ? steps : -steps);
+        }
+    }
+
+    uint32_t cycles = ARM_DWT_CYCCNT - startCycles;
+    m_totalCycles += cycles;
+    if (cycles > m_maxCycles)
+    {
+        m_maxCycles = cycles;
+    }
+}
+
+//-----------------------------------------------------------------------------------------
+// Procedure:
+//  OnRefill runs at the half and at the end of the buffer, and refills the half just played.
+//  If the DMA is already back in that half, we were a whole half late and it played stale words.
+void WaveformManager::OnRefill()
+{
+    m_dma.clearInterrupt();
+    if (!m_isRunning || m_isHalted)
+    {
+        return;
+    }
+    uint8_t half = m_nextHalf;
+    m_nextHalf ^= 1;
+    uint32_t played = (2 * WAVE_HALF_SLOTS) - m_dma.TCD->CITER_ELINKNO;
+    if ((played / WAVE_HALF_SLOTS) == half)
+    {
+        m_misses++;
+    }
+    Fill(half);
+    m_refills++;
+}
+
+//-----------------------------------------------------------------------------------------
+// Procedure:
+//  Release stops the DMA and timer, gives every pin back to the fast GPIO at its level, and
+//  the motors back to the ISR.  Interrupts must be off.
+void WaveformManager::Release()
+{
+    if (!m_isRunning)
+    {
+        return;
+    }
+    m_dma.disable();
+    StopTimer();
+    for (int idx = 0; idx < m_channelCount; idx++)
+    {
+        int8_t dirPin;
+        int8_t pulsePin;
+        m_motorControl->ReadStepperPins(m_motorIndex[idx], &dirPin, &pulsePin);
+        RoutePin(pulsePin, false);
+        RoutePin(dirPin, false);
+        m_motorControl->SetExternalDrive(m_motorIndex[idx], false);
+    }
+    m_isHalted = false;
+    m_isRunning = false;
+}
+
+void WaveformManager::Stop()
+{
+    noInterrupts();
+    Release();
+    interrupts();
+}
+
+//-----------------------------------------------------------------------------------------
+// Procedure:
+//  ForceLow is the watchdog's: no more DMA writes, and every step pin low on the DMA's GPIO.
+//  The pins stay there until Dispatch gives them back.
+void WaveformManager::ForceLow()
+{
+    if (!m_isRunning || m_isHalted)
+    {
+        return;
+    }
+    m_dma.disable();
+    StopTimer();
+    for (int idx = 0; idx < m_channelCount; idx++)
+    {
+        *PortRegister(&GPIO1_DR_CLEAR, m_channels[idx].StepPort + m_firstPort) = m_channels[idx].StepMask;
+    }
+    m_isHalted = true;
+}
+
+//-----------------------------------------------------------------------------------------
+// Procedure:
+//  Dispatch finishes what ForceLow started: the motors go back to the ISR, and the host hears.
+void WaveformManager::Dispatch()
+{
+    if (!m_isHalted)
+    {
+        return;
+    }
+    Stop();
+    m_outputQueue->Println("{'Waveform' : 'Stopped'}");
+}
+
+boolean WaveformManager::IsRunning()
+{
+    return (m_isRunning);
+}
+
+//-----------------------------------------------------------------------------------------
+// Function:
+//  ReadStatistics returns a JSON object with what the DMA drives, how many refills there have
+//  been, how many were late, and their average and worst cycles.
+String WaveformManager::ReadStatistics()
+{
+    noInterrupts();
+    boolean isRunning = m_isRunning;
+    uint32_t refills = m_refills;
+    uint32_t misses = m_misses;
+    uint64_t totalCycles = m_totalCycles;
+    uint32_t maxCycles = m_maxCycles;
+    interrupts();
+
+    String Text = String("");
+    Text += String("{'Waveform' : {'Running':");
+    Text += String(isRunning ? 1 : 0);
+    Text += String(",'Motors':");
+    Text += String(isRunning ? m_channelCount : 0);
+    Text += String(",'Ports':");
+    Text += String(isRunning ? m_portCount : 0);
+    Text += String(",'SlotsPerHalf':");
+    Text += String(WAVE_HALF_SLOTS);
+    Text += String(",'Refills':");
+    Text += String(refills);
+    Text += String(",'Misses':");
+    Text += String(misses);
+    Text += String(",'AvgCycles':");
+    Text += String((refills > 0) ? (float)totalCycles / refills : 0.0f);
+    Text += String(",'MaxCycles':");
+    Text += String(maxCycles);
+    Text += String("}}");
+    return (Text);
+}
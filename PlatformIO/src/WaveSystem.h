@@ -0,0 +1,118 @@
+// ---------------------------------------------------------------------------
+// Waveform Library - v0.0.1 - 07/12/2020
+//
+// AUTHOR/LICENSE:
+// Created by Imran Peerbhai -- ipeerbhai@aol.com
+// Copyright 2020 License:
+// Forks and derivitive works are NOT permitted without
+// permission. Permission is only granted to use as-is for private and
+// non-commercial use by natural persons or non-profit entities.
+// For-profit entities require a license.
+//
+// CONTRIBUTIONS:
+// If you wish to contribute, make changes, or enhancements,
+// please create a pull request.
+//
+// DISCLAIMER:
+// This software is furnished "as is", without technical support, and with no
+// warranty, express or implied, as to its usefulness for any purpose.
+// ---------------------------------------------------------------------------
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+// Theory of Operation:
+
+//  The motor ISR writes every step edge itself, once a microsecond, so its
+//  jitter is the step jitter.  This subsystem hands the steppers to the eDMA
+//  instead: their step and dir edges are computed ahead into a buffer, and the
+//  DMA writes them to the pins on a hardware timer, so every edge lands on its
+//  slot no matter what the CPU is doing.
+
+//  Teensy pins normally sit on the fast GPIO6-9, which only the core can reach.
+//  Start moves each step and dir pin to the matching GPIO1-4 (IOMUXC_GPR26-29,
+//  one bit per pin), where the DMA can write the DR_TOGGLE registers.  The
+//  pin's level is copied across first so nothing glitches.  Enable pins stay
+//  where they are.
+
+//  The buffer holds one toggle word per port per slot, for the span of ports
+//  in use, in two halves of WAVE_HALF_SLOTS.  A FlexPWM submodule that does
+//  nothing else reloads once a tick and asks the DMA for one slot: a minor
+//  loop writes each port's word, WAVE_GPIO_STRIDE apart, and steps back.  The
+//  major loop is the whole buffer, with interrupts at the half and the end.
+//  Each interrupt refills the half just played with WaveformGenerator (see
+//  WaveformGenerator.h), while the DMA plays the other one.
+
+//  Before a refill, MotorControl adopts any published timings for the motors
+//  it has handed over, caps and all, and gets the steps the last half made.
+//  So commands land up to two halves (about 1ms) later than in the ISR, and
+//  steps are counted when they're generated rather than when they happen.
+
+//  The watchdog's ForceOutputsLow stops the DMA and clears the step pins right
+//  in its ISR.  The next Dispatch() from loop() gives the pins back to the ISR
+//  and reports it.  A configuration commit gives them back too, before any pin
+//  can change.  "W1~" starts, "W0~" stops, "W~" reads refill times and misses.
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+
+#include <Arduino.h>
+#include <stdint.h>
+#include <DMAChannel.h>
+#include "MotorControl.h"
+#include "SafetySystem.h"
+#include "OutputQueue.h"
+#include "WaveformGenerator.h"
+
+#ifndef WAVE_ONCE
+#define WAVE_ONCE
+
+#define WAVE_HALF_SLOTS 512                           // slots per half buffer, a slot is one tick.
+#define WAVE_GPIO_STRIDE 0x4000                       // bytes from one GPIO port's registers to the next.
+#define WAVE_PWM IMXRT_FLEXPWM3                       // the slot timer.  Nothing else may use this submodule.
+#define WAVE_PWM_SUBMODULE 3
+#define WAVE_DMA_SOURCE DMAMUX_SOURCE_FLEXPWM3_WRITE3
+
+class WaveformManager
+{
+public:
+    WaveformManager();
+    WaveformManager(MotorControl *motorSystem, SafetyManager *safetySystem, OutputQueue *outputQueue);
+    void Init(MotorControl *motorSystem, SafetyManager *safetySystem, OutputQueue *outputQueue);
+    const char *Start();    // hand every stepper to the DMA.  Returns NULL, or why not.
+    void Stop();            // give them back to the motor ISR.
+    void Release();         // Stop, with interrupts already off.  MotorControl calls it before a commit.
+    void ForceLow();        // stop the DMA and pull every step pin low, now.  For the watchdog ISR.
+    void Dispatch();        // finish a ForceLow.  Call from loop().
+    boolean IsRunning();
+    String ReadStatistics(); // returns a JSON object with the refill times and misses.
+    void OnRefill();        // the DMA's half and complete interrupt.
+
+private:
+    void RoutePin(int8_t pin, boolean toDma);
+    static uint8_t PortOf(int8_t pin);
+    static volatile uint32_t *PortRegister(volatile uint32_t *gpioRegister, uint8_t port);
+    void StartTimer();
+    void StopTimer();
+    void Fill(uint8_t half);
+
+    MotorControl *m_motorControl;   // whose steppers we drive
+    SafetyManager *m_safetyManager; // no steps unless it says we're safe
+    OutputQueue *m_outputQueue;     // where replies and events go
+    WaveformGenerator m_generator;
+    DMAChannel m_dma;
+    WaveChannel m_channels[MOTOR_CAPACITY];
+    uint8_t m_motorIndex[MOTOR_CAPACITY]; // which motor each channel is.
+    uint8_t m_channelCount;
+    uint8_t m_firstPort;                  // GPIO1-4 as 0-3; the buffer starts here,
+    uint8_t m_portCount;                  // and covers this many.
+    uint32_t m_buffer[2 * WAVE_HALF_SLOTS * WAVE_MAX_PORTS] __attribute__((aligned(32))); // in DTCM, so no cache to flush.
+    volatile boolean m_isRunning;
+    volatile boolean m_isHalted;          // ForceLow ran, Dispatch hasn't cleaned up.
+    uint8_t m_nextHalf;                   // the half the next interrupt refills.
+    uint32_t m_refills;
+    uint32_t m_misses;                    // refills that found the DMA already in the half being written.
+    uint64_t m_totalCycles;
+    uint32_t m_maxCycles;
+};
+
+#endif
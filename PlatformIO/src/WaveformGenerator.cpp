@@ -0,0 +1,183 @@
+#include "WaveformGenerator.h"
+#include <string.h>
+
+//-----------------------------------------------------------------------------------------
+// Constructor:
+//  Default constructor does nothing.
+WaveformGenerator::WaveformGenerator()
+{
+    m_words = 0;
+    m_slots = 0;
+    m_portCount = 0;
+}
+
+//-----------------------------------------------------------------------------------------
+// Procedure:
+//  StartChannel picks up a stepper where the pins are.  A pulse that's high falls in the first
+//  slot, and the first step rises as soon as it can, as the ISR does when it adopts new timings.
+void WaveformGenerator::StartChannel(WaveChannel *channel, bool isPulseHigh, uint8_t dirLevel)
+{
+    channel->SinceRise = 0xFFFFFFFFUL;
+    channel->Phase = 0;
+    channel->IsHigh = isPulseHigh;
+    channel->HighLeft = 0;
+    channel->DirWritten = dirLevel;
+    channel->Steps = 0;
+}
+
+//-----------------------------------------------------------------------------------------
+// Procedure:
+//  Fill writes one block of slots x portCount toggle words from the channels' timings, and
+//  leaves each channel ready for the next block.
+void WaveformGenerator::Fill(uint32_t *words, uint32_t slots, uint8_t portCount, WaveChannel *channels, uint8_t channelCount, bool isSafe)
+{
+    m_words = words;
+    m_slots = slots;
+    m_portCount = portCount;
+    memset(words, 0, slots * portCount * sizeof(uint32_t));
+
+    for (int idx = 0; idx < channelCount; idx++)
+    {
+        WaveChannel *channel = &channels[idx];
+        uint32_t earliest = 0; // no step rises before this slot.
+        channel->Steps = 0;
+
+        if ((channel->DirPort != WAVE_NO_PORT) && (channel->DirLevel != channel->DirWritten))
+        {
+            Toggle(0, channel->DirPort, channel->DirMask);
+            channel->DirWritten = channel->DirLevel;
+            earliest = WAVE_DIR_SETUP_SLOTS;
+        }
+
+        // finish the pulse the last block left high.  Unsafe, it falls right away.
+        if (channel->IsHigh)
+        {
+            uint32_t fall = isSafe ? channel->HighLeft : 0;
+            if (fall < slots)
+            {
+                Toggle(fall, channel->StepPort, channel->StepMask);
+                channel->IsHigh = false;
+                if (fall >= earliest)
+                {
+                    earliest = fall + 1;
+                }
+            }
+            else
+            {
+                channel->HighLeft -= slots;
+                earliest = slots;
+            }
+        }
+
+        if (!isSafe)
+        {
+            earliest = slots; // keep time, make no steps.
+        }
+        if (channel->Mode == WAVE_MODE_PHASE)
+        {
+            FillPhase(channel, earliest);
+        }
+        else
+        {
+            FillInterval(channel, earliest);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------------------
+// Procedure:
+//  Rise starts a step pulse in slot and ends it highSlots later, in this block or the next.
+void WaveformGenerator::Rise(WaveChannel *channel, uint32_t slot, uint32_t highSlots)
+{
+    Toggle(slot, channel->StepPort, channel->StepMask);
+    channel->Steps++;
+    uint32_t fall = slot + highSlots;
+    if (fall < m_slots)
+    {
+        Toggle(fall, channel->StepPort, channel->StepMask);
+    }
+    else
+    {
+        channel->IsHigh = true;
+        channel->HighLeft = fall - m_slots;
+    }
+}
+
+//-----------------------------------------------------------------------------------------
+// Procedure:
+//  FillInterval makes a step every Interval slots, high for Duty of them, counting on from the
+//  last step of the previous block.  A step held back to earliest moves the ones after it too.
+void WaveformGenerator::FillInterval(WaveChannel *channel, uint32_t earliest)
+{
+    uint32_t interval = channel->Interval;
+    uint32_t duty = (channel->Duty < interval) ? channel->Duty : interval - 1; // must fall before the next step.
+    uint32_t since = channel->SinceRise;
+    if ((interval == 0) || (duty == 0))
+    {
+        channel->SinceRise = (since > (0xFFFFFFFFUL - m_slots)) ? 0xFFFFFFFFUL : since + m_slots;
+        return;
+    }
+
+    uint32_t rise = (since >= interval) ? 0 : interval - since;
+    while (rise < m_slots)
+    {
+        if (rise < earliest)
+        {
+            rise = earliest;
+            if (rise >= m_slots)
+            {
+                break;
+            }
+        }
+        Rise(channel, rise, duty);
+        since = m_slots - rise;
+        if (interval >= since)
+        {
+            break;
+        }
+        rise += interval;
+    }
+    if (channel->Steps == 0)
+    {
+        channel->SinceRise = (since > (0xFFFFFFFFUL - m_slots)) ? 0xFFFFFFFFUL : since + m_slots;
+    }
+    else
+    {
+        channel->SinceRise = since;
+    }
+}
+
+//-----------------------------------------------------------------------------------------
+// Procedure:
+//  FillPhase adds PhaseIncrement to Phase once a slot, and starts a step in the slot that
+//  carries.  It solves for that slot rather than adding slot by slot.
+void WaveformGenerator::FillPhase(WaveChannel *channel, uint32_t earliest)
+{
+    uint64_t increment = channel->PhaseIncrement;
+    if (increment == 0)
+    {
+        return;
+    }
+    uint64_t phase = channel->Phase;
+    uint32_t cursor = 0; // next slot to add the increment in.
+    while (true)
+    {
+        uint64_t toCarry = ((0x100000000ULL - phase) + increment - 1) / increment; // adds until the carry, at least 1.
+        if (toCarry > (m_slots - cursor))
+        {
+            phase += increment * (m_slots - cursor);
+            break;
+        }
+        uint32_t slot = cursor + (uint32_t)toCarry - 1;
+        phase = (phase + (increment * toCarry)) - 0x100000000ULL;
+        cursor = slot + 1;
+
+        uint32_t rise = (slot < earliest) ? earliest : slot;
+        if (rise < m_slots)
+        {
+            Rise(channel, rise, WAVE_PHASE_PULSE_SLOTS);
+            earliest = rise + WAVE_PHASE_PULSE_SLOTS + 1;
+        }
+    }
+    channel->Phase = (uint32_t)phase;
+}
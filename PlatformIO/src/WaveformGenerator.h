@@ -0,0 +1,103 @@
+// ---------------------------------------------------------------------------
+// Waveform Generator Library - v0.0.1 - 07/12/2020
+//
+// AUTHOR/LICENSE:
+// Created by Imran Peerbhai -- ipeerbhai@aol.com
+// Copyright 2020 License:
+// Forks and derivitive works are NOT permitted without
+// permission. Permission is only granted to use as-is for private and
+// non-commercial use by natural persons or non-profit entities.
+// For-profit entities require a license.
+//
+// CONTRIBUTIONS:
+// If you wish to contribute, make changes, or enhancements,
+// please create a pull request.
+//
+// DISCLAIMER:
+// This software is furnished "as is", without technical support, and with no
+// warranty, express or implied, as to its usefulness for any purpose.
+// ---------------------------------------------------------------------------
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+// Theory of Operation:
+
+//  Turns step and dir timings into a block of GPIO words, one per port per
+//  timeslot, that the DMA writes to the ports' toggle registers (see
+//  WaveSystem.h).  A set bit flips that pin in that slot; everything else is 0.
+//  A slot is one tick, so intervals mean what they mean to the motor ISR.
+
+//  Fill writes one block.  It jumps from edge to edge instead of walking the
+//  slots, so the cost is clearing the block plus a few operations per edge.
+//  Each channel carries where it is in its period (or its phase), and whether
+//  its pulse pin is still high, from one block to the next.  A changed direction
+//  is written in the first slot of a block, and no step starts until
+//  WAVE_DIR_SETUP_SLOTS later.  When isSafe is false a high pulse falls in the
+//  first slot and no new one starts.
+
+//  This is plain C++ with no Arduino or Teensy headers, so the host can build it
+//  too.  Host/WaveformCheck.cpp runs it and checks the edges it makes.
+
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+
+#include <stdint.h>
+
+#ifndef WAVEFORM_GENERATOR_ONCE
+#define WAVEFORM_GENERATOR_ONCE
+
+#define WAVE_MAX_PORTS 4          // GPIO1 to GPIO4, every port a Teensy pin can be on.
+#define WAVE_NO_PORT 0xFF         // a channel without a dir pin.
+#define WAVE_DIR_SETUP_SLOTS 2    // slots from a dir edge to the next step edge.
+#define WAVE_PHASE_PULSE_SLOTS 2  // how long a phase-mode step stays high, as PHASE_PULSE_TICKS.
+
+enum WaveModes
+{
+    WAVE_MODE_INTERVAL, // Interval and Duty in slots, as MOTOR_MODE_INTERVAL.
+    WAVE_MODE_PHASE     // PhaseIncrement per slot, a step on every carry, as MOTOR_MODE_PHASE.
+};
+
+// One stepper.  The first group is set up once, the second before every Fill, the rest is Fill's.
+struct WaveChannel
+{
+    uint8_t StepPort;         // port index into the block, not the GPIO number.
+    uint32_t StepMask;
+    uint8_t DirPort;          // WAVE_NO_PORT if there's no dir pin.
+    uint32_t DirMask;
+
+    uint8_t Mode;             // a WaveModes value.
+    uint32_t Interval;        // slots per step, 0 makes none.
+    uint32_t Duty;            // slots high per step.
+    uint32_t PhaseIncrement;  // added to Phase every slot.
+    uint8_t DirLevel;         // 1 for high.
+
+    uint32_t SinceRise;       // slots from the last rising edge to the start of the next block.
+    uint32_t Phase;
+    bool IsHigh;              // the pulse pin is high at the start of the next block,
+    uint32_t HighLeft;        // and falls this many slots into it.
+    uint8_t DirWritten;       // the dir level the blocks so far leave the pin at.
+    uint32_t Steps;           // rising edges in the last block.
+};
+
+class WaveformGenerator
+{
+public:
+    WaveformGenerator();
+    static void StartChannel(WaveChannel *channel, bool isPulseHigh, uint8_t dirLevel); // the pins as they are now.
+    void Fill(uint32_t *words, uint32_t slots, uint8_t portCount, WaveChannel *channels, uint8_t channelCount, bool isSafe);
+
+private:
+    inline void Toggle(uint32_t slot, uint8_t port, uint32_t mask)
+    {
+        m_words[(slot * m_portCount) + port] ^= mask;
+    }
+    void Rise(WaveChannel *channel, uint32_t slot, uint32_t highSlots);
+    void FillInterval(WaveChannel *channel, uint32_t earliest);
+    void FillPhase(WaveChannel *channel, uint32_t earliest);
+
+    uint32_t *m_words;     // the block being filled, slots x ports.
+    uint32_t m_slots;
+    uint8_t m_portCount;
+};
+
+#endif
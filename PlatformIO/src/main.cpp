@@ -3,18 +3,61 @@
 #include "MotorControl.h"
 #include "SafetySystem.h"
 #include "SensorSystem.h"
+#include "OdometrySystem.h"
+#include "EncoderSystem.h"
+#include "ConfigSystem.h"
+#include "Transport.h"
+#include "ClockSystem.h"
+#include "LatencySystem.h"
+#include "TraceSystem.h"
+#include "ReflexSystem.h"
+#include "ProgramSystem.h"
+#include "PowerSystem.h"
+#include "MemorySystem.h"
+#include "WaveSystem.h"
+#include "BatchSystem.h"
+#include "OutputQueue.h"
 #include "CommandSystem.h"
+#if defined(TEENSYBOT_HOST)
+#include "PtyTransport.h"
+#endif
 
 const int ledPin = 13; // for debugging.
 
+// Which link the main computer uses.  0 is USB, 1 to 8 is that hardware serial port with DMA.
+// The host build (Host/TeensyBotSim.cpp) always uses a pty.
+#define COMMAND_SERIAL_PORT 0
+#define COMMAND_UART_BAUD 2000000
+
 //-----------------------------------------------------------------------------------------
 //-----------------------------------------------------------------------------------------
 // All the subsystems
 
+#if defined(TEENSYBOT_HOST)
+PtyTransport g_transport;       // link to the host client
+#elif COMMAND_SERIAL_PORT == 0
+UsbTransport g_transport;       // link to the main computer
+#else
+UartDmaTransport g_transport(COMMAND_SERIAL_PORT, COMMAND_UART_BAUD);
+#endif
+OutputQueue g_outputQueue;      // every reply and event goes out through here
+ClockManager g_clockSystem;     // host clock sync
+LatencyManager g_latencySystem; // command latency histograms
+TraceRecorder g_traceSystem;    // flight recorder
 MotorControl g_robotMotors;     // motor control subsystem
 SafetyManager g_safetySystem;   // safety subsystem
 SensorManager g_sensorSystem;   // sensor subsystem
+ReflexManager g_reflexSystem;   // on-board obstacle reflexes
+ProgramManager g_programSystem; // on-board motion programs
+OdometryManager g_odometrySystem; // dead-reckoning subsystem
+EncoderManager g_encoderSystem; // encoder and closed-loop velocity subsystem
+EepromConfigStorage g_configStorage; // where the configuration image lives
+ConfigManager g_configSystem;   // configuration persistence subsystem
 CommandManager g_commandSystem; // Command/Control subsystem
+PowerManager g_powerSystem;     // slows the tick and sleeps when idle
+MemoryManager g_memorySystem;   // stack and heap instrumentation
+WaveformManager g_waveformSystem; // DMA step and dir waveforms
+BatchManager g_batchSystem; // multi-command frames applied on one tick
 
 //-----------------------------------------------------------------------------------------
 //-----------------------------------------------------------------------------------------
@@ -22,21 +65,27 @@ CommandManager g_commandSystem; // Command/Control subsystem
 // stuate or returns
 
 volatile uint32_t g_TimerCounter = 0; // used to count ticks, set by interrupt.
+volatile uint32_t g_TickPeriodUS = 1; // uS per tick.  1 unless the power system has slowed the tick.
 uint32_t g_PrevTimerCounter = 0;      // used to prevent double-call collisions.
 IntervalTimer g_mainTimer;
 
 //-----------------------------------------------------------------------------------------
-// Dispatch is designed to run from within an interrupt.  It gets called every 1uS.
+// Dispatch is designed to run from within an interrupt.  It gets called every 1uS,
+// or every g_TickPeriodUS while the power system has the tick slowed down.
 void Dispatch()
 {
   // update the counter we want to use
   noInterrupts();
-  g_TimerCounter++;
+  g_memorySystem.SampleInterruptedStack();
+  g_TimerCounter += g_TickPeriodUS;
   interrupts();
 
-  // Run critical Dispatch functions.
-  g_robotMotors.Dispatch();
-  g_sensorSystem.Dispatch();
+  // Run critical Dispatch functions.  Nothing for them to do on the idle tick.
+  if (g_TickPeriodUS == 1)
+  {
+    g_robotMotors.Dispatch();
+    g_sensorSystem.Dispatch();
+  }
 }
 
 //-----------------------------------------------------------------------------------------
@@ -44,7 +93,7 @@ void Dispatch()
 //  Ask the main computer to send configuration commands.
 void RequestConfiguration()
 {
-  Serial.println("{'Request' : 'Configuration'}");
+  g_outputQueue.Println("{'Request' : 'Configuration'}");
 }
 
 //-----------------------------------------------------------------------------------------
@@ -52,21 +101,49 @@ void RequestConfiguration()
 //  Standard Arduino setup.
 void setup()
 {
+  // paint the stack before anything uses it, and count every allocation from here on.
+  g_memorySystem.Init();
   // init serial port
-  while (!Serial && millis() < 4000)
-    Serial.begin(115200);
+  g_transport.Begin();
   // put your setup code here, to run once:
   pinMode(ledPin, OUTPUT);
-  g_safetySystem.Init(&g_TimerCounter);
-  g_commandSystem.Init(&g_robotMotors, &g_TimerCounter, &g_PrevTimerCounter, &g_sensorSystem, &g_safetySystem);
-  Serial.println("Ready>");
-  RequestConfiguration();
+  g_clockSystem.Init(&g_TimerCounter);
+  g_traceSystem.Init(&g_TimerCounter, &g_outputQueue, &g_clockSystem);
+  g_outputQueue.Init(&g_transport, &g_traceSystem);
+  g_traceSystem.Record(TRACE_BOOT, 0, 0);
+  g_latencySystem.Init(&g_TimerCounter, &g_robotMotors);
+  g_safetySystem.Init(&g_TimerCounter, &g_outputQueue, &g_clockSystem, &g_traceSystem, &g_robotMotors);
+  g_robotMotors.Init(0, &g_TimerCounter, &g_PrevTimerCounter, &g_safetySystem, &g_outputQueue, &g_traceSystem, &g_clockSystem, &g_waveformSystem); // no motors until configured.
+  g_waveformSystem.Init(&g_robotMotors, &g_safetySystem, &g_outputQueue);
+  g_odometrySystem.Init(&g_robotMotors, &g_TimerCounter, &g_outputQueue, &g_clockSystem);
+  g_encoderSystem.Init(&g_robotMotors, &g_clockSystem);
+  g_reflexSystem.Init(&g_robotMotors, &g_safetySystem);
+  g_sensorSystem.Init(0, &g_TimerCounter, &g_safetySystem, &g_outputQueue, &g_clockSystem, &g_reflexSystem);
+  g_programSystem.Init(&g_robotMotors, &g_sensorSystem, &g_safetySystem, &g_TimerCounter, &g_outputQueue, &g_clockSystem, &g_traceSystem);
+  g_batchSystem.Init(&g_robotMotors, &g_clockSystem);
+  g_powerSystem.Init(&g_TimerCounter, &g_TickPeriodUS, &g_mainTimer, Dispatch, &g_robotMotors, &g_sensorSystem, &g_encoderSystem, &g_programSystem, &g_transport, &g_outputQueue, &g_clockSystem);
+  g_configSystem.Init(&g_configStorage, &g_robotMotors, &g_sensorSystem, &g_safetySystem, &g_outputQueue);
+  g_commandSystem.Init(&g_robotMotors, &g_TimerCounter, &g_PrevTimerCounter, &g_sensorSystem, &g_safetySystem, &g_odometrySystem, &g_encoderSystem, &g_configSystem, &g_outputQueue, &g_transport, &g_clockSystem, &g_latencySystem, &g_traceSystem, &g_reflexSystem, &g_programSystem, &g_powerSystem, &g_memorySystem, &g_waveformSystem, &g_batchSystem);
+  g_outputQueue.Println("Ready>");
+
+  // a valid stored configuration skips the handshake.  The host can check it with "h~".
+  if (g_configSystem.LoadAndApply())
+  {
+    g_traceSystem.Record(TRACE_CONFIGURATION, 'L', 0);
+    g_outputQueue.Println(g_configSystem.ReadHash());
+  }
+  else
+  {
+    RequestConfiguration();
+  }
 
   // Wait until we get a configuration before we do the rest
 //  uint32_t x = 0;
   while (!g_safetySystem.IsConfigured())
   {
+    g_clockSystem.Dispatch();
     g_commandSystem.Dispatch();
+    g_outputQueue.Drain();
     delay(200);
 //    Serial.print("Setup Loop ");
 //    Serial.println(x);
@@ -74,14 +151,38 @@ void setup()
   }
 
   // start the timer.
-  Serial.println("Starting dispatch system");
-  Serial.print("Motor dispatch ptr::");
+  g_outputQueue.Println("Starting dispatch system");
   g_mainTimer.begin(Dispatch, 1);
+  g_safetySystem.StartWatchdog();
 }
 
 void loop()
 {
-  // Run the non-critical dispatch functions.
+  // Run the non-critical dispatch functions.  Waking up comes first, so a command never runs on the idle tick.
+  // Each one is tagged, so the memory system knows who allocated what.
+  g_memorySystem.SetTag(MEMORY_TAG_POWER);
+  g_powerSystem.Dispatch();
+  g_memorySystem.SetTag(MEMORY_TAG_CLOCK);
+  g_clockSystem.Dispatch();
+  g_memorySystem.SetTag(MEMORY_TAG_SAFETY);
   g_safetySystem.Dispatch();
+  g_memorySystem.SetTag(MEMORY_TAG_COMMAND);
   g_commandSystem.Dispatch();
+  g_memorySystem.SetTag(MEMORY_TAG_PROGRAM);
+  g_programSystem.Dispatch();
+  g_memorySystem.SetTag(MEMORY_TAG_MOTOR);
+  g_robotMotors.DispatchEvents();
+  g_waveformSystem.Dispatch();
+  g_memorySystem.SetTag(MEMORY_TAG_ODOMETRY);
+  g_odometrySystem.Dispatch();
+  g_memorySystem.SetTag(MEMORY_TAG_LATENCY);
+  g_latencySystem.Dispatch();
+  g_memorySystem.SetTag(MEMORY_TAG_TRACE);
+  g_traceSystem.Dispatch();
+
+  // everything this pass queued goes out together.
+  g_memorySystem.SetTag(MEMORY_TAG_OUTPUT);
+  g_outputQueue.Drain();
+  g_memorySystem.SetTag(MEMORY_TAG_POWER);
+  g_powerSystem.Sleep();
 }